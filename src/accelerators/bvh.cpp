@@ -38,6 +38,23 @@
 #include "stats.h"
 #include "parallel.h"
 #include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <unordered_map>
+#ifdef PBRT_HAVE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#if !defined(PBRT_FLOAT_AS_DOUBLE) && (defined(__SSE__) || defined(_M_X64))
+#define PBRT_BVH_SSE
+#include <xmmintrin.h>
+#endif
+#if defined(PBRT_BVH_SSE) && defined(PBRT_HAVE_AVX2)
+#define PBRT_BVH_AVX
+#include <immintrin.h>
+#endif
 
 namespace pbrt {
 
@@ -45,6 +62,16 @@ STAT_MEMORY_COUNTER("Memory/BVH tree", treeBytes);
 STAT_RATIO("BVH/Primitives per leaf node", totalPrimitives, totalLeafNodes);
 STAT_COUNTER("BVH/Interior nodes", interiorNodes);
 STAT_COUNTER("BVH/Leaf nodes", leafNodes);
+STAT_RATIO("BVH/Children per wide node", nWideChildren, nWideNodes);
+STAT_COUNTER("BVH/Trees loaded from cache", nCachedTrees);
+STAT_RATIO("BVH/SBVH references per primitive", sbvhReferences,
+           sbvhPrimitives);
+STAT_COUNTER("BVH/Triangle packet tests", nTrianglePacketTests);
+#ifdef PBRT_TRAVERSAL_STATS
+STAT_RATIO("BVH/Node visits per closest-hit ray", nNodeVisits,
+           nClosestHitRays);
+STAT_RATIO("BVH/Node visits per shadow ray", nShadowNodeVisits, nShadowRays);
+#endif  // PBRT_TRAVERSAL_STATS
 
 // BVHAccel Local Declarations
 struct BVHPrimitiveInfo {
@@ -80,6 +107,15 @@ struct BVHBuildNode {
     Bounds3f bounds;
     BVHBuildNode *children[2];
     int splitAxis, firstPrimOffset, nPrimitives;
+    // SAH cost of the subtree, only set during treelet optimization
+    Float sahCost;
+};
+
+// Subtree left by the top of the SAH build to a worker thread; _node_ only
+// has its bounds set until the task is run.
+struct BVHBuildTask {
+    BVHBuildNode *node;
+    int start, end;
 };
 
 struct MortonPrimitive {
@@ -103,6 +139,198 @@ struct LinearBVHNode {
     uint8_t pad[1];        // ensure 32 byte total size
 };
 
+// Node of the BVH collapsed to _N_ children. The children's bounds are stored
+// as bounds[min or max][axis][child] so that one SIMD register holds a slab
+// of all the children; unused slots have empty bounds.
+template <int N>
+struct WideBVHNode {
+    static PBRT_CONSTEXPR int width = N;
+    typedef Float ChildBounds[2][3][N];
+    WideBVHNode() {
+        for (int i = 0; i < N; ++i) {
+            for (int axis = 0; axis < 3; ++axis) {
+                bounds[0][axis][i] = Infinity;
+                bounds[1][axis][i] = -Infinity;
+            }
+            child[i] = -1;
+            nPrimitives[i] = 0;
+        }
+    }
+    const ChildBounds &GetBounds(ChildBounds &) const { return bounds; }
+    Float bounds[2][3][N];
+    int32_t child[N];         // leaf: primitives offset, interior: node index
+    uint16_t nPrimitives[N];  // 0 -> interior child
+};
+
+// Wide node whose children's bounds are stored as integers of type _T_ on a
+// grid anchored at _origin_, with a power-of-two spacing _scale_ per axis.
+// The bounds are decoded when the node is visited; they are rounded
+// outwards, so they contain the exact ones. Unused slots decode to the
+// same empty bounds as in _WideBVHNode_.
+template <int N, typename T>
+struct QuantizedBVHNode {
+    static PBRT_CONSTEXPR int width = N;
+    typedef Float ChildBounds[2][3][N];
+    const ChildBounds &GetBounds(ChildBounds &decoded) const {
+        for (int b = 0; b < 2; ++b)
+            for (int axis = 0; axis < 3; ++axis)
+                for (int i = 0; i < N; ++i)
+                    decoded[b][axis][i] =
+                        origin[axis] + Float(bounds[b][axis][i]) * scale[axis];
+        for (int i = 0; i < N; ++i)
+            if (child[i] == -1)
+                for (int axis = 0; axis < 3; ++axis) {
+                    decoded[0][axis][i] = Infinity;
+                    decoded[1][axis][i] = -Infinity;
+                }
+        return decoded;
+    }
+    Float origin[3], scale[3];
+    T bounds[2][3][N];
+    int32_t child[N];
+    uint16_t nPrimitives[N];
+};
+
+template <int N, typename T>
+static QuantizedBVHNode<N, T> QuantizeBVHNode(const WideBVHNode<N> &node) {
+    const int maxQ = std::numeric_limits<T>::max();
+    QuantizedBVHNode<N, T> qnode;
+    Bounds3f bounds;
+    for (int i = 0; i < N; ++i) {
+        qnode.child[i] = node.child[i];
+        qnode.nPrimitives[i] = node.nPrimitives[i];
+        if (node.child[i] != -1)
+            bounds = Union(
+                bounds,
+                Bounds3f(Point3f(node.bounds[0][0][i], node.bounds[0][1][i],
+                                 node.bounds[0][2][i]),
+                         Point3f(node.bounds[1][0][i], node.bounds[1][1][i],
+                                 node.bounds[1][2][i])));
+    }
+    for (int axis = 0; axis < 3; ++axis) {
+        // Use the smallest power-of-two spacing for which _maxQ_ steps from
+        // the origin reach the maximum; multiplying by it is exact, so
+        // decoding rounds only once
+        Float origin = bounds.pMin[axis];
+        Float target = std::max((bounds.pMax[axis] - origin) / maxQ,
+                                std::abs(origin) * MachineEpsilon);
+        if (target == 0) target = std::numeric_limits<Float>::min();
+        int exponent;
+        std::frexp(target, &exponent);
+        Float scale = std::ldexp(Float(1), exponent - 1);
+        while (origin + Float(maxQ) * scale < bounds.pMax[axis] ||
+               origin + Float(maxQ) * scale == origin)
+            scale *= 2;
+        qnode.origin[axis] = origin;
+        qnode.scale[axis] = scale;
+
+        // Round the children's bounds outwards against their decoded values
+        auto decode = [&](int q) { return origin + Float(q) * scale; };
+        for (int i = 0; i < N; ++i) {
+            if (node.child[i] == -1) {
+                qnode.bounds[0][axis][i] = qnode.bounds[1][axis][i] = 0;
+                continue;
+            }
+            Float lo = node.bounds[0][axis][i], hi = node.bounds[1][axis][i];
+            int qLo = Clamp((int)std::floor((lo - origin) / scale), 0, maxQ);
+            while (qLo > 0 && decode(qLo) > lo) --qLo;
+            int qHi = Clamp((int)std::ceil((hi - origin) / scale), 0, maxQ);
+            while (qHi < maxQ && decode(qHi) < hi) ++qHi;
+            qnode.bounds[0][axis][i] = qLo;
+            qnode.bounds[1][axis][i] = qHi;
+        }
+    }
+    return qnode;
+}
+
+// Appends the primitives offset and count of each leaf of a wide tree to
+// _leaves_
+template <typename Node>
+static void FindWideLeaves(const Node *wideNodes,
+                           std::vector<std::pair<int, int>> *leaves) {
+    std::vector<int> toVisit(1, 0);
+    while (!toVisit.empty()) {
+        const Node &node = wideNodes[toVisit.back()];
+        toVisit.pop_back();
+        for (int i = 0; i < Node::width; ++i) {
+            if (node.child[i] == -1) continue;
+            if (node.nPrimitives[i] > 0)
+                leaves->push_back({node.child[i], node.nPrimitives[i]});
+            else
+                toVisit.push_back(node.child[i]);
+        }
+    }
+}
+
+// Allocates the quantized copy of _wideNodes_ in _*qnodes_ and returns its
+// size in bytes.
+template <int N, typename T>
+static size_t QuantizeBVHTree(const WideBVHNode<N> *wideNodes, int nNodes,
+                              QuantizedBVHNode<N, T> **qnodes) {
+    *qnodes = AllocAligned<QuantizedBVHNode<N, T>>(nNodes);
+    for (int i = 0; i < nNodes; ++i)
+        (*qnodes)[i] = QuantizeBVHNode<N, T>(wideNodes[i]);
+    return nNodes * sizeof(QuantizedBVHNode<N, T>);
+}
+
+// Ray data shared by the tests of all the nodes
+struct WideBVHRay {
+    WideBVHRay(const Ray &ray) {
+        for (int axis = 0; axis < 3; ++axis) {
+            o[axis] = ray.o[axis];
+            invDir[axis] = 1 / ray.d[axis];
+            dirIsNeg[axis] = invDir[axis] < 0;
+        }
+    }
+    Float o[3], invDir[3];
+    int dirIsNeg[3];
+};
+
+// Vertices of up to four triangles of a leaf, stored as p[vertex][axis][lane]
+// so that one SIMD register holds a coordinate of all of them
+struct TrianglePacket {
+    Float p[3][3][4];
+};
+
+// Permutation and shear of the ray's coordinate system computed by
+// _Triangle::Intersect()_, shared by the tests of all the packets
+struct TriangleRay {
+    TriangleRay() = default;
+    explicit TriangleRay(const Ray &ray) {
+        kz = MaxDimension(Abs(ray.d));
+        kx = kz + 1;
+        if (kx == 3) kx = 0;
+        ky = kx + 1;
+        if (ky == 3) ky = 0;
+        Vector3f d = Permute(ray.d, kx, ky, kz);
+        o[0] = ray.o[kx];
+        o[1] = ray.o[ky];
+        o[2] = ray.o[kz];
+        Sx = -d.x / d.z;
+        Sy = -d.y / d.z;
+        Sz = 1.f / d.z;
+    }
+    int kx, ky, kz;
+    Float o[3], Sx, Sy, Sz;
+};
+
+// Ray data shared by the node and primitive tests of a batched traversal
+struct BVHRayBatch {
+    BVHRayBatch(const Ray *rays, int nRays, bool needTriangleRays) {
+        for (int i = 0; i < nRays; ++i) {
+            invDir[i] = Vector3f(1.f / rays[i].d.x, 1.f / rays[i].d.y,
+                                 1.f / rays[i].d.z);
+            dirIsNeg[i][0] = invDir[i].x < 0;
+            dirIsNeg[i][1] = invDir[i].y < 0;
+            dirIsNeg[i][2] = invDir[i].z < 0;
+            if (needTriangleRays) triRays[i] = TriangleRay(rays[i]);
+        }
+    }
+    Vector3f invDir[MaxRayBatchSize];
+    int dirIsNeg[MaxRayBatchSize][3];
+    TriangleRay triRays[MaxRayBatchSize];
+};
+
 // BVHAccel Utility Functions
 inline uint32_t LeftShift3(uint32_t x) {
     CHECK_LE(x, (1 << 10));
@@ -179,12 +407,432 @@ static void RadixSort(std::vector<MortonPrimitive> *v) {
     if (nPasses & 1) std::swap(*v, tempVector);
 }
 
+// BVH cache files hold a _BVHCacheHeader_, the index of each of the
+// tree's primitives in the order given to the constructor and, starting
+// at the next multiple of _cacheNodeAlignment_ bytes, the tree's nodes.
+struct BVHCacheHeader {
+    char magic[8];
+    uint64_t key;
+    int32_t nodeWidth, nPrimitives;
+    uint64_t nodeBytes;
+    Bounds3f bounds;
+};
+
+static const char bvhCacheMagic[8] = "pbrtbvh";
+static PBRT_CONSTEXPR int bvhCacheVersion = 1;
+static PBRT_CONSTEXPR size_t cacheNodeAlignment = 64;
+
+static size_t CacheNodesOffset(int nPrimitives) {
+    size_t offset = sizeof(BVHCacheHeader) + nPrimitives * sizeof(int32_t);
+    return (offset + cacheNodeAlignment - 1) & ~(cacheNodeAlignment - 1);
+}
+
+// Maps _filename_ read-only into memory, or reads it into an aligned buffer
+// where mmap() isn't available. Returns nullptr if the file can't be read.
+static char *MapCacheFile(const std::string &filename, size_t *size) {
+#ifdef PBRT_HAVE_MMAP
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd == -1) return nullptr;
+    struct stat stat;
+    if (fstat(fd, &stat) != 0 || stat.st_size == 0) {
+        close(fd);
+        return nullptr;
+    }
+    *size = stat.st_size;
+    void *ptr = mmap(0, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    return ptr == MAP_FAILED ? nullptr : (char *)ptr;
+#else
+    FILE *f = fopen(filename.c_str(), "rb");
+    if (!f) return nullptr;
+    fseek(f, 0, SEEK_END);
+    long length = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char *data = nullptr;
+    if (length > 0) {
+        *size = length;
+        data = AllocAligned<char>(*size);
+        if (fread(data, 1, *size, f) != *size) {
+            FreeAligned(data);
+            data = nullptr;
+        }
+    }
+    fclose(f);
+    return data;
+#endif
+}
+
+static void UnmapCacheFile(char *data, size_t size) {
+#ifdef PBRT_HAVE_MMAP
+    munmap(data, size);
+#else
+    FreeAligned(data);
+#endif
+}
+
+struct BucketInfo {
+    int count = 0;
+    Bounds3f bounds;
+};
+
+// Spatial split bin: bounds of the parts of the references inside the bin
+// and the number of references starting and ending in it
+struct SBVHBin {
+    Bounds3f bounds;
+    int entries = 0, exits = 0;
+};
+
+// SBVH spatial splits are only considered where the children of the best
+// object split overlap by more than this fraction of the root's area
+static PBRT_CONSTEXPR Float sbvhSplitAlpha = 1e-5f;
+
+// Nodes with at most this many primitives are built by a single thread
+static PBRT_CONSTEXPR int maxBuildTaskPrimitives = 16 * 1024;
+// Nodes at the top of the tree with at least this many primitives have
+// their bounds and SAH buckets computed in parallel, in chunks of
+// _buildChunkSize_ primitives
+static PBRT_CONSTEXPR int minParallelBinningPrimitives = 64 * 1024;
+static PBRT_CONSTEXPR int buildChunkSize = 16 * 1024;
+
+// Treelet optimization restructures treelets of up to _maxTreeletLeaves_
+// leaves, each of them a node of the tree, into the topology of lowest SAH
+// cost found over all the subsets of these leaves. Subtrees at depth
+// _treeletTaskDepth_ are optimized in parallel before the top of the tree.
+static PBRT_CONSTEXPR int maxTreeletLeaves = 5;
+static PBRT_CONSTEXPR int treeletTaskDepth = 8;
+// Costs of the SAH used by the SAH build, for the ray-node and
+// ray-primitive tests
+static PBRT_CONSTEXPR Float sahTraversalCost = 1;
+static PBRT_CONSTEXPR Float sahIntersectionCost = 1;
+
+// Computes the bounds of the primitives in _[start, end)_ and of their
+// centroids. The unions are exact, so the chunked parallel version returns
+// the same bounds as the serial loop.
+static void ComputeBounds(const std::vector<BVHPrimitiveInfo> &primitiveInfo,
+                          int start, int end, bool parallel, Bounds3f *bounds,
+                          Bounds3f *centroidBounds) {
+    if (!parallel || end - start < minParallelBinningPrimitives) {
+        for (int i = start; i < end; ++i) {
+            *bounds = Union(*bounds, primitiveInfo[i].bounds);
+            *centroidBounds = Union(*centroidBounds, primitiveInfo[i].centroid);
+        }
+        return;
+    }
+    int nChunks = (end - start + buildChunkSize - 1) / buildChunkSize;
+    std::vector<Bounds3f> chunkBounds(nChunks), chunkCentroidBounds(nChunks);
+    ParallelFor([&](int chunk) {
+        int chunkStart = start + chunk * buildChunkSize;
+        int chunkEnd = std::min(chunkStart + buildChunkSize, end);
+        for (int i = chunkStart; i < chunkEnd; ++i) {
+            chunkBounds[chunk] =
+                Union(chunkBounds[chunk], primitiveInfo[i].bounds);
+            chunkCentroidBounds[chunk] =
+                Union(chunkCentroidBounds[chunk], primitiveInfo[i].centroid);
+        }
+    }, nChunks, 1);
+    for (int chunk = 0; chunk < nChunks; ++chunk) {
+        *bounds = Union(*bounds, chunkBounds[chunk]);
+        *centroidBounds = Union(*centroidBounds, chunkCentroidBounds[chunk]);
+    }
+}
+
+// Bins the primitives in _[start, end)_ into the _nBuckets_ SAH buckets
+// along _dim_, using per-chunk buckets merged in order for large ranges.
+static void ComputeBuckets(const std::vector<BVHPrimitiveInfo> &primitiveInfo,
+                           int start, int end, const Bounds3f &centroidBounds,
+                           int dim, bool parallel, BucketInfo *buckets,
+                           int nBuckets) {
+    auto binPrimitives = [&](int binStart, int binEnd, BucketInfo *bins) {
+        for (int i = binStart; i < binEnd; ++i) {
+            int b = nBuckets *
+                    centroidBounds.Offset(primitiveInfo[i].centroid)[dim];
+            if (b == nBuckets) b = nBuckets - 1;
+            CHECK_GE(b, 0);
+            CHECK_LT(b, nBuckets);
+            bins[b].count++;
+            bins[b].bounds = Union(bins[b].bounds, primitiveInfo[i].bounds);
+        }
+    };
+    if (!parallel || end - start < minParallelBinningPrimitives) {
+        binPrimitives(start, end, buckets);
+        return;
+    }
+    int nChunks = (end - start + buildChunkSize - 1) / buildChunkSize;
+    std::vector<BucketInfo> chunkBuckets(nChunks * nBuckets);
+    ParallelFor([&](int chunk) {
+        int chunkStart = start + chunk * buildChunkSize;
+        binPrimitives(chunkStart, std::min(chunkStart + buildChunkSize, end),
+                      &chunkBuckets[chunk * nBuckets]);
+    }, nChunks, 1);
+    for (int chunk = 0; chunk < nChunks; ++chunk)
+        for (int b = 0; b < nBuckets; ++b) {
+            const BucketInfo &bin = chunkBuckets[chunk * nBuckets + b];
+            buckets[b].count += bin.count;
+            buckets[b].bounds = Union(buckets[b].bounds, bin.bounds);
+        }
+}
+
+// Sets the split axis of an interior node to the axis along which its
+// children's centers are farthest apart, the first child being the one
+// below; the traversal visits first the child nearer to the ray origin
+// along it.
+static void SetSplitAxis(BVHBuildNode *node) {
+    const Bounds3f &b0 = node->children[0]->bounds;
+    const Bounds3f &b1 = node->children[1]->bounds;
+    Vector3f d = (b1.pMin + b1.pMax) - (b0.pMin + b0.pMax);
+    int axis = MaxDimension(Abs(d));
+    if (d[axis] < 0) std::swap(node->children[0], node->children[1]);
+    node->splitAxis = axis;
+}
+
+// Treelet leaves and interior nodes, with the bounds, lowest SAH cost and
+// best partition of each subset of the leaves
+struct TreeletTopology {
+    BVHBuildNode *const *leaves, *const *interior;
+    const Bounds3f *subsetBounds;
+    const Float *cost;
+    const int *partition;
+};
+
+// Makes _node_ the root of the subset _subset_ of the treelet's leaves,
+// taking the interior nodes it needs from _*nextInterior_ on
+static void RebuildTreelet(const TreeletTopology &topology, BVHBuildNode *node,
+                           int subset, int *nextInterior) {
+    int sides[2] = {topology.partition[subset],
+                    subset ^ topology.partition[subset]};
+    for (int i = 0; i < 2; ++i) {
+        if ((sides[i] & (sides[i] - 1)) == 0)
+            node->children[i] =
+                topology.leaves[CountTrailingZeros(uint32_t(sides[i]))];
+        else {
+            node->children[i] = topology.interior[(*nextInterior)++];
+            RebuildTreelet(topology, node->children[i], sides[i],
+                           nextInterior);
+        }
+    }
+    node->bounds = topology.subsetBounds[subset];
+    node->sahCost = topology.cost[subset];
+    SetSplitAxis(node);
+}
+
+// Replaces the treelet rooted at _root_ by the topology of its leaves with
+// the lowest SAH cost, as in Karras and Aila's TRBVH. The nodes of the
+// treelet must have their _sahCost_ set; the treelet's interior nodes are
+// reused.
+static void RestructureTreelet(BVHBuildNode *root) {
+    // Grow the treelet by turning its leaf of largest area into the two
+    // children of this node
+    BVHBuildNode *leaves[maxTreeletLeaves], *interior[maxTreeletLeaves - 1];
+    leaves[0] = root->children[0];
+    leaves[1] = root->children[1];
+    interior[0] = root;
+    int nLeaves = 2, nInterior = 1;
+    while (nLeaves < maxTreeletLeaves) {
+        int expand = -1;
+        Float maxArea = -1;
+        for (int i = 0; i < nLeaves; ++i)
+            if (leaves[i]->nPrimitives == 0 &&
+                leaves[i]->bounds.SurfaceArea() > maxArea) {
+                expand = i;
+                maxArea = leaves[i]->bounds.SurfaceArea();
+            }
+        if (expand == -1) break;
+        BVHBuildNode *node = leaves[expand];
+        interior[nInterior++] = node;
+        leaves[expand] = node->children[0];
+        leaves[nLeaves++] = node->children[1];
+    }
+    // Two leaves have a single topology
+    if (nLeaves < 3) return;
+
+    // Find the lowest-cost partition of each subset of the leaves; the
+    // subsets of a subset are smaller integers, so they are found first
+    const int nSubsets = 1 << nLeaves;
+    Bounds3f subsetBounds[1 << maxTreeletLeaves];
+    Float cost[1 << maxTreeletLeaves];
+    int partition[1 << maxTreeletLeaves];
+    for (int subset = 1; subset < nSubsets; ++subset) {
+        int first = CountTrailingZeros(uint32_t(subset));
+        int rest = subset & (subset - 1);
+        if (rest == 0) {
+            subsetBounds[subset] = leaves[first]->bounds;
+            cost[subset] = leaves[first]->sahCost;
+            continue;
+        }
+        subsetBounds[subset] =
+            Union(subsetBounds[rest], leaves[first]->bounds);
+        // Enumerate the nonempty subsets _p_ of _subset_ without its first
+        // leaf, so that each partition is considered once
+        Float bestCost = Infinity;
+        int p = -rest & rest;
+        do {
+            Float c = cost[p] + cost[subset ^ p];
+            if (c < bestCost) {
+                bestCost = c;
+                partition[subset] = p;
+            }
+            p = (p - rest) & rest;
+        } while (p != 0);
+        cost[subset] = sahTraversalCost * subsetBounds[subset].SurfaceArea() +
+                       bestCost;
+    }
+    // Keep the treelet unless the gain is worth rewiring it
+    int all = nSubsets - 1;
+    if (cost[all] >= .999f * root->sahCost) return;
+
+    // Rebuild the treelet from the partitions
+    TreeletTopology topology = {leaves, interior, subsetBounds, cost,
+                                partition};
+    int nextInterior = 1;
+    RebuildTreelet(topology, root, all, &nextInterior);
+    CHECK_EQ(nextInterior, nInterior);
+}
+
+// Splits the leaf _node_ in two leaves if the SAH finds them cheaper,
+// sorting its primitives along the split axis. The primitives' bounds are
+// clipped to the leaf's, which may hold parts of them after spatial splits.
+static bool SplitLeaf(BVHBuildNode *node,
+                      std::vector<std::shared_ptr<Primitive>> &primitives,
+                      MemoryArena &arena) {
+    int n = node->nPrimitives, first = node->firstPrimOffset;
+    if (n == 1) return false;
+    std::vector<BVHPrimitiveInfo> info(n);
+    for (int i = 0; i < n; ++i)
+        info[i] = BVHPrimitiveInfo(
+            first + i,
+            Intersect(primitives[first + i]->WorldBound(), node->bounds));
+    // Find the cheapest split of the primitives sorted by centroid
+    Float bestCost = sahIntersectionCost * n * node->bounds.SurfaceArea();
+    int bestAxis = -1, bestSplit = 0;
+    std::vector<Float> areaAbove(n);
+    for (int axis = 0; axis < 3; ++axis) {
+        std::sort(info.begin(), info.end(),
+                  [axis](const BVHPrimitiveInfo &a, const BVHPrimitiveInfo &b) {
+                      return a.centroid[axis] < b.centroid[axis];
+                  });
+        Bounds3f b;
+        for (int i = n - 1; i > 0; --i) {
+            b = Union(b, info[i].bounds);
+            areaAbove[i] = b.SurfaceArea();
+        }
+        b = Bounds3f();
+        for (int i = 1; i < n; ++i) {
+            b = Union(b, info[i - 1].bounds);
+            Float cost = sahTraversalCost * node->bounds.SurfaceArea() +
+                         sahIntersectionCost * (i * b.SurfaceArea() +
+                                                (n - i) * areaAbove[i]);
+            if (cost < bestCost) {
+                bestCost = cost;
+                bestAxis = axis;
+                bestSplit = i;
+            }
+        }
+    }
+    if (bestAxis == -1) return false;
+
+    std::sort(info.begin(), info.end(),
+              [bestAxis](const BVHPrimitiveInfo &a, const BVHPrimitiveInfo &b) {
+                  return a.centroid[bestAxis] < b.centroid[bestAxis];
+              });
+    std::vector<std::shared_ptr<Primitive>> sorted(n);
+    Bounds3f bounds[2];
+    for (int i = 0; i < n; ++i) {
+        sorted[i] = primitives[info[i].primitiveNumber];
+        bounds[i >= bestSplit] = Union(bounds[i >= bestSplit], info[i].bounds);
+    }
+    std::copy(sorted.begin(), sorted.end(), primitives.begin() + first);
+    BVHBuildNode *children = arena.Alloc<BVHBuildNode>(2);
+    children[0].InitLeaf(first, bestSplit, bounds[0]);
+    children[1].InitLeaf(first + bestSplit, n - bestSplit, bounds[1]);
+    // The leaf becomes an interior node
+    --leafNodes;
+    --totalLeafNodes;
+    totalPrimitives -= n;
+    node->InitInterior(bestAxis, &children[0], &children[1]);
+    return true;
+}
+
+// State shared by the optimization of the subtrees of a tree
+struct TreeletOptimization {
+    std::vector<std::shared_ptr<Primitive>> &primitives;
+    // Per-thread arenas for the nodes of split leaves, if leaves are split
+    std::vector<MemoryArena> *arenas;
+    std::atomic<int> nCreatedNodes;
+};
+
+// Optimizes the treelets of the subtree at _node_, at depth _depth_, from
+// the bottom up; nodes at _stopDepth_ are already optimized. Leaves are
+// first split while it lowers their SAH cost, so that the treelets can
+// gather their primitives in better ones. Returns the subtree's SAH cost.
+static Float OptimizeTreelets(TreeletOptimization &opt, BVHBuildNode *node,
+                              int depth, int stopDepth) {
+    if (depth == stopDepth) return node->sahCost;
+    if (node->nPrimitives > 0) {
+        if (!opt.arenas ||
+            !SplitLeaf(node, opt.primitives, (*opt.arenas)[ThreadIndex]))
+            return node->sahCost = sahIntersectionCost * node->nPrimitives *
+                                   node->bounds.SurfaceArea();
+        opt.nCreatedNodes += 2;
+        // The new leaves weren't gathered as tasks, so optimize them even
+        // if they lie at _stopDepth_
+        stopDepth = -1;
+    }
+    node->sahCost =
+        sahTraversalCost * node->bounds.SurfaceArea() +
+        OptimizeTreelets(opt, node->children[0], depth + 1, stopDepth) +
+        OptimizeTreelets(opt, node->children[1], depth + 1, stopDepth);
+    RestructureTreelet(node);
+    return node->sahCost;
+}
+
+static void GatherTreeletTasks(BVHBuildNode *node, int depth,
+                               std::vector<BVHBuildNode *> *tasks) {
+    if (depth == treeletTaskDepth)
+        tasks->push_back(node);
+    else if (node->nPrimitives == 0) {
+        GatherTreeletTasks(node->children[0], depth + 1, tasks);
+        GatherTreeletTasks(node->children[1], depth + 1, tasks);
+    }
+}
+
+// Accumulates the quality measures of the subtree at _node_, the areas not
+// yet divided by the root's
+static void ComputeQuality(const BVHBuildNode *node, BVHQuality *quality) {
+    if (node->nPrimitives > 0) {
+        quality->sahCost += sahIntersectionCost * node->nPrimitives *
+                            node->bounds.SurfaceArea();
+        if (node->nPrimitives >= (int)quality->leafSizes.size())
+            quality->leafSizes.resize(node->nPrimitives + 1);
+        ++quality->leafSizes[node->nPrimitives];
+        return;
+    }
+    quality->sahCost += sahTraversalCost * node->bounds.SurfaceArea();
+    Bounds3f overlap =
+        Intersect(node->children[0]->bounds, node->children[1]->bounds);
+    if (overlap.pMin.x <= overlap.pMax.x && overlap.pMin.y <= overlap.pMax.y &&
+        overlap.pMin.z <= overlap.pMax.z)
+        quality->siblingOverlap += overlap.SurfaceArea();
+    ComputeQuality(node->children[0], quality);
+    ComputeQuality(node->children[1], quality);
+}
+
 // BVHAccel Method Definitions
 BVHAccel::BVHAccel(std::vector<std::shared_ptr<Primitive>> p,
-                   int maxPrimsInNode, SplitMethod splitMethod)
+                   int maxPrimsInNode, SplitMethod splitMethod, int nodeWidth,
+                   const std::string &cacheDir, Float maxDuplication,
+                   int quantizeBits, bool packTriangles, int optimizePasses)
     : maxPrimsInNode(std::min(255, maxPrimsInNode)),
       splitMethod(splitMethod),
+      nodeWidth(nodeWidth),
+      maxDuplication(maxDuplication),
+      quantizeBits(quantizeBits),
+      optimizePasses(optimizePasses),
       primitives(std::move(p)) {
+    CHECK(nodeWidth == 2 || nodeWidth == 4 || nodeWidth == 8);
+    CHECK_GE(maxDuplication, 0);
+    CHECK_GE(optimizePasses, 0);
+    CHECK(quantizeBits == 0 || quantizeBits == 8 || quantizeBits == 16);
+    CHECK(quantizeBits == 0 || nodeWidth != 2);
     ProfilePhase _(Prof::AccelConstruction);
     if (primitives.empty()) return;
     // Build BVH from _primitives_
@@ -194,19 +842,83 @@ BVHAccel::BVHAccel(std::vector<std::shared_ptr<Primitive>> p,
     for (size_t i = 0; i < primitives.size(); ++i)
         primitiveInfo[i] = {i, primitives[i]->WorldBound()};
 
+    // Use the tree stored in the cache file for these primitives, if any
+    std::string cacheFilename;
+    uint64_t key = 0;
+    if (!cacheDir.empty()) {
+        key = cacheKey(primitiveInfo);
+        cacheFilename = cacheDir + StringPrintf("/bvh-%016llx.cache",
+                                                (unsigned long long)key);
+        if (loadCache(cacheFilename, key)) {
+            if (packTriangles) packTriangleLeaves();
+            return;
+        }
+    }
+
     // Build BVH tree for primitives using _primitiveInfo_
     MemoryArena arena(1024 * 1024);
     int totalNodes = 0;
-    std::vector<std::shared_ptr<Primitive>> orderedPrims;
-    orderedPrims.reserve(primitives.size());
+    std::vector<std::shared_ptr<Primitive>> orderedPrims(primitives.size());
     BVHBuildNode *root;
+    bool parallelBuild = splitMethod != SplitMethod::HLBVH &&
+                         splitMethod != SplitMethod::SBVH &&
+                         MaxThreadIndex() > 1 &&
+                         primitives.size() > maxBuildTaskPrimitives;
+    std::vector<MemoryArena> threadArenas(parallelBuild ? MaxThreadIndex()
+                                                        : 0);
     if (splitMethod == SplitMethod::HLBVH)
         root = HLBVHBuild(arena, primitiveInfo, &totalNodes, orderedPrims);
-    else
+    else if (splitMethod == SplitMethod::SBVH)
+        root = SBVHBuild(arena, primitiveInfo, &totalNodes, orderedPrims);
+    else if (parallelBuild) {
+        // Build the top of the tree, then its subtrees in parallel, each
+        // worker allocating nodes from its own arena. Splits do not depend on
+        // the order in which nodes are built, so the tree is the same as the
+        // serial one.
+        std::vector<BVHBuildTask> tasks;
+        root = recursiveBuild(arena, primitiveInfo, 0, primitives.size(),
+                              &totalNodes, orderedPrims, &tasks);
+        std::sort(tasks.begin(), tasks.end(),
+                  [](const BVHBuildTask &a, const BVHBuildTask &b) {
+                      return a.end - a.start > b.end - b.start;
+                  });
+        std::atomic<int> atomicTotal(totalNodes);
+        ParallelFor([&](int i) {
+            int nodesCreated = 0;
+            const BVHBuildTask &task = tasks[i];
+            *task.node = *recursiveBuild(threadArenas[ThreadIndex],
+                                         primitiveInfo, task.start, task.end,
+                                         &nodesCreated, orderedPrims);
+            atomicTotal += nodesCreated;
+        }, tasks.size(), 1);
+        totalNodes = atomicTotal;
+    } else
         root = recursiveBuild(arena, primitiveInfo, 0, primitives.size(),
                               &totalNodes, orderedPrims);
     primitives.swap(orderedPrims);
     primitiveInfo.resize(0);
+
+    // Optimize the tree's treelets, the subtrees below _treeletTaskDepth_
+    // in parallel; the first pass also splits the leaves
+    std::vector<MemoryArena> optimizeArenas(optimizePasses > 0 ? MaxThreadIndex()
+                                                               : 0);
+    for (int pass = 0; pass < optimizePasses; ++pass) {
+        TreeletOptimization opt = {primitives,
+                                   pass == 0 ? &optimizeArenas : nullptr, {0}};
+        std::vector<BVHBuildNode *> tasks;
+        GatherTreeletTasks(root, 0, &tasks);
+        ParallelFor([&](int i) {
+            OptimizeTreelets(opt, tasks[i], treeletTaskDepth, -1);
+        }, tasks.size(), 1);
+        OptimizeTreelets(opt, root, 0, treeletTaskDepth);
+        totalNodes += opt.nCreatedNodes;
+    }
+    ComputeQuality(root, &quality);
+    Float rootArea = root->bounds.SurfaceArea();
+    if (rootArea > 0) {
+        quality.sahCost /= rootArea;
+        quality.siblingOverlap /= rootArea;
+    }
     LOG(INFO) << StringPrintf("BVH created with %d nodes for %d "
                               "primitives (%.2f MB), arena allocated %.2f MB",
                               totalNodes, (int)primitives.size(),
@@ -214,61 +926,367 @@ BVHAccel::BVHAccel(std::vector<std::shared_ptr<Primitive>> p,
                               (1024.f * 1024.f),
                               float(arena.TotalAllocated()) /
                               (1024.f * 1024.f));
+    LOG(INFO) << StringPrintf("BVH SAH cost %f, sibling overlap %f",
+                              quality.sahCost, quality.siblingOverlap);
 
-    // Compute representation of depth-first traversal of BVH tree
-    treeBytes += totalNodes * sizeof(LinearBVHNode) + sizeof(*this) +
-                 primitives.size() * sizeof(primitives[0]);
-    nodes = AllocAligned<LinearBVHNode>(totalNodes);
-    int offset = 0;
-    flattenBVHTree(root, &offset);
-    CHECK_EQ(totalNodes, offset);
+    bounds = root->bounds;
+    size_t nodeBytes;
+    if (nodeWidth == 4) {
+        int totalWideNodes = 0;
+        nodes4 = collapseBVHTree<4>(root, &totalWideNodes);
+        nodeBytes = totalWideNodes * sizeof(WideBVHNode<4>);
+        if (quantizeBits != 0) {
+            nodeBytes =
+                quantizeBits == 8
+                    ? QuantizeBVHTree(nodes4, totalWideNodes, &nodes4q8)
+                    : QuantizeBVHTree(nodes4, totalWideNodes, &nodes4q16);
+            FreeAligned(nodes4);
+            nodes4 = nullptr;
+        }
+    } else if (nodeWidth == 8) {
+        int totalWideNodes = 0;
+        nodes8 = collapseBVHTree<8>(root, &totalWideNodes);
+        nodeBytes = totalWideNodes * sizeof(WideBVHNode<8>);
+        if (quantizeBits != 0) {
+            nodeBytes =
+                quantizeBits == 8
+                    ? QuantizeBVHTree(nodes8, totalWideNodes, &nodes8q8)
+                    : QuantizeBVHTree(nodes8, totalWideNodes, &nodes8q16);
+            FreeAligned(nodes8);
+            nodes8 = nullptr;
+        }
+    } else {
+        // Compute representation of depth-first traversal of BVH tree
+        nodeBytes = totalNodes * sizeof(LinearBVHNode);
+        nodes = AllocAligned<LinearBVHNode>(totalNodes);
+        int offset = 0;
+        flattenBVHTree(root, &offset);
+        CHECK_EQ(totalNodes, offset);
+    }
+    treeBytes += sizeof(*this) + primitives.size() * sizeof(primitives[0]) +
+                 nodeBytes;
+    // _orderedPrims_ now holds the primitives in their original order
+    if (!cacheFilename.empty())
+        writeCache(cacheFilename, key, orderedPrims, nodeBytes);
+    if (packTriangles) packTriangleLeaves();
 }
 
-Bounds3f BVHAccel::WorldBound() const {
-    return nodes ? nodes[0].bounds : Bounds3f();
+uint64_t BVHAccel::cacheKey(
+    const std::vector<BVHPrimitiveInfo> &primitiveInfo) const {
+    // Hash the build parameters and the bounds of the primitives; the tree
+    // only depends on them
+    int32_t params[] = {bvhCacheVersion, (int32_t)sizeof(Float),
+                        maxPrimsInNode, (int32_t)splitMethod, nodeWidth,
+                        quantizeBits, (int32_t)primitiveInfo.size()};
+    uint64_t hash = HashBytes(params, sizeof(params));
+    if (splitMethod == SplitMethod::SBVH)
+        hash = HashBytes(&maxDuplication, sizeof(maxDuplication), hash);
+    if (optimizePasses > 0)
+        hash = HashBytes(&optimizePasses, sizeof(optimizePasses), hash);
+    for (const BVHPrimitiveInfo &pi : primitiveInfo)
+        hash = HashBytes(&pi.bounds, sizeof(pi.bounds), hash);
+    return hash;
 }
 
-struct BucketInfo {
-    int count = 0;
-    Bounds3f bounds;
-};
+// Checks that a node of a cache file only references the nodes after it and
+// the tree's primitives, so that traversals neither loop nor read out of
+// bounds
+static bool ValidCacheNode(const LinearBVHNode &node, int index, int nNodes,
+                           int nPrimitives) {
+    if (node.nPrimitives > 0)
+        return node.primitivesOffset >= 0 &&
+               node.primitivesOffset <= nPrimitives - node.nPrimitives;
+    // The first child is the next node
+    return index + 1 < nNodes && node.secondChildOffset > index + 1 &&
+           node.secondChildOffset < nNodes && node.axis < 3;
+}
+
+template <typename Node>
+static bool ValidCacheNode(const Node &node, int index, int nNodes,
+                           int nPrimitives) {
+    for (int i = 0; i < Node::width; ++i) {
+        int child = node.child[i], n = node.nPrimitives[i];
+        if (child == -1) {
+            if (n != 0) return false;
+        } else if (n > 0) {
+            if (child < 0 || child > nPrimitives - n) return false;
+        } else if (child <= index || child >= nNodes)
+            return false;
+    }
+    return true;
+}
+
+template <typename Node>
+static bool ValidCacheNodes(const char *data, uint64_t nodeBytes,
+                            int nPrimitives) {
+    if (nodeBytes % sizeof(Node) != 0 ||
+        nodeBytes / sizeof(Node) > (uint64_t)std::numeric_limits<int>::max())
+        return false;
+    const Node *nodes = (const Node *)data;
+    int nNodes = nodeBytes / sizeof(Node);
+    for (int i = 0; i < nNodes; ++i)
+        if (!ValidCacheNode(nodes[i], i, nNodes, nPrimitives)) return false;
+    return true;
+}
+
+bool BVHAccel::validCacheNodes(const char *data, uint64_t nodeBytes,
+                               int nPrimitives) const {
+    if (nodeWidth == 4) {
+        if (quantizeBits == 8)
+            return ValidCacheNodes<QuantizedBVHNode<4, uint8_t>>(
+                data, nodeBytes, nPrimitives);
+        else if (quantizeBits == 16)
+            return ValidCacheNodes<QuantizedBVHNode<4, uint16_t>>(
+                data, nodeBytes, nPrimitives);
+        else
+            return ValidCacheNodes<WideBVHNode<4>>(data, nodeBytes,
+                                                   nPrimitives);
+    } else if (nodeWidth == 8) {
+        if (quantizeBits == 8)
+            return ValidCacheNodes<QuantizedBVHNode<8, uint8_t>>(
+                data, nodeBytes, nPrimitives);
+        else if (quantizeBits == 16)
+            return ValidCacheNodes<QuantizedBVHNode<8, uint16_t>>(
+                data, nodeBytes, nPrimitives);
+        else
+            return ValidCacheNodes<WideBVHNode<8>>(data, nodeBytes,
+                                                   nPrimitives);
+    } else
+        return ValidCacheNodes<LinearBVHNode>(data, nodeBytes, nPrimitives);
+}
+
+bool BVHAccel::loadCache(const std::string &filename, uint64_t key) {
+    size_t size;
+    char *data = MapCacheFile(filename, &size);
+    if (!data) return false;
+
+    // Check that the file holds a tree for these primitives; SBVH trees
+    // may reference some of them more than once. The nodes are checked too,
+    // since a truncated or corrupted file could otherwise crash traversals
+    const BVHCacheHeader *header = (const BVHCacheHeader *)data;
+    int nInputPrimitives = primitives.size();
+    bool valid = size >= sizeof(BVHCacheHeader) &&
+                 memcmp(header->magic, bvhCacheMagic, 8) == 0 &&
+                 header->key == key && header->nodeWidth == nodeWidth &&
+                 header->nPrimitives >= nInputPrimitives &&
+                 header->nodeBytes > 0;
+    int nPrimitives = valid ? header->nPrimitives : 0;
+    size_t nodesOffset = CacheNodesOffset(nPrimitives);
+    valid = valid && size == nodesOffset + header->nodeBytes;
+    const int32_t *primitiveIndices =
+        (const int32_t *)(data + sizeof(BVHCacheHeader));
+    for (int i = 0; valid && i < nPrimitives; ++i)
+        valid = primitiveIndices[i] >= 0 &&
+                primitiveIndices[i] < nInputPrimitives;
+    valid = valid &&
+            validCacheNodes(data + nodesOffset, header->nodeBytes, nPrimitives);
+    if (!valid) {
+        Warning("%s: ignoring invalid BVH cache file", filename.c_str());
+        UnmapCacheFile(data, size);
+        return false;
+    }
+
+    // Reorder _primitives_ and use the nodes in place
+    std::vector<std::shared_ptr<Primitive>> orderedPrims(nPrimitives);
+    for (int i = 0; i < nPrimitives; ++i)
+        orderedPrims[i] = primitives[primitiveIndices[i]];
+    primitives.swap(orderedPrims);
+    bounds = header->bounds;
+    setNodeData(data + nodesOffset);
+    cacheData = data;
+    cacheSize = size;
+    treeBytes += sizeof(*this) + primitives.size() * sizeof(primitives[0]) +
+                 header->nodeBytes;
+    ++nCachedTrees;
+    LOG(INFO) << "Loaded BVH for " << nPrimitives << " primitives from "
+              << filename;
+    return true;
+}
+
+void BVHAccel::writeCache(
+    const std::string &filename, uint64_t key,
+    const std::vector<std::shared_ptr<Primitive>> &inputPrims,
+    size_t nodeBytes) const {
+    // Find the index of each of the tree's primitives in _inputPrims_
+    std::unordered_map<const Primitive *, int32_t> inputIndex;
+    for (size_t i = 0; i < inputPrims.size(); ++i)
+        inputIndex[inputPrims[i].get()] = i;
+    std::vector<int32_t> primitiveIndices(primitives.size());
+    for (size_t i = 0; i < primitives.size(); ++i)
+        primitiveIndices[i] = inputIndex[primitives[i].get()];
+
+    BVHCacheHeader header = {};
+    memcpy(header.magic, bvhCacheMagic, 8);
+    header.key = key;
+    header.nodeWidth = nodeWidth;
+    header.nPrimitives = primitives.size();
+    header.nodeBytes = nodeBytes;
+    header.bounds = bounds;
+    size_t padding = CacheNodesOffset(primitives.size()) - sizeof(header) -
+                     primitiveIndices.size() * sizeof(int32_t);
+    const char zeros[cacheNodeAlignment] = {0};
+
+    // Write to a temporary file first so that other processes never map a
+    // partially written cache
+    std::string tempFilename = filename + ".tmp";
+    FILE *f = fopen(tempFilename.c_str(), "wb");
+    if (!f) {
+        Warning("%s: unable to create BVH cache file", tempFilename.c_str());
+        return;
+    }
+    bool written =
+        fwrite(&header, sizeof(header), 1, f) == 1 &&
+        fwrite(primitiveIndices.data(), sizeof(int32_t),
+               primitiveIndices.size(), f) == primitiveIndices.size() &&
+        fwrite(zeros, 1, padding, f) == padding &&
+        fwrite(nodeData(), 1, nodeBytes, f) == nodeBytes;
+    if (fclose(f) != 0 || !written ||
+        rename(tempFilename.c_str(), filename.c_str()) != 0) {
+        Warning("%s: unable to write BVH cache file", filename.c_str());
+        remove(tempFilename.c_str());
+    }
+}
+
+void BVHAccel::packTriangleLeaves() {
+#ifdef PBRT_BVH_SSE
+    // Find the leaves of the tree in whichever layout it has
+    std::vector<std::pair<int, int>> leaves;
+    if (nodes) {
+        std::vector<int> toVisit(1, 0);
+        while (!toVisit.empty()) {
+            const LinearBVHNode &node = nodes[toVisit.back()];
+            int nodeIndex = toVisit.back();
+            toVisit.pop_back();
+            if (node.nPrimitives > 0)
+                leaves.push_back({node.primitivesOffset, node.nPrimitives});
+            else {
+                toVisit.push_back(nodeIndex + 1);
+                toVisit.push_back(node.secondChildOffset);
+            }
+        }
+    } else if (nodes4)
+        FindWideLeaves(nodes4, &leaves);
+    else if (nodes8)
+        FindWideLeaves(nodes8, &leaves);
+    else if (nodes4q8)
+        FindWideLeaves(nodes4q8, &leaves);
+    else if (nodes4q16)
+        FindWideLeaves(nodes4q16, &leaves);
+    else if (nodes8q8)
+        FindWideLeaves(nodes8q8, &leaves);
+    else if (nodes8q16)
+        FindWideLeaves(nodes8q16, &leaves);
+
+    // Copy the vertices of the leaves made only of triangles; unused lanes
+    // are left zero and masked out by the test
+    std::vector<TrianglePacket> packets;
+    leafPackets.assign(primitives.size(), -1);
+    int nPackedLeaves = 0;
+    for (const std::pair<int, int> &leaf : leaves) {
+        int offset = leaf.first, nPrimitives = leaf.second;
+        std::vector<TrianglePacket> leafData((nPrimitives + 3) / 4);
+        bool allTriangles = true;
+        for (int i = 0; i < nPrimitives && allTriangles; ++i) {
+            Point3f p[3];
+            allTriangles = primitives[offset + i]->GetTriangleVertices(p);
+            for (int j = 0; j < 3; ++j)
+                for (int axis = 0; axis < 3; ++axis)
+                    leafData[i / 4].p[j][axis][i % 4] = p[j][axis];
+        }
+        if (!allTriangles) continue;
+        leafPackets[offset] = packets.size();
+        packets.insert(packets.end(), leafData.begin(), leafData.end());
+        ++nPackedLeaves;
+    }
+    if (packets.empty()) {
+        leafPackets.clear();
+        return;
+    }
+    trianglePackets = AllocAligned<TrianglePacket>(packets.size());
+    std::copy(packets.begin(), packets.end(), trianglePackets);
+    treeBytes += packets.size() * sizeof(TrianglePacket) +
+                 leafPackets.size() * sizeof(int32_t);
+    LOG(INFO) << "Packed the triangles of " << nPackedLeaves << " of "
+              << leaves.size() << " BVH leaves";
+#endif  // PBRT_BVH_SSE
+}
+
+const void *BVHAccel::nodeData() const {
+    if (nodes4) return nodes4;
+    if (nodes8) return nodes8;
+    if (nodes4q8) return nodes4q8;
+    if (nodes4q16) return nodes4q16;
+    if (nodes8q8) return nodes8q8;
+    if (nodes8q16) return nodes8q16;
+    return nodes;
+}
+
+// Points the array of the tree's layout at _data_
+void BVHAccel::setNodeData(void *data) {
+    if (nodeWidth == 4) {
+        if (quantizeBits == 8)
+            nodes4q8 = (QuantizedBVHNode<4, uint8_t> *)data;
+        else if (quantizeBits == 16)
+            nodes4q16 = (QuantizedBVHNode<4, uint16_t> *)data;
+        else
+            nodes4 = (WideBVHNode<4> *)data;
+    } else if (nodeWidth == 8) {
+        if (quantizeBits == 8)
+            nodes8q8 = (QuantizedBVHNode<8, uint8_t> *)data;
+        else if (quantizeBits == 16)
+            nodes8q16 = (QuantizedBVHNode<8, uint16_t> *)data;
+        else
+            nodes8 = (WideBVHNode<8> *)data;
+    } else
+        nodes = (LinearBVHNode *)data;
+}
+
+Bounds3f BVHAccel::WorldBound() const { return bounds; }
 
 BVHBuildNode *BVHAccel::recursiveBuild(
     MemoryArena &arena, std::vector<BVHPrimitiveInfo> &primitiveInfo, int start,
     int end, int *totalNodes,
-    std::vector<std::shared_ptr<Primitive>> &orderedPrims) {
+    std::vector<std::shared_ptr<Primitive>> &orderedPrims,
+    std::vector<BVHBuildTask> *tasks) {
     CHECK_NE(start, end);
+    // Compute bounds of all primitives and of their centroids in BVH node
+    Bounds3f bounds, centroidBounds;
+    ComputeBounds(primitiveInfo, start, end, tasks != nullptr, &bounds,
+                  &centroidBounds);
+    int nPrimitives = end - start;
+    if (tasks && nPrimitives <= maxBuildTaskPrimitives) {
+        // Leave the subtree to a worker thread; the parent only needs its
+        // bounds
+        BVHBuildNode *node = arena.Alloc<BVHBuildNode>();
+        node->bounds = bounds;
+        tasks->push_back({node, start, end});
+        return node;
+    }
     BVHBuildNode *node = arena.Alloc<BVHBuildNode>();
     (*totalNodes)++;
-    // Compute bounds of all primitives in BVH node
-    Bounds3f bounds;
-    for (int i = start; i < end; ++i)
-        bounds = Union(bounds, primitiveInfo[i].bounds);
-    int nPrimitives = end - start;
+    // The primitives of the subtree over _[start, end)_ end up at the same
+    // indices in _orderedPrims_, so that subtrees can be built in any order
     if (nPrimitives == 1) {
         // Create leaf _BVHBuildNode_
-        int firstPrimOffset = orderedPrims.size();
+        int firstPrimOffset = start;
         for (int i = start; i < end; ++i) {
             int primNum = primitiveInfo[i].primitiveNumber;
-            orderedPrims.push_back(primitives[primNum]);
+            orderedPrims[i] = primitives[primNum];
         }
         node->InitLeaf(firstPrimOffset, nPrimitives, bounds);
         return node;
     } else {
-        // Compute bound of primitive centroids, choose split dimension _dim_
-        Bounds3f centroidBounds;
-        for (int i = start; i < end; ++i)
-            centroidBounds = Union(centroidBounds, primitiveInfo[i].centroid);
+        // Choose split dimension _dim_
         int dim = centroidBounds.MaximumExtent();
 
         // Partition primitives into two sets and build children
         int mid = (start + end) / 2;
         if (centroidBounds.pMax[dim] == centroidBounds.pMin[dim]) {
             // Create leaf _BVHBuildNode_
-            int firstPrimOffset = orderedPrims.size();
+            int firstPrimOffset = start;
             for (int i = start; i < end; ++i) {
                 int primNum = primitiveInfo[i].primitiveNumber;
-                orderedPrims.push_back(primitives[primNum]);
+                orderedPrims[i] = primitives[primNum];
             }
             node->InitLeaf(firstPrimOffset, nPrimitives, bounds);
             return node;
@@ -321,17 +1339,8 @@ BVHBuildNode *BVHAccel::recursiveBuild(
                     BucketInfo buckets[nBuckets];
 
                     // Initialize _BucketInfo_ for SAH partition buckets
-                    for (int i = start; i < end; ++i) {
-                        int b = nBuckets *
-                                centroidBounds.Offset(
-                                    primitiveInfo[i].centroid)[dim];
-                        if (b == nBuckets) b = nBuckets - 1;
-                        CHECK_GE(b, 0);
-                        CHECK_LT(b, nBuckets);
-                        buckets[b].count++;
-                        buckets[b].bounds =
-                            Union(buckets[b].bounds, primitiveInfo[i].bounds);
-                    }
+                    ComputeBuckets(primitiveInfo, start, end, centroidBounds,
+                                   dim, tasks != nullptr, buckets, nBuckets);
 
                     // Compute costs for splitting after each bucket
                     Float cost[nBuckets - 1];
@@ -379,10 +1388,10 @@ BVHBuildNode *BVHAccel::recursiveBuild(
                         mid = pmid - &primitiveInfo[0];
                     } else {
                         // Create leaf _BVHBuildNode_
-                        int firstPrimOffset = orderedPrims.size();
+                        int firstPrimOffset = start;
                         for (int i = start; i < end; ++i) {
                             int primNum = primitiveInfo[i].primitiveNumber;
-                            orderedPrims.push_back(primitives[primNum]);
+                            orderedPrims[i] = primitives[primNum];
                         }
                         node->InitLeaf(firstPrimOffset, nPrimitives, bounds);
                         return node;
@@ -393,11 +1402,280 @@ BVHBuildNode *BVHAccel::recursiveBuild(
             }
             node->InitInterior(dim,
                                recursiveBuild(arena, primitiveInfo, start, mid,
-                                              totalNodes, orderedPrims),
+                                              totalNodes, orderedPrims, tasks),
                                recursiveBuild(arena, primitiveInfo, mid, end,
-                                              totalNodes, orderedPrims));
+                                              totalNodes, orderedPrims, tasks));
+        }
+    }
+    return node;
+}
+
+// Whether the bounds enclose nothing, as the default or a disjoint
+// _Intersect()_ do
+static bool IsEmpty(const Bounds3f &b) {
+    return b.pMin.x > b.pMax.x || b.pMin.y > b.pMax.y || b.pMin.z > b.pMax.z;
+}
+
+BVHBuildNode *BVHAccel::SBVHBuild(
+    MemoryArena &arena, const std::vector<BVHPrimitiveInfo> &primitiveInfo,
+    int *totalNodes,
+    std::vector<std::shared_ptr<Primitive>> &orderedPrims) const {
+    // Start with one reference per primitive; spatial splits may then split
+    // at most _maxDuplication_ times as many references in two
+    std::vector<BVHPrimitiveInfo> references(primitiveInfo);
+    Bounds3f bounds;
+    for (const BVHPrimitiveInfo &ref : references)
+        bounds = Union(bounds, ref.bounds);
+    int duplicatesLeft = maxDuplication * primitiveInfo.size();
+    orderedPrims.clear();
+    BVHBuildNode *root =
+        recursiveSBVHBuild(arena, references, bounds.SurfaceArea(),
+                           &duplicatesLeft, totalNodes, orderedPrims);
+    sbvhReferences += orderedPrims.size();
+    sbvhPrimitives += primitiveInfo.size();
+    return root;
+}
+
+BVHBuildNode *BVHAccel::recursiveSBVHBuild(
+    MemoryArena &arena, std::vector<BVHPrimitiveInfo> &references,
+    Float rootSurfaceArea, int *duplicatesLeft, int *totalNodes,
+    std::vector<std::shared_ptr<Primitive>> &orderedPrims) const {
+    CHECK(!references.empty());
+    BVHBuildNode *node = arena.Alloc<BVHBuildNode>();
+    (*totalNodes)++;
+    // Compute bounds of the references and of their centroids
+    Bounds3f bounds, centroidBounds;
+    for (const BVHPrimitiveInfo &ref : references) {
+        bounds = Union(bounds, ref.bounds);
+        centroidBounds = Union(centroidBounds, ref.centroid);
+    }
+    int nReferences = references.size();
+    // Bounds of the part of _ref_'s primitive inside _clip_
+    auto clipReference = [&](const BVHPrimitiveInfo &ref,
+                             const Bounds3f &clip) {
+        return primitives[ref.primitiveNumber]->ClippedWorldBound(clip);
+    };
+
+    // Find the best object split with the binned SAH
+    PBRT_CONSTEXPR int nBuckets = 12;
+    int dim = centroidBounds.MaximumExtent();
+    Float objectCost = Infinity;
+    int objectBucket = 0;
+    Bounds3f objectBounds[2];
+    if (centroidBounds.pMax[dim] > centroidBounds.pMin[dim]) {
+        BucketInfo buckets[nBuckets];
+        ComputeBuckets(references, 0, nReferences, centroidBounds, dim, false,
+                       buckets, nBuckets);
+        for (int i = 0; i < nBuckets - 1; ++i) {
+            Bounds3f b0, b1;
+            int count0 = 0, count1 = 0;
+            for (int j = 0; j <= i; ++j) {
+                b0 = Union(b0, buckets[j].bounds);
+                count0 += buckets[j].count;
+            }
+            for (int j = i + 1; j < nBuckets; ++j) {
+                b1 = Union(b1, buckets[j].bounds);
+                count1 += buckets[j].count;
+            }
+            if (count0 == 0 || count1 == 0) continue;
+            Float cost = 1 + (count0 * b0.SurfaceArea() +
+                              count1 * b1.SurfaceArea()) /
+                                 bounds.SurfaceArea();
+            if (cost < objectCost) {
+                objectCost = cost;
+                objectBucket = i;
+                objectBounds[0] = b0;
+                objectBounds[1] = b1;
+            }
         }
     }
+
+    // Find the best spatial split if the object split's children overlap
+    // significantly and references may still be duplicated
+    PBRT_CONSTEXPR int nBins = 16;
+    Float spatialCost = Infinity, spatialPlane = 0;
+    int spatialDim = 0, spatialCounts[2] = {0, 0};
+    Bounds3f spatialBounds[2];
+    Bounds3f overlap = pbrt::Intersect(objectBounds[0], objectBounds[1]);
+    if (nReferences > 1 && *duplicatesLeft > 0 &&
+        bounds.Diagonal()[bounds.MaximumExtent()] > 0 &&
+        (objectCost == Infinity ||
+         (!IsEmpty(overlap) &&
+          overlap.SurfaceArea() > sbvhSplitAlpha * rootSurfaceArea))) {
+        // Only bin along the node's longest axis: the clipping of the
+        // references dominates the build time and the other axes rarely
+        // give a better split
+        int axis = bounds.MaximumExtent();
+        Float binMin = bounds.pMin[axis];
+        Float binWidth = (bounds.pMax[axis] - binMin) / nBins;
+        auto binPlane = [&](int b) {
+            return b == nBins ? bounds.pMax[axis] : binMin + b * binWidth;
+        };
+        auto binIndex = [&](Float x) {
+            return Clamp(int((x - binMin) / binWidth), 0, nBins - 1);
+        };
+
+        // Chop the references into the bins they overlap
+        SBVHBin bins[nBins];
+        for (const BVHPrimitiveInfo &ref : references) {
+            int first = binIndex(ref.bounds.pMin[axis]);
+            int last = binIndex(ref.bounds.pMax[axis]);
+            bins[first].entries++;
+            bins[last].exits++;
+            if (first == last) {
+                bins[first].bounds = Union(bins[first].bounds, ref.bounds);
+                continue;
+            }
+            for (int b = first; b <= last; ++b) {
+                Bounds3f slab = ref.bounds;
+                if (b > first) slab.pMin[axis] = binPlane(b);
+                if (b < last) slab.pMax[axis] = binPlane(b + 1);
+                Bounds3f clipped = clipReference(ref, slab);
+                if (!IsEmpty(clipped))
+                    bins[b].bounds = Union(bins[b].bounds, clipped);
+            }
+        }
+
+        // Compute costs for splitting after each bin
+        Bounds3f rightBounds[nBins - 1];
+        int rightCounts[nBins - 1];
+        Bounds3f b1;
+        int count1 = 0;
+        for (int i = nBins - 1; i > 0; --i) {
+            b1 = Union(b1, bins[i].bounds);
+            count1 += bins[i].exits;
+            rightBounds[i - 1] = b1;
+            rightCounts[i - 1] = count1;
+        }
+        Bounds3f b0;
+        int count0 = 0;
+        for (int i = 0; i < nBins - 1; ++i) {
+            b0 = Union(b0, bins[i].bounds);
+            count0 += bins[i].entries;
+            // Only consider splits that leave fewer references on both
+            // sides and stay within the duplication budget
+            if (count0 == 0 || rightCounts[i] == 0 ||
+                count0 == nReferences || rightCounts[i] == nReferences ||
+                count0 + rightCounts[i] - nReferences > *duplicatesLeft)
+                continue;
+            Float cost = 1 + (count0 * b0.SurfaceArea() +
+                              rightCounts[i] * rightBounds[i].SurfaceArea()) /
+                                 bounds.SurfaceArea();
+            if (cost < spatialCost) {
+                spatialCost = cost;
+                spatialDim = axis;
+                spatialPlane = binPlane(i + 1);
+                spatialBounds[0] = b0;
+                spatialBounds[1] = rightBounds[i];
+                spatialCounts[0] = count0;
+                spatialCounts[1] = rightCounts[i];
+            }
+        }
+    }
+
+    // Create leaf _BVHBuildNode_ if splitting doesn't pay off; like the SAH
+    // build, always split pairs of references that can be separated
+    Float leafCost = nReferences;
+    if (std::min(objectCost, spatialCost) == Infinity ||
+        (nReferences <= maxPrimsInNode && nReferences > 2 &&
+         std::min(objectCost, spatialCost) >= leafCost)) {
+        int firstPrimOffset = orderedPrims.size();
+        for (const BVHPrimitiveInfo &ref : references)
+            orderedPrims.push_back(primitives[ref.primitiveNumber]);
+        node->InitLeaf(firstPrimOffset, nReferences, bounds);
+        return node;
+    }
+
+    std::vector<BVHPrimitiveInfo> left, right;
+    if (spatialCost < objectCost) {
+        // Partition references at the spatial split plane, splitting those
+        // that straddle it unless keeping them whole on one side is cheaper
+        Bounds3f b0 = spatialBounds[0], b1 = spatialBounds[1];
+        int count0 = spatialCounts[0], count1 = spatialCounts[1];
+        int duplicates = 0;
+        for (const BVHPrimitiveInfo &ref : references) {
+            if (ref.bounds.pMax[spatialDim] <= spatialPlane) {
+                left.push_back(ref);
+                continue;
+            }
+            if (ref.bounds.pMin[spatialDim] >= spatialPlane) {
+                right.push_back(ref);
+                continue;
+            }
+            Bounds3f leftClip = ref.bounds, rightClip = ref.bounds;
+            leftClip.pMax[spatialDim] = spatialPlane;
+            rightClip.pMin[spatialDim] = spatialPlane;
+            Bounds3f leftBounds = clipReference(ref, leftClip);
+            Bounds3f rightBounds = clipReference(ref, rightClip);
+            if (IsEmpty(leftBounds)) {
+                right.push_back(BVHPrimitiveInfo(ref.primitiveNumber,
+                                                 rightBounds));
+                continue;
+            }
+            if (IsEmpty(rightBounds)) {
+                left.push_back(BVHPrimitiveInfo(ref.primitiveNumber,
+                                                leftBounds));
+                continue;
+            }
+            Float splitCost = count0 * b0.SurfaceArea() +
+                              count1 * b1.SurfaceArea();
+            Float leftCost = count0 * Union(b0, ref.bounds).SurfaceArea() +
+                             (count1 - 1) * b1.SurfaceArea();
+            Float rightCost = (count0 - 1) * b0.SurfaceArea() +
+                              count1 * Union(b1, ref.bounds).SurfaceArea();
+            if (duplicates < *duplicatesLeft &&
+                splitCost < std::min(leftCost, rightCost)) {
+                left.push_back(BVHPrimitiveInfo(ref.primitiveNumber,
+                                                leftBounds));
+                right.push_back(BVHPrimitiveInfo(ref.primitiveNumber,
+                                                 rightBounds));
+                ++duplicates;
+            } else if (leftCost <= rightCost) {
+                left.push_back(ref);
+                b0 = Union(b0, ref.bounds);
+                --count1;
+            } else {
+                right.push_back(ref);
+                b1 = Union(b1, ref.bounds);
+                --count0;
+            }
+        }
+        if (left.empty() || right.empty() || (int)left.size() == nReferences ||
+            (int)right.size() == nReferences) {
+            // Fall back to the object split if the spatial one didn't
+            // separate the references
+            left.clear();
+            right.clear();
+        } else {
+            *duplicatesLeft -= duplicates;
+            dim = spatialDim;
+        }
+    }
+    if (left.empty()) {
+        if (objectCost == Infinity) {
+            int firstPrimOffset = orderedPrims.size();
+            for (const BVHPrimitiveInfo &ref : references)
+                orderedPrims.push_back(primitives[ref.primitiveNumber]);
+            node->InitLeaf(firstPrimOffset, nReferences, bounds);
+            return node;
+        }
+        // Partition references at the object split's bucket
+        for (const BVHPrimitiveInfo &ref : references) {
+            int b = nBuckets * centroidBounds.Offset(ref.centroid)[dim];
+            if (b == nBuckets) b = nBuckets - 1;
+            (b <= objectBucket ? left : right).push_back(ref);
+        }
+    }
+
+    // Release this node's references before building the children
+    std::vector<BVHPrimitiveInfo>().swap(references);
+    BVHBuildNode *c0 = recursiveSBVHBuild(arena, left, rootSurfaceArea,
+                                          duplicatesLeft, totalNodes,
+                                          orderedPrims);
+    BVHBuildNode *c1 = recursiveSBVHBuild(arena, right, rootSurfaceArea,
+                                          duplicatesLeft, totalNodes,
+                                          orderedPrims);
+    node->InitInterior(dim, c0, c1);
     return node;
 }
 
@@ -657,27 +1935,506 @@ int BVHAccel::flattenBVHTree(BVHBuildNode *node, int *offset) {
     return myOffset;
 }
 
-BVHAccel::~BVHAccel() { FreeAligned(nodes); }
+template <int N>
+static int CollapseBVHNode(BVHBuildNode *node,
+                           std::vector<WideBVHNode<N>> &wideNodes) {
+    // Gather the children of the wide node, opening the interior child with
+    // the largest surface area until there are _N_ of them
+    BVHBuildNode *children[N];
+    int nChildren = 0;
+    if (node->nPrimitives > 0)
+        // A single leaf at the root
+        children[nChildren++] = node;
+    else {
+        children[nChildren++] = node->children[0];
+        children[nChildren++] = node->children[1];
+        while (nChildren < N) {
+            int largest = -1;
+            Float largestArea = -1;
+            for (int i = 0; i < nChildren; ++i) {
+                if (children[i]->nPrimitives > 0) continue;
+                Float area = children[i]->bounds.SurfaceArea();
+                if (area > largestArea) {
+                    largest = i;
+                    largestArea = area;
+                }
+            }
+            if (largest == -1) break;
+            BVHBuildNode *opened = children[largest];
+            children[largest] = opened->children[0];
+            children[nChildren++] = opened->children[1];
+        }
+    }
+    ++nWideNodes;
+    nWideChildren += nChildren;
+
+    // Emit the node, then its interior children in depth-first order
+    int offset = wideNodes.size();
+    wideNodes.push_back(WideBVHNode<N>());
+    for (int i = 0; i < nChildren; ++i) {
+        BVHBuildNode *c = children[i];
+        int childOffset;
+        if (c->nPrimitives > 0) {
+            CHECK_LT(c->nPrimitives, 65536);
+            childOffset = c->firstPrimOffset;
+        } else
+            childOffset = CollapseBVHNode<N>(c, wideNodes);
+        WideBVHNode<N> &wideNode = wideNodes[offset];
+        for (int axis = 0; axis < 3; ++axis) {
+            wideNode.bounds[0][axis][i] = c->bounds.pMin[axis];
+            wideNode.bounds[1][axis][i] = c->bounds.pMax[axis];
+        }
+        wideNode.child[i] = childOffset;
+        wideNode.nPrimitives[i] = c->nPrimitives;
+    }
+    return offset;
+}
+
+template <int N>
+WideBVHNode<N> *BVHAccel::collapseBVHTree(BVHBuildNode *root,
+                                          int *totalWideNodes) {
+    std::vector<WideBVHNode<N>> wideNodes;
+    CollapseBVHNode<N>(root, wideNodes);
+    *totalWideNodes = wideNodes.size();
+    WideBVHNode<N> *linearNodes =
+        AllocAligned<WideBVHNode<N>>(wideNodes.size());
+    std::copy(wideNodes.begin(), wideNodes.end(), linearNodes);
+    return linearNodes;
+}
+
+// Returns the mask of the children of _node_ that the ray enters before
+// _tMax_, and the distance at which it enters them in _tEntry_. As in
+// _Bounds3::IntersectP()_, the exit distances are slightly increased to be
+// conservative, and NaNs, from rays in the plane of a slab, leave the
+// distances unchanged.
+template <int N>
+static int IntersectChildren(const Float (&bounds)[2][3][N],
+                             const WideBVHRay &r, Float tMax,
+                             Float tEntry[N]) {
+    int mask = 0;
+    for (int i = 0; i < N; ++i) {
+        Float entry = 0, exit = tMax;
+        for (int axis = 0; axis < 3; ++axis) {
+            Float tNear = (bounds[r.dirIsNeg[axis]][axis][i] - r.o[axis]) *
+                          r.invDir[axis];
+            Float tFar = (bounds[1 - r.dirIsNeg[axis]][axis][i] - r.o[axis]) *
+                         r.invDir[axis] * (1 + 2 * gamma(3));
+            entry = tNear > entry ? tNear : entry;
+            exit = tFar < exit ? tFar : exit;
+        }
+        tEntry[i] = entry;
+        if (entry <= exit) mask |= 1 << i;
+    }
+    return mask;
+}
+
+#ifdef PBRT_BVH_SSE
+// _mm_max_ps()_ and _mm_min_ps()_ return their second operand when the first
+// one is a NaN, which gives the same results as the scalar version.
+template <>
+inline int IntersectChildren<4>(const Float (&bounds)[2][3][4],
+                                const WideBVHRay &r, Float tMax,
+                                Float tEntry[4]) {
+    __m128 entry = _mm_setzero_ps(), exit = _mm_set1_ps(tMax);
+    const __m128 robust = _mm_set1_ps(1 + 2 * gamma(3));
+    for (int axis = 0; axis < 3; ++axis) {
+        __m128 o = _mm_set1_ps(r.o[axis]);
+        __m128 invDir = _mm_set1_ps(r.invDir[axis]);
+        __m128 tNear = _mm_mul_ps(
+            _mm_sub_ps(_mm_loadu_ps(bounds[r.dirIsNeg[axis]][axis]), o),
+            invDir);
+        __m128 tFar = _mm_mul_ps(
+            _mm_mul_ps(
+                _mm_sub_ps(_mm_loadu_ps(bounds[1 - r.dirIsNeg[axis]][axis]),
+                           o),
+                invDir),
+            robust);
+        entry = _mm_max_ps(tNear, entry);
+        exit = _mm_min_ps(tFar, exit);
+    }
+    _mm_storeu_ps(tEntry, entry);
+    return _mm_movemask_ps(_mm_cmple_ps(entry, exit));
+}
+#endif  // PBRT_BVH_SSE
+
+#ifdef PBRT_BVH_AVX
+__attribute__((target("avx"))) static int IntersectChildrenAVX(
+    const Float (&bounds)[2][3][8], const WideBVHRay &r, Float tMax,
+    Float tEntry[8]) {
+    __m256 entry = _mm256_setzero_ps(), exit = _mm256_set1_ps(tMax);
+    const __m256 robust = _mm256_set1_ps(1 + 2 * gamma(3));
+    for (int axis = 0; axis < 3; ++axis) {
+        __m256 o = _mm256_set1_ps(r.o[axis]);
+        __m256 invDir = _mm256_set1_ps(r.invDir[axis]);
+        __m256 tNear = _mm256_mul_ps(
+            _mm256_sub_ps(_mm256_loadu_ps(bounds[r.dirIsNeg[axis]][axis]), o),
+            invDir);
+        __m256 tFar = _mm256_mul_ps(
+            _mm256_mul_ps(
+                _mm256_sub_ps(
+                    _mm256_loadu_ps(bounds[1 - r.dirIsNeg[axis]][axis]), o),
+                invDir),
+            robust);
+        entry = _mm256_max_ps(tNear, entry);
+        exit = _mm256_min_ps(tFar, exit);
+    }
+    _mm256_storeu_ps(tEntry, entry);
+    return _mm256_movemask_ps(_mm256_cmp_ps(entry, exit, _CMP_LE_OQ));
+}
+
+static bool HasAVX() {
+    static const bool hasAVX = __builtin_cpu_supports("avx");
+    return hasAVX;
+}
+
+template <>
+inline int IntersectChildren<8>(const Float (&bounds)[2][3][8],
+                                const WideBVHRay &r, Float tMax,
+                                Float tEntry[8]) {
+    if (HasAVX()) return IntersectChildrenAVX(bounds, r, tMax, tEntry);
+    // Two SSE halves
+    Float half[2][3][4];
+    int mask = 0;
+    for (int h = 0; h < 2; ++h) {
+        for (int b = 0; b < 2; ++b)
+            for (int axis = 0; axis < 3; ++axis)
+                for (int i = 0; i < 4; ++i)
+                    half[b][axis][i] = bounds[b][axis][4 * h + i];
+        mask |= IntersectChildren<4>(half, r, tMax, tEntry + 4 * h) << (4 * h);
+    }
+    return mask;
+}
+#endif  // PBRT_BVH_AVX
+
+#ifdef PBRT_BVH_SSE
+// Runs the watertight test of _Triangle::Intersect()_ on the lanes of
+// _packet_ in _laneMask_, with the same floating-point operations so that
+// it finds the same hits. Returns the mask of the lanes hit before _tMax_,
+// with their distance in _tHit_. Lanes with a zero edge function need the
+// scalar test's double-precision fallback; they are returned in
+// _*scalarMask_ instead.
+static int IntersectTriangles(const TrianglePacket &packet,
+                              const TriangleRay &r, Float tMax, int laneMask,
+                              Float tHit[4], int *scalarMask) {
+    ++nTrianglePacketTests;
+    // Translate, permute and shear the vertices
+    __m128 x[3], y[3], z[3];
+    const __m128 Sx = _mm_set1_ps(r.Sx), Sy = _mm_set1_ps(r.Sy);
+    for (int j = 0; j < 3; ++j) {
+        x[j] = _mm_sub_ps(_mm_loadu_ps(packet.p[j][r.kx]), _mm_set1_ps(r.o[0]));
+        y[j] = _mm_sub_ps(_mm_loadu_ps(packet.p[j][r.ky]), _mm_set1_ps(r.o[1]));
+        z[j] = _mm_sub_ps(_mm_loadu_ps(packet.p[j][r.kz]), _mm_set1_ps(r.o[2]));
+        x[j] = _mm_add_ps(x[j], _mm_mul_ps(Sx, z[j]));
+        y[j] = _mm_add_ps(y[j], _mm_mul_ps(Sy, z[j]));
+    }
+
+    // Compute the edge functions and test them and the determinant
+    __m128 e0 = _mm_sub_ps(_mm_mul_ps(x[1], y[2]), _mm_mul_ps(y[1], x[2]));
+    __m128 e1 = _mm_sub_ps(_mm_mul_ps(x[2], y[0]), _mm_mul_ps(y[2], x[0]));
+    __m128 e2 = _mm_sub_ps(_mm_mul_ps(x[0], y[1]), _mm_mul_ps(y[0], x[1]));
+    const __m128 zero = _mm_setzero_ps();
+    int edgeMask = _mm_movemask_ps(
+        _mm_or_ps(_mm_or_ps(_mm_cmpeq_ps(e0, zero), _mm_cmpeq_ps(e1, zero)),
+                  _mm_cmpeq_ps(e2, zero)));
+    *scalarMask = edgeMask & laneMask;
+    laneMask &= ~edgeMask;
+    __m128 anyNegative =
+        _mm_or_ps(_mm_or_ps(_mm_cmplt_ps(e0, zero), _mm_cmplt_ps(e1, zero)),
+                  _mm_cmplt_ps(e2, zero));
+    __m128 anyPositive =
+        _mm_or_ps(_mm_or_ps(_mm_cmpgt_ps(e0, zero), _mm_cmpgt_ps(e1, zero)),
+                  _mm_cmpgt_ps(e2, zero));
+    __m128 det = _mm_add_ps(_mm_add_ps(e0, e1), e2);
+    __m128 reject = _mm_or_ps(_mm_and_ps(anyNegative, anyPositive),
+                              _mm_cmpeq_ps(det, zero));
+
+    // Test the scaled hit distance against the ray's range
+    const __m128 Sz = _mm_set1_ps(r.Sz);
+    for (int j = 0; j < 3; ++j) z[j] = _mm_mul_ps(z[j], Sz);
+    __m128 tScaled =
+        _mm_add_ps(_mm_add_ps(_mm_mul_ps(e0, z[0]), _mm_mul_ps(e1, z[1])),
+                   _mm_mul_ps(e2, z[2]));
+    __m128 tMaxDet = _mm_mul_ps(_mm_set1_ps(tMax), det);
+    reject = _mm_or_ps(
+        reject, _mm_and_ps(_mm_cmplt_ps(det, zero),
+                           _mm_or_ps(_mm_cmpge_ps(tScaled, zero),
+                                     _mm_cmplt_ps(tScaled, tMaxDet))));
+    reject = _mm_or_ps(
+        reject, _mm_and_ps(_mm_cmpgt_ps(det, zero),
+                           _mm_or_ps(_mm_cmple_ps(tScaled, zero),
+                                     _mm_cmpgt_ps(tScaled, tMaxDet))));
+    laneMask &= ~_mm_movemask_ps(reject);
+    if (laneMask == 0) return 0;
+
+    // Ensure that the hit distances are conservatively greater than zero
+    const __m128 signBit = _mm_set1_ps(-0.f);
+    auto abs = [&](__m128 v) { return _mm_andnot_ps(signBit, v); };
+    auto maxAbs = [&](const __m128 v[3]) {
+        return _mm_max_ps(abs(v[0]), _mm_max_ps(abs(v[1]), abs(v[2])));
+    };
+    __m128 invDet = _mm_div_ps(_mm_set1_ps(1), det);
+    __m128 t = _mm_mul_ps(tScaled, invDet);
+    __m128 maxZt = maxAbs(z), maxXt = maxAbs(x), maxYt = maxAbs(y);
+    __m128 deltaZ = _mm_mul_ps(_mm_set1_ps(gamma(3)), maxZt);
+    __m128 deltaX = _mm_mul_ps(_mm_set1_ps(gamma(5)), _mm_add_ps(maxXt, maxZt));
+    __m128 deltaY = _mm_mul_ps(_mm_set1_ps(gamma(5)), _mm_add_ps(maxYt, maxZt));
+    __m128 deltaE = _mm_mul_ps(
+        _mm_set1_ps(2),
+        _mm_add_ps(
+            _mm_add_ps(
+                _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(gamma(2)), maxXt), maxYt),
+                _mm_mul_ps(deltaY, maxXt)),
+            _mm_mul_ps(deltaX, maxYt)));
+    __m128 e[3] = {e0, e1, e2};
+    __m128 maxE = maxAbs(e);
+    __m128 deltaT = _mm_mul_ps(
+        _mm_mul_ps(
+            _mm_set1_ps(3),
+            _mm_add_ps(
+                _mm_add_ps(
+                    _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(gamma(3)), maxE), maxZt),
+                    _mm_mul_ps(deltaE, maxZt)),
+                _mm_mul_ps(deltaZ, maxE))),
+        abs(invDet));
+    laneMask &= ~_mm_movemask_ps(_mm_cmple_ps(t, deltaT));
+    _mm_storeu_ps(tHit, t);
+    return laneMask;
+}
+#endif  // PBRT_BVH_SSE
+
+// Returns the mask of the lanes of the packet starting at the _first_ of a
+// leaf's _nPrimitives_ triangles
+static inline int PacketLaneMask(int first, int nPrimitives) {
+    return nPrimitives - first >= 4 ? 0xf : (1 << (nPrimitives - first)) - 1;
+}
+
+bool BVHAccel::intersectLeaf(const Ray &ray, const TriangleRay &triRay,
+                             SurfaceInteraction *isect, int offset,
+                             int nPrimitives) const {
+    bool hit = false;
+    int packet = leafPackets.empty() ? -1 : leafPackets[offset];
+    if (packet == -1) {
+        for (int i = 0; i < nPrimitives; ++i)
+            if (primitives[offset + i]->Intersect(ray, isect)) hit = true;
+        return hit;
+    }
+#ifdef PBRT_BVH_SSE
+    for (int first = 0; first < nPrimitives; first += 4, ++packet) {
+        Float tHit[4];
+        int scalarMask;
+        int mask = IntersectTriangles(trianglePackets[packet], triRay,
+                                      ray.tMax, PacketLaneMask(first,
+                                                               nPrimitives),
+                                      tHit, &scalarMask);
+        for (; scalarMask != 0; scalarMask &= scalarMask - 1) {
+            int i = first + CountTrailingZeros(uint64_t(scalarMask));
+            if (primitives[offset + i]->Intersect(ray, isect)) hit = true;
+        }
+        if (mask == 0) continue;
+        // Compute the interaction of the closest triangle only; if it
+        // rejects the hit (e.g. when it is degenerate), test the others
+        int closest = CountTrailingZeros(uint64_t(mask));
+        for (int m = mask & (mask - 1); m != 0; m &= m - 1) {
+            int lane = CountTrailingZeros(uint64_t(m));
+            if (tHit[lane] < tHit[closest]) closest = lane;
+        }
+        if (primitives[offset + first + closest]->Intersect(ray, isect))
+            hit = true;
+        else
+            for (mask &= ~(1 << closest); mask != 0; mask &= mask - 1) {
+                int i = first + CountTrailingZeros(uint64_t(mask));
+                if (primitives[offset + i]->Intersect(ray, isect)) hit = true;
+            }
+    }
+#endif  // PBRT_BVH_SSE
+    return hit;
+}
+
+const Primitive *BVHAccel::leafOccluder(const Ray &ray,
+                                        const TriangleRay &triRay, int offset,
+                                        int nPrimitives) const {
+    int packet = leafPackets.empty() ? -1 : leafPackets[offset];
+    if (packet == -1) {
+        for (int i = 0; i < nPrimitives; ++i)
+            if (primitives[offset + i]->IntersectP(ray))
+                return primitives[offset + i].get();
+        return nullptr;
+    }
+#ifdef PBRT_BVH_SSE
+    for (int first = 0; first < nPrimitives; first += 4, ++packet) {
+        Float tHit[4];
+        int scalarMask;
+        int mask = IntersectTriangles(trianglePackets[packet], triRay,
+                                      ray.tMax, PacketLaneMask(first,
+                                                               nPrimitives),
+                                      tHit, &scalarMask);
+        if (mask != 0)
+            return primitives[offset + first +
+                              CountTrailingZeros(uint64_t(mask))].get();
+        for (; scalarMask != 0; scalarMask &= scalarMask - 1) {
+            int i = first + CountTrailingZeros(uint64_t(scalarMask));
+            if (primitives[offset + i]->IntersectP(ray))
+                return primitives[offset + i].get();
+        }
+    }
+#endif  // PBRT_BVH_SSE
+    return nullptr;
+}
+
+template <typename Node>
+bool BVHAccel::wideIntersect(const Node *wideNodes, const Ray &ray,
+                             SurfaceInteraction *isect) const {
+    PBRT_CONSTEXPR int N = Node::width;
+    ProfilePhase p(Prof::AccelIntersect);
+    WideBVHRay r(ray);
+    TriangleRay triRay;
+    if (trianglePackets) triRay = TriangleRay(ray);
+    bool hit = false;
+    // Children to visit, with the distance at which the ray enters them;
+    // leaves are stored with their primitives
+    struct ToVisit {
+        int offset, nPrimitives;
+        Float tEntry;
+    };
+    ToVisit toVisit[64 * N];
+    int toVisitOffset = 0;
+    TRAVERSAL_STAT(int nVisited = 0);
+    toVisit[toVisitOffset++] = {0, 0, 0};
+    while (toVisitOffset > 0) {
+        ToVisit current = toVisit[--toVisitOffset];
+        // Skip the children beyond the closest hit found since they were
+        // pushed
+        if (current.tEntry > ray.tMax) continue;
+        if (current.nPrimitives > 0) {
+            if (intersectLeaf(ray, triRay, isect, current.offset,
+                              current.nPrimitives))
+                hit = true;
+            continue;
+        }
+        const Node &node = wideNodes[current.offset];
+        TRAVERSAL_STAT(++nVisited);
+        typename Node::ChildBounds decoded;
+        Float tEntry[N];
+        int mask =
+            IntersectChildren<N>(node.GetBounds(decoded), r, ray.tMax, tEntry);
+        // Push the children that were hit from the farthest to the nearest
+        int order[N], nHit = 0;
+        for (; mask != 0; mask &= mask - 1) {
+            int i = CountTrailingZeros(uint64_t(mask));
+            int j = nHit++;
+            while (j > 0 && tEntry[order[j - 1]] < tEntry[i]) {
+                order[j] = order[j - 1];
+                --j;
+            }
+            order[j] = i;
+        }
+        for (int j = 0; j < nHit; ++j) {
+            int i = order[j];
+            toVisit[toVisitOffset++] = {node.child[i], node.nPrimitives[i],
+                                        tEntry[i]};
+        }
+    }
+    TRAVERSAL_STAT(nNodeVisits += nVisited);
+    TRAVERSAL_STAT(++nClosestHitRays);
+    return hit;
+}
+
+template <typename Node>
+const Primitive *BVHAccel::wideOccluder(const Node *wideNodes,
+                                        const Ray &ray) const {
+    PBRT_CONSTEXPR int N = Node::width;
+    ProfilePhase p(Prof::AccelIntersectP);
+    WideBVHRay r(ray);
+    TriangleRay triRay;
+    if (trianglePackets) triRay = TriangleRay(ray);
+    int nodesToVisit[64 * N];
+    int toVisitOffset = 0;
+    TRAVERSAL_STAT(int nVisited = 0);
+    nodesToVisit[toVisitOffset++] = 0;
+    TRAVERSAL_STAT(++nShadowRays);
+    while (toVisitOffset > 0) {
+        const Node &node = wideNodes[nodesToVisit[--toVisitOffset]];
+        TRAVERSAL_STAT(++nVisited);
+        typename Node::ChildBounds decoded;
+        Float tEntry[N];
+        int mask =
+            IntersectChildren<N>(node.GetBounds(decoded), r, ray.tMax, tEntry);
+        for (; mask != 0; mask &= mask - 1) {
+            int i = CountTrailingZeros(uint64_t(mask));
+            if (node.nPrimitives[i] == 0) {
+                nodesToVisit[toVisitOffset++] = node.child[i];
+                continue;
+            }
+            // Any hit ends the traversal, so leaves are tested right away
+            if (const Primitive *prim = leafOccluder(
+                    ray, triRay, node.child[i], node.nPrimitives[i])) {
+                TRAVERSAL_STAT(nShadowNodeVisits += nVisited);
+                return prim;
+            }
+        }
+    }
+    TRAVERSAL_STAT(nShadowNodeVisits += nVisited);
+    return nullptr;
+}
+
+bool BVHAccel::wideIntersect(const Ray &ray, SurfaceInteraction *isect) const {
+    if (nodes4) return wideIntersect(nodes4, ray, isect);
+    if (nodes8) return wideIntersect(nodes8, ray, isect);
+    if (nodes4q8) return wideIntersect(nodes4q8, ray, isect);
+    if (nodes4q16) return wideIntersect(nodes4q16, ray, isect);
+    if (nodes8q8) return wideIntersect(nodes8q8, ray, isect);
+    if (nodes8q16) return wideIntersect(nodes8q16, ray, isect);
+    return false;
+}
+
+const Primitive *BVHAccel::wideOccluder(const Ray &ray) const {
+    if (nodes4) return wideOccluder(nodes4, ray);
+    if (nodes8) return wideOccluder(nodes8, ray);
+    if (nodes4q8) return wideOccluder(nodes4q8, ray);
+    if (nodes4q16) return wideOccluder(nodes4q16, ray);
+    if (nodes8q8) return wideOccluder(nodes8q8, ray);
+    if (nodes8q16) return wideOccluder(nodes8q16, ray);
+    return nullptr;
+}
+
+BVHAccel::~BVHAccel() {
+    FreeAligned(trianglePackets);
+    if (cacheData) {
+        UnmapCacheFile(cacheData, cacheSize);
+        return;
+    }
+    FreeAligned(nodes);
+    FreeAligned(nodes4);
+    FreeAligned(nodes8);
+    FreeAligned(nodes4q8);
+    FreeAligned(nodes4q16);
+    FreeAligned(nodes8q8);
+    FreeAligned(nodes8q16);
+}
 
 bool BVHAccel::Intersect(const Ray &ray, SurfaceInteraction *isect) const {
-    if (!nodes) return false;
+    // Empty trees have no nodes in any layout
+    if (!nodes) return wideIntersect(ray, isect);
     ProfilePhase p(Prof::AccelIntersect);
     bool hit = false;
     Vector3f invDir(1 / ray.d.x, 1 / ray.d.y, 1 / ray.d.z);
     int dirIsNeg[3] = {invDir.x < 0, invDir.y < 0, invDir.z < 0};
+    TriangleRay triRay;
+    if (trianglePackets) triRay = TriangleRay(ray);
     // Follow ray through BVH nodes to find primitive intersections
     int toVisitOffset = 0, currentNodeIndex = 0;
+    TRAVERSAL_STAT(int nVisited = 0);
     int nodesToVisit[64];
     while (true) {
         const LinearBVHNode *node = &nodes[currentNodeIndex];
+        TRAVERSAL_STAT(++nVisited);
         // Check ray against BVH node
         if (node->bounds.IntersectP(ray, invDir, dirIsNeg)) {
             if (node->nPrimitives > 0) {
                 // Intersect ray with primitives in leaf BVH node
-                for (int i = 0; i < node->nPrimitives; ++i)
-                    if (primitives[node->primitivesOffset + i]->Intersect(
-                            ray, isect))
-                        hit = true;
+                if (intersectLeaf(ray, triRay, isect, node->primitivesOffset,
+                                  node->nPrimitives))
+                    hit = true;
                 if (toVisitOffset == 0) break;
                 currentNodeIndex = nodesToVisit[--toVisitOffset];
             } else {
@@ -696,26 +2453,32 @@ bool BVHAccel::Intersect(const Ray &ray, SurfaceInteraction *isect) const {
             currentNodeIndex = nodesToVisit[--toVisitOffset];
         }
     }
+    TRAVERSAL_STAT(nNodeVisits += nVisited);
+    TRAVERSAL_STAT(++nClosestHitRays);
     return hit;
 }
 
 bool BVHAccel::IntersectP(const Ray &ray) const {
-    if (!nodes) return false;
+    if (!nodes) return wideOccluder(ray) != nullptr;
     ProfilePhase p(Prof::AccelIntersectP);
     Vector3f invDir(1.f / ray.d.x, 1.f / ray.d.y, 1.f / ray.d.z);
     int dirIsNeg[3] = {invDir.x < 0, invDir.y < 0, invDir.z < 0};
+    TriangleRay triRay;
+    if (trianglePackets) triRay = TriangleRay(ray);
     int nodesToVisit[64];
     int toVisitOffset = 0, currentNodeIndex = 0;
+    TRAVERSAL_STAT(int nVisited = 0);
+    TRAVERSAL_STAT(++nShadowRays);
     while (true) {
         const LinearBVHNode *node = &nodes[currentNodeIndex];
+        TRAVERSAL_STAT(++nVisited);
         if (node->bounds.IntersectP(ray, invDir, dirIsNeg)) {
             // Process BVH node _node_ for traversal
             if (node->nPrimitives > 0) {
-                for (int i = 0; i < node->nPrimitives; ++i) {
-                    if (primitives[node->primitivesOffset + i]->IntersectP(
-                            ray)) {
-                        return true;
-                    }
+                if (leafOccluder(ray, triRay, node->primitivesOffset,
+                                 node->nPrimitives)) {
+                    TRAVERSAL_STAT(nShadowNodeVisits += nVisited);
+                    return true;
                 }
                 if (toVisitOffset == 0) break;
                 currentNodeIndex = nodesToVisit[--toVisitOffset];
@@ -734,9 +2497,181 @@ bool BVHAccel::IntersectP(const Ray &ray) const {
             currentNodeIndex = nodesToVisit[--toVisitOffset];
         }
     }
+    TRAVERSAL_STAT(nShadowNodeVisits += nVisited);
     return false;
 }
 
+uint64_t BVHAccel::IntersectP(const Ray *rays, int nRays,
+                              const Primitive **occluders) const {
+    CHECK_LE(nRays, MaxRayBatchSize);
+    if (!nodes) {
+        // Wide nodes already test several boxes per step, the rays are
+        // traced one after the other
+        uint64_t occluded = 0;
+        for (int i = 0; i < nRays; ++i) {
+            const Primitive *occluder = wideOccluder(rays[i]);
+            if (occluder) occluded |= uint64_t(1) << i;
+            if (occluders) occluders[i] = occluder;
+        }
+        return occluded;
+    }
+    if (nRays == 0) return 0;
+    ProfilePhase p(Prof::AccelIntersectP);
+    BVHRayBatch batch(rays, nRays, trianglePackets != nullptr);
+    uint64_t all =
+        (nRays == 64) ? ~uint64_t(0) : ((uint64_t(1) << nRays) - 1);
+    uint64_t occluded = 0;
+    if (occluders)
+        for (int i = 0; i < nRays; ++i) occluders[i] = nullptr;
+    // Each node to visit is stored with the mask of the rays that reached it
+    int nodesToVisit[64];
+    uint64_t raysToVisit[64];
+    int toVisitOffset = 0, currentNodeIndex = 0;
+    TRAVERSAL_STAT(int nVisited = 0);
+    uint64_t currentRays = all;
+    while (true) {
+        const LinearBVHNode *node = &nodes[currentNodeIndex];
+        TRAVERSAL_STAT(++nVisited);
+        // Find the rays still unoccluded that intersect the node's bounds
+        uint64_t hitRays = 0;
+        for (uint64_t m = currentRays & ~occluded; m != 0; m &= m - 1) {
+            int i = CountTrailingZeros(m);
+            if (node->bounds.IntersectP(rays[i], batch.invDir[i],
+                                        batch.dirIsNeg[i]))
+                hitRays |= uint64_t(1) << i;
+        }
+        if (hitRays != 0) {
+            if (node->nPrimitives > 0) {
+                // Test the rays that reached the leaf against its primitives
+                if (!leafPackets.empty() &&
+                    leafPackets[node->primitivesOffset] != -1) {
+                    // Triangle packets are tested one ray at a time
+                    for (uint64_t m = hitRays & ~occluded; m != 0;
+                         m &= m - 1) {
+                        int i = CountTrailingZeros(m);
+                        const Primitive *prim = leafOccluder(
+                            rays[i], batch.triRays[i], node->primitivesOffset,
+                            node->nPrimitives);
+                        if (prim) {
+                            occluded |= uint64_t(1) << i;
+                            if (occluders) occluders[i] = prim;
+                        }
+                    }
+                } else {
+                    for (int j = 0; j < node->nPrimitives; ++j) {
+                        const std::shared_ptr<Primitive> &prim =
+                            primitives[node->primitivesOffset + j];
+                        for (uint64_t m = hitRays & ~occluded; m != 0;
+                             m &= m - 1) {
+                            int i = CountTrailingZeros(m);
+                            if (prim->IntersectP(rays[i])) {
+                                occluded |= uint64_t(1) << i;
+                                if (occluders) occluders[i] = prim.get();
+                            }
+                        }
+                    }
+                }
+                if (occluded == all) break;
+                if (toVisitOffset == 0) break;
+                --toVisitOffset;
+                currentNodeIndex = nodesToVisit[toVisitOffset];
+                currentRays = raysToVisit[toVisitOffset];
+            } else {
+                // Visit first the child that is nearer for the first ray
+                // that reached the node
+                int first = CountTrailingZeros(hitRays);
+                if (batch.dirIsNeg[first][node->axis]) {
+                    nodesToVisit[toVisitOffset] = currentNodeIndex + 1;
+                    currentNodeIndex = node->secondChildOffset;
+                } else {
+                    nodesToVisit[toVisitOffset] = node->secondChildOffset;
+                    currentNodeIndex = currentNodeIndex + 1;
+                }
+                raysToVisit[toVisitOffset++] = hitRays;
+                currentRays = hitRays;
+            }
+        } else {
+            if (toVisitOffset == 0) break;
+            --toVisitOffset;
+            currentNodeIndex = nodesToVisit[toVisitOffset];
+            currentRays = raysToVisit[toVisitOffset];
+        }
+    }
+    TRAVERSAL_STAT(nShadowNodeVisits += nVisited);
+    TRAVERSAL_STAT(nShadowRays += nRays);
+    return occluded;
+}
+
+uint64_t BVHAccel::Intersect(Ray *rays, int nRays,
+                             SurfaceInteraction *isects) const {
+    CHECK_LE(nRays, MaxRayBatchSize);
+    if (!nodes) {
+        uint64_t hits = 0;
+        for (int i = 0; i < nRays; ++i)
+            if (wideIntersect(rays[i], &isects[i])) hits |= uint64_t(1) << i;
+        return hits;
+    }
+    if (nRays == 0) return 0;
+    ProfilePhase p(Prof::AccelIntersect);
+    BVHRayBatch batch(rays, nRays, trianglePackets != nullptr);
+    uint64_t hits = 0;
+    // As in the occlusion traversal, nodes are visited with the mask of the
+    // rays that reached them, nearest child first for the first of them.
+    // Rays whose closest hit so far is before a node's bounds drop out.
+    int nodesToVisit[64];
+    uint64_t raysToVisit[64];
+    int toVisitOffset = 0, currentNodeIndex = 0;
+    uint64_t currentRays =
+        (nRays == 64) ? ~uint64_t(0) : ((uint64_t(1) << nRays) - 1);
+    // Nodes are fetched once for all the rays visiting them
+    TRAVERSAL_STAT(int nVisited = 0);
+    while (true) {
+        const LinearBVHNode *node = &nodes[currentNodeIndex];
+        TRAVERSAL_STAT(++nVisited);
+        uint64_t hitRays = 0;
+        for (uint64_t m = currentRays; m != 0; m &= m - 1) {
+            int i = CountTrailingZeros(m);
+            if (node->bounds.IntersectP(rays[i], batch.invDir[i],
+                                        batch.dirIsNeg[i]))
+                hitRays |= uint64_t(1) << i;
+        }
+        if (hitRays != 0) {
+            if (node->nPrimitives > 0) {
+                for (uint64_t m = hitRays; m != 0; m &= m - 1) {
+                    int i = CountTrailingZeros(m);
+                    if (intersectLeaf(rays[i], batch.triRays[i], &isects[i],
+                                      node->primitivesOffset,
+                                      node->nPrimitives))
+                        hits |= uint64_t(1) << i;
+                }
+                if (toVisitOffset == 0) break;
+                --toVisitOffset;
+                currentNodeIndex = nodesToVisit[toVisitOffset];
+                currentRays = raysToVisit[toVisitOffset];
+            } else {
+                int first = CountTrailingZeros(hitRays);
+                if (batch.dirIsNeg[first][node->axis]) {
+                    nodesToVisit[toVisitOffset] = currentNodeIndex + 1;
+                    currentNodeIndex = node->secondChildOffset;
+                } else {
+                    nodesToVisit[toVisitOffset] = node->secondChildOffset;
+                    currentNodeIndex = currentNodeIndex + 1;
+                }
+                raysToVisit[toVisitOffset++] = hitRays;
+                currentRays = hitRays;
+            }
+        } else {
+            if (toVisitOffset == 0) break;
+            --toVisitOffset;
+            currentNodeIndex = nodesToVisit[toVisitOffset];
+            currentRays = raysToVisit[toVisitOffset];
+        }
+    }
+    TRAVERSAL_STAT(nNodeVisits += nVisited);
+    TRAVERSAL_STAT(nClosestHitRays += nRays);
+    return hits;
+}
+
 std::shared_ptr<BVHAccel> CreateBVHAccelerator(
     std::vector<std::shared_ptr<Primitive>> prims, const ParamSet &ps) {
     std::string splitMethodName = ps.FindOneString("splitmethod", "sah");
@@ -749,6 +2684,8 @@ std::shared_ptr<BVHAccel> CreateBVHAccelerator(
         splitMethod = BVHAccel::SplitMethod::Middle;
     else if (splitMethodName == "equal")
         splitMethod = BVHAccel::SplitMethod::EqualCounts;
+    else if (splitMethodName == "sbvh")
+        splitMethod = BVHAccel::SplitMethod::SBVH;
     else {
         Warning("BVH split method \"%s\" unknown.  Using \"sah\".",
                 splitMethodName.c_str());
@@ -756,7 +2693,44 @@ std::shared_ptr<BVHAccel> CreateBVHAccelerator(
     }
 
     int maxPrimsInNode = ps.FindOneInt("maxnodeprims", 4);
-    return std::make_shared<BVHAccel>(std::move(prims), maxPrimsInNode, splitMethod);
+    int nodeWidth = ps.FindOneInt("nodewidth", 2);
+    if (nodeWidth != 2 && nodeWidth != 4 && nodeWidth != 8) {
+        Warning("BVH node width %d unsupported, must be 2, 4 or 8.  Using 2.",
+                nodeWidth);
+        nodeWidth = 2;
+    }
+    Float maxDuplication = ps.FindOneFloat("maxduplication", .5f);
+    if (maxDuplication < 0) {
+        Warning("BVH \"maxduplication\" must be non-negative.  Using 0.");
+        maxDuplication = 0;
+    }
+    int quantizeBits = ps.FindOneInt("quantizebits", 0);
+    if (quantizeBits != 0 && quantizeBits != 8 && quantizeBits != 16) {
+        Warning("BVH \"quantizebits\" %d unsupported, must be 0, 8 or 16.  "
+                "Using 0.", quantizeBits);
+        quantizeBits = 0;
+    }
+    if (quantizeBits != 0 && nodeWidth == 2) {
+        Warning("BVH \"quantizebits\" only applies to \"nodewidth\" 4 and "
+                "8.  Ignoring it.");
+        quantizeBits = 0;
+    }
+    // Test the triangles of leaves four at a time with SIMD instructions
+    bool packTriangles = ps.FindOneBool("packtriangles", false);
+    // Directory where trees are cached across runs, keyed by a hash of the
+    // primitives' bounds and of the build parameters
+    std::string cacheDir = ps.FindOneFilename("cachedir", "");
+    // Passes of treelet restructuring after the build, which mostly
+    // benefits the "hlbvh" trees
+    int optimizePasses = ps.FindOneInt("optimizepasses", 0);
+    if (optimizePasses < 0) {
+        Warning("BVH \"optimizepasses\" must be non-negative.  Using 0.");
+        optimizePasses = 0;
+    }
+    return std::make_shared<BVHAccel>(std::move(prims), maxPrimsInNode,
+                                      splitMethod, nodeWidth, cacheDir,
+                                      maxDuplication, quantizeBits,
+                                      packTriangles, optimizePasses);
 }
 
 }  // namespace pbrt
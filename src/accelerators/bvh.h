@@ -48,30 +48,63 @@ struct BVHBuildNode;
 
 // BVHAccel Forward Declarations
 struct BVHPrimitiveInfo;
+struct BVHBuildTask;
 struct MortonPrimitive;
 struct LinearBVHNode;
+template <int N>
+struct WideBVHNode;
+template <int N, typename T>
+struct QuantizedBVHNode;
+struct TrianglePacket;
+struct TriangleRay;
+
+// Measures of the quality of a BVH, computed on its binary tree
+struct BVHQuality {
+    // SAH cost of the tree and sum of the surface areas of the overlaps of
+    // sibling nodes, both relative to the surface area of the root
+    Float sahCost = 0, siblingOverlap = 0;
+    // _leafSizes[n]_ is the number of leaves with _n_ primitives
+    std::vector<int> leafSizes;
+};
 
 // BVHAccel Declarations
 class BVHAccel : public Aggregate {
   public:
     // BVHAccel Public Types
-    enum class SplitMethod { SAH, HLBVH, Middle, EqualCounts };
+    enum class SplitMethod { SAH, HLBVH, Middle, EqualCounts, SBVH };
 
     // BVHAccel Public Methods
     BVHAccel(std::vector<std::shared_ptr<Primitive>> p,
              int maxPrimsInNode = 1,
-             SplitMethod splitMethod = SplitMethod::SAH);
+             SplitMethod splitMethod = SplitMethod::SAH, int nodeWidth = 2,
+             const std::string &cacheDir = "", Float maxDuplication = .5f,
+             int quantizeBits = 0, bool packTriangles = false,
+             int optimizePasses = 0);
     Bounds3f WorldBound() const;
+    // Quality of the tree; empty when it was loaded from a cache file
+    const BVHQuality &Quality() const { return quality; }
     ~BVHAccel();
     bool Intersect(const Ray &ray, SurfaceInteraction *isect) const;
     bool IntersectP(const Ray &ray) const;
+    uint64_t IntersectP(const Ray *rays, int nRays,
+                        const Primitive **occluders = nullptr) const;
+    uint64_t Intersect(Ray *rays, int nRays, SurfaceInteraction *isects) const;
 
   private:
     // BVHAccel Private Methods
     BVHBuildNode *recursiveBuild(
         MemoryArena &arena, std::vector<BVHPrimitiveInfo> &primitiveInfo,
         int start, int end, int *totalNodes,
-        std::vector<std::shared_ptr<Primitive>> &orderedPrims);
+        std::vector<std::shared_ptr<Primitive>> &orderedPrims,
+        std::vector<BVHBuildTask> *tasks = nullptr);
+    BVHBuildNode *SBVHBuild(
+        MemoryArena &arena, const std::vector<BVHPrimitiveInfo> &primitiveInfo,
+        int *totalNodes,
+        std::vector<std::shared_ptr<Primitive>> &orderedPrims) const;
+    BVHBuildNode *recursiveSBVHBuild(
+        MemoryArena &arena, std::vector<BVHPrimitiveInfo> &references,
+        Float rootSurfaceArea, int *duplicatesLeft, int *totalNodes,
+        std::vector<std::shared_ptr<Primitive>> &orderedPrims) const;
     BVHBuildNode *HLBVHBuild(
         MemoryArena &arena, const std::vector<BVHPrimitiveInfo> &primitiveInfo,
         int *totalNodes,
@@ -86,12 +119,63 @@ class BVHAccel : public Aggregate {
                                 std::vector<BVHBuildNode *> &treeletRoots,
                                 int start, int end, int *totalNodes) const;
     int flattenBVHTree(BVHBuildNode *node, int *offset);
+    uint64_t cacheKey(
+        const std::vector<BVHPrimitiveInfo> &primitiveInfo) const;
+    bool loadCache(const std::string &filename, uint64_t key);
+    bool validCacheNodes(const char *data, uint64_t nodeBytes,
+                         int nPrimitives) const;
+    void writeCache(const std::string &filename, uint64_t key,
+                    const std::vector<std::shared_ptr<Primitive>> &inputPrims,
+                    size_t nodeBytes) const;
+    template <int N>
+    WideBVHNode<N> *collapseBVHTree(BVHBuildNode *root, int *totalWideNodes);
+    template <typename Node>
+    bool wideIntersect(const Node *wideNodes, const Ray &ray,
+                       SurfaceInteraction *isect) const;
+    template <typename Node>
+    const Primitive *wideOccluder(const Node *wideNodes, const Ray &ray) const;
+    bool wideIntersect(const Ray &ray, SurfaceInteraction *isect) const;
+    const Primitive *wideOccluder(const Ray &ray) const;
+    void packTriangleLeaves();
+    bool intersectLeaf(const Ray &ray, const TriangleRay &triRay,
+                       SurfaceInteraction *isect, int offset,
+                       int nPrimitives) const;
+    const Primitive *leafOccluder(const Ray &ray, const TriangleRay &triRay,
+                                  int offset, int nPrimitives) const;
+    const void *nodeData() const;
+    void setNodeData(void *data);
 
     // BVHAccel Private Data
     const int maxPrimsInNode;
     const SplitMethod splitMethod;
+    const int nodeWidth;
+    // SBVH: maximum number of extra primitive references, as a fraction of
+    // the number of primitives
+    const Float maxDuplication;
+    // Bits of the quantized child bounds of wide nodes, or 0 for floats
+    const int quantizeBits;
+    // Passes of treelet restructuring run on the built tree
+    const int optimizePasses;
     std::vector<std::shared_ptr<Primitive>> primitives;
+    BVHQuality quality;
+    Bounds3f bounds;
+    // Only one of the layouts is built: binary nodes or the nodes of the
+    // tree collapsed to _nodeWidth_ children, possibly with quantized bounds
     LinearBVHNode *nodes = nullptr;
+    WideBVHNode<4> *nodes4 = nullptr;
+    WideBVHNode<8> *nodes8 = nullptr;
+    QuantizedBVHNode<4, uint8_t> *nodes4q8 = nullptr;
+    QuantizedBVHNode<4, uint16_t> *nodes4q16 = nullptr;
+    QuantizedBVHNode<8, uint8_t> *nodes8q8 = nullptr;
+    QuantizedBVHNode<8, uint16_t> *nodes8q16 = nullptr;
+    // Vertices of the triangles of the leaves made only of triangles, by
+    // groups of four: _leafPackets[o]_ is the index of the first packet of
+    // the leaf whose primitives start at offset _o_, or -1
+    std::vector<int32_t> leafPackets;
+    TrianglePacket *trianglePackets = nullptr;
+    // Cache file mapped in memory when the nodes were loaded from one
+    char *cacheData = nullptr;
+    size_t cacheSize = 0;
 };
 
 std::shared_ptr<BVHAccel> CreateBVHAccelerator(
@@ -0,0 +1,183 @@
+
+/*
+    pbrt source code is Copyright(c) 1998-2016
+                        Matt Pharr, Greg Humphreys, and Wenzel Jakob.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+// accelerators/flatbvh.cpp*
+#include "accelerators/flatbvh.h"
+#include <algorithm>
+
+namespace pbrt {
+
+// FlatBVH Local Declarations
+struct FlatBVHBuild {
+    const std::vector<Bounds3f> &itemBounds;
+    const int nSegments, maxItemsInLeaf;
+    std::vector<Point3f> centroids;
+    std::vector<int> &items;
+    std::vector<FlatBVHNode> &nodes;
+    std::vector<Bounds3f> &nodeBounds;
+    // Bounds of the SAH buckets over each segment
+    std::vector<Bounds3f> bucketBounds;
+};
+
+static PBRT_CONSTEXPR int nBuckets = 12;
+
+// FlatBVH Function Definitions
+static void RecursiveFlatBVHBuild(FlatBVHBuild &build, int start, int end) {
+    const int nSegments = build.nSegments;
+    int nodeIndex = build.nodes.size();
+    build.nodes.push_back(FlatBVHNode());
+    build.nodeBounds.resize(build.nodeBounds.size() + nSegments);
+    Bounds3f *bounds = &build.nodeBounds[nodeIndex * nSegments];
+    Bounds3f centroidBounds;
+    for (int i = start; i < end; ++i) {
+        const Bounds3f *itemBounds =
+            &build.itemBounds[build.items[i] * nSegments];
+        for (int s = 0; s < nSegments; ++s)
+            bounds[s] = Union(bounds[s], itemBounds[s]);
+        centroidBounds = Union(centroidBounds, build.centroids[build.items[i]]);
+    }
+    int nItems = end - start;
+    auto makeLeaf = [&]() {
+        build.nodes[nodeIndex].itemOffset = start;
+        build.nodes[nodeIndex].nItems = nItems;
+    };
+    if (nItems == 1) {
+        makeLeaf();
+        return;
+    }
+
+    // Partition the items with the SAH along the centroids' largest
+    // extent, or in two halves when it doesn't separate them
+    int dim = centroidBounds.MaximumExtent();
+    int mid = (start + end) / 2;
+    if (centroidBounds.pMax[dim] > centroidBounds.pMin[dim]) {
+        int counts[nBuckets] = {0};
+        std::vector<Bounds3f> &buckets = build.bucketBounds;
+        buckets.assign(nBuckets * nSegments, Bounds3f());
+        auto bucketIndex = [&](int item) {
+            int b = nBuckets *
+                    centroidBounds.Offset(build.centroids[item])[dim];
+            return std::min(b, nBuckets - 1);
+        };
+        for (int i = start; i < end; ++i) {
+            int b = bucketIndex(build.items[i]);
+            counts[b]++;
+            const Bounds3f *itemBounds =
+                &build.itemBounds[build.items[i] * nSegments];
+            for (int s = 0; s < nSegments; ++s)
+                buckets[b * nSegments + s] =
+                    Union(buckets[b * nSegments + s], itemBounds[s]);
+        }
+        Float minCost = Infinity;
+        int minCostSplitBucket = 0;
+        for (int i = 0; i < nBuckets - 1; ++i) {
+            int count0 = 0, count1 = 0;
+            for (int j = 0; j <= i; ++j) count0 += counts[j];
+            for (int j = i + 1; j < nBuckets; ++j) count1 += counts[j];
+            Float cost = 0;
+            for (int s = 0; s < nSegments; ++s) {
+                Bounds3f b0, b1;
+                for (int j = 0; j <= i; ++j)
+                    b0 = Union(b0, buckets[j * nSegments + s]);
+                for (int j = i + 1; j < nBuckets; ++j)
+                    b1 = Union(b1, buckets[j * nSegments + s]);
+                cost += (count0 ? count0 * b0.SurfaceArea() : 0) +
+                        (count1 ? count1 * b1.SurfaceArea() : 0);
+            }
+            if (cost < minCost) {
+                minCost = cost;
+                minCostSplitBucket = i;
+            }
+        }
+        // Small sets of items stay together when testing them all is
+        // cheaper than splitting them
+        if (nItems <= build.maxItemsInLeaf) {
+            Float area = 0;
+            for (int s = 0; s < nSegments; ++s) area += bounds[s].SurfaceArea();
+            if (1 + minCost / area >= nItems) {
+                makeLeaf();
+                return;
+            }
+        }
+        int *pmid = std::partition(
+            &build.items[start], &build.items[end - 1] + 1,
+            [&](int item) { return bucketIndex(item) <= minCostSplitBucket; });
+        mid = pmid - &build.items[0];
+    } else if (nItems <= build.maxItemsInLeaf) {
+        makeLeaf();
+        return;
+    }
+    if (mid == start || mid == end) {
+        mid = (start + end) / 2;
+        std::nth_element(&build.items[start], &build.items[mid],
+                         &build.items[end - 1] + 1, [&](int a, int b) {
+                             return build.centroids[a][dim] <
+                                    build.centroids[b][dim];
+                         });
+    }
+    RecursiveFlatBVHBuild(build, start, mid);
+    int secondChild = build.nodes.size();
+    RecursiveFlatBVHBuild(build, mid, end);
+    build.nodes[nodeIndex].secondChildOffset = secondChild;
+    build.nodes[nodeIndex].nItems = 0;
+    build.nodes[nodeIndex].axis = dim;
+}
+
+std::vector<int> BuildFlatBVH(const std::vector<Bounds3f> &itemBounds,
+                              int nItems, int nSegments, int maxItemsInLeaf,
+                              std::vector<FlatBVHNode> *nodes,
+                              std::vector<Bounds3f> *nodeBounds) {
+    CHECK_EQ(itemBounds.size(), (size_t)nItems * nSegments);
+    CHECK_LE(maxItemsInLeaf, 65535);
+    CHECK(nodes->empty() && nodeBounds->empty());
+    std::vector<int> items(nItems);
+    FlatBVHBuild build{itemBounds, nSegments, maxItemsInLeaf,
+                       std::vector<Point3f>(nItems), items, *nodes,
+                       *nodeBounds};
+    // An item's centroid is the average of its segments' centroids
+    for (int i = 0; i < nItems; ++i) {
+        for (int s = 0; s < nSegments; ++s) {
+            const Bounds3f &b = itemBounds[i * nSegments + s];
+            build.centroids[i] += .5f * b.pMin + .5f * b.pMax;
+        }
+        build.centroids[i] /= nSegments;
+        items[i] = i;
+    }
+    nodes->reserve(2 * nItems / maxItemsInLeaf + 1);
+    nodeBounds->reserve((2 * nItems / maxItemsInLeaf + 1) * nSegments);
+    if (nItems > 0) RecursiveFlatBVHBuild(build, 0, nItems);
+    nodes->shrink_to_fit();
+    nodeBounds->shrink_to_fit();
+    return items;
+}
+
+}  // namespace pbrt
@@ -0,0 +1,113 @@
+
+/*
+    pbrt source code is Copyright(c) 1998-2016
+                        Matt Pharr, Greg Humphreys, and Wenzel Jakob.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+#if defined(_MSC_VER)
+#define NOMINMAX
+#pragma once
+#endif
+
+#ifndef PBRT_ACCELERATORS_FLATBVH_H
+#define PBRT_ACCELERATORS_FLATBVH_H
+
+// accelerators/flatbvh.h*
+#include "pbrt.h"
+#include "geometry.h"
+
+namespace pbrt {
+
+// FlatBVH Declarations
+
+// Node of the small BVHs that instance and motion BVHs and compact triangle
+// meshes build over their items. Nodes are stored depth-first, so that the
+// first child of an interior node follows it; their bounds are stored
+// apart, one per time segment for moving items.
+struct FlatBVHNode {
+    union {
+        int itemOffset;         // leaf
+        int secondChildOffset;  // interior
+    };
+    uint16_t nItems;  // 0 -> interior node
+    uint8_t axis;     // interior node: xyz
+    uint8_t pad[1];   // ensure 8 byte total size
+};
+
+// Builds a BVH over _nItems_ items whose bounds over each of _nSegments_
+// time segments are _itemBounds[item * nSegments + segment]_, storing
+// its nodes in the empty _nodes_ and their bounds, in the same layout, in
+// _nodeBounds_. Items are partitioned with the SAH, summing the surface
+// areas of the segments' bounds; leaves hold up to _maxItemsInLeaf_ items
+// when testing them all is cheaper than splitting them. Returns the items
+// in the order of the leaves.
+std::vector<int> BuildFlatBVH(const std::vector<Bounds3f> &itemBounds,
+                              int nItems, int nSegments, int maxItemsInLeaf,
+                              std::vector<FlatBVHNode> *nodes,
+                              std::vector<Bounds3f> *nodeBounds);
+
+// Calls _intersectLeaf(node)_ for each leaf whose bounds _ray_ intersects,
+// nearer children first, until it returns _true_; a node's bounds are
+// _nodeBounds[node * boundsStride]_. Closer hits may shorten _ray_ on the
+// way. Returns whether _intersectLeaf_ returned _true_.
+template <typename Func>
+bool TraverseFlatBVH(const FlatBVHNode *nodes, const Bounds3f *nodeBounds,
+                     int boundsStride, const Ray &ray, Func intersectLeaf) {
+    Vector3f invDir(1 / ray.d.x, 1 / ray.d.y, 1 / ray.d.z);
+    int dirIsNeg[3] = {invDir.x < 0, invDir.y < 0, invDir.z < 0};
+    int toVisitOffset = 0, currentNodeIndex = 0;
+    int nodesToVisit[64];
+    while (true) {
+        const FlatBVHNode *node = &nodes[currentNodeIndex];
+        if (nodeBounds[currentNodeIndex * boundsStride].IntersectP(
+                ray, invDir, dirIsNeg)) {
+            if (node->nItems > 0) {
+                if (intersectLeaf(*node)) return true;
+                if (toVisitOffset == 0) break;
+                currentNodeIndex = nodesToVisit[--toVisitOffset];
+            } else {
+                if (dirIsNeg[node->axis]) {
+                    nodesToVisit[toVisitOffset++] = currentNodeIndex + 1;
+                    currentNodeIndex = node->secondChildOffset;
+                } else {
+                    nodesToVisit[toVisitOffset++] = node->secondChildOffset;
+                    currentNodeIndex = currentNodeIndex + 1;
+                }
+            }
+        } else {
+            if (toVisitOffset == 0) break;
+            currentNodeIndex = nodesToVisit[--toVisitOffset];
+        }
+    }
+    return false;
+}
+
+}  // namespace pbrt
+
+#endif  // PBRT_ACCELERATORS_FLATBVH_H
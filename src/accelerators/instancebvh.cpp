@@ -0,0 +1,114 @@
+
+/*
+    pbrt source code is Copyright(c) 1998-2016
+                        Matt Pharr, Greg Humphreys, and Wenzel Jakob.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+// accelerators/instancebvh.cpp*
+#include "accelerators/instancebvh.h"
+#include "interaction.h"
+#include "stats.h"
+
+namespace pbrt {
+
+STAT_MEMORY_COUNTER("Memory/Instance BVH", instanceBVHBytes);
+STAT_COUNTER("Scene/Instances in instance BVH", nBVHInstances);
+
+// InstanceBVH Local Declarations
+// Intersects _r_ with the instance's object in its own space, as
+// _TransformedPrimitive::Intersect()_ does for a static transformation
+static bool IntersectInstance(const InstanceRecord &instance, const Ray &r,
+                              SurfaceInteraction *isect) {
+    Ray ray = Inverse(*instance.instanceToWorld)(r);
+    if (!instance.object->Intersect(ray, isect)) return false;
+    r.tMax = ray.tMax;
+    // Transform instance's intersection data to world space
+    if (!instance.instanceToWorld->IsIdentity())
+        *isect = (*instance.instanceToWorld)(*isect);
+    CHECK_GE(Dot(isect->n, isect->shading.n), 0);
+    return true;
+}
+
+// InstanceBVH Method Definitions
+InstanceBVH::InstanceBVH(std::vector<InstanceRecord> in,
+                         std::vector<std::shared_ptr<Primitive>> objects)
+    : objects(std::move(objects)) {
+    ProfilePhase _(Prof::AccelConstruction);
+    if (in.empty()) return;
+    nBVHInstances += in.size();
+    // Each instance gets its own leaf: testing one is a traversal of its
+    // object, far more expensive than testing a node
+    std::vector<Bounds3f> instanceBounds(in.size());
+    for (size_t i = 0; i < in.size(); ++i)
+        instanceBounds[i] =
+            (*in[i].instanceToWorld)(in[i].object->WorldBound());
+    std::vector<int> order =
+        BuildFlatBVH(instanceBounds, in.size(), 1, 1, &nodes, &nodeBounds);
+
+    // Store the instances in the order of the leaves
+    instances.resize(in.size());
+    for (size_t i = 0; i < in.size(); ++i) instances[i] = in[order[i]];
+    bounds = nodeBounds[0];
+    instanceBVHBytes += sizeof(*this) +
+                        instances.size() * sizeof(InstanceRecord) +
+                        nodes.size() * sizeof(FlatBVHNode) +
+                        nodeBounds.size() * sizeof(Bounds3f);
+}
+
+bool InstanceBVH::Intersect(const Ray &ray, SurfaceInteraction *isect) const {
+    if (nodes.empty()) return false;
+    ProfilePhase p(Prof::AccelIntersect);
+    bool hit = false;
+    TraverseFlatBVH(nodes.data(), nodeBounds.data(), 1, ray,
+                    [&](const FlatBVHNode &node) {
+                        for (int i = 0; i < node.nItems; ++i)
+                            if (IntersectInstance(
+                                    instances[node.itemOffset + i], ray, isect))
+                                hit = true;
+                        return false;
+                    });
+    return hit;
+}
+
+bool InstanceBVH::IntersectP(const Ray &ray) const {
+    if (nodes.empty()) return false;
+    ProfilePhase p(Prof::AccelIntersectP);
+    return TraverseFlatBVH(
+        nodes.data(), nodeBounds.data(), 1, ray, [&](const FlatBVHNode &node) {
+            for (int i = 0; i < node.nItems; ++i) {
+                const InstanceRecord &instance = instances[node.itemOffset + i];
+                if (instance.object->IntersectP(
+                        Inverse(*instance.instanceToWorld)(ray)))
+                    return true;
+            }
+            return false;
+        });
+}
+
+}  // namespace pbrt
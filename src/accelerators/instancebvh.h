@@ -0,0 +1,79 @@
+
+/*
+    pbrt source code is Copyright(c) 1998-2016
+                        Matt Pharr, Greg Humphreys, and Wenzel Jakob.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+#if defined(_MSC_VER)
+#define NOMINMAX
+#pragma once
+#endif
+
+#ifndef PBRT_ACCELERATORS_INSTANCEBVH_H
+#define PBRT_ACCELERATORS_INSTANCEBVH_H
+
+// accelerators/instancebvh.h*
+#include "pbrt.h"
+#include "primitive.h"
+#include "transform.h"
+#include "accelerators/flatbvh.h"
+
+namespace pbrt {
+
+// Instance of an object placed in the scene by a static transformation. The
+// object is the aggregate shared by all the instances of its definition and
+// the transformation is owned by the scene description's transform cache.
+struct InstanceRecord {
+    const Primitive *object;
+    const Transform *instanceToWorld;
+};
+
+// InstanceBVH Declarations
+class InstanceBVH : public Aggregate {
+  public:
+    // InstanceBVH Public Methods
+    InstanceBVH(std::vector<InstanceRecord> instances,
+                std::vector<std::shared_ptr<Primitive>> objects);
+    Bounds3f WorldBound() const { return bounds; }
+    bool Intersect(const Ray &ray, SurfaceInteraction *isect) const;
+    bool IntersectP(const Ray &ray) const;
+
+  private:
+    // InstanceBVH Private Data
+    std::vector<InstanceRecord> instances;
+    // Owners of the instances' objects
+    std::vector<std::shared_ptr<Primitive>> objects;
+    Bounds3f bounds;
+    std::vector<FlatBVHNode> nodes;
+    std::vector<Bounds3f> nodeBounds;
+};
+
+}  // namespace pbrt
+
+#endif  // PBRT_ACCELERATORS_INSTANCEBVH_H
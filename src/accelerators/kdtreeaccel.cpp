@@ -30,25 +30,44 @@
 
  */
 
-
 // accelerators/kdtreeaccel.cpp*
 #include "accelerators/kdtreeaccel.h"
 #include "paramset.h"
 #include "interaction.h"
 #include "stats.h"
+#include "parallel.h"
 #include <algorithm>
+#include <cstdio>
+#include <cstring>
 
 namespace pbrt {
 
+STAT_COUNTER("Kd-tree/Trees loaded from cache", nCachedTrees);
+#ifdef PBRT_TRAVERSAL_STATS
+STAT_RATIO("Kd-tree/Node visits per closest-hit ray", nNodeVisits,
+           nClosestHitRays);
+STAT_RATIO("Kd-tree/Node visits per shadow ray", nShadowNodeVisits,
+           nShadowRays);
+#endif  // PBRT_TRAVERSAL_STATS
+
 // KdTreeAccel Local Declarations
 struct KdAccelNode {
     // KdAccelNode Methods
-    void InitLeaf(int *primNums, int np, std::vector<int> *primitiveIndices);
+    void InitLeaf(const int *primNums, int np,
+                  std::vector<int> *primitiveIndices);
     void InitInterior(int axis, int ac, Float s) {
         split = s;
         flags = axis;
         aboveChild |= (ac << 2);
     }
+    // Moves a node built in a separate array to _nodeOffset_ in the tree,
+    // with its primitive indices at _indicesOffset_
+    void Relocate(int nodeOffset, int indicesOffset) {
+        if (!IsLeaf())
+            aboveChild += nodeOffset << 2;
+        else if (nPrimitives() > 1)
+            primitiveIndicesOffset += indicesOffset;
+    }
     Float SplitPos() const { return split; }
     int nPrimitives() const { return nPrims >> 2; }
     int SplitAxis() const { return flags & 3; }
@@ -75,15 +94,55 @@ struct BoundEdge {
     BoundEdge(Float t, int primNum, bool starting) : t(t), primNum(primNum) {
         type = starting ? EdgeType::Start : EdgeType::End;
     }
+    bool operator<(const BoundEdge &e) const {
+        if (t != e.t) return t < e.t;
+        if (type != e.type) return (int)type < (int)e.type;
+        return primNum < e.primNum;
+    }
     Float t;
     int primNum;
     EdgeType type;
 };
 
+// Primitives overlapping a node under construction and their bounding
+// edges along each axis, in sorted order. Edges are only sorted at the
+// root: children filter their parent's, which keeps them sorted.
+struct KdBuildInput {
+    std::vector<int> primNums;
+    std::vector<BoundEdge> edges[3];
+};
+
+// Subtree left by the top of the build to a worker thread, which builds it
+// into its own node and primitive index arrays; _nodeNum_ is the leaf
+// standing for it at the top.
+struct KdBuildTask {
+    int nodeNum;
+    Bounds3f bounds;
+    KdBuildInput input;
+    int depth, badRefines;
+    std::vector<KdAccelNode> nodes;
+    std::vector<int> primitiveIndices;
+};
+
+static PBRT_CONSTEXPR int maxKdBuildTaskPrimitives = 4 * 1024;
+
+// Kd-tree cache files hold a _KdCacheHeader_, the tree's nodes and its
+// primitive indices.
+struct KdCacheHeader {
+    char magic[8];
+    uint64_t key;
+    int32_t nPrimitives, nNodes, nPrimitiveIndices;
+    Bounds3f bounds;
+};
+
+static const char kdCacheMagic[8] = "pbrtkdt";
+static PBRT_CONSTEXPR int kdCacheVersion = 1;
+
 // KdTreeAccel Method Definitions
 KdTreeAccel::KdTreeAccel(std::vector<std::shared_ptr<Primitive>> p,
                          int isectCost, int traversalCost, Float emptyBonus,
-                         int maxPrims, int maxDepth)
+                         int maxPrims, int maxDepth,
+                         const std::string &cacheDir)
     : isectCost(isectCost),
       traversalCost(traversalCost),
       maxPrims(maxPrims),
@@ -91,7 +150,6 @@ KdTreeAccel::KdTreeAccel(std::vector<std::shared_ptr<Primitive>> p,
       primitives(std::move(p)) {
     // Build kd-tree for accelerator
     ProfilePhase _(Prof::AccelConstruction);
-    nextFreeNode = nAllocedNodes = 0;
     if (maxDepth <= 0)
         maxDepth = std::round(8 + 1.3f * Log2Int(int64_t(primitives.size())));
 
@@ -104,23 +162,101 @@ KdTreeAccel::KdTreeAccel(std::vector<std::shared_ptr<Primitive>> p,
         primBounds.push_back(b);
     }
 
-    // Allocate working memory for kd-tree construction
-    std::unique_ptr<BoundEdge[]> edges[3];
-    for (int i = 0; i < 3; ++i)
-        edges[i].reset(new BoundEdge[2 * primitives.size()]);
-    std::unique_ptr<int[]> prims0(new int[primitives.size()]);
-    std::unique_ptr<int[]> prims1(new int[(maxDepth + 1) * primitives.size()]);
-
-    // Initialize _primNums_ for kd-tree construction
-    std::unique_ptr<int[]> primNums(new int[primitives.size()]);
-    for (size_t i = 0; i < primitives.size(); ++i) primNums[i] = i;
+    // Use the tree stored in the cache file for these primitives, if any
+    std::string cacheFilename;
+    uint64_t key = 0;
+    if (!cacheDir.empty()) {
+        key = cacheKey(primBounds, maxDepth);
+        cacheFilename = cacheDir + StringPrintf("/kdtree-%016llx.cache",
+                                                (unsigned long long)key);
+        if (loadCache(cacheFilename, key)) return;
+    }
 
-    // Start recursive construction of kd-tree
-    buildTree(0, bounds, primBounds, primNums.get(), primitives.size(),
-              maxDepth, edges, prims0.get(), prims1.get());
+    // Initialize sorted edges of all primitives for the root
+    KdBuildInput input;
+    int nPrimitives = primitives.size();
+    input.primNums.resize(nPrimitives);
+    for (int i = 0; i < nPrimitives; ++i) input.primNums[i] = i;
+    bool parallelBuild =
+        MaxThreadIndex() > 1 && nPrimitives > maxKdBuildTaskPrimitives;
+    auto sortEdges = [&](int axis) {
+        std::vector<BoundEdge> &edges = input.edges[axis];
+        edges.resize(2 * nPrimitives);
+        for (int i = 0; i < nPrimitives; ++i) {
+            edges[2 * i] = BoundEdge(primBounds[i].pMin[axis], i, true);
+            edges[2 * i + 1] = BoundEdge(primBounds[i].pMax[axis], i, false);
+        }
+        std::sort(edges.begin(), edges.end());
+    };
+    if (parallelBuild)
+        ParallelFor(sortEdges, 3, 1);
+    else
+        for (int axis = 0; axis < 3; ++axis) sortEdges(axis);
+
+    // Build the top of the tree, then its subtrees in parallel. Splits only
+    // depend on the node's primitives, so the tree is the same as the serial
+    // one.
+    std::vector<KdAccelNode> topNodes;
+    std::vector<KdBuildTask> tasks;
+    // Per-thread flags of the children each primitive goes to, only set
+    // while a node's edges are partitioned
+    std::vector<std::vector<uint8_t>> threadSides(
+        parallelBuild ? MaxThreadIndex() : 1);
+    threadSides[0].resize(nPrimitives);
+    buildTree(bounds, primBounds, std::move(input), maxDepth, 0,
+              threadSides[0].data(), &topNodes, &primitiveIndices,
+              parallelBuild ? &tasks : nullptr);
+    std::vector<int> taskOrder(tasks.size());
+    for (size_t i = 0; i < tasks.size(); ++i) taskOrder[i] = i;
+    std::sort(taskOrder.begin(), taskOrder.end(), [&](int a, int b) {
+        return tasks[a].input.primNums.size() > tasks[b].input.primNums.size();
+    });
+    ParallelFor([&](int i) {
+        KdBuildTask &task = tasks[taskOrder[i]];
+        std::vector<uint8_t> &sides = threadSides[ThreadIndex];
+        sides.resize(nPrimitives);
+        buildTree(task.bounds, primBounds, std::move(task.input), task.depth,
+                  task.badRefines, sides.data(), &task.nodes,
+                  &task.primitiveIndices);
+    }, tasks.size(), 1);
+
+    // Splice the subtrees into the top of the tree in depth-first order: a
+    // task's nodes replace its leaf and shift the nodes that follow it
+    std::vector<int> nodeOffset(topNodes.size() + 1);
+    nNodes = 0;
+    for (size_t i = 0, t = 0; i < topNodes.size(); ++i) {
+        nodeOffset[i] = nNodes;
+        if (t < tasks.size() && tasks[t].nodeNum == (int)i)
+            nNodes += tasks[t++].nodes.size();
+        else
+            ++nNodes;
+    }
+    nodeOffset[topNodes.size()] = nNodes;
+    nodes = AllocAligned<KdAccelNode>(nNodes);
+    for (size_t i = 0, t = 0; i < topNodes.size(); ++i) {
+        KdAccelNode *node = &nodes[nodeOffset[i]];
+        if (t < tasks.size() && tasks[t].nodeNum == (int)i) {
+            KdBuildTask &task = tasks[t++];
+            int indicesOffset = primitiveIndices.size();
+            for (size_t j = 0; j < task.nodes.size(); ++j) {
+                node[j] = task.nodes[j];
+                node[j].Relocate(nodeOffset[i], indicesOffset);
+            }
+            primitiveIndices.insert(primitiveIndices.end(),
+                                    task.primitiveIndices.begin(),
+                                    task.primitiveIndices.end());
+        } else {
+            *node = topNodes[i];
+            if (!node->IsLeaf())
+                node->InitInterior(node->SplitAxis(),
+                                   nodeOffset[node->AboveChild()],
+                                   node->SplitPos());
+        }
+    }
+    if (!cacheFilename.empty()) writeCache(cacheFilename, key);
 }
 
-void KdAccelNode::InitLeaf(int *primNums, int np,
+void KdAccelNode::InitLeaf(const int *primNums, int np,
                            std::vector<int> *primitiveIndices) {
     flags = 3;
     nPrims |= (np << 2);
@@ -137,28 +273,29 @@ void KdAccelNode::InitLeaf(int *primNums, int np,
 
 KdTreeAccel::~KdTreeAccel() { FreeAligned(nodes); }
 
-void KdTreeAccel::buildTree(int nodeNum, const Bounds3f &nodeBounds,
+void KdTreeAccel::buildTree(const Bounds3f &nodeBounds,
                             const std::vector<Bounds3f> &allPrimBounds,
-                            int *primNums, int nPrimitives, int depth,
-                            const std::unique_ptr<BoundEdge[]> edges[3],
-                            int *prims0, int *prims1, int badRefines) {
-    CHECK_EQ(nodeNum, nextFreeNode);
-    // Get next free node from _nodes_ array
-    if (nextFreeNode == nAllocedNodes) {
-        int nNewAllocNodes = std::max(2 * nAllocedNodes, 512);
-        KdAccelNode *n = AllocAligned<KdAccelNode>(nNewAllocNodes);
-        if (nAllocedNodes > 0) {
-            memcpy(n, nodes, nAllocedNodes * sizeof(KdAccelNode));
-            FreeAligned(nodes);
-        }
-        nodes = n;
-        nAllocedNodes = nNewAllocNodes;
-    }
-    ++nextFreeNode;
+                            KdBuildInput input, int depth, int badRefines,
+                            uint8_t *sides, std::vector<KdAccelNode> *nodes,
+                            std::vector<int> *primitiveIndices,
+                            std::vector<KdBuildTask> *tasks) const {
+    int nodeNum = nodes->size();
+    nodes->push_back(KdAccelNode());
+    const std::vector<int> &primNums = input.primNums;
+    int nPrimitives = primNums.size();
 
     // Initialize leaf node if termination criteria met
     if (nPrimitives <= maxPrims || depth == 0) {
-        nodes[nodeNum].InitLeaf(primNums, nPrimitives, &primitiveIndices);
+        (*nodes)[nodeNum].InitLeaf(primNums.data(), nPrimitives,
+                                   primitiveIndices);
+        return;
+    }
+
+    // Leave small enough subtrees to the worker threads
+    if (tasks && nPrimitives <= maxKdBuildTaskPrimitives) {
+        (*nodes)[nodeNum].InitLeaf(nullptr, 0, primitiveIndices);
+        tasks->push_back(
+            {nodeNum, nodeBounds, std::move(input), depth, badRefines});
         return;
     }
 
@@ -177,28 +314,12 @@ void KdTreeAccel::buildTree(int nodeNum, const Bounds3f &nodeBounds,
     int retries = 0;
 retrySplit:
 
-    // Initialize edges for _axis_
-    for (int i = 0; i < nPrimitives; ++i) {
-        int pn = primNums[i];
-        const Bounds3f &bounds = allPrimBounds[pn];
-        edges[axis][2 * i] = BoundEdge(bounds.pMin[axis], pn, true);
-        edges[axis][2 * i + 1] = BoundEdge(bounds.pMax[axis], pn, false);
-    }
-
-    // Sort _edges_ for _axis_
-    std::sort(&edges[axis][0], &edges[axis][2 * nPrimitives],
-              [](const BoundEdge &e0, const BoundEdge &e1) -> bool {
-                  if (e0.t == e1.t)
-                      return (int)e0.type < (int)e1.type;
-                  else
-                      return e0.t < e1.t;
-              });
-
     // Compute cost of all splits for _axis_ to find best
+    const std::vector<BoundEdge> &edges = input.edges[axis];
     int nBelow = 0, nAbove = nPrimitives;
     for (int i = 0; i < 2 * nPrimitives; ++i) {
-        if (edges[axis][i].type == EdgeType::End) --nAbove;
-        Float edgeT = edges[axis][i].t;
+        if (edges[i].type == EdgeType::End) --nAbove;
+        Float edgeT = edges[i].t;
         if (edgeT > nodeBounds.pMin[axis] && edgeT < nodeBounds.pMax[axis]) {
             // Compute cost for split at _i_th edge
 
@@ -224,7 +345,7 @@ retrySplit:
                 bestOffset = i;
             }
         }
-        if (edges[axis][i].type == EdgeType::Start) ++nBelow;
+        if (edges[i].type == EdgeType::Start) ++nBelow;
     }
     CHECK(nBelow == nPrimitives && nAbove == 0);
 
@@ -237,33 +358,157 @@ retrySplit:
     if (bestCost > oldCost) ++badRefines;
     if ((bestCost > 4 * oldCost && nPrimitives < 16) || bestAxis == -1 ||
         badRefines == 3) {
-        nodes[nodeNum].InitLeaf(primNums, nPrimitives, &primitiveIndices);
+        (*nodes)[nodeNum].InitLeaf(primNums.data(), nPrimitives,
+                                   primitiveIndices);
         return;
     }
 
     // Classify primitives with respect to split
-    int n0 = 0, n1 = 0;
+    const std::vector<BoundEdge> &bestEdges = input.edges[bestAxis];
+    KdBuildInput below, above;
     for (int i = 0; i < bestOffset; ++i)
-        if (edges[bestAxis][i].type == EdgeType::Start)
-            prims0[n0++] = edges[bestAxis][i].primNum;
+        if (bestEdges[i].type == EdgeType::Start) {
+            below.primNums.push_back(bestEdges[i].primNum);
+            sides[bestEdges[i].primNum] |= 1;
+        }
     for (int i = bestOffset + 1; i < 2 * nPrimitives; ++i)
-        if (edges[bestAxis][i].type == EdgeType::End)
-            prims1[n1++] = edges[bestAxis][i].primNum;
+        if (bestEdges[i].type == EdgeType::End) {
+            above.primNums.push_back(bestEdges[i].primNum);
+            sides[bestEdges[i].primNum] |= 2;
+        }
+
+    // Partition the sorted edges of each axis between the children in linear
+    // time; each edge is written to both children, with one extra slot for
+    // the last one, and kept by those it belongs to
+    for (int a = 0; a < 3; ++a) {
+        below.edges[a].resize(2 * below.primNums.size() + 1);
+        above.edges[a].resize(2 * above.primNums.size() + 1);
+        BoundEdge *belowEdges = below.edges[a].data();
+        BoundEdge *aboveEdges = above.edges[a].data();
+        for (const BoundEdge &edge : input.edges[a]) {
+            uint8_t side = sides[edge.primNum];
+            *belowEdges = edge;
+            belowEdges += side & 1;
+            *aboveEdges = edge;
+            aboveEdges += side >> 1;
+        }
+        below.edges[a].pop_back();
+        above.edges[a].pop_back();
+    }
+    for (int pn : primNums) sides[pn] = 0;
 
     // Recursively initialize children nodes
-    Float tSplit = edges[bestAxis][bestOffset].t;
+    Float tSplit = bestEdges[bestOffset].t;
     Bounds3f bounds0 = nodeBounds, bounds1 = nodeBounds;
     bounds0.pMax[bestAxis] = bounds1.pMin[bestAxis] = tSplit;
-    buildTree(nodeNum + 1, bounds0, allPrimBounds, prims0, n0, depth - 1, edges,
-              prims0, prims1 + nPrimitives, badRefines);
-    int aboveChild = nextFreeNode;
-    nodes[nodeNum].InitInterior(bestAxis, aboveChild, tSplit);
-    buildTree(aboveChild, bounds1, allPrimBounds, prims1, n1, depth - 1, edges,
-              prims0, prims1 + nPrimitives, badRefines);
+    input = KdBuildInput();
+    buildTree(bounds0, allPrimBounds, std::move(below), depth - 1, badRefines,
+              sides, nodes, primitiveIndices, tasks);
+    int aboveChild = nodes->size();
+    (*nodes)[nodeNum].InitInterior(bestAxis, aboveChild, tSplit);
+    buildTree(bounds1, allPrimBounds, std::move(above), depth - 1, badRefines,
+              sides, nodes, primitiveIndices, tasks);
+}
+
+uint64_t KdTreeAccel::cacheKey(const std::vector<Bounds3f> &primBounds,
+                               int maxDepth) const {
+    // Hash the build parameters and the bounds of the primitives; the tree
+    // only depends on them
+    int32_t params[] = {kdCacheVersion, (int32_t)sizeof(Float), isectCost,
+                        traversalCost,  maxPrims, maxDepth,
+                        (int32_t)primBounds.size()};
+    uint64_t hash = HashBytes(params, sizeof(params));
+    hash = HashBytes(&emptyBonus, sizeof(emptyBonus), hash);
+    for (const Bounds3f &b : primBounds) hash = HashBytes(&b, sizeof(b), hash);
+    return hash;
+}
+
+bool KdTreeAccel::loadCache(const std::string &filename, uint64_t key) {
+    FILE *f = fopen(filename.c_str(), "rb");
+    if (!f) return false;
+
+    // Check that the file holds a tree for these primitives before reading
+    // its nodes and primitive indices
+    KdCacheHeader header = {};
+    int nPrimitives = primitives.size();
+    bool valid = fread(&header, sizeof(header), 1, f) == 1 &&
+                 memcmp(header.magic, kdCacheMagic, 8) == 0 &&
+                 header.key == key && header.nPrimitives == nPrimitives &&
+                 header.nNodes > 0 && header.nPrimitiveIndices >= 0;
+    KdAccelNode *cachedNodes = nullptr;
+    std::vector<int> cachedIndices;
+    if (valid) {
+        cachedNodes = AllocAligned<KdAccelNode>(header.nNodes);
+        cachedIndices.resize(header.nPrimitiveIndices);
+        valid = fread(cachedNodes, sizeof(KdAccelNode), header.nNodes, f) ==
+                    (size_t)header.nNodes &&
+                fread(cachedIndices.data(), sizeof(int), cachedIndices.size(),
+                      f) == cachedIndices.size() &&
+                fgetc(f) == EOF;
+    }
+    fclose(f);
+    for (int i = 0; valid && i < (int)cachedIndices.size(); ++i)
+        valid = cachedIndices[i] >= 0 && cachedIndices[i] < nPrimitives;
+    for (int i = 0; valid && i < header.nNodes; ++i) {
+        const KdAccelNode &node = cachedNodes[i];
+        int np = node.nPrimitives();
+        if (!node.IsLeaf())
+            valid = node.AboveChild() > i && node.AboveChild() < header.nNodes;
+        else if (np == 1)
+            valid = node.onePrimitive >= 0 && node.onePrimitive < nPrimitives;
+        else if (np > 1)
+            valid = node.primitiveIndicesOffset >= 0 &&
+                    node.primitiveIndicesOffset + np <= (int)cachedIndices.size();
+    }
+    if (!valid) {
+        Warning("%s: ignoring invalid kd-tree cache file", filename.c_str());
+        FreeAligned(cachedNodes);
+        return false;
+    }
+
+    nodes = cachedNodes;
+    nNodes = header.nNodes;
+    primitiveIndices.swap(cachedIndices);
+    bounds = header.bounds;
+    ++nCachedTrees;
+    LOG(INFO) << "Loaded kd-tree for " << nPrimitives << " primitives from "
+              << filename;
+    return true;
+}
+
+void KdTreeAccel::writeCache(const std::string &filename, uint64_t key) const {
+    KdCacheHeader header = {};
+    memcpy(header.magic, kdCacheMagic, 8);
+    header.key = key;
+    header.nPrimitives = primitives.size();
+    header.nNodes = nNodes;
+    header.nPrimitiveIndices = primitiveIndices.size();
+    header.bounds = bounds;
+
+    // Write to a temporary file first so that other processes never read a
+    // partially written cache
+    std::string tempFilename = filename + ".tmp";
+    FILE *f = fopen(tempFilename.c_str(), "wb");
+    if (!f) {
+        Warning("%s: unable to create kd-tree cache file",
+                tempFilename.c_str());
+        return;
+    }
+    bool written =
+        fwrite(&header, sizeof(header), 1, f) == 1 &&
+        fwrite(nodes, sizeof(KdAccelNode), nNodes, f) == (size_t)nNodes &&
+        fwrite(primitiveIndices.data(), sizeof(int), primitiveIndices.size(),
+               f) == primitiveIndices.size();
+    if (fclose(f) != 0 || !written ||
+        rename(tempFilename.c_str(), filename.c_str()) != 0) {
+        Warning("%s: unable to write kd-tree cache file", filename.c_str());
+        remove(tempFilename.c_str());
+    }
 }
 
 bool KdTreeAccel::Intersect(const Ray &ray, SurfaceInteraction *isect) const {
     ProfilePhase p(Prof::AccelIntersect);
+    TRAVERSAL_STAT(++nClosestHitRays);
     // Compute initial parametric range of ray inside kd-tree extent
     Float tMin, tMax;
     if (!bounds.IntersectP(ray, &tMin, &tMax)) {
@@ -278,10 +523,12 @@ bool KdTreeAccel::Intersect(const Ray &ray, SurfaceInteraction *isect) const {
 
     // Traverse kd-tree nodes in order for ray
     bool hit = false;
+    TRAVERSAL_STAT(int nVisited = 0);
     const KdAccelNode *node = &nodes[0];
     while (node != nullptr) {
         // Bail out if we found a hit closer than the current node
         if (ray.tMax < tMin) break;
+        TRAVERSAL_STAT(++nVisited);
         if (!node->IsLeaf()) {
             // Process kd-tree interior node
 
@@ -344,11 +591,13 @@ bool KdTreeAccel::Intersect(const Ray &ray, SurfaceInteraction *isect) const {
                 break;
         }
     }
+    TRAVERSAL_STAT(nNodeVisits += nVisited);
     return hit;
 }
 
 bool KdTreeAccel::IntersectP(const Ray &ray) const {
     ProfilePhase p(Prof::AccelIntersectP);
+    TRAVERSAL_STAT(++nShadowRays);
     // Compute initial parametric range of ray inside kd-tree extent
     Float tMin, tMax;
     if (!bounds.IntersectP(ray, &tMin, &tMax)) {
@@ -360,8 +609,10 @@ bool KdTreeAccel::IntersectP(const Ray &ray) const {
     PBRT_CONSTEXPR int maxTodo = 64;
     KdToDo todo[maxTodo];
     int todoPos = 0;
+    TRAVERSAL_STAT(int nVisited = 0);
     const KdAccelNode *node = &nodes[0];
     while (node != nullptr) {
+        TRAVERSAL_STAT(++nVisited);
         if (node->IsLeaf()) {
             // Check for shadow ray intersections inside leaf node
             int nPrimitives = node->nPrimitives();
@@ -369,6 +620,7 @@ bool KdTreeAccel::IntersectP(const Ray &ray) const {
                 const std::shared_ptr<Primitive> &p =
                     primitives[node->onePrimitive];
                 if (p->IntersectP(ray)) {
+                    TRAVERSAL_STAT(nShadowNodeVisits += nVisited);
                     return true;
                 }
             } else {
@@ -378,6 +630,7 @@ bool KdTreeAccel::IntersectP(const Ray &ray) const {
                     const std::shared_ptr<Primitive> &prim =
                         primitives[primitiveIndex];
                     if (prim->IntersectP(ray)) {
+                        TRAVERSAL_STAT(nShadowNodeVisits += nVisited);
                         return true;
                     }
                 }
@@ -427,6 +680,7 @@ bool KdTreeAccel::IntersectP(const Ray &ray) const {
             }
         }
     }
+    TRAVERSAL_STAT(nShadowNodeVisits += nVisited);
     return false;
 }
 
@@ -437,8 +691,9 @@ std::shared_ptr<KdTreeAccel> CreateKdTreeAccelerator(
     Float emptyBonus = ps.FindOneFloat("emptybonus", 0.5f);
     int maxPrims = ps.FindOneInt("maxprims", 1);
     int maxDepth = ps.FindOneInt("maxdepth", -1);
+    std::string cacheDir = ps.FindOneFilename("cachedir", "");
     return std::make_shared<KdTreeAccel>(std::move(prims), isectCost, travCost, emptyBonus,
-                                         maxPrims, maxDepth);
+                                         maxPrims, maxDepth, cacheDir);
 }
 
 }  // namespace pbrt
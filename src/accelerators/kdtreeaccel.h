@@ -46,13 +46,15 @@ namespace pbrt {
 
 // KdTreeAccel Declarations
 struct KdAccelNode;
-struct BoundEdge;
+struct KdBuildInput;
+struct KdBuildTask;
 class KdTreeAccel : public Aggregate {
   public:
     // KdTreeAccel Public Methods
     KdTreeAccel(std::vector<std::shared_ptr<Primitive>> p,
                 int isectCost = 80, int traversalCost = 1,
-                Float emptyBonus = 0.5, int maxPrims = 1, int maxDepth = -1);
+                Float emptyBonus = 0.5, int maxPrims = 1, int maxDepth = -1,
+                const std::string &cacheDir = "");
     Bounds3f WorldBound() const { return bounds; }
     ~KdTreeAccel();
     bool Intersect(const Ray &ray, SurfaceInteraction *isect) const;
@@ -60,19 +62,24 @@ class KdTreeAccel : public Aggregate {
 
   private:
     // KdTreeAccel Private Methods
-    void buildTree(int nodeNum, const Bounds3f &bounds,
-                   const std::vector<Bounds3f> &primBounds, int *primNums,
-                   int nprims, int depth,
-                   const std::unique_ptr<BoundEdge[]> edges[3], int *prims0,
-                   int *prims1, int badRefines = 0);
+    void buildTree(const Bounds3f &bounds,
+                   const std::vector<Bounds3f> &primBounds,
+                   KdBuildInput input, int depth, int badRefines,
+                   uint8_t *sides, std::vector<KdAccelNode> *nodes,
+                   std::vector<int> *primitiveIndices,
+                   std::vector<KdBuildTask> *tasks = nullptr) const;
+    uint64_t cacheKey(const std::vector<Bounds3f> &primBounds,
+                      int maxDepth) const;
+    bool loadCache(const std::string &filename, uint64_t key);
+    void writeCache(const std::string &filename, uint64_t key) const;
 
     // KdTreeAccel Private Data
     const int isectCost, traversalCost, maxPrims;
     const Float emptyBonus;
     std::vector<std::shared_ptr<Primitive>> primitives;
     std::vector<int> primitiveIndices;
-    KdAccelNode *nodes;
-    int nAllocedNodes, nextFreeNode;
+    KdAccelNode *nodes = nullptr;
+    int nNodes = 0;
     Bounds3f bounds;
 };
 
@@ -0,0 +1,112 @@
+
+/*
+    pbrt source code is Copyright(c) 1998-2016
+                        Matt Pharr, Greg Humphreys, and Wenzel Jakob.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+// accelerators/motionbvh.cpp*
+#include "accelerators/motionbvh.h"
+#include "interaction.h"
+#include "stats.h"
+#include <algorithm>
+
+namespace pbrt {
+
+STAT_MEMORY_COUNTER("Memory/Motion BVH", motionBVHBytes);
+STAT_COUNTER("Scene/Primitives in motion BVH", nMotionBVHPrimitives);
+
+// MotionBVH Method Definitions
+MotionBVH::MotionBVH(std::vector<std::shared_ptr<Primitive>> prims,
+                     Float startTime, Float endTime, int nSegments)
+    : startTime(startTime), nSegments(std::max(nSegments, 1)) {
+    ProfilePhase _(Prof::AccelConstruction);
+    segmentsPerTime =
+        endTime > startTime ? this->nSegments / (endTime - startTime) : 0;
+    if (prims.empty()) return;
+    nMotionBVHPrimitives += prims.size();
+
+    // Bound each primitive over each time segment. Each primitive gets its
+    // own leaf: moving primitives are animated shapes and instances whose
+    // test is a traversal of their own aggregate
+    std::vector<Bounds3f> primSegmentBounds(prims.size() * this->nSegments);
+    for (size_t i = 0; i < prims.size(); ++i) {
+        for (int s = 0; s < this->nSegments; ++s) {
+            Float t0 = Lerp(Float(s) / this->nSegments, startTime, endTime);
+            Float t1 = Lerp(Float(s + 1) / this->nSegments, startTime, endTime);
+            Bounds3f &b = primSegmentBounds[i * this->nSegments + s];
+            if (!prims[i]->MotionWorldBound(t0, t1, &b))
+                b = prims[i]->WorldBound();
+        }
+    }
+    std::vector<int> order =
+        BuildFlatBVH(primSegmentBounds, prims.size(), this->nSegments, 1,
+                     &nodes, &segmentBounds);
+
+    // Store the primitives in the order of the leaves
+    primitives.resize(prims.size());
+    for (size_t i = 0; i < prims.size(); ++i)
+        primitives[i] = std::move(prims[order[i]]);
+    for (int s = 0; s < this->nSegments; ++s)
+        bounds = Union(bounds, segmentBounds[s]);
+    motionBVHBytes += sizeof(*this) +
+                      primitives.size() * sizeof(primitives[0]) +
+                      nodes.size() * sizeof(FlatBVHNode) +
+                      segmentBounds.size() * sizeof(Bounds3f);
+}
+
+bool MotionBVH::Intersect(const Ray &ray, SurfaceInteraction *isect) const {
+    if (nodes.empty()) return false;
+    ProfilePhase p(Prof::AccelIntersect);
+    bool hit = false;
+    // Only the bounds of the segment containing the ray's time are tested
+    TraverseFlatBVH(nodes.data(), &segmentBounds[Segment(ray.time)],
+                    nSegments, ray, [&](const FlatBVHNode &node) {
+                        for (int i = 0; i < node.nItems; ++i)
+                            if (primitives[node.itemOffset + i]->Intersect(
+                                    ray, isect))
+                                hit = true;
+                        return false;
+                    });
+    return hit;
+}
+
+bool MotionBVH::IntersectP(const Ray &ray) const {
+    if (nodes.empty()) return false;
+    ProfilePhase p(Prof::AccelIntersectP);
+    return TraverseFlatBVH(
+        nodes.data(), &segmentBounds[Segment(ray.time)], nSegments, ray,
+        [&](const FlatBVHNode &node) {
+            for (int i = 0; i < node.nItems; ++i)
+                if (primitives[node.itemOffset + i]->IntersectP(ray))
+                    return true;
+            return false;
+        });
+}
+
+}  // namespace pbrt
@@ -0,0 +1,79 @@
+
+/*
+    pbrt source code is Copyright(c) 1998-2016
+                        Matt Pharr, Greg Humphreys, and Wenzel Jakob.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+#if defined(_MSC_VER)
+#define NOMINMAX
+#pragma once
+#endif
+
+#ifndef PBRT_ACCELERATORS_MOTIONBVH_H
+#define PBRT_ACCELERATORS_MOTIONBVH_H
+
+// accelerators/motionbvh.h*
+#include "pbrt.h"
+#include "primitive.h"
+#include "accelerators/flatbvh.h"
+
+namespace pbrt {
+
+// MotionBVH Declarations
+class MotionBVH : public Aggregate {
+  public:
+    // MotionBVH Public Methods
+    MotionBVH(std::vector<std::shared_ptr<Primitive>> prims, Float startTime,
+              Float endTime, int nSegments);
+    Bounds3f WorldBound() const { return bounds; }
+    bool Intersect(const Ray &ray, SurfaceInteraction *isect) const;
+    bool IntersectP(const Ray &ray) const;
+
+  private:
+    // MotionBVH Private Methods
+    int Segment(Float time) const {
+        return (int)Clamp((time - startTime) * segmentsPerTime, 0,
+                          nSegments - 1);
+    }
+
+    // MotionBVH Private Data
+    std::vector<std::shared_ptr<Primitive>> primitives;
+    const Float startTime;
+    const int nSegments;
+    Float segmentsPerTime;
+    Bounds3f bounds;
+    std::vector<FlatBVHNode> nodes;
+    // Bounds of each node over each time segment, indexed by
+    // _node * nSegments + segment_
+    std::vector<Bounds3f> segmentBounds;
+};
+
+}  // namespace pbrt
+
+#endif  // PBRT_ACCELERATORS_MOTIONBVH_H
@@ -42,6 +42,8 @@
 
 // API Additional Headers
 #include "accelerators/bvh.h"
+#include "accelerators/instancebvh.h"
+#include "accelerators/motionbvh.h"
 #include "accelerators/kdtreeaccel.h"
 #include "cameras/environment.h"
 #include "cameras/orthographic.h"
@@ -117,6 +119,7 @@
 #include "media/grid.h"
 #include "media/homogeneous.h"
 
+#include <iterator>
 #include <map>
 #include <stdio.h>
 
@@ -161,6 +164,8 @@ struct RenderOptions {
     // RenderOptions Public Methods
     Integrator *MakeIntegrator() const;
     Scene *MakeScene();
+    std::shared_ptr<Primitive> MakeInstanceBVH();
+    std::shared_ptr<Primitive> MakeMotionBVH();
     Camera *MakeCamera() const;
 
     // RenderOptions Public Data
@@ -173,6 +178,8 @@ struct RenderOptions {
     ParamSet SamplerParams;
     std::string AcceleratorName = "bvh";
     ParamSet AcceleratorParams;
+    // Number of time segments bounded by the _MotionBVH_; 0 disables it
+    int motionSegments = 4;
     std::string IntegratorName = "path";
     ParamSet IntegratorParams;
     std::string CameraName = "perspective";
@@ -183,6 +190,11 @@ struct RenderOptions {
     std::vector<std::shared_ptr<Primitive>> primitives;
     std::map<std::string, std::vector<std::shared_ptr<Primitive>>> instances;
     std::vector<std::shared_ptr<Primitive>> *currentInstance = nullptr;
+    // Instances with a static transformation, gathered in an _InstanceBVH_,
+    // and the owners of their objects, which outlive a redefinition of the
+    // object's name
+    std::vector<InstanceRecord> instanceRecords;
+    std::map<const Primitive *, std::shared_ptr<Primitive>> instanceObjects;
     bool haveScatteringMedia = false;
 };
 
@@ -371,6 +383,8 @@ static std::vector<GraphicsState> pushedGraphicsStates;
 static std::vector<TransformSet> pushedTransforms;
 static std::vector<uint32_t> pushedActiveTransformBits;
 static TransformCache transformCache;
+// Set while pbrtLoadWorld() parses a scene
+static WorldDescription *loadedWorld = nullptr;
 int catIndentCount = 0;
 
 // API Forward Declarations
@@ -894,6 +908,9 @@ void pbrtCleanup() {
     else if (currentApiState == APIState::WorldBlock)
         Error("pbrtCleanup() called while inside world block.");
     currentApiState = APIState::Uninitialized;
+    transformCache.Clear();
+    ImageTexture<Float, Float>::ClearCache();
+    ImageTexture<RGBSpectrum, Spectrum>::ClearCache();
     ParallelCleanup();
     CleanupProfiler();
 }
@@ -1056,6 +1073,9 @@ void pbrtSampler(const std::string &name, const ParamSet &params) {
 void pbrtAccelerator(const std::string &name, const ParamSet &params) {
     VERIFY_OPTIONS("Accelerator");
     renderOptions->AcceleratorName = name;
+    // Read here rather than when the scene is made, so that the accelerators
+    // of object instances don't report it as unused
+    renderOptions->motionSegments = params.FindOneInt("motionsegments", 4);
     renderOptions->AcceleratorParams = params;
     if (PbrtOptions.cat || PbrtOptions.toPly) {
         printf("%*sAccelerator \"%s\" ", catIndentCount, "", name.c_str());
@@ -1581,6 +1601,13 @@ void pbrtObjectInstance(const std::string &name) {
         transformCache.Lookup(curTransform[0]),
         transformCache.Lookup(curTransform[1])
     };
+    if (*InstanceToWorld[0] == *InstanceToWorld[1]) {
+        // Instances that aren't animated only need an _InstanceRecord_
+        renderOptions->instanceRecords.push_back(
+            {in[0].get(), InstanceToWorld[0]});
+        renderOptions->instanceObjects[in[0].get()] = in[0];
+        return;
+    }
     AnimatedTransform animatedInstanceToWorld(
         InstanceToWorld[0], renderOptions->transformStartTime,
         InstanceToWorld[1], renderOptions->transformEndTime);
@@ -1605,6 +1632,16 @@ void pbrtWorldEnd() {
     // Create scene and render
     if (PbrtOptions.cat || PbrtOptions.toPly) {
         printf("%*sWorldEnd\n", catIndentCount, "");
+    } else if (loadedWorld) {
+        // Hand the world over to pbrtLoadWorld()
+        std::shared_ptr<Primitive> motionBVH = renderOptions->MakeMotionBVH();
+        loadedWorld->primitives = std::move(renderOptions->primitives);
+        if (std::shared_ptr<Primitive> instanceBVH =
+                renderOptions->MakeInstanceBVH())
+            loadedWorld->primitives.push_back(instanceBVH);
+        if (motionBVH) loadedWorld->primitives.push_back(motionBVH);
+        loadedWorld->lights = std::move(renderOptions->lights);
+        loadedWorld->camera.reset(renderOptions->MakeCamera());
     } else {
         std::unique_ptr<Integrator> integrator(renderOptions->MakeIntegrator());
         std::unique_ptr<Scene> scene(renderOptions->MakeScene());
@@ -1627,13 +1664,17 @@ void pbrtWorldEnd() {
     // Clean up after rendering. Do this before reporting stats so that
     // destructors can run and update stats as needed.
     graphicsState = GraphicsState();
-    transformCache.Clear();
     currentApiState = APIState::OptionsBlock;
-    ImageTexture<Float, Float>::ClearCache();
-    ImageTexture<RGBSpectrum, Spectrum>::ClearCache();
+    // The shapes, camera and textures of a loaded world reference the cached
+    // transforms and images; they are released by pbrtCleanup()
+    if (!loadedWorld) {
+        transformCache.Clear();
+        ImageTexture<Float, Float>::ClearCache();
+        ImageTexture<RGBSpectrum, Spectrum>::ClearCache();
+    }
     renderOptions.reset(new RenderOptions);
 
-    if (!PbrtOptions.cat && !PbrtOptions.toPly) {
+    if (!PbrtOptions.cat && !PbrtOptions.toPly && !loadedWorld) {
         MergeWorkerThreadStats();
         ReportThreadStats();
         if (!PbrtOptions.quiet) {
@@ -1650,9 +1691,63 @@ void pbrtWorldEnd() {
                                  namedCoordinateSystems.end());
 }
 
+bool pbrtLoadWorld(const std::string &filename, WorldDescription *world) {
+    *world = WorldDescription();
+    loadedWorld = world;
+    pbrtParseFile(filename);
+    loadedWorld = nullptr;
+    if (!world->camera) {
+        Error("No world block loaded from \"%s\"", filename.c_str());
+        return false;
+    }
+    return true;
+}
+
+std::shared_ptr<Primitive> RenderOptions::MakeInstanceBVH() {
+    if (instanceRecords.empty()) return nullptr;
+    // The instance BVH keeps the instantiated objects alive
+    std::vector<std::shared_ptr<Primitive>> objects;
+    for (const auto &object : instanceObjects) objects.push_back(object.second);
+    std::shared_ptr<Primitive> instanceBVH = std::make_shared<InstanceBVH>(
+        std::move(instanceRecords), std::move(objects));
+    instanceRecords.clear();
+    instanceObjects.clear();
+    return instanceBVH;
+}
+
+std::shared_ptr<Primitive> RenderOptions::MakeMotionBVH() {
+    if (motionSegments <= 0) return nullptr;
+    // Moving primitives are bounded over the whole shutter interval;
+    // gather them in a _MotionBVH_ that bounds each part of it
+    std::vector<std::shared_ptr<Primitive>> moving;
+    auto isStatic = [&](const std::shared_ptr<Primitive> &prim) {
+        Bounds3f b;
+        return !prim->MotionWorldBound(transformStartTime, transformEndTime,
+                                       &b);
+    };
+    auto firstMoving =
+        std::stable_partition(primitives.begin(), primitives.end(), isStatic);
+    std::move(firstMoving, primitives.end(), std::back_inserter(moving));
+    primitives.erase(firstMoving, primitives.end());
+    if (moving.empty()) return nullptr;
+    return std::make_shared<MotionBVH>(std::move(moving), transformStartTime,
+                                       transformEndTime, motionSegments);
+}
+
 Scene *RenderOptions::MakeScene() {
-    std::shared_ptr<Primitive> accelerator =
-        MakeAccelerator(AcceleratorName, std::move(primitives), AcceleratorParams);
+    std::shared_ptr<Primitive> instanceBVH = MakeInstanceBVH();
+    std::shared_ptr<Primitive> motionBVH = MakeMotionBVH();
+    std::shared_ptr<Primitive> accelerator;
+    if (instanceBVH && !motionBVH && primitives.empty())
+        accelerator = instanceBVH;
+    else if (motionBVH && !instanceBVH && primitives.empty())
+        accelerator = motionBVH;
+    else {
+        if (instanceBVH) primitives.push_back(instanceBVH);
+        if (motionBVH) primitives.push_back(motionBVH);
+        accelerator = MakeAccelerator(AcceleratorName, std::move(primitives),
+                                      AcceleratorParams);
+    }
     if (!accelerator) accelerator = std::make_shared<BVHAccel>(primitives);
     Scene *scene = new Scene(accelerator, lights);
     // Erase primitives and lights from _RenderOptions_
@@ -91,6 +91,21 @@ void pbrtWorldEnd();
 void pbrtParseFile(std::string filename);
 void pbrtParseString(std::string str);
 
+// Scene Loading Declarations
+struct WorldDescription {
+    // Primitives of the world block, not yet gathered in an accelerator;
+    // the instances with a static transformation are in an _InstanceBVH_
+    std::vector<std::shared_ptr<Primitive>> primitives;
+    std::vector<std::shared_ptr<Light>> lights;
+    std::shared_ptr<const Camera> camera;
+};
+
+// Parses _filename_ like pbrtParseFile() but returns the description of
+// its last world block in _world_ instead of rendering it. The world
+// references transforms and textures cached by the API until
+// pbrtCleanup(), so it must be destroyed before that call
+bool pbrtLoadWorld(const std::string &filename, WorldDescription *world);
+
 }  // namespace pbrt
 
 #endif  // PBRT_CORE_API_H
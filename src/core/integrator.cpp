@@ -47,15 +47,101 @@ namespace pbrt {
 
 STAT_COUNTER("Integrator/Camera rays traced", nCameraRays);
 
+// Width and height of the image tiles rendered by _SamplerIntegrator_
+static const int TileSize = 16;
+
 // Integrator Method Definitions
 Integrator::~Integrator() {}
 
 // Integrator Utility Functions
+static Spectrum BatchedSampleAllLights(const SurfaceInteraction &isect,
+                                       const Scene &scene, MemoryArena &arena,
+                                       Sampler &sampler,
+                                       const std::vector<int> &nLightSamples) {
+    // Get the light and scattering samples of all lights up front
+    size_t nLights = scene.lights.size();
+    int *nSamples = arena.Alloc<int>(nLights);
+    const Point2f **uLightArrays = arena.Alloc<const Point2f *>(nLights);
+    const Point2f **uScatteringArrays = arena.Alloc<const Point2f *>(nLights);
+    int nTotalSamples = 0;
+    for (size_t j = 0; j < nLights; ++j) {
+        nSamples[j] = nLightSamples[j];
+        uLightArrays[j] = sampler.Get2DArray(nSamples[j]);
+        uScatteringArrays[j] = sampler.Get2DArray(nSamples[j]);
+        if (!uLightArrays[j] || !uScatteringArrays[j]) {
+            // Use a single sample for illumination from the light
+            Point2f *u = arena.Alloc<Point2f>(2);
+            u[0] = sampler.Get2D();
+            u[1] = sampler.Get2D();
+            uLightArrays[j] = &u[0];
+            uScatteringArrays[j] = &u[1];
+            nSamples[j] = 1;
+        }
+        nTotalSamples += nSamples[j];
+    }
+
+    // Take the light samples and trace their shadow rays in batches
+    BxDFType bsdfFlags = BxDFType(BSDF_ALL & ~BSDF_SPECULAR);
+    DirectLightSample *lightSamples =
+        arena.Alloc<DirectLightSample>(nTotalSamples);
+    VisibilityTester *testers = arena.Alloc<VisibilityTester>(MaxRayBatchSize);
+    const VisibilityTester *batch[MaxRayBatchSize];
+    int batchSample[MaxRayBatchSize];
+    int nBatch = 0, sample = 0;
+    for (size_t j = 0; j < nLights; ++j) {
+        for (int k = 0; k < nSamples[j]; ++k, ++sample) {
+            // Only light samples that _EstimateDirect()_ would test need a ray
+            DirectLightSample &ls = lightSamples[sample];
+            ls.Li = scene.lights[j]->Sample_Li(isect, uLightArrays[j][k],
+                                               &ls.wi, &ls.lightPdf,
+                                               &testers[nBatch]);
+            if (ls.lightPdf > 0 && !ls.Li.IsBlack()) {
+                ls.f = isect.bsdf->f(isect.wo, ls.wi, bsdfFlags) *
+                       AbsDot(ls.wi, isect.shading.n);
+                if (!ls.f.IsBlack()) {
+                    ls.scatteringPdf =
+                        isect.bsdf->Pdf(isect.wo, ls.wi, bsdfFlags);
+                    batch[nBatch] = &testers[nBatch];
+                    batchSample[nBatch++] = sample;
+                }
+            }
+            if (nBatch == MaxRayBatchSize ||
+                (sample == nTotalSamples - 1 && nBatch > 0)) {
+                uint64_t visible =
+                    VisibilityTester::Unoccluded(batch, nBatch, scene);
+                for (int b = 0; b < nBatch; ++b)
+                    lightSamples[batchSample[b]].unoccluded =
+                        (visible >> b) & 1;
+                nBatch = 0;
+            }
+        }
+    }
+
+    // Estimate direct lighting with the light samples taken above
+    Spectrum L(0.f);
+    sample = 0;
+    for (size_t j = 0; j < nLights; ++j) {
+        Spectrum Ld(0.f);
+        for (int k = 0; k < nSamples[j]; ++k, ++sample)
+            Ld += EstimateDirect(isect, uScatteringArrays[j][k],
+                                 *scene.lights[j], uLightArrays[j][k], scene,
+                                 sampler, arena, false, false,
+                                 &lightSamples[sample]);
+        L += Ld / nSamples[j];
+    }
+    return L;
+}
+
 Spectrum UniformSampleAllLights(const Interaction &it, const Scene &scene,
                                 MemoryArena &arena, Sampler &sampler,
                                 const std::vector<int> &nLightSamples,
                                 bool handleMedia) {
     ProfilePhase p(Prof::DirectLighting);
+    // Without participating media the sampler isn't used for visibility, so
+    // the shadow rays of all lights can be traced together
+    if (!handleMedia && it.IsSurfaceInteraction())
+        return BatchedSampleAllLights((const SurfaceInteraction &)it, scene,
+                                      arena, sampler, nLightSamples);
     Spectrum L(0.f);
     for (size_t j = 0; j < scene.lights.size(); ++j) {
         // Accumulate contribution of _j_th light to _L_
@@ -105,10 +191,26 @@ Spectrum UniformSampleOneLight(const Interaction &it, const Scene &scene,
                           scene, sampler, arena, handleMedia) / lightPdf;
 }
 
+// Returns the light reflected at _isect_ toward _isect.wo_ from the sample
+// _uLight_ of _light_, as if it weren't occluded, and sets _vis_ to test
+// whether it is. Unlike _EstimateDirect()_, the light sample is used alone.
+Spectrum UnshadowedContribution(const SurfaceInteraction &isect,
+                                const Light &light, const Point2f &uLight,
+                                BxDFType bsdfFlags, VisibilityTester *vis) {
+    Vector3f wi;
+    Float lightPdf = 0;
+    Spectrum Li = light.Sample_Li(isect, uLight, &wi, &lightPdf, vis);
+    if (lightPdf == 0 || Li.IsBlack()) return Spectrum(0.f);
+    Spectrum f = isect.bsdf->f(isect.wo, wi, bsdfFlags) *
+                 AbsDot(wi, isect.shading.n);
+    return f.IsBlack() ? Spectrum(0.f) : f * Li / lightPdf;
+}
+
 Spectrum EstimateDirect(const Interaction &it, const Point2f &uScattering,
                         const Light &light, const Point2f &uLight,
                         const Scene &scene, Sampler &sampler,
-                        MemoryArena &arena, bool handleMedia, bool specular) {
+                        MemoryArena &arena, bool handleMedia, bool specular,
+                        const DirectLightSample *lightSample) {
     BxDFType bsdfFlags =
         specular ? BSDF_ALL : BxDFType(BSDF_ALL & ~BSDF_SPECULAR);
     Spectrum Ld(0.f);
@@ -116,13 +218,22 @@ Spectrum EstimateDirect(const Interaction &it, const Point2f &uScattering,
     Vector3f wi;
     Float lightPdf = 0, scatteringPdf = 0;
     VisibilityTester visibility;
-    Spectrum Li = light.Sample_Li(it, uLight, &wi, &lightPdf, &visibility);
+    Spectrum Li;
+    if (lightSample) {
+        Li = lightSample->Li;
+        wi = lightSample->wi;
+        lightPdf = lightSample->lightPdf;
+    } else
+        Li = light.Sample_Li(it, uLight, &wi, &lightPdf, &visibility);
     VLOG(2) << "EstimateDirect uLight:" << uLight << " -> Li: " << Li << ", wi: "
             << wi << ", pdf: " << lightPdf;
     if (lightPdf > 0 && !Li.IsBlack()) {
         // Compute BSDF or phase function's value for light sample
         Spectrum f;
-        if (it.IsSurfaceInteraction()) {
+        if (lightSample) {
+            f = lightSample->f;
+            scatteringPdf = lightSample->scatteringPdf;
+        } else if (it.IsSurfaceInteraction()) {
             // Evaluate BSDF for light sampling strategy
             const SurfaceInteraction &isect = (const SurfaceInteraction &)it;
             f = isect.bsdf->f(isect.wo, wi, bsdfFlags) *
@@ -143,7 +254,8 @@ Spectrum EstimateDirect(const Interaction &it, const Point2f &uScattering,
                 Li *= visibility.Tr(scene, sampler);
                 VLOG(2) << "  after Tr, Li: " << Li;
             } else {
-              if (!visibility.Unoccluded(scene)) {
+              if (lightSample ? !lightSample->unoccluded
+                              : !visibility.Unoccluded(scene)) {
                 VLOG(2) << "  shadow ray blocked";
                 Li = Spectrum(0.f);
               } else
@@ -225,16 +337,27 @@ std::unique_ptr<Distribution1D> ComputeLightPowerDistribution(
 }
 
 // SamplerIntegrator Method Definitions
+int SamplerIntegrator::TileIndex(const Point2i &pixel) const {
+    Bounds2i sampleBounds = camera->film->GetSampleBounds();
+    int nTilesX = (sampleBounds.pMax.x - sampleBounds.pMin.x + TileSize - 1) /
+                  TileSize;
+    return (pixel.y - sampleBounds.pMin.y) / TileSize * nTilesX +
+           (pixel.x - sampleBounds.pMin.x) / TileSize;
+}
+
 void SamplerIntegrator::Render(const Scene &scene) {
     Preprocess(scene, *sampler);
+    // Create the per-thread integrator states
+    threadStates.clear();
+    for (int i = 0; i < MaxThreadIndex(); ++i)
+        threadStates.push_back(CreateThreadState());
     // Render image tiles in parallel
 
     // Compute number of tiles, _nTiles_, to use for parallel rendering
     Bounds2i sampleBounds = camera->film->GetSampleBounds();
     Vector2i sampleExtent = sampleBounds.Diagonal();
-    const int tileSize = 16;
-    Point2i nTiles((sampleExtent.x + tileSize - 1) / tileSize,
-                   (sampleExtent.y + tileSize - 1) / tileSize);
+    Point2i nTiles((sampleExtent.x + TileSize - 1) / TileSize,
+                   (sampleExtent.y + TileSize - 1) / TileSize);
     ProgressReporter reporter(nTiles.x * nTiles.y, "Rendering");
     {
         ParallelFor2D([&](Point2i tile) {
@@ -248,83 +371,25 @@ void SamplerIntegrator::Render(const Scene &scene) {
             std::unique_ptr<Sampler> tileSampler = sampler->Clone(seed);
 
             // Compute sample bounds for tile
-            int x0 = sampleBounds.pMin.x + tile.x * tileSize;
-            int x1 = std::min(x0 + tileSize, sampleBounds.pMax.x);
-            int y0 = sampleBounds.pMin.y + tile.y * tileSize;
-            int y1 = std::min(y0 + tileSize, sampleBounds.pMax.y);
+            int x0 = sampleBounds.pMin.x + tile.x * TileSize;
+            int x1 = std::min(x0 + TileSize, sampleBounds.pMax.x);
+            int y0 = sampleBounds.pMin.y + tile.y * TileSize;
+            int y1 = std::min(y0 + TileSize, sampleBounds.pMax.y);
             Bounds2i tileBounds(Point2i(x0, y0), Point2i(x1, y1));
             LOG(INFO) << "Starting image tile " << tileBounds;
 
             // Get _FilmTile_ for tile
             std::unique_ptr<FilmTile> filmTile =
                 camera->film->GetFilmTile(tileBounds);
+            if (threadStates[ThreadIndex])
+                StartTile(threadStates[ThreadIndex].get(),
+                          tile.y * nTiles.x + tile.x, tileBounds);
 
-            // Loop over pixels in tile to render them
-            for (Point2i pixel : tileBounds) {
-                {
-                    ProfilePhase pp(Prof::StartPixel);
-                    tileSampler->StartPixel(pixel);
-                }
-
-                // Do this check after the StartPixel() call; this keeps
-                // the usage of RNG values from (most) Samplers that use
-                // RNGs consistent, which improves reproducability /
-                // debugging.
-                if (!InsideExclusive(pixel, pixelBounds))
-                    continue;
-
-                do {
-                    // Initialize _CameraSample_ for current sample
-                    CameraSample cameraSample =
-                        tileSampler->GetCameraSample(pixel);
-
-                    // Generate camera ray for current sample
-                    RayDifferential ray;
-                    Float rayWeight =
-                        camera->GenerateRayDifferential(cameraSample, &ray);
-                    ray.ScaleDifferentials(
-                        1 / std::sqrt((Float)tileSampler->samplesPerPixel));
-                    ++nCameraRays;
-
-                    // Evaluate radiance along camera ray
-                    Spectrum L(0.f);
-                    if (rayWeight > 0) L = Li(ray, scene, *tileSampler, arena);
-
-                    // Issue warning if unexpected radiance value returned
-                    if (L.HasNaNs()) {
-                        LOG(ERROR) << StringPrintf(
-                            "Not-a-number radiance value returned "
-                            "for pixel (%d, %d), sample %d. Setting to black.",
-                            pixel.x, pixel.y,
-                            (int)tileSampler->CurrentSampleNumber());
-                        L = Spectrum(0.f);
-                    } else if (L.y() < -1e-5) {
-                        LOG(ERROR) << StringPrintf(
-                            "Negative luminance value, %f, returned "
-                            "for pixel (%d, %d), sample %d. Setting to black.",
-                            L.y(), pixel.x, pixel.y,
-                            (int)tileSampler->CurrentSampleNumber());
-                        L = Spectrum(0.f);
-                    } else if (std::isinf(L.y())) {
-                          LOG(ERROR) << StringPrintf(
-                            "Infinite luminance value returned "
-                            "for pixel (%d, %d), sample %d. Setting to black.",
-                            pixel.x, pixel.y,
-                            (int)tileSampler->CurrentSampleNumber());
-                        L = Spectrum(0.f);
-                    }
-                    VLOG(1) << "Camera sample: " << cameraSample << " -> ray: " <<
-                        ray << " -> L = " << L;
-
-                    // Add camera ray's contribution to image
-                    filmTile->AddSample(cameraSample.pFilm, L, rayWeight);
-
-                    // Free _MemoryArena_ memory from computing image sample
-                    // value
-                    arena.Reset();
-                } while (tileSampler->StartNextSample());
-            }
+            RenderTile(scene, tileBounds, *tileSampler, filmTile.get(),
+                       arena);
             LOG(INFO) << "Finished image tile " << tileBounds;
+            if (threadStates[ThreadIndex])
+                ReduceTile(threadStates[ThreadIndex].get());
 
             // Merge image tile into _Film_
             camera->film->MergeFilmTile(std::move(filmTile));
@@ -332,247 +397,96 @@ void SamplerIntegrator::Render(const Scene &scene) {
         }, nTiles);
         reporter.Done();
     }
+    // Reduce the per-thread states, in thread order so that the result
+    // doesn't depend on scheduling
+    for (std::unique_ptr<ThreadState> &state : threadStates)
+        if (state) ReduceRender(state.get());
+    threadStates.clear();
     LOG(INFO) << "Rendering finished";
 
     // Save final image after rendering
     camera->film->WriteImage();
 }
 
-Spectrum SamplerIntegrator::SpecularReflect(
-    const RayDifferential &ray, const SurfaceInteraction &isect,
-    const Scene &scene, Sampler &sampler, MemoryArena &arena, int depth) const {
-    // Compute specular reflection direction _wi_ and BSDF value
-    Vector3f wo = isect.wo, wi;
-    Float pdf;
-    BxDFType type = BxDFType(BSDF_REFLECTION | BSDF_SPECULAR);
-    Spectrum f = isect.bsdf->Sample_f(wo, &wi, sampler.Get2D(), &pdf, type);
-
-    // Return contribution of specular reflection
-    const Normal3f &ns = isect.shading.n;
-    if (pdf > 0.f && !f.IsBlack() && AbsDot(wi, ns) != 0.f) {
-        // Compute ray differential _rd_ for specular reflection
-        RayDifferential rd = isect.SpawnRay(wi);
-        if (ray.hasDifferentials) {
-            rd.hasDifferentials = true;
-            rd.rxOrigin = isect.p + isect.dpdx;
-            rd.ryOrigin = isect.p + isect.dpdy;
-            // Compute differential reflected directions
-            Normal3f dndx = isect.shading.dndu * isect.dudx +
-                            isect.shading.dndv * isect.dvdx;
-            Normal3f dndy = isect.shading.dndu * isect.dudy +
-                            isect.shading.dndv * isect.dvdy;
-            Vector3f dwodx = -ray.rxDirection - wo,
-                     dwody = -ray.ryDirection - wo;
-            Float dDNdx = Dot(dwodx, ns) + Dot(wo, dndx);
-            Float dDNdy = Dot(dwody, ns) + Dot(wo, dndy);
-            rd.rxDirection =
-                wi - dwodx + 2.f * Vector3f(Dot(wo, ns) * dndx + dDNdx * ns);
-            rd.ryDirection =
-                wi - dwody + 2.f * Vector3f(Dot(wo, ns) * dndy + dDNdy * ns);
+void SamplerIntegrator::RenderTile(const Scene &scene,
+                                   const Bounds2i &tileBounds,
+                                   Sampler &tileSampler, FilmTile *filmTile,
+                                   MemoryArena &arena) const {
+    // Loop over pixels in tile to render them
+    for (Point2i pixel : tileBounds) {
+        {
+            ProfilePhase pp(Prof::StartPixel);
+            tileSampler.StartPixel(pixel);
         }
-        return f * Li(rd, scene, sampler, arena, depth + 1) * AbsDot(wi, ns) /
-               pdf;
-    } else
-        return Spectrum(0.f);
-}
 
-Spectrum SamplerIntegrator::SpecularTransmit(
-    const RayDifferential &ray, const SurfaceInteraction &isect,
-    const Scene &scene, Sampler &sampler, MemoryArena &arena, int depth) const {
-    Vector3f wo = isect.wo, wi;
-    Float pdf;
-    const Point3f &p = isect.p;
-    const BSDF &bsdf = *isect.bsdf;
-    Spectrum f = bsdf.Sample_f(wo, &wi, sampler.Get2D(), &pdf,
-                               BxDFType(BSDF_TRANSMISSION | BSDF_SPECULAR));
-    Spectrum L = Spectrum(0.f);
-    Normal3f ns = isect.shading.n;
-    if (pdf > 0.f && !f.IsBlack() && AbsDot(wi, ns) != 0.f) {
-        // Compute ray differential _rd_ for specular transmission
-        RayDifferential rd = isect.SpawnRay(wi);
-        if (ray.hasDifferentials) {
-            rd.hasDifferentials = true;
-            rd.rxOrigin = p + isect.dpdx;
-            rd.ryOrigin = p + isect.dpdy;
-
-            Normal3f dndx = isect.shading.dndu * isect.dudx +
-                            isect.shading.dndv * isect.dvdx;
-            Normal3f dndy = isect.shading.dndu * isect.dudy +
-                            isect.shading.dndv * isect.dvdy;
-
-            // The BSDF stores the IOR of the interior of the object being
-            // intersected.  Compute the relative IOR by first out by
-            // assuming that the ray is entering the object.
-            Float eta = 1 / bsdf.eta;
-            if (Dot(wo, ns) < 0) {
-                // If the ray isn't entering, then we need to invert the
-                // relative IOR and negate the normal and its derivatives.
-                eta = 1 / eta;
-                ns = -ns;
-                dndx = -dndx;
-                dndy = -dndy;
-            }
-
-            /*
-              Notes on the derivation:
-              - pbrt computes the refracted ray as: \wi = -\eta \omega_o + [ \eta (\wo \cdot \N) - \cos \theta_t ] \N
-                It flips the normal to lie in the same hemisphere as \wo, and then \eta is the relative IOR from
-                \wo's medium to \wi's medium.
-              - If we denote the term in brackets by \mu, then we have: \wi = -\eta \omega_o + \mu \N
-              - Now let's take the partial derivative. (We'll use "d" for \partial in the following for brevity.)
-                We get: -\eta d\omega_o / dx + \mu dN/dx + d\mu/dx N.
-              - We have the values of all of these except for d\mu/dx (using bits from the derivation of specularly
-                reflected ray deifferentials).
-              - The first term of d\mu/dx is easy: \eta d(\wo \cdot N)/dx. We already have d(\wo \cdot N)/dx.
-              - The second term takes a little more work. We have:
-                 \cos \theta_i = \sqrt{1 - \eta^2 (1 - (\wo \cdot N)^2)}.
-                 Starting from (\wo \cdot N)^2 and reading outward, we have \cos^2 \theta_o, then \sin^2 \theta_o,
-                 then \sin^2 \theta_i (via Snell's law), then \cos^2 \theta_i and then \cos \theta_i.
-              - Let's take the partial derivative of the sqrt expression. We get:
-                1 / 2 * 1 / \cos \theta_i * d/dx (1 - \eta^2 (1 - (\wo \cdot N)^2)).
-              - That partial derivatve is equal to:
-                d/dx \eta^2 (\wo \cdot N)^2 = 2 \eta^2 (\wo \cdot N) d/dx (\wo \cdot N).
-              - Plugging it in, we have d\mu/dx =
-                \eta d(\wo \cdot N)/dx - (\eta^2 (\wo \cdot N) d/dx (\wo \cdot N))/(-\wi \cdot N).
-             */
-            Vector3f dwodx = -ray.rxDirection - wo,
-                     dwody = -ray.ryDirection - wo;
-            Float dDNdx = Dot(dwodx, ns) + Dot(wo, dndx);
-            Float dDNdy = Dot(dwody, ns) + Dot(wo, dndy);
-
-            Float mu = eta * Dot(wo, ns) - AbsDot(wi, ns);
-            Float dmudx =
-                (eta - (eta * eta * Dot(wo, ns)) / AbsDot(wi, ns)) * dDNdx;
-            Float dmudy =
-                (eta - (eta * eta * Dot(wo, ns)) / AbsDot(wi, ns)) * dDNdy;
-
-            rd.rxDirection =
-                wi - eta * dwodx + Vector3f(mu * dndx + dmudx * ns);
-            rd.ryDirection =
-                wi - eta * dwody + Vector3f(mu * dndy + dmudy * ns);
-        }
-        L = f * Li(rd, scene, sampler, arena, depth + 1) * AbsDot(wi, ns) / pdf;
+        // Do this check after the StartPixel() call; this keeps
+        // the usage of RNG values from (most) Samplers that use
+        // RNGs consistent, which improves reproducability /
+        // debugging.
+        if (!InsideExclusive(pixel, pixelBounds))
+            continue;
+        if (threadStates[ThreadIndex])
+            StartPixel(threadStates[ThreadIndex].get(), pixel, tileBounds);
+
+        do {
+            // Initialize _CameraSample_ for current sample
+            CameraSample cameraSample = tileSampler.GetCameraSample(pixel);
+
+            // Generate camera ray for current sample
+            RayDifferential ray;
+            Float rayWeight =
+                camera->GenerateRayDifferential(cameraSample, &ray);
+            ray.ScaleDifferentials(
+                1 / std::sqrt((Float)tileSampler.samplesPerPixel));
+            ++nCameraRays;
+
+            // Evaluate radiance along camera ray
+            Spectrum L(0.f);
+            if (rayWeight > 0) L = Li(ray, scene, tileSampler, arena);
+
+            // Issue warning if unexpected radiance value returned
+            L = CheckRadiance(L, pixel, tileSampler.CurrentSampleNumber());
+            VLOG(1) << "Camera sample: " << cameraSample << " -> ray: " <<
+                ray << " -> L = " << L;
+
+            // Add camera ray's contribution to image
+            filmTile->AddSample(cameraSample.pFilm, L, rayWeight);
+
+            // Free _MemoryArena_ memory from computing image sample
+            // value
+            arena.Reset();
+        } while (tileSampler.StartNextSample());
     }
-    return L;
 }
 
-// SamplerIntegratorBis Method Definitions (same as SamplerIntegrator but makes the methods non-const)
-void SamplerIntegratorBis::Render(const Scene &scene) {
-    Preprocess(scene, *sampler);
-    // Render image tiles in parallel
-
-    // Compute number of tiles, _nTiles_, to use for parallel rendering
-    Bounds2i sampleBounds = camera->film->GetSampleBounds();
-    Vector2i sampleExtent = sampleBounds.Diagonal();
-    const int tileSize = 16;
-    Point2i nTiles((sampleExtent.x + tileSize - 1) / tileSize,
-                   (sampleExtent.y + tileSize - 1) / tileSize);
-    ProgressReporter reporter(nTiles.x * nTiles.y, "Rendering");
-    {
-        ParallelFor2D([&](Point2i tile) {
-            // Render section of image corresponding to _tile_
-
-            // Allocate _MemoryArena_ for tile
-            MemoryArena arena;
-
-            // Get sampler instance for tile
-            int seed = tile.y * nTiles.x + tile.x;
-            std::unique_ptr<Sampler> tileSampler = sampler->Clone(seed);
-
-            // Compute sample bounds for tile
-            int x0 = sampleBounds.pMin.x + tile.x * tileSize;
-            int x1 = std::min(x0 + tileSize, sampleBounds.pMax.x);
-            int y0 = sampleBounds.pMin.y + tile.y * tileSize;
-            int y1 = std::min(y0 + tileSize, sampleBounds.pMax.y);
-            Bounds2i tileBounds(Point2i(x0, y0), Point2i(x1, y1));
-            LOG(INFO) << "Starting image tile " << tileBounds;
-
-            // Get _FilmTile_ for tile
-            std::unique_ptr<FilmTile> filmTile =
-                camera->film->GetFilmTile(tileBounds);
-
-            // Loop over pixels in tile to render them
-            for (Point2i pixel : tileBounds) {
-                {
-                    ProfilePhase pp(Prof::StartPixel);
-                    tileSampler->StartPixel(pixel);
-                }
-
-                // Do this check after the StartPixel() call; this keeps
-                // the usage of RNG values from (most) Samplers that use
-                // RNGs consistent, which improves reproducability /
-                // debugging.
-                if (!InsideExclusive(pixel, pixelBounds))
-                    continue;
-
-                do {
-                    // Initialize _CameraSample_ for current sample
-                    CameraSample cameraSample =
-                        tileSampler->GetCameraSample(pixel);
-
-                    // Generate camera ray for current sample
-                    RayDifferential ray;
-                    Float rayWeight =
-                        camera->GenerateRayDifferential(cameraSample, &ray);
-                    ray.ScaleDifferentials(
-                        1 / std::sqrt((Float)tileSampler->samplesPerPixel));
-                    ++nCameraRays;
-
-                    // Evaluate radiance along camera ray
-                    Spectrum L(0.f);
-                    if (rayWeight > 0) L = Li(ray, scene, *tileSampler, arena);
-
-                    // Issue warning if unexpected radiance value returned
-                    if (L.HasNaNs()) {
-                        LOG(ERROR) << StringPrintf(
-                            "Not-a-number radiance value returned "
-                            "for pixel (%d, %d), sample %d. Setting to black.",
-                            pixel.x, pixel.y,
-                            (int)tileSampler->CurrentSampleNumber());
-                        L = Spectrum(0.f);
-                    } else if (L.y() < -1e-5) {
-                        LOG(ERROR) << StringPrintf(
-                            "Negative luminance value, %f, returned "
-                            "for pixel (%d, %d), sample %d. Setting to black.",
-                            L.y(), pixel.x, pixel.y,
-                            (int)tileSampler->CurrentSampleNumber());
-                        L = Spectrum(0.f);
-                    } else if (std::isinf(L.y())) {
-                          LOG(ERROR) << StringPrintf(
-                            "Infinite luminance value returned "
-                            "for pixel (%d, %d), sample %d. Setting to black.",
-                            pixel.x, pixel.y,
-                            (int)tileSampler->CurrentSampleNumber());
-                        L = Spectrum(0.f);
-                    }
-                    VLOG(1) << "Camera sample: " << cameraSample << " -> ray: " <<
-                        ray << " -> L = " << L;
-
-                    // Add camera ray's contribution to image
-                    filmTile->AddSample(cameraSample.pFilm, L, rayWeight);
-
-                    // Free _MemoryArena_ memory from computing image sample
-                    // value
-                    arena.Reset();
-                } while (tileSampler->StartNextSample());
-            }
-            LOG(INFO) << "Finished image tile " << tileBounds;
-
-            // Merge image tile into _Film_
-            camera->film->MergeFilmTile(std::move(filmTile));
-            reporter.Update();
-        }, nTiles);
-        reporter.Done();
+Spectrum SamplerIntegrator::CheckRadiance(const Spectrum &L,
+                                          const Point2i &pixel,
+                                          int64_t sampleNumber) const {
+    if (L.HasNaNs()) {
+        LOG(ERROR) << StringPrintf(
+            "Not-a-number radiance value returned "
+            "for pixel (%d, %d), sample %d. Setting to black.",
+            pixel.x, pixel.y, (int)sampleNumber);
+        return Spectrum(0.f);
+    } else if (L.y() < -1e-5) {
+        LOG(ERROR) << StringPrintf(
+            "Negative luminance value, %f, returned "
+            "for pixel (%d, %d), sample %d. Setting to black.",
+            L.y(), pixel.x, pixel.y, (int)sampleNumber);
+        return Spectrum(0.f);
+    } else if (std::isinf(L.y())) {
+        LOG(ERROR) << StringPrintf(
+            "Infinite luminance value returned "
+            "for pixel (%d, %d), sample %d. Setting to black.",
+            pixel.x, pixel.y, (int)sampleNumber);
+        return Spectrum(0.f);
     }
-    LOG(INFO) << "Rendering finished";
-
-    // Save final image after rendering
-    camera->film->WriteImage();
+    return L;
 }
 
-Spectrum SamplerIntegratorBis::SpecularReflect(
+Spectrum SamplerIntegrator::SpecularReflect(
     const RayDifferential &ray, const SurfaceInteraction &isect,
-    const Scene &scene, Sampler &sampler, MemoryArena &arena, int depth) {
+    const Scene &scene, Sampler &sampler, MemoryArena &arena, int depth) const {
     // Compute specular reflection direction _wi_ and BSDF value
     Vector3f wo = isect.wo, wi;
     Float pdf;
@@ -608,9 +522,9 @@ Spectrum SamplerIntegratorBis::SpecularReflect(
         return Spectrum(0.f);
 }
 
-Spectrum SamplerIntegratorBis::SpecularTransmit(
+Spectrum SamplerIntegrator::SpecularTransmit(
     const RayDifferential &ray, const SurfaceInteraction &isect,
-    const Scene &scene, Sampler &sampler, MemoryArena &arena, int depth) {
+    const Scene &scene, Sampler &sampler, MemoryArena &arena, int depth) const {
     Vector3f wo = isect.wo, wi;
     Float pdf;
     const Point3f &p = isect.p;
@@ -46,6 +46,7 @@
 #include "reflection.h"
 #include "sampler.h"
 #include "material.h"
+#include "parallel.h"
 
 namespace pbrt {
 
@@ -65,11 +66,23 @@ Spectrum UniformSampleOneLight(const Interaction &it, const Scene &scene,
                                MemoryArena &arena, Sampler &sampler,
                                bool handleMedia = false,
                                const Distribution1D *lightDistrib = nullptr);
+// Light sample of _EstimateDirect()_'s light sampling strategy, taken
+// ahead of it along with the visibility of its shadow ray
+struct DirectLightSample {
+    Spectrum Li, f;
+    Vector3f wi;
+    Float lightPdf = 0, scatteringPdf = 0;
+    bool unoccluded = false;
+};
 Spectrum EstimateDirect(const Interaction &it, const Point2f &uShading,
                         const Light &light, const Point2f &uLight,
                         const Scene &scene, Sampler &sampler,
                         MemoryArena &arena, bool handleMedia = false,
-                        bool specular = false);
+                        bool specular = false,
+                        const DirectLightSample *lightSample = nullptr);
+Spectrum UnshadowedContribution(const SurfaceInteraction &isect,
+                                const Light &light, const Point2f &uLight,
+                                BxDFType bsdfFlags, VisibilityTester *vis);
 std::unique_ptr<Distribution1D> ComputeLightPowerDistribution(
     const Scene &scene);
 
@@ -80,7 +93,7 @@ class SamplerIntegrator : public Integrator {
     SamplerIntegrator(std::shared_ptr<const Camera> camera,
                       std::shared_ptr<Sampler> sampler,
                       const Bounds2i &pixelBounds)
-        : camera(camera), sampler(sampler), pixelBounds(pixelBounds) {}
+        : camera(camera), pixelBounds(pixelBounds), sampler(sampler) {}
     virtual void Preprocess(const Scene &scene, Sampler &sampler) {}
     void Render(const Scene &scene);
     virtual Spectrum Li(const RayDifferential &ray, const Scene &scene,
@@ -96,47 +109,59 @@ class SamplerIntegrator : public Integrator {
                               MemoryArena &arena, int depth) const;
 
   protected:
+    // SamplerIntegrator Protected Methods
+    // Integrators that learn while rendering keep the data they update in a
+    // ThreadState rather than in the integrator, so that _Li()_ can modify
+    // it without locking. _CreateThreadState()_ is called once per thread
+    // after _Preprocess()_; the state of the thread evaluating a sample is
+    // returned by _GetThreadState()_. _StartTile()_ is called by the worker
+    // that renders a tile before its first pixel; tiles are indexed in
+    // scanline order, which is also the order they are handed out in.
+    // _StartPixel()_ is called before the first sample of each pixel, the
+    // pixels of a tile being visited in scanline order by a single thread.
+    // _ReduceTile()_ is called by the worker that rendered a tile once all
+    // of its samples have been evaluated, and _ReduceRender()_ is called for
+    // each state, in thread order, after all tiles are done.
+    // _RenderTile()_ evaluates the samples of a tile, taking them from
+    // _tileSampler_, and adds them to _filmTile_; the default calls _Li()_
+    // for each sample in turn.
+    class ThreadState {
+      public:
+        virtual ~ThreadState() {}
+    };
+    virtual std::unique_ptr<ThreadState> CreateThreadState() const {
+        return nullptr;
+    }
+    virtual void StartTile(ThreadState *state, int tileIndex,
+                           const Bounds2i &tileBounds) const {}
+    virtual void StartPixel(ThreadState *state, const Point2i &pixel,
+                            const Bounds2i &tileBounds) const {}
+    virtual void ReduceTile(ThreadState *state) const {}
+    virtual void ReduceRender(ThreadState *state) {}
+    virtual void RenderTile(const Scene &scene, const Bounds2i &tileBounds,
+                            Sampler &tileSampler, FilmTile *filmTile,
+                            MemoryArena &arena) const;
+    // Returns _L_, or black after logging an error if _L_ isn't a valid
+    // radiance value for the given sample
+    Spectrum CheckRadiance(const Spectrum &L, const Point2i &pixel,
+                           int64_t sampleNumber) const;
+    // Index of the tile that renders _pixel_, as passed to _StartTile()_
+    int TileIndex(const Point2i &pixel) const;
+    template <typename T>
+    T *GetThreadState() const {
+        return static_cast<T *>(threadStates[ThreadIndex].get());
+    }
+
     // SamplerIntegrator Protected Data
     std::shared_ptr<const Camera> camera;
+    const Bounds2i pixelBounds;
 
   private:
     // SamplerIntegrator Private Data
     std::shared_ptr<Sampler> sampler;
-    const Bounds2i pixelBounds;
+    std::vector<std::unique_ptr<ThreadState>> threadStates;
 };
 
-  
-// SamplerIntegratorBis Declarations (mostly the same as samplerIntegrator but remove the const on the methods)
-class SamplerIntegratorBis : public Integrator {
-  public:
-    // SamplerIntegratorBis Public Methods
-    SamplerIntegratorBis(std::shared_ptr<const Camera> camera,
-                      std::shared_ptr<Sampler> sampler,
-                      const Bounds2i &pixelBounds)
-        : camera(camera), sampler(sampler), pixelBounds(pixelBounds) {}
-    virtual void Preprocess(const Scene &scene, Sampler &sampler) {}
-    void Render(const Scene &scene);
-    virtual Spectrum Li(const RayDifferential &ray, const Scene &scene,
-                        Sampler &sampler, MemoryArena &arena,
-                        int depth = 0) = 0;
-    Spectrum SpecularReflect(const RayDifferential &ray,
-                             const SurfaceInteraction &isect,
-                             const Scene &scene, Sampler &sampler,
-                             MemoryArena &arena, int depth);
-    Spectrum SpecularTransmit(const RayDifferential &ray,
-                              const SurfaceInteraction &isect,
-                              const Scene &scene, Sampler &sampler,
-                              MemoryArena &arena, int depth);
-
-  protected:
-    // SamplerIntegratorBis Protected Data
-    std::shared_ptr<const Camera> camera;
-
-  private:
-    // SamplerIntegratorBis Private Data
-    std::shared_ptr<Sampler> sampler;
-    const Bounds2i pixelBounds;
-};
 
 }  // namespace pbrt
 
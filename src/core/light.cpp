@@ -60,6 +60,18 @@ bool VisibilityTester::Unoccluded(const Scene &scene) const {
     return !scene.IntersectP(p0.SpawnRayTo(p1));
 }
 
+uint64_t VisibilityTester::Unoccluded(const VisibilityTester *const *testers,
+                                      int n, const Scene &scene,
+                                      const Primitive **occluders) {
+    CHECK_LE(n, MaxRayBatchSize);
+    if (n == 0) return 0;
+    Ray rays[MaxRayBatchSize];
+    for (int i = 0; i < n; ++i)
+        rays[i] = testers[i]->p0.SpawnRayTo(testers[i]->p1);
+    uint64_t all = (n == 64) ? ~uint64_t(0) : ((uint64_t(1) << n) - 1);
+    return ~scene.IntersectP(rays, n, occluders) & all;
+}
+
 Spectrum VisibilityTester::Tr(const Scene &scene, Sampler &sampler) const {
     Ray ray(p0.SpawnRayTo(p1));
     Spectrum Tr(1.f);
@@ -77,6 +77,24 @@ class Light {
                                Float *pdfDir) const = 0;
     virtual void Pdf_Le(const Ray &ray, const Normal3f &nLight, Float *pdfPos,
                         Float *pdfDir) const = 0;
+    // Bounds the points the light emits from and the radiant intensity it
+    // emits in any direction, so that the radiance estimate returned by
+    // Sample_Li() at a point at distance d from _bounds_ is at most
+    // _maxIntensity_ / d^2. Lights with no finite extent, or with no
+    // useful bound, return false.
+    virtual bool EmissionBounds(Bounds3f *bounds,
+                                Spectrum *maxIntensity) const {
+        return false;
+    }
+    // Lights whose sample for _u_ doesn't depend on the receiving point
+    // return true, with the sampled point in _pLight_ and its intensity in
+    // _I_: the radiance arriving at a point at distance d is _I_ / d^2,
+    // times the cosine at _pLight_ if it has a surface normal, in which case
+    // one-sided lights only emit on the side the normal faces.
+    virtual bool SampleFixedPoint(const Point2f &u, Interaction *pLight,
+                                  Spectrum *I, bool *twoSided) const {
+        return false;
+    }
 
     // Light Public Data
     const int flags;
@@ -97,6 +115,13 @@ class VisibilityTester {
     const Interaction &P0() const { return p0; }
     const Interaction &P1() const { return p1; }
     bool Unoccluded(const Scene &scene) const;
+    // Traces the shadow rays of the _n_ (at most _MaxRayBatchSize_) testers
+    // with a single traversal of the scene and returns a mask with bit _i_
+    // set if _testers[i]_ is unoccluded. _occluders_, if given, receives the
+    // occluding primitives as in _Primitive::IntersectP()_.
+    static uint64_t Unoccluded(const VisibilityTester *const *testers, int n,
+                               const Scene &scene,
+                               const Primitive **occluders = nullptr);
     Spectrum Tr(const Scene &scene, Sampler &sampler) const;
 
   private:
@@ -0,0 +1,302 @@
+
+/*
+    pbrt source code is Copyright(c) 1998-2016
+                        Matt Pharr, Greg Humphreys, and Wenzel Jakob.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+// core/lighttree.cpp*
+#include "lighttree.h"
+#include "interaction.h"
+#include "light.h"
+#include "reflection.h"
+#include "rng.h"
+#include "stats.h"
+#include <algorithm>
+
+namespace pbrt {
+
+STAT_MEMORY_COUNTER("Memory/Light trees", treeBytes);
+STAT_INT_DISTRIBUTION("Integrator/Light cut size", cutSize);
+STAT_RATIO("Integrator/Light cut representatives evaluated per cut",
+           nRepresentativesEvaluated, nCuts);
+
+// LightTree Method Definitions
+LightTree::LightTree(const std::vector<Bounds3f> &lightBounds,
+                     const std::vector<Float> &lightIntensity, uint64_t seed)
+    : nLights(lightBounds.size()) {
+    CHECK_EQ(lightBounds.size(), lightIntensity.size());
+    if (nLights == 0) return;
+    nodes.reserve(2 * nLights - 1);
+    std::vector<int> lights(nLights);
+    for (int i = 0; i < nLights; ++i) lights[i] = i;
+    RNG rng(seed);
+    recursiveBuild(lights, 0, nLights, lightBounds, lightIntensity, rng);
+    CHECK_EQ((int)nodes.size(), 2 * nLights - 1);
+    treeBytes += nodes.size() * sizeof(LightTreeNode) + sizeof(*this);
+    LOG(INFO) << StringPrintf("Light tree created with %d nodes for %d lights",
+                              (int)nodes.size(), nLights);
+}
+
+LightTree::~LightTree() {}
+
+int LightTree::recursiveBuild(std::vector<int> &lights, int start, int end,
+                              const std::vector<Bounds3f> &lightBounds,
+                              const std::vector<Float> &lightIntensity,
+                              RNG &rng) {
+    CHECK_LT(start, end);
+    int nodeIndex = nodes.size();
+    nodes.push_back(LightTreeNode());
+    if (end - start == 1) {
+        // Create leaf _LightTreeNode_
+        LightTreeNode &node = nodes[nodeIndex];
+        node.bounds = lightBounds[lights[start]];
+        node.intensity = node.representativeIntensity =
+            lightIntensity[lights[start]];
+        node.representative = lights[start];
+        node.secondChild = -1;
+        return nodeIndex;
+    }
+
+    // Compute bound of light centroids, choose split dimension _dim_
+    auto centroid = [&](int light) {
+        return .5f * lightBounds[light].pMin + .5f * lightBounds[light].pMax;
+    };
+    Bounds3f centroidBounds;
+    for (int i = start; i < end; ++i)
+        centroidBounds = Union(centroidBounds, centroid(lights[i]));
+    int dim = centroidBounds.MaximumExtent();
+
+    // Partition lights into two sets; lights that all share the same
+    // centroid are simply split in halves
+    int mid = (start + end) / 2;
+    if (centroidBounds.pMax[dim] > centroidBounds.pMin[dim]) {
+        // Initialize buckets along _dim_
+        PBRT_CONSTEXPR int nBuckets = 12;
+        struct BucketInfo {
+            int count = 0;
+            Float intensity = 0;
+            Bounds3f bounds;
+        };
+        BucketInfo buckets[nBuckets];
+        auto bucketIndex = [&](int light) {
+            int b = nBuckets * centroidBounds.Offset(centroid(light))[dim];
+            return std::min(b, nBuckets - 1);
+        };
+        for (int i = start; i < end; ++i) {
+            BucketInfo &bucket = buckets[bucketIndex(lights[i])];
+            bucket.count++;
+            bucket.intensity += lightIntensity[lights[i]];
+            bucket.bounds = Union(bucket.bounds, lightBounds[lights[i]]);
+        }
+
+        // Split after the bucket that minimizes the Lightcuts cluster
+        // metric, intensity times squared diagonal, summed over both sides.
+        // The first and last buckets are never empty, so both sides of
+        // any split are valid clusters.
+        Float minCost = Infinity;
+        int minCostSplitBucket = 0;
+        for (int i = 0; i < nBuckets - 1; ++i) {
+            Bounds3f b0, b1;
+            Float intensity0 = 0, intensity1 = 0;
+            for (int j = 0; j <= i; ++j) {
+                if (buckets[j].count == 0) continue;
+                b0 = Union(b0, buckets[j].bounds);
+                intensity0 += buckets[j].intensity;
+            }
+            for (int j = i + 1; j < nBuckets; ++j) {
+                if (buckets[j].count == 0) continue;
+                b1 = Union(b1, buckets[j].bounds);
+                intensity1 += buckets[j].intensity;
+            }
+            Float cost = intensity0 * b0.Diagonal().LengthSquared() +
+                         intensity1 * b1.Diagonal().LengthSquared();
+            if (cost < minCost) {
+                minCost = cost;
+                minCostSplitBucket = i;
+            }
+        }
+        int *pmid = std::partition(
+            &lights[start], &lights[end - 1] + 1,
+            [&](int light) { return bucketIndex(light) <= minCostSplitBucket; });
+        mid = pmid - &lights[0];
+        CHECK(mid > start && mid < end);
+    }
+
+    // Build children and initialize interior node
+    int child0 = recursiveBuild(lights, start, mid, lightBounds,
+                                lightIntensity, rng);
+    int child1 =
+        recursiveBuild(lights, mid, end, lightBounds, lightIntensity, rng);
+    const LightTreeNode &c0 = nodes[child0], &c1 = nodes[child1];
+    LightTreeNode &node = nodes[nodeIndex];
+    node.bounds = Union(c0.bounds, c1.bounds);
+    node.intensity = c0.intensity + c1.intensity;
+    // Choose the representative among the children's, with probability
+    // proportional to their intensity
+    Float p0 = node.intensity > 0 ? c0.intensity / node.intensity : .5f;
+    const LightTreeNode &rep = (rng.UniformFloat() < p0) ? c0 : c1;
+    node.representative = rep.representative;
+    node.representativeIntensity = rep.representativeIntensity;
+    node.secondChild = child1;
+    return nodeIndex;
+}
+
+Float LightTree::errorBound(const LightTreeNode &node,
+                            const SurfaceInteraction &isect,
+                            Float fBound) const {
+    // Leaves are evaluated exactly
+    if (node.secondChild == -1) return 0;
+    Float d2 = DistanceSquared(isect.p, node.bounds);
+    if (d2 == 0) return Infinity;
+
+    // Bound the cosine with the shading normal over the node's bounds, using
+    // their bounds in a frame where the normal is the $z$ axis
+    Vector3f n(isect.shading.n), s, t;
+    CoordinateSystem(n, &s, &t);
+    Bounds3f local;
+    for (int c = 0; c < 8; ++c) {
+        Vector3f v = node.bounds.Corner(c) - isect.p;
+        local = Union(local, Point3f(Dot(v, s), Dot(v, t), Dot(v, n)));
+    }
+    auto minSquared = [](Float a, Float b) {
+        return (a <= 0 && b >= 0) ? 0 : std::min(a * a, b * b);
+    };
+    Float z = std::max(std::abs(local.pMin.z), std::abs(local.pMax.z));
+    Float xy2 = minSquared(local.pMin.x, local.pMax.x) +
+                minSquared(local.pMin.y, local.pMax.y);
+    Float cosBound = (z > 0) ? z / std::sqrt(xy2 + z * z) : 0;
+    return fBound * cosBound * node.intensity / d2;
+}
+
+int LightTree::Cut(const SurfaceInteraction &isect, BxDFType bsdfFlags,
+                   const std::function<Spectrum(int)> &evalLight,
+                   Float maxRelativeError, int maxCutSize,
+                   LightCutEntry *cut) const {
+    if (nLights == 0) return 0;
+    CHECK(isect.bsdf);
+    maxCutSize = MaxCutEntries(maxCutSize);
+    // Lambertian BSDFs are constant over each hemisphere, so their values
+    // along the normal bound them over any cluster. Other BSDFs may peak
+    // anywhere in a cluster's solid angle, so their clusters are refined
+    // regardless of the error tolerance, the largest geometric bounds
+    // first, until they are single lights or the cut is full.
+    Spectrum R;
+    bool boundedBSDF = isect.bsdf->IsLambertian(&R, bsdfFlags);
+    Float fBound = 1;
+    if (boundedBSDF) {
+        Vector3f n(isect.shading.n);
+        fBound = std::max(isect.bsdf->f(isect.wo, n, bsdfFlags).y(), (Float)0) +
+                 std::max(isect.bsdf->f(isect.wo, -n, bsdfFlags).y(), (Float)0);
+    }
+    int nEvaluated = 0;
+    auto initEntry = [&](int nodeIndex, const LightCutEntry *parent,
+                         LightCutEntry *entry) {
+        const LightTreeNode &node = nodes[nodeIndex];
+        entry->nodeIndex = nodeIndex;
+        entry->representative = node.representative;
+        // A child shares its representative with its parent half of the
+        // time; it doesn't need to be evaluated again then
+        if (parent && parent->representative == node.representative)
+            entry->LRepresentative = parent->LRepresentative;
+        else {
+            entry->LRepresentative = evalLight(node.representative);
+            ++nEvaluated;
+        }
+        entry->L = node.representativeIntensity > 0
+                       ? entry->LRepresentative *
+                             (node.intensity / node.representativeIntensity)
+                       : Spectrum(0.f);
+        entry->errorBound = errorBound(node, isect, fBound);
+    };
+    auto byErrorBound = [](const LightCutEntry &a, const LightCutEntry &b) {
+        return a.errorBound < b.errorBound;
+    };
+
+    // Start from the root, and refine the cluster with the largest error
+    // bound until all of them are small enough; _cut_ is kept as a heap and
+    // _y_ is the luminance of the total estimate
+    int nEntries = 1;
+    initEntry(0, nullptr, &cut[0]);
+    Float y = cut[0].L.y();
+    while (nEntries < maxCutSize) {
+        const LightCutEntry &worst = cut[0];
+        if (nodes[worst.nodeIndex].secondChild == -1 ||
+            (boundedBSDF && worst.errorBound <= maxRelativeError * y))
+            break;
+        LightCutEntry parent = worst;
+        std::pop_heap(cut, cut + nEntries, byErrorBound);
+        --nEntries;
+        y -= parent.L.y();
+        int children[2] = {parent.nodeIndex + 1,
+                           nodes[parent.nodeIndex].secondChild};
+        for (int child : children) {
+            initEntry(child, &parent, &cut[nEntries]);
+            y += cut[nEntries].L.y();
+            std::push_heap(cut, cut + ++nEntries, byErrorBound);
+        }
+    }
+    ReportValue(cutSize, nEntries);
+    nRepresentativesEvaluated += nEvaluated;
+    ++nCuts;
+    return nEntries;
+}
+
+void LightTree::ClusterLights(int nodeIndex, std::vector<int> *lights) const {
+    const LightTreeNode &node = nodes[nodeIndex];
+    if (node.secondChild == -1)
+        lights->push_back(node.representative);
+    else {
+        ClusterLights(nodeIndex + 1, lights);
+        ClusterLights(node.secondChild, lights);
+    }
+}
+
+std::unique_ptr<LightTree> CreateLightTree(
+    const std::vector<const Light *> &lights, const std::vector<int> &nSamples,
+    std::vector<int> *treeLights, std::vector<int> *otherLights) {
+    CHECK_EQ(lights.size(), nSamples.size());
+    std::vector<Bounds3f> lightBounds;
+    std::vector<Float> lightIntensity;
+    treeLights->clear();
+    otherLights->clear();
+    for (size_t i = 0; i < lights.size(); ++i) {
+        Bounds3f bounds;
+        Spectrum maxIntensity;
+        if (lights[i]->EmissionBounds(&bounds, &maxIntensity)) {
+            treeLights->push_back(i);
+            lightBounds.push_back(bounds);
+            lightIntensity.push_back(maxIntensity.y() / nSamples[i]);
+        } else
+            otherLights->push_back(i);
+    }
+    return std::unique_ptr<LightTree>(
+        new LightTree(lightBounds, lightIntensity));
+}
+
+}  // namespace pbrt
@@ -0,0 +1,139 @@
+
+/*
+    pbrt source code is Copyright(c) 1998-2016
+                        Matt Pharr, Greg Humphreys, and Wenzel Jakob.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+#if defined(_MSC_VER)
+#define NOMINMAX
+#pragma once
+#endif
+
+#ifndef PBRT_CORE_LIGHTTREE_H
+#define PBRT_CORE_LIGHTTREE_H
+
+// core/lighttree.h*
+#include "pbrt.h"
+#include "geometry.h"
+#include "spectrum.h"
+#include "reflection.h"
+#include <functional>
+#include <vector>
+
+namespace pbrt {
+
+// A LightCutEntry is one cluster of a light cut: the contribution of all of
+// the cluster's point lights is estimated from the contribution of its
+// representative, scaled by the ratio of their intensities.
+struct LightCutEntry {
+    int nodeIndex;
+    // Index of the representative point light, as given to the LightTree
+    // constructor.
+    int representative;
+    // Contribution of the representative alone, and estimated contribution
+    // of the whole cluster.
+    Spectrum LRepresentative, L;
+    // Upper bound on the luminance of the contribution of the cluster, and
+    // thus on the error of _L_, for Lambertian BSDFs; for others, the bound
+    // leaves out the BSDF and only orders the clusters.
+    Float errorBound;
+};
+
+// LightTree Declarations
+struct LightTreeNode {
+    // Union of the bounds of the node's point lights
+    Bounds3f bounds;
+    // Sum of the intensities of the node's point lights, and intensity of
+    // its representative
+    Float intensity, representativeIntensity;
+    int representative;
+    // Index of the second child, or -1 for leaves; the first child of an
+    // interior node immediately follows it.
+    int secondChild;
+};
+
+
+// LightTree is a binary cluster hierarchy over point lights, in the spirit
+// of Lightcuts (Walter et al. 2005). Each light is given as the bounds of
+// the points it may be sampled at and the luminance of its maximum
+// intensity (see Light::EmissionBounds()); rather than evaluating every
+// light, a shading point evaluates a cut through the tree, refining the
+// clusters whose error bound is too large compared to the total estimate.
+class LightTree {
+  public:
+    // LightTree Public Methods
+    LightTree(const std::vector<Bounds3f> &lightBounds,
+              const std::vector<Float> &lightIntensity, uint64_t seed = 0);
+    ~LightTree();
+    int NumLights() const { return nLights; }
+    // Maximum number of entries Cut() may write for the given maximum cut
+    // size.
+    int MaxCutEntries(int maxCutSize) const {
+        return std::max(1, std::min(maxCutSize, nLights));
+    }
+    // Computes a cut for the shading point _isect_, which must have a BSDF,
+    // and stores its entries in _cut_, returning their number. _evalLight_
+    // is called to get the contribution of the representative point
+    // lights; clusters are refined until each error bound is at most
+    // _maxRelativeError_ times the luminance of the total estimate, or the
+    // cut reaches _maxCutSize_ entries. The error bounds only hold for
+    // Lambertian BSDFs; for others, the cut is refined until it reaches
+    // _maxCutSize_ entries or holds single lights.
+    int Cut(const SurfaceInteraction &isect, BxDFType bsdfFlags,
+            const std::function<Spectrum(int)> &evalLight,
+            Float maxRelativeError, int maxCutSize, LightCutEntry *cut) const;
+    // Appends the indices of the point lights in the cluster of node
+    // _nodeIndex_ to _lights_.
+    void ClusterLights(int nodeIndex, std::vector<int> *lights) const;
+
+  private:
+    // LightTree Private Methods
+    int recursiveBuild(std::vector<int> &lights, int start, int end,
+                       const std::vector<Bounds3f> &lightBounds,
+                       const std::vector<Float> &lightIntensity, RNG &rng);
+    Float errorBound(const LightTreeNode &node, const SurfaceInteraction &isect,
+                     Float fBound) const;
+
+    // LightTree Private Data
+    const int nLights;
+    std::vector<LightTreeNode> nodes;
+};
+
+// Builds a LightTree over point lights that each stand for one of
+// _nSamples[i]_ samples of _lights[i]_. Point lights whose light can't bound
+// its emission are left out of the tree; the indices of the point lights
+// that are in the tree, in tree order, and of those that aren't are
+// returned in _treeLights_ and _otherLights_.
+std::unique_ptr<LightTree> CreateLightTree(
+    const std::vector<const Light *> &lights, const std::vector<int> &nSamples,
+    std::vector<int> *treeLights, std::vector<int> *otherLights);
+
+}  // namespace pbrt
+
+#endif  // PBRT_CORE_LIGHTTREE_H
@@ -399,6 +399,35 @@ inline int CountTrailingZeros(uint32_t v) {
 #endif
 }
 
+inline int CountTrailingZeros(uint64_t v) {
+#if defined(PBRT_IS_MSVC)
+    unsigned long index;
+#if defined(_WIN64)
+    if (_BitScanForward64(&index, v))
+        return index;
+#else
+    if (_BitScanForward(&index, v & 0xffffffff))
+        return index;
+    if (_BitScanForward(&index, v >> 32))
+        return index + 32;
+#endif  // _WIN64
+    return 64;
+#else
+    return __builtin_ctzll(v);
+#endif
+}
+
+// 64-bit FNV-1a hash of _nBytes_ bytes, continuing from _hash_
+inline uint64_t HashBytes(const void *data, size_t nBytes,
+                          uint64_t hash = 14695981039346656037ull) {
+    const unsigned char *bytes = (const unsigned char *)data;
+    for (size_t i = 0; i < nBytes; ++i) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
 template <typename Predicate>
 int FindInterval(int size, const Predicate &pred) {
     int first = 0, len = size;
@@ -95,6 +95,39 @@ bool TransformedPrimitive::IntersectP(const Ray &r) const {
     return primitive->IntersectP(InterpolatedWorldToPrim(r));
 }
 
+bool TransformedPrimitive::MotionWorldBound(Float time0, Float time1,
+                                            Bounds3f *bounds) const {
+    Bounds3f primBounds;
+    bool primitiveMoves =
+        primitive->MotionWorldBound(time0, time1, &primBounds);
+    if (!primitiveMoves) {
+        if (!PrimitiveToWorld.IsAnimated()) return false;
+        primBounds = primitive->WorldBound();
+    }
+    *bounds = PrimitiveToWorld.MotionBounds(primBounds, time0, time1);
+    return true;
+}
+
+uint64_t Primitive::IntersectP(const Ray *rays, int nRays,
+                               const Primitive **occluders) const {
+    CHECK_LE(nRays, MaxRayBatchSize);
+    uint64_t occluded = 0;
+    for (int i = 0; i < nRays; ++i) {
+        if (IntersectP(rays[i])) occluded |= uint64_t(1) << i;
+        if (occluders) occluders[i] = nullptr;
+    }
+    return occluded;
+}
+
+uint64_t Primitive::Intersect(Ray *rays, int nRays,
+                              SurfaceInteraction *isects) const {
+    CHECK_LE(nRays, MaxRayBatchSize);
+    uint64_t hits = 0;
+    for (int i = 0; i < nRays; ++i)
+        if (Intersect(rays[i], &isects[i])) hits |= uint64_t(1) << i;
+    return hits;
+}
+
 // GeometricPrimitive Method Definitions
 GeometricPrimitive::GeometricPrimitive(const std::shared_ptr<Shape> &shape,
                                        const std::shared_ptr<Material> &material,
@@ -109,6 +142,14 @@ GeometricPrimitive::GeometricPrimitive(const std::shared_ptr<Shape> &shape,
 
 Bounds3f GeometricPrimitive::WorldBound() const { return shape->WorldBound(); }
 
+Bounds3f GeometricPrimitive::ClippedWorldBound(const Bounds3f &clip) const {
+    return shape->ClippedWorldBound(clip);
+}
+
+bool GeometricPrimitive::GetTriangleVertices(Point3f p[3]) const {
+    return shape->GetTriangleVertices(p);
+}
+
 bool GeometricPrimitive::IntersectP(const Ray &r) const {
     return shape->IntersectP(r);
 }
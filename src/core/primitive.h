@@ -47,14 +47,44 @@
 
 namespace pbrt {
 
+// Maximum number of rays in a batched occlusion query; one bit of the
+// returned mask per ray.
+static PBRT_CONSTEXPR int MaxRayBatchSize = 64;
+
 // Primitive Declarations
 class Primitive {
   public:
     // Primitive Interface
     virtual ~Primitive();
     virtual Bounds3f WorldBound() const = 0;
+    // Bounds of the part of the primitive inside _clip_, used by builds
+    // that split primitives across nodes
+    virtual Bounds3f ClippedWorldBound(const Bounds3f &clip) const {
+        return pbrt::Intersect(WorldBound(), clip);
+    }
+    // Returns false if the primitive's bounds don't change over time;
+    // otherwise sets _*bounds_ to its bounds between _time0_ and _time1_
+    virtual bool MotionWorldBound(Float time0, Float time1,
+                                  Bounds3f *bounds) const {
+        return false;
+    }
+    // Returns true and the vertices of the primitive's triangle if
+    // _Intersect()_ and _IntersectP()_ only test the ray against it; see
+    // _Shape::GetTriangleVertices()_
+    virtual bool GetTriangleVertices(Point3f p[3]) const { return false; }
     virtual bool Intersect(const Ray &r, SurfaceInteraction *) const = 0;
     virtual bool IntersectP(const Ray &r) const = 0;
+    // Tests the _nRays_ (at most _MaxRayBatchSize_) rays for occlusion and
+    // returns a mask with bit _i_ set if _rays[i]_ is occluded. If
+    // _occluders_ is given, _occluders[i]_ is set to a primitive occluding
+    // _rays[i]_, or to _nullptr_ if the aggregate can't tell.
+    virtual uint64_t IntersectP(const Ray *rays, int nRays,
+                                const Primitive **occluders = nullptr) const;
+    // Finds the closest intersection of each of the _nRays_ (at most
+    // _MaxRayBatchSize_) rays as _Intersect()_ does, updating _rays[i].tMax_
+    // and _isects[i]_, and returns a mask with bit _i_ set if _rays[i]_ hit.
+    virtual uint64_t Intersect(Ray *rays, int nRays,
+                               SurfaceInteraction *isects) const;
     virtual const AreaLight *GetAreaLight() const = 0;
     virtual const Material *GetMaterial() const = 0;
     virtual void ComputeScatteringFunctions(SurfaceInteraction *isect,
@@ -68,6 +98,8 @@ class GeometricPrimitive : public Primitive {
   public:
     // GeometricPrimitive Public Methods
     virtual Bounds3f WorldBound() const;
+    virtual Bounds3f ClippedWorldBound(const Bounds3f &clip) const;
+    virtual bool GetTriangleVertices(Point3f p[3]) const;
     virtual bool Intersect(const Ray &r, SurfaceInteraction *isect) const;
     virtual bool IntersectP(const Ray &r) const;
     GeometricPrimitive(const std::shared_ptr<Shape> &shape,
@@ -108,6 +140,7 @@ class TransformedPrimitive : public Primitive {
     Bounds3f WorldBound() const {
         return PrimitiveToWorld.MotionBounds(primitive->WorldBound());
     }
+    bool MotionWorldBound(Float time0, Float time1, Bounds3f *bounds) const;
 
   private:
     // TransformedPrimitive Private Data
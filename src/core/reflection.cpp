@@ -692,6 +692,18 @@ Spectrum BSDF::f(const Vector3f &woW, const Vector3f &wiW,
     return f;
 }
 
+bool BSDF::IsLambertian(Spectrum *R, BxDFType flags) const {
+    *R = Spectrum(0.f);
+    for (int i = 0; i < nBxDFs; ++i) {
+        if (!bxdfs[i]->MatchesFlags(flags)) continue;
+        const LambertianReflection *lambertian =
+            dynamic_cast<const LambertianReflection *>(bxdfs[i]);
+        if (!lambertian) return false;
+        *R += lambertian->rho(Vector3f(), 0, nullptr);
+    }
+    return true;
+}
+
 Spectrum BSDF::rho(int nSamples, const Point2f *samples1,
                    const Point2f *samples2, BxDFType flags) const {
     Spectrum ret(0.f);
@@ -194,6 +194,9 @@ class BSDF {
                       BxDFType *sampledType = nullptr) const;
     Float Pdf(const Vector3f &wo, const Vector3f &wi,
               BxDFType flags = BSDF_ALL) const;
+    // Returns true if the components matching _flags_ are all Lambertian
+    // reflections, setting _R_ to their total reflectance.
+    bool IsLambertian(Spectrum *R, BxDFType flags = BSDF_ALL) const;
     std::string ToString() const;
 
     // BSDF Public Data
@@ -54,6 +54,20 @@ bool Scene::IntersectP(const Ray &ray) const {
     return aggregate->IntersectP(ray);
 }
 
+uint64_t Scene::IntersectP(const Ray *rays, int nRays,
+                           const Primitive **occluders) const {
+    nShadowTests += nRays;
+    for (int i = 0; i < nRays; ++i) DCHECK_NE(rays[i].d, Vector3f(0,0,0));
+    return aggregate->IntersectP(rays, nRays, occluders);
+}
+
+uint64_t Scene::Intersect(Ray *rays, int nRays,
+                          SurfaceInteraction *isects) const {
+    nIntersectionTests += nRays;
+    for (int i = 0; i < nRays; ++i) DCHECK_NE(rays[i].d, Vector3f(0,0,0));
+    return aggregate->Intersect(rays, nRays, isects);
+}
+
 bool Scene::IntersectTr(Ray ray, Sampler &sampler, SurfaceInteraction *isect,
                         Spectrum *Tr) const {
     *Tr = Spectrum(1.f);
@@ -64,6 +64,9 @@ class Scene {
     const Bounds3f &WorldBound() const { return worldBound; }
     bool Intersect(const Ray &ray, SurfaceInteraction *isect) const;
     bool IntersectP(const Ray &ray) const;
+    uint64_t IntersectP(const Ray *rays, int nRays,
+                        const Primitive **occluders = nullptr) const;
+    uint64_t Intersect(Ray *rays, int nRays, SurfaceInteraction *isects) const;
     bool IntersectTr(Ray ray, Sampler &sampler, SurfaceInteraction *isect,
                      Spectrum *transmittance) const;
 
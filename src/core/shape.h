@@ -56,6 +56,15 @@ class Shape {
     virtual ~Shape();
     virtual Bounds3f ObjectBound() const = 0;
     virtual Bounds3f WorldBound() const;
+    // Returns bounds of the part of the shape inside _clip_, possibly empty;
+    // shapes that can't do better than their world bound clip it.
+    virtual Bounds3f ClippedWorldBound(const Bounds3f &clip) const {
+        return pbrt::Intersect(WorldBound(), clip);
+    }
+    // If the shape is a triangle whose intersections only depend on its
+    // vertices, returns true and its world-space vertices in _p_, so that
+    // aggregates can test it together with other triangles.
+    virtual bool GetTriangleVertices(Point3f p[3]) const { return false; }
     virtual bool Intersect(const Ray &ray, Float *tHit,
                            SurfaceInteraction *isect,
                            bool testAlphaTexture = true) const = 0;
@@ -74,6 +83,9 @@ class Shape {
     virtual Interaction Sample(const Interaction &ref, const Point2f &u,
                                Float *pdf) const;
     virtual Float Pdf(const Interaction &ref, const Vector3f &wi) const;
+    // Returns true if the point sampled for |u| given a reference point
+    // isn't the one sampled by area, Sample(u, pdf).
+    virtual bool SampleDependsOnReference() const { return false; }
 
     // Returns the solid angle subtended by the shape w.r.t. the reference
     // point p, given in world space. Some shapes compute this value in
@@ -90,6 +90,16 @@ void PrintStats(FILE *dest) { statsAccumulator.Print(dest); }
 
 void ClearStats() { statsAccumulator.Clear(); }
 
+int64_t GetStatsCounter(const std::string &name) {
+    return statsAccumulator.GetCounter(name);
+}
+
+void GetStatsRatio(const std::string &name, int64_t *num, int64_t *denom) {
+    std::pair<int64_t, int64_t> ratio = statsAccumulator.GetRatio(name);
+    *num = ratio.first;
+    *denom = ratio.second;
+}
+
 static void getCategoryAndTitle(const std::string &str, std::string *category,
                                 std::string *title) {
     const char *s = str.c_str();
@@ -70,6 +70,9 @@ class StatRegisterer {
 
 void PrintStats(FILE *dest);
 void ClearStats();
+int64_t GetStatsCounter(const std::string &name);
+// Returns the numerator and denominator of a ratio or percentage statistic
+void GetStatsRatio(const std::string &name, int64_t *num, int64_t *denom);
 void ReportThreadStats();
 
 class StatsAccumulator {
@@ -120,6 +123,18 @@ class StatsAccumulator {
         ratios[name].second += denom;
     }
 
+    int64_t GetCounter(const std::string &name) const {
+        auto iter = counters.find(name);
+        return iter == counters.end() ? 0 : iter->second;
+    }
+    std::pair<int64_t, int64_t> GetRatio(const std::string &name) const {
+        auto iter = ratios.find(name);
+        if (iter != ratios.end()) return iter->second;
+        iter = percentages.find(name);
+        return iter == percentages.end() ? std::make_pair(int64_t(0), int64_t(0))
+                                         : iter->second;
+    }
+
     void Print(FILE *file);
     void Clear();
 
@@ -361,6 +376,15 @@ void CleanupProfiler();
     }                                                         \
     static StatRegisterer STATS_REG##numVar(STATS_FUNC##numVar)
 
+// Statistics updated in the innermost loops of the ray traversals, like the
+// nodes each ray visits, are only gathered when PBRT_TRAVERSAL_STATS is
+// defined; _statement_ compiles to nothing otherwise
+#ifdef PBRT_TRAVERSAL_STATS
+#define TRAVERSAL_STAT(statement) statement
+#else
+#define TRAVERSAL_STAT(statement)
+#endif
+
 }  // namespace pbrt
 
 #endif  // PBRT_CORE_STATS_H
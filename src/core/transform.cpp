@@ -1246,4 +1246,49 @@ Bounds3f AnimatedTransform::BoundPointMotion(const Point3f &p) const {
     return bounds;
 }
 
+Bounds3f AnimatedTransform::MotionBounds(const Bounds3f &b, Float time0,
+                                         Float time1) const {
+    time0 = Clamp(time0, startTime, endTime);
+    time1 = Clamp(time1, startTime, endTime);
+    if (!actuallyAnimated || (time0 == startTime && time1 == endTime))
+        return MotionBounds(b);
+    Transform t0, t1;
+    Interpolate(time0, &t0);
+    Interpolate(time1, &t1);
+    // Without rotation, points move linearly
+    if (hasRotation == false) return Union(t0(b), t1(b));
+    Bounds3f bounds;
+    for (int corner = 0; corner < 8; ++corner)
+        bounds =
+            Union(bounds, BoundPointMotion(b.Corner(corner), time0, time1));
+    return bounds;
+}
+
+Bounds3f AnimatedTransform::BoundPointMotion(const Point3f &p, Float time0,
+                                             Float time1) const {
+    if (!actuallyAnimated) return Bounds3f((*startTransform)(p));
+    Float u0 = (time0 - startTime) / (endTime - startTime);
+    Float u1 = (time1 - startTime) / (endTime - startTime);
+    Bounds3f bounds((*this)(time0, p), (*this)(time1, p));
+    Float cosTheta = Dot(R[0], R[1]);
+    Float theta = std::acos(Clamp(cosTheta, -1, 1));
+    for (int c = 0; c < 3; ++c) {
+        // Find the motion derivative zeros over the whole interval, as
+        // interval arithmetic over a short one reports spurious zeros, and
+        // keep the ones between the two times
+        Float zeros[8];
+        int nZeros = 0;
+        IntervalFindZeros(c1[c].Eval(p), c2[c].Eval(p), c3[c].Eval(p),
+                          c4[c].Eval(p), c5[c].Eval(p), theta, Interval(0., 1.),
+                          zeros, &nZeros);
+        CHECK_LE(nZeros, sizeof(zeros) / sizeof(zeros[0]));
+        for (int i = 0; i < nZeros; ++i) {
+            if (zeros[i] <= u0 || zeros[i] >= u1) continue;
+            Point3f pz = (*this)(Lerp(zeros[i], startTime, endTime), p);
+            bounds = Union(bounds, pz);
+        }
+    }
+    return bounds;
+}
+
 }  // namespace pbrt
@@ -424,8 +424,13 @@ class AnimatedTransform {
     bool HasScale() const {
         return startTransform->HasScale() || endTransform->HasScale();
     }
+    bool IsAnimated() const { return actuallyAnimated; }
     Bounds3f MotionBounds(const Bounds3f &b) const;
+    // Bounds of the motion of _b_ between _time0_ and _time1_ only
+    Bounds3f MotionBounds(const Bounds3f &b, Float time0, Float time1) const;
     Bounds3f BoundPointMotion(const Point3f &p) const;
+    Bounds3f BoundPointMotion(const Point3f &p, Float time0,
+                              Float time1) const;
 
   private:
     // AnimatedTransform Private Data
@@ -0,0 +1,249 @@
+
+/*
+    pbrt source code is Copyright(c) 1998-2016
+                        Matt Pharr, Greg Humphreys, and Wenzel Jakob.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+// core/virtuallights.cpp*
+#include "virtuallights.h"
+#include "light.h"
+#include "reflection.h"
+#include "stats.h"
+#if defined(PBRT_HAVE_AVX2) && !defined(PBRT_FLOAT_AS_DOUBLE) && \
+    !defined(PBRT_SAMPLED_SPECTRUM)
+#define PBRT_VIRTUALLIGHTS_AVX2
+#include <immintrin.h>
+#endif
+
+namespace pbrt {
+
+STAT_RATIO("Integrator/Virtual lights evaluated per SIMD evaluation",
+           nVirtualLightsEvaluated, nSIMDEvaluations);
+
+// VirtualPointLights Local Definitions
+// The shading point and its Lambertian BSDF.
+struct LambertianQuery {
+    Float p[3], ng[3], ns[3];
+    Float woNg;
+    Spectrum RInvPi;
+};
+
+// The light arrays, padded to a multiple of eight lights.
+struct LightArrays {
+    int nLights;
+    const Float *px, *py, *pz, *nx, *ny, *nz, *hasNormal, *twoSided;
+    const Float *I[Spectrum::nSamples];
+};
+
+static void EvaluateLambertianScalar(const LightArrays &l,
+                                     const LambertianQuery &q, Spectrum *ld,
+                                     Float *luminance) {
+    for (int i = 0; i < l.nLights; ++i) {
+        ld[i] = Spectrum(0.f);
+        luminance[i] = 0;
+        // Mirror _Sample_Li()_ and _BSDF::f()_ for a light with a fixed
+        // sample
+        Vector3f d(l.px[i] - q.p[0], l.py[i] - q.p[1], l.pz[i] - q.p[2]);
+        Float d2 = d.LengthSquared();
+        if (d2 == 0) continue;
+        Vector3f wi = d / std::sqrt(d2);
+        Float wiNg = wi.x * q.ng[0] + wi.y * q.ng[1] + wi.z * q.ng[2];
+        if (wiNg * q.woNg <= 0) continue;
+        Float cosLight = wi.x * l.nx[i] + wi.y * l.ny[i] + wi.z * l.nz[i];
+        if (l.hasNormal[i] != 0 && l.twoSided[i] == 0 && cosLight >= 0)
+            continue;
+        Float cosShading =
+            std::abs(wi.x * q.ns[0] + wi.y * q.ns[1] + wi.z * q.ns[2]);
+        Float g = cosShading * (l.hasNormal[i] != 0 ? std::abs(cosLight) : 1) /
+                  d2;
+        for (int c = 0; c < Spectrum::nSamples; ++c)
+            ld[i][c] = q.RInvPi[c] * l.I[c][i] * g;
+        luminance[i] = ld[i].y();
+    }
+}
+
+#ifdef PBRT_VIRTUALLIGHTS_AVX2
+__attribute__((target("avx2"))) static void EvaluateLambertianAVX2(
+    const LightArrays &l, const LambertianQuery &q, Spectrum *ld,
+    Float *luminance) {
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1.f);
+    const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+    const __m256 rx = _mm256_set1_ps(q.p[0]), ry = _mm256_set1_ps(q.p[1]),
+                 rz = _mm256_set1_ps(q.p[2]);
+    const __m256 ngx = _mm256_set1_ps(q.ng[0]), ngy = _mm256_set1_ps(q.ng[1]),
+                 ngz = _mm256_set1_ps(q.ng[2]);
+    const __m256 nsx = _mm256_set1_ps(q.ns[0]), nsy = _mm256_set1_ps(q.ns[1]),
+                 nsz = _mm256_set1_ps(q.ns[2]);
+    const __m256 woNg = _mm256_set1_ps(q.woNg);
+    // Luminance weights of _RGBSpectrum::y()_
+    const __m256 yWeight[3] = {_mm256_set1_ps(0.212671f),
+                               _mm256_set1_ps(0.715160f),
+                               _mm256_set1_ps(0.072169f)};
+    __m256 RInvPi[3];
+    for (int c = 0; c < 3; ++c) RInvPi[c] = _mm256_set1_ps(q.RInvPi[c]);
+
+    for (int i = 0; i < l.nLights; i += 8) {
+        // Compute the normalized direction to the eight lights
+        __m256 dx = _mm256_sub_ps(_mm256_loadu_ps(l.px + i), rx);
+        __m256 dy = _mm256_sub_ps(_mm256_loadu_ps(l.py + i), ry);
+        __m256 dz = _mm256_sub_ps(_mm256_loadu_ps(l.pz + i), rz);
+        __m256 d2 = _mm256_add_ps(
+            _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)),
+            _mm256_mul_ps(dz, dz));
+        __m256 invD = _mm256_div_ps(one, _mm256_sqrt_ps(d2));
+        __m256 wx = _mm256_mul_ps(dx, invD), wy = _mm256_mul_ps(dy, invD),
+               wz = _mm256_mul_ps(dz, invD);
+
+        // Find the lights that reflect toward _wo_ and emit toward the point
+        __m256 wiNg = _mm256_add_ps(
+            _mm256_add_ps(_mm256_mul_ps(wx, ngx), _mm256_mul_ps(wy, ngy)),
+            _mm256_mul_ps(wz, ngz));
+        __m256 cosLight = _mm256_add_ps(
+            _mm256_add_ps(_mm256_mul_ps(wx, _mm256_loadu_ps(l.nx + i)),
+                          _mm256_mul_ps(wy, _mm256_loadu_ps(l.ny + i))),
+            _mm256_mul_ps(wz, _mm256_loadu_ps(l.nz + i)));
+        __m256 hasNormal =
+            _mm256_cmp_ps(_mm256_loadu_ps(l.hasNormal + i), zero, _CMP_NEQ_OQ);
+        __m256 twoSided =
+            _mm256_cmp_ps(_mm256_loadu_ps(l.twoSided + i), zero, _CMP_NEQ_OQ);
+        __m256 emits = _mm256_or_ps(
+            _mm256_andnot_ps(hasNormal, _mm256_castsi256_ps(
+                                            _mm256_set1_epi32(-1))),
+            _mm256_or_ps(twoSided, _mm256_cmp_ps(cosLight, zero, _CMP_LT_OQ)));
+        __m256 valid = _mm256_and_ps(
+            _mm256_and_ps(_mm256_cmp_ps(d2, zero, _CMP_GT_OQ),
+                          _mm256_cmp_ps(_mm256_mul_ps(wiNg, woNg), zero,
+                                        _CMP_GT_OQ)),
+            emits);
+
+        // Compute the geometric factor and the contributions
+        __m256 cosShading = _mm256_and_ps(
+            absMask,
+            _mm256_add_ps(
+                _mm256_add_ps(_mm256_mul_ps(wx, nsx), _mm256_mul_ps(wy, nsy)),
+                _mm256_mul_ps(wz, nsz)));
+        __m256 cosFactor =
+            _mm256_blendv_ps(one, _mm256_and_ps(absMask, cosLight), hasNormal);
+        __m256 g = _mm256_and_ps(
+            valid, _mm256_div_ps(_mm256_mul_ps(cosShading, cosFactor), d2));
+        alignas(32) float c[3][8], y[8];
+        __m256 yv = zero;
+        for (int k = 0; k < 3; ++k) {
+            __m256 v = _mm256_mul_ps(
+                _mm256_mul_ps(RInvPi[k], _mm256_loadu_ps(l.I[k] + i)), g);
+            _mm256_store_ps(c[k], v);
+            yv = _mm256_add_ps(yv, _mm256_mul_ps(yWeight[k], v));
+        }
+        _mm256_store_ps(y, yv);
+        for (int j = 0; j < 8 && i + j < l.nLights; ++j) {
+            for (int k = 0; k < 3; ++k) ld[i + j][k] = c[k][j];
+            luminance[i + j] = y[j];
+        }
+    }
+}
+
+static bool HasAVX2() {
+    static const bool hasAVX2 = __builtin_cpu_supports("avx2");
+    return hasAVX2;
+}
+#endif  // PBRT_VIRTUALLIGHTS_AVX2
+
+// VirtualPointLights Method Definitions
+int VirtualPointLights::Add(const Light &light, const Point2f &u,
+                            Float scale) {
+    Interaction pLight;
+    Spectrum I;
+    bool lightTwoSided;
+    if (!light.SampleFixedPoint(u, &pLight, &I, &lightTwoSided)) return -1;
+    // Grow the arrays by eight black lights when they are full
+    if (nLights % 8 == 0) {
+        size_t size = nLights + 8;
+        for (std::vector<Float> *v : {&px, &py, &pz, &nx, &ny, &nz,
+                                      &hasNormal, &twoSided})
+            v->resize(size, 0);
+        for (int c = 0; c < Spectrum::nSamples; ++c) intensity[c].resize(size, 0);
+    }
+    int i = nLights++;
+    px[i] = pLight.p.x;
+    py[i] = pLight.p.y;
+    pz[i] = pLight.p.z;
+    nx[i] = pLight.n.x;
+    ny[i] = pLight.n.y;
+    nz[i] = pLight.n.z;
+    hasNormal[i] = (pLight.n != Normal3f(0, 0, 0)) ? 1 : 0;
+    twoSided[i] = lightTwoSided ? 1 : 0;
+    for (int c = 0; c < Spectrum::nSamples; ++c) intensity[c][i] = I[c] * scale;
+    points.push_back(pLight);
+    return i;
+}
+
+bool VirtualPointLights::EvaluateLambertian(const SurfaceInteraction &isect,
+                                            Spectrum *ld,
+                                            Float *luminance,
+                                            bool allowSIMD) const {
+    BxDFType bsdfFlags = BxDFType(BSDF_ALL & ~BSDF_SPECULAR);
+    Spectrum R;
+    if (!isect.bsdf || !isect.bsdf->IsLambertian(&R, bsdfFlags)) return false;
+    if (nLights == 0) return true;
+    LambertianQuery q;
+    for (int i = 0; i < 3; ++i) {
+        q.p[i] = isect.p[i];
+        q.ng[i] = isect.n[i];
+        q.ns[i] = isect.shading.n[i];
+    }
+    q.woNg = Dot(isect.wo, isect.n);
+    q.RInvPi = R * InvPi;
+    // _BSDF::f()_ is zero when _wo_ is perpendicular to the shading normal
+    if (Dot(isect.wo, isect.shading.n) == 0) q.RInvPi = Spectrum(0.f);
+
+    LightArrays l;
+    l.nLights = nLights;
+    l.px = px.data();
+    l.py = py.data();
+    l.pz = pz.data();
+    l.nx = nx.data();
+    l.ny = ny.data();
+    l.nz = nz.data();
+    l.hasNormal = hasNormal.data();
+    l.twoSided = twoSided.data();
+    for (int c = 0; c < Spectrum::nSamples; ++c) l.I[c] = intensity[c].data();
+#ifdef PBRT_VIRTUALLIGHTS_AVX2
+    if (allowSIMD && HasAVX2()) {
+        nVirtualLightsEvaluated += nLights;
+        ++nSIMDEvaluations;
+        EvaluateLambertianAVX2(l, q, ld, luminance);
+        return true;
+    }
+#endif
+    EvaluateLambertianScalar(l, q, ld, luminance);
+    return true;
+}
+
+}  // namespace pbrt
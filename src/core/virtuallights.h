@@ -0,0 +1,89 @@
+
+/*
+    pbrt source code is Copyright(c) 1998-2016
+                        Matt Pharr, Greg Humphreys, and Wenzel Jakob.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+#if defined(_MSC_VER)
+#define NOMINMAX
+#pragma once
+#endif
+
+#ifndef PBRT_CORE_VIRTUALLIGHTS_H
+#define PBRT_CORE_VIRTUALLIGHTS_H
+
+// core/virtuallights.h*
+#include "pbrt.h"
+#include "geometry.h"
+#include "spectrum.h"
+#include "interaction.h"
+#include <vector>
+
+namespace pbrt {
+
+// VirtualPointLights Declarations
+// A structure-of-arrays snapshot of light samples that don't depend on the
+// receiving point (see Light::SampleFixedPoint()), so that the unshadowed
+// contributions of all of them to a point can be computed together, eight
+// lights at a time when AVX2 is available.
+class VirtualPointLights {
+  public:
+    // VirtualPointLights Public Methods
+    // Adds the sample of _light_ for _u_, its contribution scaled by
+    // _scale_, and returns its index, or -1 if the light can't be
+    // represented by a fixed point.
+    int Add(const Light &light, const Point2f &u, Float scale);
+    int size() const { return nLights; }
+    // The point sampled on the light, to test its visibility.
+    const Interaction &LightPoint(int i) const { return points[i]; }
+    // If the non-specular part of the BSDF at _isect_ is Lambertian, sets
+    // _ld[i]_ to the unshadowed contribution of light _i_ as estimated by
+    // _Sample_Li()_, times its scale, and _luminance[i]_ to its luminance,
+    // and returns true. Returns false for other BSDFs. The AVX2 kernel is
+    // used when available unless _allowSIMD_ is false.
+    bool EvaluateLambertian(const SurfaceInteraction &isect, Spectrum *ld,
+                            Float *luminance, bool allowSIMD = true) const;
+
+  private:
+    // VirtualPointLights Private Data
+    int nLights = 0;
+    // Arrays are padded to a multiple of eight lights with black ones.
+    std::vector<Float> px, py, pz;
+    std::vector<Float> nx, ny, nz;
+    // 1 for lights with a surface normal, 0 for point lights.
+    std::vector<Float> hasNormal;
+    // 1 for lights emitting on both sides of their normal, 0 otherwise.
+    std::vector<Float> twoSided;
+    std::vector<Float> intensity[Spectrum::nSamples];
+    std::vector<Interaction> points;
+};
+
+}  // namespace pbrt
+
+#endif  // PBRT_CORE_VIRTUALLIGHTS_H
@@ -79,24 +79,32 @@ Spectrum AOIntegrator::Li(const RayDifferential &r, const Scene &scene,
         Vector3f t = Cross(isect.n, s);
 
         const Point2f *u = sampler.Get2DArray(nSamples);
-        for (int i = 0; i < nSamples; ++i) {
-            Vector3f wi;
-            Float pdf;
-            if (cosSample) {
-                wi = CosineSampleHemisphere(u[i]);
-                pdf = CosineHemispherePdf(std::abs(wi.z));
-            } else {
-                wi = UniformSampleHemisphere(u[i]);
-                pdf = UniformHemispherePdf();
+        // Trace the occlusion rays in batches
+        Ray rays[MaxRayBatchSize];
+        Float weights[MaxRayBatchSize];
+        for (int first = 0; first < nSamples; first += MaxRayBatchSize) {
+            int nBatch = std::min(nSamples - first, MaxRayBatchSize);
+            for (int b = 0; b < nBatch; ++b) {
+                Vector3f wi;
+                Float pdf;
+                if (cosSample) {
+                    wi = CosineSampleHemisphere(u[first + b]);
+                    pdf = CosineHemispherePdf(std::abs(wi.z));
+                } else {
+                    wi = UniformSampleHemisphere(u[first + b]);
+                    pdf = UniformHemispherePdf();
+                }
+
+                // Transform wi from local frame to world space.
+                wi = Vector3f(s.x * wi.x + t.x * wi.y + n.x * wi.z,
+                              s.y * wi.x + t.y * wi.y + n.y * wi.z,
+                              s.z * wi.x + t.z * wi.y + n.z * wi.z);
+                rays[b] = isect.SpawnRay(wi);
+                weights[b] = Dot(wi, n) / (pdf * nSamples);
             }
-
-            // Transform wi from local frame to world space.
-            wi = Vector3f(s.x * wi.x + t.x * wi.y + n.x * wi.z,
-                          s.y * wi.x + t.y * wi.y + n.y * wi.z,
-                          s.z * wi.x + t.z * wi.y + n.z * wi.z);
-
-            if (!scene.IntersectP(isect.SpawnRay(wi)))
-                L += Dot(wi, n) / (pdf * nSamples);
+            uint64_t occluded = scene.IntersectP(rays, nBatch);
+            for (int b = 0; b < nBatch; ++b)
+                if (!((occluded >> b) & 1)) L += weights[b];
         }
     }
     return L;
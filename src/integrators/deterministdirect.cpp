@@ -5,8 +5,12 @@
 #include "camera.h"
 #include "film.h"
 #include "stats.h"
+#include "parallel.h"
 
 namespace pbrt {
+
+STAT_PERCENT("Integrator/Shadow occluder cache hits", nOccluderCacheHits, nOccluderCacheTests);
+STAT_COUNTER("Integrator/Light source shadow rays", nSourceShadowRays);
 	
 void DeterministDirectIntegrator::Preprocess(const Scene &scene,
                                 Sampler &sampler) {
@@ -50,6 +54,121 @@ void DeterministDirectIntegrator::Preprocess(const Scene &scene,
       }
     }
   }
+  virtualLights = VirtualPointLights();
+  sourceVirtualLight.clear();
+  for (const LightSource &source : lightSources) {
+    sourceVirtualLight.push_back(virtualLights.Add(**source.light, source.uLight, 1.f / source.nSamples));
+  }
+  if (useLightTree) {
+    std::vector<const Light *> lights;
+    std::vector<int> nSamples;
+    for (const LightSource &source : lightSources) {
+      lights.push_back(source.light->get());
+      nSamples.push_back(source.nSamples);
+    }
+    lightTree = CreateLightTree(lights, nSamples, &treeSources, &otherSources);
+  }
+  if (useOccluderCache) {
+    //one cache per thread
+    occluderCache.assign(MaxThreadIndex(), std::vector<const Primitive *>(lightSources.size(), nullptr));
+  }
+}
+
+Spectrum DeterministDirectIntegrator::unshadowedContribution(const LightSource &source,
+							     const SurfaceInteraction &isect,
+							     VisibilityTester *visibility) const {
+  BxDFType bsdfFlags = BxDFType(BSDF_ALL & ~BSDF_SPECULAR);
+  return UnshadowedContribution(isect, **source.light, source.uLight, bsdfFlags, visibility) /
+    source.nSamples;
+}
+
+bool DeterministDirectIntegrator::hitsCachedOccluder(int sourceIndex,
+						     const VisibilityTester &visibility) const {
+  if (!useOccluderCache) {
+    return false;
+  }
+  ++nOccluderCacheTests;
+  //testing the cached occluder alone is counted as a cache test, not as a
+  //shadow ray; the full shadow ray traced on a miss is counted by the caller
+  const Primitive *occluder = occluderCache[ThreadIndex][sourceIndex];
+  if (occluder && occluder->IntersectP(visibility.P0().SpawnRayTo(visibility.P1()))) {
+    ++nOccluderCacheHits;
+    return true;
+  }
+  return false;
+}
+
+Spectrum DeterministDirectIntegrator::sourceContribution(int sourceIndex,
+							 const SurfaceInteraction &isect,
+							 const Scene &scene) const {
+  VisibilityTester visibility;
+  Spectrum ld = unshadowedContribution(lightSources[sourceIndex], isect, &visibility);
+  if (ld.IsBlack() || hitsCachedOccluder(sourceIndex, visibility)) {
+    return Spectrum(0.f);
+  }
+  ++nSourceShadowRays;
+  if (!useOccluderCache) {
+    return visibility.Unoccluded(scene) ? ld : Spectrum(0.f);
+  }
+  const VisibilityTester *tester = &visibility;
+  const Primitive *occluder;
+  if (VisibilityTester::Unoccluded(&tester, 1, scene, &occluder)) {
+    return ld;
+  }
+  if (occluder) {
+    occluderCache[ThreadIndex][sourceIndex] = occluder;
+  }
+  return Spectrum(0.f);
+}
+
+Spectrum DeterministDirectIntegrator::visibleContribution(const int *sources, int nSources,
+							  const SurfaceInteraction &isect,
+							  const Scene &scene, MemoryArena &arena) const {
+  Spectrum L(0.f);
+  VisibilityTester *testers = arena.Alloc<VisibilityTester>(MaxRayBatchSize);
+  Spectrum *ld = arena.Alloc<Spectrum>(MaxRayBatchSize);
+  const VisibilityTester *batch[MaxRayBatchSize];
+  int batchSources[MaxRayBatchSize];
+  const Primitive *occluders[MaxRayBatchSize];
+  int nBatch = 0;
+  //when all the sources are evaluated, the virtual lights are done together
+  Spectrum *virtualLd = arena.Alloc<Spectrum>(virtualLights.size());
+  Float *virtualLuminance = arena.Alloc<Float>(virtualLights.size());
+  bool useVirtualLights = !sources && virtualLights.EvaluateLambertian(isect, virtualLd, virtualLuminance);
+  for(int i = 0; i < nSources; ++i){
+    int sourceIndex = sources ? sources[i] : i;
+    int virtualLight = sourceVirtualLight[sourceIndex];
+    if(useVirtualLights && virtualLight >= 0){
+      ld[nBatch] = virtualLd[virtualLight];
+      if(!ld[nBatch].IsBlack()){
+	testers[nBatch] = VisibilityTester(isect, virtualLights.LightPoint(virtualLight));
+      }
+    }
+    else{
+      ld[nBatch] = unshadowedContribution(lightSources[sourceIndex], isect, &testers[nBatch]);
+    }
+    //only the sources that would contribute need a shadow ray
+    if(!ld[nBatch].IsBlack() && !hitsCachedOccluder(sourceIndex, testers[nBatch])){
+      batch[nBatch] = &testers[nBatch];
+      batchSources[nBatch] = sourceIndex;
+      nBatch++;
+    }
+    if(nBatch == MaxRayBatchSize || (i == nSources - 1 && nBatch > 0)){
+      nSourceShadowRays += nBatch;
+      uint64_t unoccluded = VisibilityTester::Unoccluded(batch, nBatch, scene,
+							 useOccluderCache ? occluders : nullptr);
+      for(int j = 0; j < nBatch; ++j){
+	if(unoccluded & (uint64_t(1) << j)){
+	  L += ld[j];
+	}
+	else if(useOccluderCache && occluders[j]){
+	  occluderCache[ThreadIndex][batchSources[j]] = occluders[j];
+	}
+      }
+      nBatch = 0;
+    }
+  }
+  return L;
 }
 
 Spectrum DeterministDirectIntegrator::Li(const RayDifferential &ray,
@@ -70,28 +189,22 @@ Spectrum DeterministDirectIntegrator::Li(const RayDifferential &ray,
   }
   Vector3f wo = isect.wo;
   L += isect.Le(wo);
-  if (lightSources.size() > 0) {
+  if (lightTree) {
+    L += visibleContribution(otherSources.data(), otherSources.size(), isect, scene, arena);
+    //evaluate a cut of the tree, each cluster through its representative
+    LightCutEntry *cut = arena.Alloc<LightCutEntry>(lightTree->MaxCutEntries(maxCutSize));
+    int nEntries = lightTree->Cut(isect, bsdfFlags, [&](int light) {
+	return sourceContribution(treeSources[light], isect, scene);
+      }, maxCutError, maxCutSize, cut);
+    for(int i = 0; i < nEntries; ++i){
+      L += cut[i].L;
+    }
+  }
+  else if (lightSources.size() > 0) {
     for(int i = 0; i<lightSources.size();++i){
-      Vector3f wi;
-      Float lightPdf = 0;
-      VisibilityTester visibility;
       Point2f uLight = sampler.Get2D();
-      Spectrum Li = (*lightSources[i].light)->Sample_Li(isect, lightSources[i].uLight, &wi, &lightPdf, &visibility);
-      if (lightPdf > 0 && !Li.IsBlack()) {
-	//compute the BSDF
-	Spectrum f;
-	f = isect.bsdf->f(isect.wo, wi, bsdfFlags) * AbsDot(wi, isect.shading.n);
-	if (!f.IsBlack()) {
-	  if (!visibility.Unoccluded(scene)) {
-	    Li = Spectrum(0.f);
-	  }
-	  
-	  if (!Li.IsBlack()) {
-	    L += (f * Li / lightPdf) / lightSources[i].nSamples;
-	  }
-	}
-      }
     }
+    L += visibleContribution(nullptr, lightSources.size(), isect, scene, arena);
   }
   if (depth + 1 < maxDepth) {
     // Trace rays for specular reflection and refraction
@@ -119,6 +232,17 @@ DeterministDirectIntegrator *CreateDeterministDirectIntegrator(
                 Error("Degenerate \"pixelbounds\" specified.");
         }
     }
-    return new DeterministDirectIntegrator(maxDepth, camera, sampler, pixelBounds);
+    bool useLightTree = params.FindOneBool("lighttree", false);
+    Float maxCutError = params.FindOneFloat("lightcuterror", 0.02f);
+    int maxCutSize = params.FindOneInt("maxcutsize", 1000);
+    if (maxCutError < 0 || maxCutSize < 1) {
+      Error("Expected \"lightcuterror\" to be positive and \"maxcutsize\" to be at least 1");
+      maxCutError = std::max(maxCutError, (Float)0);
+      maxCutSize = std::max(maxCutSize, 1);
+    }
+    bool useOccluderCache = params.FindOneBool("occludercache", false);
+    return new DeterministDirectIntegrator(maxDepth, camera, sampler, pixelBounds,
+					   useLightTree, maxCutError, maxCutSize,
+					   useOccluderCache);
   }		
 }  // namespace pbrt
@@ -10,6 +10,8 @@
 #include "pbrt.h"
 #include "integrator.h"
 #include "scene.h"
+#include "lighttree.h"
+#include "virtuallights.h"
 
 namespace pbrt {
 class DeterministDirectIntegrator : public SamplerIntegrator {
@@ -17,9 +19,13 @@ class DeterministDirectIntegrator : public SamplerIntegrator {
     //constructor
     DeterministDirectIntegrator(int maxDepth, std::shared_ptr<const Camera> camera,
 		   std::shared_ptr<Sampler> sampler,
-		   const Bounds2i &pixelBounds)
+		   const Bounds2i &pixelBounds, bool useLightTree = false,
+		   Float maxCutError = 0.02f, int maxCutSize = 1000,
+		   bool useOccluderCache = false)
       : SamplerIntegrator(camera, sampler, pixelBounds),
-        maxDepth(maxDepth){}
+        maxDepth(maxDepth), useLightTree(useLightTree),
+        maxCutError(maxCutError), maxCutSize(maxCutSize),
+        useOccluderCache(useOccluderCache){}
 
     Spectrum Li(const RayDifferential &ray, const Scene &scene,
                 Sampler &sampler, MemoryArena &arena, int depth) const;
@@ -35,8 +41,36 @@ class DeterministDirectIntegrator : public SamplerIntegrator {
       int nSamples; //number of samples requested on the light source
     };
 
+    //contribution of a source to the point if it is visible, and the tester for its visibility
+    Spectrum unshadowedContribution(const LightSource &source, const SurfaceInteraction &isect,
+				    VisibilityTester *visibility) const;
+    //contribution of a source to the point, 0 if the source isn't visible
+    Spectrum sourceContribution(int sourceIndex, const SurfaceInteraction &isect,
+				const Scene &scene) const;
+    //true if the shadow ray of the tester hits the last occluder this thread found for the source
+    bool hitsCachedOccluder(int sourceIndex, const VisibilityTester &visibility) const;
+    //sum of the contributions of the given sources (all of them if sources is null),
+    //their shadow rays being traced in batches
+    Spectrum visibleContribution(const int *sources, int nSources, const SurfaceInteraction &isect,
+				 const Scene &scene, MemoryArena &arena) const;
+
     const int maxDepth;
     std::vector<LightSource>lightSources;
+    //snapshot of the sources whose point doesn't depend on the shading point, evaluated
+    //all at once at Lambertian points
+    VirtualPointLights virtualLights;
+    std::vector<int> sourceVirtualLight; //index in virtualLights of each source, -1 if not in it
+    //lightcuts: the sources are clustered in a tree and each point evaluates a cut of it
+    const bool useLightTree;
+    const Float maxCutError; //maximum error of a cluster, relative to the total estimate
+    const int maxCutSize;
+    std::unique_ptr<LightTree> lightTree;
+    std::vector<int> treeSources; //index in lightSources of the lights of the tree
+    std::vector<int> otherSources; //sources that can't be clustered, always evaluated
+    //neighbouring points are often shadowed from a source by the same primitive, so
+    //each thread remembers the last occluder of each source and tests it first
+    const bool useOccluderCache;
+    mutable std::vector<std::vector<const Primitive *>> occluderCache;
 };
 
   DeterministDirectIntegrator *CreateDeterministDirectIntegrator(
@@ -37,24 +37,66 @@
 #include "film.h"
 #include "interaction.h"
 #include "paramset.h"
+#include "sampler.h"
 #include "scene.h"
 #include "stats.h"
+#include <algorithm>
 
 namespace pbrt {
 
 STAT_PERCENT("Integrator/Zero-radiance paths", zeroRadiancePaths, totalPaths);
 STAT_INT_DISTRIBUTION("Integrator/Path length", pathLength);
+STAT_COUNTER("Integrator/Sorted camera rays", nSortedCameraRays);
+STAT_RATIO("Integrator/Rays per sorted batch", nSortedRays, nSortedBatches);
+
+// PathIntegrator Local Declarations
+struct PathState {
+    PathState(const RayDifferential &ray, int pixelIndex = 0)
+        : ray(ray), pixelIndex(pixelIndex) {}
+    RayDifferential ray;
+    Spectrum L = Spectrum(0.f), beta = Spectrum(1.f);
+    bool specularBounce = false;
+    int bounces = 0;
+    // Added after book publication: etaScale tracks the accumulated effect
+    // of radiance scaling due to rays passing through refractive
+    // boundaries (see the derivation on p. 527 of the third edition). We
+    // track this value in order to remove it from beta when we apply
+    // Russian roulette; this is worthwhile, since it lets us sometimes
+    // avoid terminating refracted rays that are about to be refracted back
+    // out of a medium and thus have their beta value increased.
+    Float etaScale = 1;
+    // Index of the pixel in the tile, in sorted mode
+    int pixelIndex;
+};
+
+// Key sorting rays by the octant of their direction, then by the Morton
+// code of the cell of a 1024^3 grid over the scene holding their origin;
+// the 3 octant bits sit above the 30 bits of the Morton code
+static uint64_t RaySortKey(const Ray &ray, const Bounds3f &sceneBounds) {
+    Vector3f o = sceneBounds.Offset(ray.o);
+    uint64_t key = 0;
+    for (int axis = 0; axis < 3; ++axis) {
+        uint64_t cell = Clamp(int(o[axis] * 1024), 0, 1023);
+        for (int bit = 0; bit < 10; ++bit)
+            key |= ((cell >> bit) & 1) << (3 * bit + axis);
+    }
+    uint64_t octant =
+        (ray.d.x < 0) | ((ray.d.y < 0) << 1) | ((ray.d.z < 0) << 2);
+    return (octant << 30) | key;
+}
 
 // PathIntegrator Method Definitions
 PathIntegrator::PathIntegrator(int maxDepth,
                                std::shared_ptr<const Camera> camera,
                                std::shared_ptr<Sampler> sampler,
                                const Bounds2i &pixelBounds, Float rrThreshold,
-                               const std::string &lightSampleStrategy)
+                               const std::string &lightSampleStrategy,
+                               bool sortRays)
     : SamplerIntegrator(camera, sampler, pixelBounds),
       maxDepth(maxDepth),
       rrThreshold(rrThreshold),
-      lightSampleStrategy(lightSampleStrategy) {}
+      lightSampleStrategy(lightSampleStrategy),
+      sortRays(sortRays) {}
 
 void PathIntegrator::Preprocess(const Scene &scene, Sampler &sampler) {
     lightDistribution =
@@ -65,126 +107,230 @@ Spectrum PathIntegrator::Li(const RayDifferential &r, const Scene &scene,
                             Sampler &sampler, MemoryArena &arena,
                             int depth) const {
     ProfilePhase p(Prof::SamplerIntegratorLi);
-    Spectrum L(0.f), beta(1.f);
-    RayDifferential ray(r);
-    bool specularBounce = false;
-    int bounces;
-    // Added after book publication: etaScale tracks the accumulated effect
-    // of radiance scaling due to rays passing through refractive
-    // boundaries (see the derivation on p. 527 of the third edition). We
-    // track this value in order to remove it from beta when we apply
-    // Russian roulette; this is worthwhile, since it lets us sometimes
-    // avoid terminating refracted rays that are about to be refracted back
-    // out of a medium and thus have their beta value increased.
-    Float etaScale = 1;
-
-    for (bounces = 0;; ++bounces) {
-        // Find next path vertex and accumulate contribution
-        VLOG(2) << "Path tracer bounce " << bounces << ", current L = " << L
-                << ", beta = " << beta;
-
+    PathState path(r);
+    while (true) {
         // Intersect _ray_ with scene and store intersection in _isect_
         SurfaceInteraction isect;
-        bool foundIntersection = scene.Intersect(ray, &isect);
-
-        // Possibly add emitted light at intersection
-        if (bounces == 0 || specularBounce) {
-            // Add emitted light at path vertex or from the environment
-            if (foundIntersection) {
-                L += beta * isect.Le(-ray.d);
-                VLOG(2) << "Added Le -> L = " << L;
-            } else {
-                for (const auto &light : scene.infiniteLights)
-                    L += beta * light->Le(ray);
-                VLOG(2) << "Added infinite area lights -> L = " << L;
-            }
-        }
+        bool foundIntersection = scene.Intersect(path.ray, &isect);
+        if (!Bounce(&path, foundIntersection, isect, scene, sampler, arena))
+            break;
+    }
+    ReportValue(pathLength, path.bounces);
+    return path.L;
+}
 
-        // Terminate path if ray escaped or _maxDepth_ was reached
-        if (!foundIntersection || bounces >= maxDepth) break;
+// Accounts for the path vertex found by tracing _path->ray_ and samples the
+// path's next ray. Returns false once the path has terminated.
+bool PathIntegrator::Bounce(PathState *path, bool foundIntersection,
+                            SurfaceInteraction &isect, const Scene &scene,
+                            Sampler &sampler, MemoryArena &arena) const {
+    Spectrum &L = path->L, &beta = path->beta;
+    const RayDifferential &ray = path->ray;
+    int &bounces = path->bounces;
+    // Find next path vertex and accumulate contribution
+    VLOG(2) << "Path tracer bounce " << bounces << ", current L = " << L
+            << ", beta = " << beta;
 
-        // Compute scattering functions and skip over medium boundaries
-        isect.ComputeScatteringFunctions(ray, arena, true);
-        if (!isect.bsdf) {
-            VLOG(2) << "Skipping intersection due to null bsdf";
-            ray = isect.SpawnRay(ray.d);
-            bounces--;
-            continue;
+    // Possibly add emitted light at intersection
+    if (bounces == 0 || path->specularBounce) {
+        // Add emitted light at path vertex or from the environment
+        if (foundIntersection) {
+            L += beta * isect.Le(-ray.d);
+            VLOG(2) << "Added Le -> L = " << L;
+        } else {
+            for (const auto &light : scene.infiniteLights)
+                L += beta * light->Le(ray);
+            VLOG(2) << "Added infinite area lights -> L = " << L;
         }
+    }
 
-        const Distribution1D *distrib = lightDistribution->Lookup(isect.p);
-
-        // Sample illumination from lights to find path contribution.
-        // (But skip this for perfectly specular BSDFs.)
-        if (isect.bsdf->NumComponents(BxDFType(BSDF_ALL & ~BSDF_SPECULAR)) >
-            0) {
-            ++totalPaths;
-            Spectrum Ld = beta * UniformSampleOneLight(isect, scene, arena,
-                                                       sampler, false, distrib);
-            VLOG(2) << "Sampled direct lighting Ld = " << Ld;
-            if (Ld.IsBlack()) ++zeroRadiancePaths;
-            CHECK_GE(Ld.y(), 0.f);
-            L += Ld;
-        }
+    // Terminate path if ray escaped or _maxDepth_ was reached
+    if (!foundIntersection || bounces >= maxDepth) return false;
+
+    // Compute scattering functions and skip over medium boundaries
+    isect.ComputeScatteringFunctions(ray, arena, true);
+    if (!isect.bsdf) {
+        VLOG(2) << "Skipping intersection due to null bsdf";
+        path->ray = isect.SpawnRay(ray.d);
+        return true;
+    }
+
+    const Distribution1D *distrib = lightDistribution->Lookup(isect.p);
+
+    // Sample illumination from lights to find path contribution.
+    // (But skip this for perfectly specular BSDFs.)
+    if (isect.bsdf->NumComponents(BxDFType(BSDF_ALL & ~BSDF_SPECULAR)) > 0) {
+        ++totalPaths;
+        Spectrum Ld = beta * UniformSampleOneLight(isect, scene, arena,
+                                                   sampler, false, distrib);
+        VLOG(2) << "Sampled direct lighting Ld = " << Ld;
+        if (Ld.IsBlack()) ++zeroRadiancePaths;
+        CHECK_GE(Ld.y(), 0.f);
+        L += Ld;
+    }
+
+    // Sample BSDF to get new path direction
+    Vector3f wo = -ray.d, wi;
+    Float pdf;
+    BxDFType flags;
+    Spectrum f = isect.bsdf->Sample_f(wo, &wi, sampler.Get2D(), &pdf,
+                                      BSDF_ALL, &flags);
+    VLOG(2) << "Sampled BSDF, f = " << f << ", pdf = " << pdf;
+    if (f.IsBlack() || pdf == 0.f) return false;
+    beta *= f * AbsDot(wi, isect.shading.n) / pdf;
+    VLOG(2) << "Updated beta = " << beta;
+    CHECK_GE(beta.y(), 0.f);
+    DCHECK(!std::isinf(beta.y()));
+    path->specularBounce = (flags & BSDF_SPECULAR) != 0;
+    if ((flags & BSDF_SPECULAR) && (flags & BSDF_TRANSMISSION)) {
+        Float eta = isect.bsdf->eta;
+        // Update the term that tracks radiance scaling for refraction
+        // depending on whether the ray is entering or leaving the
+        // medium.
+        path->etaScale *= (Dot(wo, isect.n) > 0) ? (eta * eta) : 1 / (eta * eta);
+    }
+    path->ray = isect.SpawnRay(wi);
 
-        // Sample BSDF to get new path direction
-        Vector3f wo = -ray.d, wi;
-        Float pdf;
-        BxDFType flags;
-        Spectrum f = isect.bsdf->Sample_f(wo, &wi, sampler.Get2D(), &pdf,
-                                          BSDF_ALL, &flags);
-        VLOG(2) << "Sampled BSDF, f = " << f << ", pdf = " << pdf;
-        if (f.IsBlack() || pdf == 0.f) break;
-        beta *= f * AbsDot(wi, isect.shading.n) / pdf;
-        VLOG(2) << "Updated beta = " << beta;
-        CHECK_GE(beta.y(), 0.f);
+    // Account for subsurface scattering, if applicable
+    if (isect.bssrdf && (flags & BSDF_TRANSMISSION)) {
+        // Importance sample the BSSRDF
+        SurfaceInteraction pi;
+        Spectrum S = isect.bssrdf->Sample_S(
+            scene, sampler.Get1D(), sampler.Get2D(), arena, &pi, &pdf);
         DCHECK(!std::isinf(beta.y()));
-        specularBounce = (flags & BSDF_SPECULAR) != 0;
-        if ((flags & BSDF_SPECULAR) && (flags & BSDF_TRANSMISSION)) {
-            Float eta = isect.bsdf->eta;
-            // Update the term that tracks radiance scaling for refraction
-            // depending on whether the ray is entering or leaving the
-            // medium.
-            etaScale *= (Dot(wo, isect.n) > 0) ? (eta * eta) : 1 / (eta * eta);
-        }
-        ray = isect.SpawnRay(wi);
-
-        // Account for subsurface scattering, if applicable
-        if (isect.bssrdf && (flags & BSDF_TRANSMISSION)) {
-            // Importance sample the BSSRDF
-            SurfaceInteraction pi;
-            Spectrum S = isect.bssrdf->Sample_S(
-                scene, sampler.Get1D(), sampler.Get2D(), arena, &pi, &pdf);
-            DCHECK(!std::isinf(beta.y()));
-            if (S.IsBlack() || pdf == 0) break;
-            beta *= S / pdf;
-
-            // Account for the direct subsurface scattering component
-            L += beta * UniformSampleOneLight(pi, scene, arena, sampler, false,
-                                              lightDistribution->Lookup(pi.p));
-
-            // Account for the indirect subsurface scattering component
-            Spectrum f = pi.bsdf->Sample_f(pi.wo, &wi, sampler.Get2D(), &pdf,
-                                           BSDF_ALL, &flags);
-            if (f.IsBlack() || pdf == 0) break;
-            beta *= f * AbsDot(wi, pi.shading.n) / pdf;
-            DCHECK(!std::isinf(beta.y()));
-            specularBounce = (flags & BSDF_SPECULAR) != 0;
-            ray = pi.SpawnRay(wi);
+        if (S.IsBlack() || pdf == 0) return false;
+        beta *= S / pdf;
+
+        // Account for the direct subsurface scattering component
+        L += beta * UniformSampleOneLight(pi, scene, arena, sampler, false,
+                                          lightDistribution->Lookup(pi.p));
+
+        // Account for the indirect subsurface scattering component
+        Spectrum f = pi.bsdf->Sample_f(pi.wo, &wi, sampler.Get2D(), &pdf,
+                                       BSDF_ALL, &flags);
+        if (f.IsBlack() || pdf == 0) return false;
+        beta *= f * AbsDot(wi, pi.shading.n) / pdf;
+        DCHECK(!std::isinf(beta.y()));
+        path->specularBounce = (flags & BSDF_SPECULAR) != 0;
+        path->ray = pi.SpawnRay(wi);
+    }
+
+    // Possibly terminate the path with Russian roulette.
+    // Factor out radiance scaling due to refraction in rrBeta.
+    Spectrum rrBeta = beta * path->etaScale;
+    if (rrBeta.MaxComponentValue() < rrThreshold && bounces > 3) {
+        Float q = std::max((Float).05, 1 - rrBeta.MaxComponentValue());
+        if (sampler.Get1D() < q) return false;
+        beta /= 1 - q;
+        DCHECK(!std::isinf(beta.y()));
+    }
+    ++bounces;
+    return true;
+}
+
+void PathIntegrator::RenderTile(const Scene &scene, const Bounds2i &tileBounds,
+                                Sampler &tileSampler, FilmTile *filmTile,
+                                MemoryArena &arena) const {
+    if (!sortRays) {
+        SamplerIntegrator::RenderTile(scene, tileBounds, tileSampler, filmTile,
+                                      arena);
+        return;
+    }
+    // Get a sampler instance for each pixel of the tile, since their
+    // samples are taken in turn
+    Bounds2i sampleBounds = camera->film->GetSampleBounds();
+    int sampleExtentX = sampleBounds.Diagonal().x;
+    std::vector<Point2i> pixels;
+    std::vector<std::unique_ptr<Sampler>> pixelSamplers;
+    for (Point2i pixel : tileBounds) {
+        Vector2i offset = pixel - sampleBounds.pMin;
+        std::unique_ptr<Sampler> pixelSampler =
+            tileSampler.Clone(offset.y * sampleExtentX + offset.x);
+        pixelSampler->StartPixel(pixel);
+        if (!InsideExclusive(pixel, pixelBounds)) continue;
+        pixels.push_back(pixel);
+        pixelSamplers.push_back(std::move(pixelSampler));
+    }
+
+    // Trace the paths of the _i_th sample of all pixels together, so that
+    // their rays can be traced in sorted order; their samples are added to
+    // the film tile in the usual order at the end
+    int64_t spp = tileSampler.samplesPerPixel;
+    std::vector<CameraSample> cameraSamples(pixels.size() * spp);
+    std::vector<Float> rayWeights(pixels.size() * spp);
+    std::vector<Spectrum> radiance(pixels.size() * spp, Spectrum(0.f));
+    std::vector<PathState> paths;
+    for (int64_t i = 0; i < spp; ++i) {
+        paths.clear();
+        for (size_t p = 0; p < pixels.size(); ++p) {
+            CameraSample &cameraSample = cameraSamples[p * spp + i];
+            cameraSample = pixelSamplers[p]->GetCameraSample(pixels[p]);
+            RayDifferential ray;
+            Float rayWeight =
+                camera->GenerateRayDifferential(cameraSample, &ray);
+            ray.ScaleDifferentials(1 / std::sqrt((Float)spp));
+            ++nSortedCameraRays;
+            rayWeights[p * spp + i] = rayWeight;
+            if (rayWeight > 0) paths.push_back(PathState(ray, p));
         }
+        TraceSorted(paths, pixelSamplers, scene, arena);
+        for (const PathState &path : paths)
+            radiance[path.pixelIndex * spp + i] = path.L;
+        for (std::unique_ptr<Sampler> &pixelSampler : pixelSamplers)
+            pixelSampler->StartNextSample();
+    }
+    for (size_t j = 0; j < radiance.size(); ++j) {
+        Spectrum L = CheckRadiance(radiance[j], pixels[j / spp], j % spp);
+        filmTile->AddSample(cameraSamples[j].pFilm, L, rayWeights[j]);
+    }
+}
 
-        // Possibly terminate the path with Russian roulette.
-        // Factor out radiance scaling due to refraction in rrBeta.
-        Spectrum rrBeta = beta * etaScale;
-        if (rrBeta.MaxComponentValue() < rrThreshold && bounces > 3) {
-            Float q = std::max((Float).05, 1 - rrBeta.MaxComponentValue());
-            if (sampler.Get1D() < q) break;
-            beta /= 1 - q;
-            DCHECK(!std::isinf(beta.y()));
+// Advances _paths_ bounce after bounce until all of them have terminated.
+// At each bounce, the rays of the paths still alive are sorted by direction
+// octant and origin, then traced in batches of consecutive rays.
+void PathIntegrator::TraceSorted(
+    std::vector<PathState> &paths,
+    std::vector<std::unique_ptr<Sampler>> &samplers, const Scene &scene,
+    MemoryArena &arena) const {
+    ProfilePhase p(Prof::SamplerIntegratorLi);
+    Bounds3f sceneBounds = scene.WorldBound();
+    std::vector<std::pair<uint64_t, int>> order;
+    for (size_t i = 0; i < paths.size(); ++i)
+        order.push_back(std::make_pair(RaySortKey(paths[i].ray, sceneBounds),
+                                       (int)i));
+    Ray rays[MaxRayBatchSize];
+    SurfaceInteraction isects[MaxRayBatchSize];
+    while (!order.empty()) {
+        std::sort(order.begin(), order.end());
+        size_t nAlive = 0;
+        for (size_t start = 0; start < order.size();
+             start += MaxRayBatchSize) {
+            int nRays = std::min(order.size() - start, (size_t)MaxRayBatchSize);
+            for (int j = 0; j < nRays; ++j) {
+                rays[j] = paths[order[start + j].second].ray;
+                isects[j] = SurfaceInteraction();
+            }
+            uint64_t hits = scene.Intersect(rays, nRays, isects);
+            ++nSortedBatches;
+            nSortedRays += nRays;
+
+            // Continue the paths and keep those still alive, with the key
+            // of their next ray
+            for (int j = 0; j < nRays; ++j) {
+                PathState &path = paths[order[start + j].second];
+                path.ray.tMax = rays[j].tMax;
+                if (Bounce(&path, hits & (uint64_t(1) << j), isects[j], scene,
+                           *samplers[path.pixelIndex], arena))
+                    order[nAlive++] =
+                        std::make_pair(RaySortKey(path.ray, sceneBounds),
+                                       order[start + j].second);
+                else
+                    ReportValue(pathLength, path.bounces);
+            }
+            arena.Reset();
         }
+        order.resize(nAlive);
     }
-    ReportValue(pathLength, bounces);
-    return L;
 }
 
 PathIntegrator *CreatePathIntegrator(const ParamSet &params,
@@ -208,8 +354,9 @@ PathIntegrator *CreatePathIntegrator(const ParamSet &params,
     Float rrThreshold = params.FindOneFloat("rrthreshold", 1.);
     std::string lightStrategy =
         params.FindOneString("lightsamplestrategy", "spatial");
+    bool sortRays = params.FindOneBool("sortrays", false);
     return new PathIntegrator(maxDepth, camera, sampler, pixelBounds,
-                              rrThreshold, lightStrategy);
+                              rrThreshold, lightStrategy, sortRays);
 }
 
 }  // namespace pbrt
@@ -45,6 +45,9 @@
 
 namespace pbrt {
 
+// PathIntegrator Forward Declarations
+struct PathState;
+
 // PathIntegrator Declarations
 class PathIntegrator : public SamplerIntegrator {
   public:
@@ -52,17 +55,35 @@ class PathIntegrator : public SamplerIntegrator {
     PathIntegrator(int maxDepth, std::shared_ptr<const Camera> camera,
                    std::shared_ptr<Sampler> sampler,
                    const Bounds2i &pixelBounds, Float rrThreshold = 1,
-                   const std::string &lightSampleStrategy = "spatial");
+                   const std::string &lightSampleStrategy = "spatial",
+                   bool sortRays = false);
 
     void Preprocess(const Scene &scene, Sampler &sampler);
     Spectrum Li(const RayDifferential &ray, const Scene &scene,
                 Sampler &sampler, MemoryArena &arena, int depth) const;
 
+  protected:
+    // PathIntegrator Protected Methods
+    void RenderTile(const Scene &scene, const Bounds2i &tileBounds,
+                    Sampler &tileSampler, FilmTile *filmTile,
+                    MemoryArena &arena) const;
+
   private:
+    // PathIntegrator Private Methods
+    bool Bounce(PathState *path, bool foundIntersection,
+                SurfaceInteraction &isect, const Scene &scene,
+                Sampler &sampler, MemoryArena &arena) const;
+    void TraceSorted(std::vector<PathState> &paths,
+                     std::vector<std::unique_ptr<Sampler>> &samplers,
+                     const Scene &scene, MemoryArena &arena) const;
+
     // PathIntegrator Private Data
     const int maxDepth;
     const Float rrThreshold;
     const std::string lightSampleStrategy;
+    // Trace the rays of all the paths of a tile together, sorted by origin
+    // and direction, rather than one path at a time
+    const bool sortRays;
     std::unique_ptr<LightDistribution> lightDistribution;
 };
 
@@ -5,10 +5,96 @@
 #include "camera.h"
 #include "film.h"
 #include "stats.h"
+#include "parallel.h"
 #include <math.h>
 
 namespace pbrt {
 
+STAT_COUNTER("Integrator/Light source shadow rays", nSourceShadowRays);
+STAT_FLOAT_DISTRIBUTION("Integrator/Ward adaptive tolerance", adaptedTolerance);
+
+SourceRanking::SourceRanking(LocalSource *sources, int nSources, MemoryArena &arena)
+  : sources(sources), nSources(nSources) {
+  prefixLuminance = arena.Alloc<double>(nSources + 1, false);
+  prefixLuminance[0] = 0;
+  for(int i = 0; i < nSources; ++i) {
+    totalLuminance += sources[i].luminance;
+  }
+}
+
+void SourceRanking::ensureSorted(int end) {
+  if(end <= nSorted) return;
+  //sort at least twice as many sources as last time to amortize the scans over the unsorted sources
+  int newSorted = std::min(nSources, std::max(end, std::max(2 * nSorted, 16)));
+  std::partial_sort(sources + nSorted, sources + newSorted, sources + nSources, std::greater<LocalSource>());
+  for(int i = nSorted; i < newSorted; ++i) {
+    prefixLuminance[i + 1] = prefixLuminance[i] + sources[i].luminance;
+  }
+  nSorted = newSorted;
+}
+
+double SourceRanking::luminanceSum(int start, int end) {
+  //the sum up to the last source doesn't need the order past start
+  if(end >= nSources) {
+    ensureSorted(start);
+    return totalLuminance - prefixLuminance[start];
+  }
+  ensureSorted(end);
+  return prefixLuminance[end] - prefixLuminance[start];
+}
+
+static bool bySourceIndex(const CellSourceStats &s, int sourceIndex) {
+  return s.sourceIndex < sourceIndex;
+}
+
+SourceStats &VisibilityStats::get(uint64_t cellIndex, int sourceIndex) {
+  std::vector<CellSourceStats> &cell = cells[cellIndex];
+  auto it = std::lower_bound(cell.begin(), cell.end(), sourceIndex, bySourceIndex);
+  if(it == cell.end() || it->sourceIndex != sourceIndex){
+    it = cell.insert(it, CellSourceStats{sourceIndex, SourceStats()});
+  }
+  return it->stats;
+}
+
+const SourceStats *VisibilityStats::find(uint64_t cellIndex, int sourceIndex) const {
+  auto cellIt = cells.find(cellIndex);
+  if(cellIt == cells.end()) return nullptr;
+  const std::vector<CellSourceStats> &cell = cellIt->second;
+  auto it = std::lower_bound(cell.begin(), cell.end(), sourceIndex, bySourceIndex);
+  return (it == cell.end() || it->sourceIndex != sourceIndex) ? nullptr : &it->stats;
+}
+
+void VisibilityStats::merge(VisibilityStats &other) {
+  for(size_t i = 0; i < global.size(); ++i) {
+    global[i].nSampled += other.global[i].nSampled;
+    global[i].nHits += other.global[i].nHits;
+    other.global[i] = SourceStats();
+  }
+  for(auto &otherCell : other.cells) {
+    //both cells are sorted by source index, merge them in one pass
+    std::vector<CellSourceStats> &cell = cells[otherCell.first];
+    std::vector<CellSourceStats> merged;
+    merged.reserve(cell.size() + otherCell.second.size());
+    auto a = cell.begin(), b = otherCell.second.begin();
+    while(a != cell.end() || b != otherCell.second.end()) {
+      if(b == otherCell.second.end() || (a != cell.end() && a->sourceIndex < b->sourceIndex)) {
+	merged.push_back(*a++);
+      }
+      else if(a == cell.end() || b->sourceIndex < a->sourceIndex) {
+	merged.push_back(*b++);
+      }
+      else {
+	merged.push_back(*a++);
+	merged.back().stats.nSampled += b->stats.nSampled;
+	merged.back().stats.nHits += b->stats.nHits;
+	++b;
+      }
+    }
+    cell.swap(merged);
+  }
+  other.cells.clear();
+}
+
 void WardIntegrator::Preprocess(const Scene &scene,
                                 Sampler &sampler) {
   std::vector<int> nLightSamples;
@@ -51,17 +137,89 @@ void WardIntegrator::Preprocess(const Scene &scene,
       }
     }
   }
+  virtualLights = VirtualPointLights();
+  sourceVirtualLight.clear();
+  for (const LightSource &source : lightSources) {
+    sourceVirtualLight.push_back(virtualLights.Add(**source.light, source.uLight, 1.f / source.nSamples));
+  }
+  if (useLightTree) {
+    std::vector<const Light *> lights;
+    std::vector<int> nSamples;
+    for (const LightSource &source : lightSources) {
+      lights.push_back(source.light->get());
+      nSamples.push_back(source.nSamples);
+    }
+    lightTree = CreateLightTree(lights, nSamples, &treeSources, &otherSources);
+  }
+  //roughly cube shaped voxels, as in SpatialLightDistribution
+  gridBounds = scene.WorldBound();
+  Vector3f diag = gridBounds.Diagonal();
+  Float bmax = diag[gridBounds.MaximumExtent()];
+  for (int i = 0; i < 3; ++i) {
+    nVoxels[i] = (bmax > 0) ? std::max(1, int(std::round(diag[i] / bmax * maxVoxels))) : 1;
+    CHECK_LT(nVoxels[i], 1 << 20);
+  }
+  stats = VisibilityStats();
+  stats.global.assign(lightSources.size(), SourceStats());
+  tilesPerGeneration = MaxThreadIndex();
+  finishedTiles.clear();
+  nMergedTiles = 0;
+  mergedStats = stats;
+  nGenerations = 1;
+  generations[0] = std::make_shared<const VisibilityStats>(stats);
+  generations[1].reset();
+  generations[2].reset();
+  sampleBounds = camera->film->GetSampleBounds();
+  pixelEstimates.clear();
+  if (adaptiveTolerance) pixelEstimates.resize(sampleBounds.Area());
+}
+
+std::unique_ptr<SamplerIntegrator::ThreadState> WardIntegrator::CreateThreadState() const {
+  std::unique_ptr<WardThreadState> state(new WardThreadState);
+  state->tile.global.assign(lightSources.size(), SourceStats());
+  return state;
+}
+
+uint64_t WardIntegrator::cellIndex(const Point3f &p) const {
+  if (maxVoxels == 0) {
+    return 0;
+  }
+  Vector3f offset = gridBounds.Offset(p);
+  Point3i pi;
+  for (int i = 0; i < 3; ++i) {
+    //the clamp handles points slightly outside the bounds due to roundoff
+    pi[i] = Clamp(int(offset[i] * nVoxels[i]), 0, nVoxels[i] - 1);
+  }
+  return (uint64_t(pi[0]) << 40) | (uint64_t(pi[1]) << 20) | pi[2];
+}
+
+Spectrum WardIntegrator::unshadowedContribution(int sourceIndex, const SurfaceInteraction &isect,
+						 VisibilityTester *visibility) const {
+  BxDFType bsdfFlags = BxDFType(BSDF_ALL & ~BSDF_SPECULAR);
+  const LightSource &source = lightSources[sourceIndex];
+  return UnshadowedContribution(isect, **source.light, source.uLight, bsdfFlags, visibility) /
+    source.nSamples;
+}
+
+void WardIntegrator::initLocalSource(LocalSource *localSource, int sourceIndex,
+				     const SurfaceInteraction &isect) const {
+  localSource->lightSource = &lightSources[sourceIndex];
+  localSource->sourceIndex = sourceIndex;
+  localSource->ld = unshadowedContribution(sourceIndex, isect, &localSource->visibility);
+  localSource->luminance = localSource->ld.y();
 }
 
 Spectrum WardIntegrator::Li(const RayDifferential &ray,
                                       const Scene &scene, Sampler &sampler,
-                                      MemoryArena &arena, int depth) {
+                                      MemoryArena &arena, int depth) const {
   BxDFType bsdfFlags = BxDFType(BSDF_ALL & ~BSDF_SPECULAR);
   Spectrum L(0.f);
   SurfaceInteraction isect;
   //if no intersection found, consider that there is no incoming light (not considering environment maps)
   if (!scene.Intersect(ray, &isect)) {
     for (const auto &light : scene.lights) L += light->Le(ray);
+    //the background is part of the pixel's estimate too
+    if (adaptiveTolerance && depth == 0) recordPixelSample(L);
     return L;
   }
   
@@ -72,57 +230,111 @@ Spectrum WardIntegrator::Li(const RayDifferential &ray,
   Vector3f wo = isect.wo;
   L += isect.Le(wo);
   if (lightSources.size() > 0) {
-    
-    std::vector<LocalSource> localSources; //used to avoid modifying the integrator
-    for(int i = 0; i < lightSources.size();++i){
-      Vector3f wi;
-      Float lightPdf = 0;
-      VisibilityTester visibility;
-      Point2f uLight = sampler.Get2D();
-      Spectrum Li = (*lightSources[i].light)->Sample_Li(isect, lightSources[i].uLight, &wi, &lightPdf, &visibility);
-      Spectrum ld(0.0f);
-      if (lightPdf > 0 && !Li.IsBlack()) {
-	//compute the BSDF
-	Spectrum f;
-	f = isect.bsdf->f(isect.wo, wi, bsdfFlags) * AbsDot(wi, isect.shading.n);
-	if (!f.IsBlack()) {
-	  ld = (f * Li / lightPdf) / lightSources[i].nSamples;
+    float pointTolerance = tolerance;
+    WardThreadState *state = GetThreadState<WardThreadState>();
+    if (adaptiveTolerance) {
+      //the tolerance is adapted for the first hit, secondary points use the one of their sample
+      if (depth == 0) {
+	state->pixelTolerance = adaptTolerance(*state);
+	ReportValue(adaptedTolerance, state->pixelTolerance);
+      }
+      pointTolerance = state->pixelTolerance;
+    }
+    int nSources;
+    LocalSource *localSources; //used to avoid modifying the integrator
+    if (lightTree) {
+      //rank the clusters of a cut computed on the unshadowed contributions
+      LightCutEntry *cut = arena.Alloc<LightCutEntry>(lightTree->MaxCutEntries(maxCutSize));
+      int nEntries = lightTree->Cut(isect, bsdfFlags, [&](int light) {
+	  VisibilityTester visibility;
+	  return unshadowedContribution(treeSources[light], isect, &visibility);
+	}, maxCutError, maxCutSize, cut);
+      nSources = nEntries + otherSources.size();
+      localSources = arena.Alloc<LocalSource>(nSources);
+      for(int i = 0; i < nEntries; ++i){
+	initLocalSource(&localSources[i], treeSources[cut[i].representative], isect);
+	localSources[i].ld = cut[i].L;
+	localSources[i].luminance = cut[i].L.y();
+      }
+      for(int i = 0; i < otherSources.size(); ++i){
+	initLocalSource(&localSources[nEntries + i], otherSources[i], isect);
+      }
+    }
+    else {
+      nSources = lightSources.size();
+      localSources = arena.Alloc<LocalSource>(nSources);
+      Spectrum *virtualLd = arena.Alloc<Spectrum>(virtualLights.size());
+      Float *virtualLuminance = arena.Alloc<Float>(virtualLights.size());
+      bool useVirtualLights = virtualLights.EvaluateLambertian(isect, virtualLd, virtualLuminance);
+      for(int i = 0; i < nSources;++i){
+	Point2f uLight = sampler.Get2D();
+	int virtualLight = sourceVirtualLight[i];
+	if(useVirtualLights && virtualLight >= 0){
+	  LocalSource &localSource = localSources[i];
+	  localSource.lightSource = &lightSources[i];
+	  localSource.sourceIndex = i;
+	  localSource.ld = virtualLd[virtualLight];
+	  localSource.luminance = virtualLuminance[virtualLight];
+	  localSource.visibility = VisibilityTester(isect, virtualLights.LightPoint(virtualLight));
+	}
+	else{
+	  initLocalSource(&localSources[i], i, isect);
 	}
       }
-      LocalSource newLocalSource {};
-      newLocalSource.lightSource = &lightSources[i];
-      newLocalSource.ld = ld;
-      newLocalSource.luminance = ld.y();
-      newLocalSource.visibility = visibility;
-      localSources.push_back (newLocalSource);
-    }
-    std::sort(localSources.begin(), localSources.end(),std::greater<LocalSource>()); //sorts in descending order   
+    }
+    SourceRanking ranking(localSources, nSources, arena); //sorts in descending order as far as needed
     int sourcesSampled = 0; //number of light sources a ray was traced to from the point being evaluated
     int sourcesHit = 0; //number of tested sources visible from the point
     int i =0;
     float sumLuminance = 0.0f;
     //test source visibility until stopping criteria
     do {
-      if(!localSources[i].ld.IsBlack()){
-	localSources[i].updateSampled = true;
-	//localSources[i].lightSource->nSampled.fetch_add(1);
-	sourcesSampled++;
-	if(localSources[i].visibility.Unoccluded(scene)) {
-	  L+= localSources[i].ld;
-	  localSources[i].updateHits = true;
-	  //localSources[i].lightSource->nHits.fetch_add(1);
-	  sourcesHit++;
-	  sumLuminance += localSources[i].luminance;
+      //even if all of them are visible the criteria can't be met before source
+      //end, so the shadow rays of the sources up to it are traced together
+      int end = i + 1;
+      float maxLuminance = sumLuminance + std::max(ranking[i].luminance, 0.0f);
+      while(end < nSources && end - i < MaxRayBatchSize &&
+	    !isStopCriteriaMet(ranking, maxLuminance, end, pointTolerance)) {
+	maxLuminance += std::max(ranking[end].luminance, 0.0f);
+	end++;
+      }
+      const VisibilityTester *batch[MaxRayBatchSize];
+      int nBatch = 0;
+      for(int j = i; j < end; ++j){
+	if(!ranking[j].ld.IsBlack()){
+	  batch[nBatch++] = &ranking[j].visibility;
 	}
       }
-      i++;
-    } while(i < localSources.size() && !isStopCriteriaMet(localSources, sumLuminance, i));
+      nSourceShadowRays += nBatch;
+      uint64_t unoccluded = VisibilityTester::Unoccluded(batch, nBatch, scene);
+      for(int b = 0; i < end; ++i){
+	LocalSource &source = ranking[i];
+	if(!source.ld.IsBlack()){
+	  source.updateSampled = true;
+	  sourcesSampled++;
+	  if(unoccluded & (uint64_t(1) << b++)) {
+	    L+= source.ld;
+	    source.updateHits = true;
+	    sourcesHit++;
+	    sumLuminance += source.luminance;
+	  }
+	}
+      }
+    } while(i < nSources && !isStopCriteriaMet(ranking, sumLuminance, i, pointTolerance));
+    uint64_t cell = cellIndex(isect.p);
+    if (adaptiveTolerance && depth == 0 && sourcesSampled != 0) {
+      //measured before the statistics include the tested sources
+      PixelEstimate &estimate = pixelEstimates[pixelIndex(state->pixel)];
+      estimate.nPredictions++;
+      estimate.sumPredictionError += predictionError(localSources, i, (float)sourcesHit / sourcesSampled, cell);
+    }
     //update the number of times each source was sampled and hit
-    updateSourcesStats (localSources);
-    //approximate the remaining sources
-    for(i; i < localSources.size(); ++i) {
-      if(localSources[i].lightSource->nSampled != 0 && sourcesSampled != 0){
-	L += localSources[i].ld * (sourcesHit / sourcesSampled) * (localSources[i].lightSource->nHits / localSources[i].lightSource->nSampled);
+    updateSourcesStats (localSources, i, cell);
+    //approximate the remaining sources, their order doesn't matter
+    if(sourcesSampled != 0){
+      float pointVisibility = (float)sourcesHit / sourcesSampled;
+      for(i; i < nSources; ++i) {
+	L += localSources[i].ld * pointVisibility * visibilityEstimate(localSources[i].sourceIndex, cell);
       }
     }
   }
@@ -131,29 +343,185 @@ Spectrum WardIntegrator::Li(const RayDifferential &ray,
     L += SpecularReflect(ray, isect, scene, sampler, arena, depth);
     L += SpecularTransmit(ray, isect, scene, sampler, arena, depth);
   }
+  if (adaptiveTolerance && depth == 0) recordPixelSample(L);
   return L;
 }
 
-bool WardIntegrator::isStopCriteriaMet(const std::vector<LocalSource> &localSources, const float sumLuminance, const int i){
+void WardIntegrator::recordPixelSample(const Spectrum &L) const {
+  PixelEstimate &estimate = pixelEstimates[pixelIndex(GetThreadState<WardThreadState>()->pixel)];
+  estimate.nSamples++;
+  estimate.sumLuminance += L.y();
+  estimate.sumSquaredLuminance += L.y() * L.y();
+}
+
+bool WardIntegrator::isStopCriteriaMet(SourceRanking &localSources, const float sumLuminance, const int i,
+				       const float tolerance) const {
   int toCompareTo = std::round((localSources.size() - i) * certainty ) + i;//Number of sources past i to compare the sum to
-  float sumLuminancePost = 0.0f; //sum of the luminance of the sources accounted for after source i
-  for(int k = i; k < toCompareTo; ++k){
-    sumLuminancePost += localSources[k].luminance;
-  }
+  //sum of the luminance of the sources accounted for after source i
+  double sumLuminancePost = localSources.luminanceSum(i, toCompareTo);
   return tolerance * sumLuminance >= sumLuminancePost;
 }
 
-void WardIntegrator::updateSourcesStats(std::vector<LocalSource> &localSources) {
-  mtx.lock();
-  for(int i = 0; i < localSources.size(); ++i) {
-    if(localSources[i].updateSampled){
-      localSources[i].lightSource->nSampled++;
+float WardIntegrator::adaptTolerance(const WardThreadState &state) const {
+  //the sources past the stopping point are accounted for with the visibility
+  //statistics, so the relative error of a sample is about its tolerance times
+  //the error the statistics make there. That error is estimated from the
+  //tested sources of the previous samples of the pixel and of its known
+  //neighbours, the worst one being kept since it jumps near shadow boundaries
+  bool known = false;
+  float error = 0;
+  //the statistics blur shadow boundaries, so the budget is also tightened
+  //where the luminance varies, from sample to sample in a pixel (variance) or
+  //from pixel to pixel (contrast)
+  float deviation = 0;
+  double minMean = Infinity, maxMean = 0;
+  for(int dy = -1; dy <= 1; ++dy){
+    for(int dx = -1; dx <= 1; ++dx){
+      const PixelEstimate *e = knownEstimate(state, state.pixel + Vector2i(dx, dy));
+      if(!e) continue;
+      if(e->nPredictions > 0){
+	known = true;
+	error = std::max(error, (float)(e->sumPredictionError / e->nPredictions));
+      }
+      if(e->nSamples == 0) continue;
+      double mean = e->sumLuminance / e->nSamples;
+      minMean = std::min(minMean, mean);
+      maxMean = std::max(maxMean, mean);
+      if(e->nSamples > 1 && mean > 0){
+	double variance = std::max(0.0, e->sumSquaredLuminance / e->nSamples - mean * mean) *
+	  e->nSamples / (e->nSamples - 1);
+	deviation = std::max(deviation, (float)(std::sqrt(variance) / mean));
+      }
     }
+  }
+  //nothing is known yet about the first pixels rendered around here
+  if(!known) return tolerance;
+  //both terms are in [0, 1], a flat area gets the whole budget
+  float contrast = maxMean > 0 ? (float)((maxMean - minMean) / (maxMean + minMean)) : 0.0f;
+  float budget = errorBudget / (1 + std::min(deviation, 1.0f) + contrast);
+  if(error * maxTolerance <= budget) return maxTolerance;
+  return Clamp(budget / error, minTolerance, maxTolerance);
+}
+
+const PixelEstimate *WardIntegrator::knownEstimate(const WardThreadState &state,
+						   const Point2i &p) const {
+  if(!InsideExclusive(p, sampleBounds)) return nullptr;
+  int tile = TileIndex(p);
+  if(tile == state.tileIndex){
+    //pixels of a tile are visited in scanline order
+    if(p.y > state.pixel.y || (p.y == state.pixel.y && p.x > state.pixel.x)) return nullptr;
+  }
+  else if(tile >= state.generationTiles){
+    //the tile may still be being rendered by another thread
+    return nullptr;
+  }
+  return &pixelEstimates[pixelIndex(p)];
+}
+
+int WardIntegrator::pixelIndex(const Point2i &p) const {
+  int width = sampleBounds.pMax.x - sampleBounds.pMin.x;
+  return (p.y - sampleBounds.pMin.y) * width + p.x - sampleBounds.pMin.x;
+}
+
+float WardIntegrator::predictionError(const LocalSource *localSources, int nTested,
+				      float pointVisibility, uint64_t cell) const {
+  double error = 0, sumLuminance = 0;
+  for(int i = 0; i < nTested; ++i) {
+    const LocalSource &source = localSources[i];
+    if(!source.updateSampled) continue;
+    float predicted = pointVisibility * visibilityEstimate(source.sourceIndex, cell);
+    error += source.luminance * std::abs(predicted - (source.updateHits ? 1.0f : 0.0f));
+    sumLuminance += source.luminance;
+  }
+  return sumLuminance > 0 ? error / sumLuminance : 0.0f;
+}
+
+void WardIntegrator::StartPixel(ThreadState *state, const Point2i &pixel,
+				const Bounds2i &tileBounds) const {
+  WardThreadState *wardState = static_cast<WardThreadState *>(state);
+  wardState->pixel = pixel;
+  wardState->pixelTolerance = tolerance;
+}
+
+void WardIntegrator::updateSourcesStats(const LocalSource *localSources, int nTested, uint64_t cell) const {
+  //only the calling thread writes to its state, no lock needed
+  VisibilityStats &tile = GetThreadState<WardThreadState>()->tile;
+  for(int i = 0; i < nTested; ++i) {
+    //sources that weren't tested don't get an entry in the cell
+    if(!localSources[i].updateSampled) continue;
+    SourceStats &s = tile.global[localSources[i].sourceIndex];
+    SourceStats &c = tile.get(cell, localSources[i].sourceIndex);
+    s.nSampled++;
+    c.nSampled++;
     if(localSources[i].updateHits){
-      localSources[i].lightSource->nHits++;
+      s.nHits++;
+      c.nHits++;
     }
   }
-  mtx.unlock();
+}
+
+float WardIntegrator::visibilityEstimate(int sourceIndex, uint64_t cell) const {
+  //the statistics of the cell are used once the source was tested there,
+  //the ones of the whole scene otherwise
+  const WardThreadState *state = GetThreadState<WardThreadState>();
+  const VisibilityStats &stats = *state->generation;
+  const VisibilityStats &tile = state->tile;
+  const SourceStats *mergedCell = stats.find(cell, sourceIndex);
+  const SourceStats *tileCell = tile.find(cell, sourceIndex);
+  int nSampled = 0, nHits = 0;
+  if(mergedCell){
+    nSampled += mergedCell->nSampled;
+    nHits += mergedCell->nHits;
+  }
+  if(tileCell){
+    nSampled += tileCell->nSampled;
+    nHits += tileCell->nHits;
+  }
+  if(nSampled == 0){
+    nSampled = stats.global[sourceIndex].nSampled + tile.global[sourceIndex].nSampled;
+    nHits = stats.global[sourceIndex].nHits + tile.global[sourceIndex].nHits;
+  }
+  return nSampled == 0 ? 0.0f : (float)nHits / nSampled;
+}
+
+void WardIntegrator::StartTile(ThreadState *state, int tileIndex,
+			       const Bounds2i &tileBounds) const {
+  WardThreadState *wardState = static_cast<WardThreadState *>(state);
+  wardState->tileIndex = tileIndex;
+  //tiles are started in order, so the tiles of the generation were all started
+  //at least a generation ago and the wait ends once the slowest of them is done
+  int generation = std::max(0, tileIndex / tilesPerGeneration - 2);
+  std::unique_lock<std::mutex> lock(sharedMutex);
+  generationPublished.wait(lock, [&]() { return nGenerations > generation; });
+  //the tile isn't done, so generation + 3 can't be published yet and the slot is still valid
+  wardState->generation = generations[generation % 3];
+  wardState->generationTiles = generation * tilesPerGeneration;
+}
+
+void WardIntegrator::ReduceTile(ThreadState *state) const {
+  WardThreadState *wardState = static_cast<WardThreadState *>(state);
+  wardState->generation.reset();
+  std::lock_guard<std::mutex> lock(sharedMutex);
+  finishedTiles[wardState->tileIndex].global.assign(lightSources.size(), SourceStats());
+  finishedTiles[wardState->tileIndex].merge(wardState->tile);
+  //merge the tiles that were waiting for this one, in order
+  bool published = false;
+  for(auto it = finishedTiles.begin();
+      it != finishedTiles.end() && it->first == nMergedTiles; it = finishedTiles.erase(it)) {
+    mergedStats.merge(it->second);
+    if(++nMergedTiles % tilesPerGeneration == 0) {
+      generations[nGenerations % 3] = std::make_shared<const VisibilityStats>(mergedStats);
+      nGenerations++;
+      published = true;
+    }
+  }
+  if(published) generationPublished.notify_all();
+}
+
+void WardIntegrator::ReduceRender(ThreadState *state) {
+  //all tiles are done and merged, the first call takes their statistics
+  stats.merge(mergedStats);
+  for(auto &generation : generations) generation.reset();
 }
   
 WardIntegrator *CreateWardIntegrator(
@@ -179,6 +547,31 @@ WardIntegrator *CreateWardIntegrator(
     if(certainty > 1.0f || certainty < 0.0f || tolerance > 1.0f || tolerance < 0.0f) {
       Error ("Expected certainty and tolerance to be between 0 and 1");
     }
-    return new WardIntegrator(maxDepth, camera, sampler, pixelBounds, certainty, tolerance);
+    bool useLightTree = params.FindOneBool("lighttree", false);
+    Float maxCutError = params.FindOneFloat("lightcuterror", 0.02f);
+    int maxCutSize = params.FindOneInt("maxcutsize", 1000);
+    if (maxCutError < 0 || maxCutSize < 1) {
+      Error("Expected \"lightcuterror\" to be positive and \"maxcutsize\" to be at least 1");
+      maxCutError = std::max(maxCutError, (Float)0);
+      maxCutSize = std::max(maxCutSize, 1);
+    }
+    int maxVoxels = params.FindOneInt("visibilityvoxels", 16);
+    if (maxVoxels < 0) {
+      Error("Expected \"visibilityvoxels\" to be positive");
+      maxVoxels = 0;
+    }
+    bool adaptiveTolerance = params.FindOneBool("adaptivetolerance", false);
+    float errorBudget = params.FindOneFloat("errorbudget", 0.01f);
+    float minTolerance = params.FindOneFloat("mintolerance", 0.02f);
+    float maxTolerance = params.FindOneFloat("maxtolerance", 0.5f);
+    if(errorBudget <= 0.0f || minTolerance < 0.0f || maxTolerance > 1.0f || minTolerance > maxTolerance) {
+      Error("Expected \"errorbudget\" to be positive and 0 <= \"mintolerance\" <= \"maxtolerance\" <= 1");
+      errorBudget = std::max(errorBudget, 0.01f);
+      minTolerance = Clamp(minTolerance, 0.0f, 1.0f);
+      maxTolerance = Clamp(maxTolerance, minTolerance, 1.0f);
+    }
+    return new WardIntegrator(maxDepth, camera, sampler, pixelBounds, certainty, tolerance,
+			      useLightTree, maxCutError, maxCutSize, maxVoxels,
+			      adaptiveTolerance, errorBudget, minTolerance, maxTolerance);
   }
 }  // namespace pbrt
@@ -7,28 +7,66 @@
 #define PBRT_INTEGRATORS_WARD_H
 
 // integrators/ward.h*
-#include <mutex>
-//#include <atomic>
 #include "pbrt.h"
 #include "integrator.h"
 #include "scene.h"
+#include "lighttree.h"
+#include "virtuallights.h"
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <unordered_map>
 
 namespace pbrt {
 
+//visibility statistics gathered for a light source
+struct SourceStats{
+  int nSampled = 0; //number of times the source was sampled
+  int nHits = 0; //number of times the source was hit
+};
+
+//visibility statistics of a source in a cell
+struct CellSourceStats{
+  int sourceIndex;
+  SourceStats stats;
+};
+
+//visibility statistics of all the sources, over the whole scene and per cell
+//of a voxel grid over the scene bounds. A cell only holds the sources tested
+//in it, sorted by index, so that memory grows with the tests rather than with
+//cells times sources
+struct VisibilityStats{
+  std::vector<SourceStats> global;
+  std::unordered_map<uint64_t, std::vector<CellSourceStats>> cells; //indexed by packed voxel coordinates
+
+  //statistics of a source in a cell, created if needed
+  SourceStats &get(uint64_t cellIndex, int sourceIndex);
+  //statistics of a source in a cell, null if it wasn't tested there
+  const SourceStats *find(uint64_t cellIndex, int sourceIndex) const;
+  //adds other to these statistics and clears it
+  void merge(VisibilityStats &other);
+};
+
+//what the samples of a pixel tell about it: how well the visibility statistics
+//predicted their tested sources, and how much their luminance varies
+struct PixelEstimate{
+  int nPredictions = 0;
+  double sumPredictionError = 0;
+  int nSamples = 0;
+  double sumLuminance = 0, sumSquaredLuminance = 0;
+};
+
 //represents a light source as a single point
 struct LightSource{  
   const std::shared_ptr<Light> *light; //light source the point belongs too
   Point2f uLight; //position of the point on the source
   int nSamples; //number of samples requested on the light source
-  //std::atomic<int> nSampled{0};
-  //std::atomic<int> nHits{0};
-  int nSampled = 0; //number of times the source was sampled
-  int nHits = 0; //number of times the source was hit
 };
 
 
 struct LocalSource{
-  LightSource* lightSource;
+  const LightSource* lightSource;
+  int sourceIndex; //index of lightSource in the integrator's lightSources
   Spectrum ld = NULL; //store the contribution of the source for a given point
   VisibilityTester visibility;
   float luminance = 0.0f;
@@ -40,31 +78,147 @@ struct LocalSource{
   }
 };
 
+//ranks the local sources of a shading point by decreasing luminance. The
+//sorting is done lazily, in chunks, so that only the sources the stopping
+//criteria actually looks at get ordered. Storage comes from the arena.
+class SourceRanking{
+  public:
+    SourceRanking(LocalSource *sources, int nSources, MemoryArena &arena);
+    int size() const { return nSources; }
+    //returns the source of rank i
+    LocalSource &operator[](int i) {
+      ensureSorted(i + 1);
+      return sources[i];
+    }
+    //sum of the luminance of the sources of rank start to end - 1
+    double luminanceSum(int start, int end);
+
+  private:
+    //makes sure the sources of rank 0 to end - 1 are in place
+    void ensureSorted(int end);
+
+    LocalSource *sources;
+    const int nSources;
+    int nSorted = 0; //sources before nSorted are the brightest, in order
+    double *prefixLuminance; //sum of the luminance of the first i sources, valid up to nSorted
+    double totalLuminance = 0;
+};
+
   
-class WardIntegrator : public SamplerIntegratorBis {
+class WardIntegrator : public SamplerIntegrator {
   public:
     //constructor
     WardIntegrator(int maxDepth, std::shared_ptr<const Camera> camera,
 		   std::shared_ptr<Sampler> sampler,
-		   const Bounds2i &pixelBounds, float certainty, float tolerance)
-      : SamplerIntegratorBis(camera, sampler, pixelBounds),
-        certainty(certainty), maxDepth(maxDepth), tolerance(tolerance) {}
+		   const Bounds2i &pixelBounds, float certainty, float tolerance,
+		   bool useLightTree = false, Float maxCutError = 0.02f, int maxCutSize = 1000,
+		   int maxVoxels = 16, bool adaptiveTolerance = false, float errorBudget = 0.01f,
+		   float minTolerance = 0.02f, float maxTolerance = 0.5f)
+      : SamplerIntegrator(camera, sampler, pixelBounds),
+        certainty(certainty), tolerance(tolerance), maxDepth(maxDepth),
+        maxVoxels(maxVoxels), useLightTree(useLightTree), maxCutError(maxCutError),
+        maxCutSize(maxCutSize), adaptiveTolerance(adaptiveTolerance),
+        errorBudget(errorBudget), minTolerance(minTolerance), maxTolerance(maxTolerance) {}
 
     void Preprocess(const Scene &scene, Sampler &sampler);
 
     Spectrum Li(const RayDifferential &ray,
               const Scene &scene, Sampler &sampler,
-	      MemoryArena &arena, int depth);
+	      MemoryArena &arena, int depth) const;
 
   protected:
-    void updateSourcesStats(std::vector<LocalSource> &localSources);
+    //visibility statistics read and gathered by a thread: Li reads generation, the
+    //statistics of the tiles finished before the tile being rendered, plus tile, what
+    //was gathered so far in that tile
+    struct WardThreadState : public ThreadState {
+      std::shared_ptr<const VisibilityStats> generation;
+      int tileIndex;
+      int generationTiles; //number of tiles in generation
+      VisibilityStats tile;
+      //adaptive tolerance
+      Point2i pixel; //pixel being rendered
+      float pixelTolerance; //tolerance of the current sample
+    };
+    std::unique_ptr<ThreadState> CreateThreadState() const;
+    void StartTile(ThreadState *state, int tileIndex, const Bounds2i &tileBounds) const;
+    void StartPixel(ThreadState *state, const Point2i &pixel, const Bounds2i &tileBounds) const;
+    void ReduceTile(ThreadState *state) const;
+    void ReduceRender(ThreadState *state);
+
+    //contribution of source sourceIndex to the point if it is visible, and the tester for its visibility
+    Spectrum unshadowedContribution(int sourceIndex, const SurfaceInteraction &isect,
+				    VisibilityTester *visibility) const;
+    void initLocalSource(LocalSource *localSource, int sourceIndex, const SurfaceInteraction &isect) const;
+    //packed coordinates of the voxel of the statistics grid containing p
+    uint64_t cellIndex(const Point3f &p) const;
+    //records the visibility tests done on the nTested first sources of localSources
+    void updateSourcesStats(const LocalSource *localSources, int nTested, uint64_t cell) const;
+    //estimated probability for a source to be visible from the cell
+    float visibilityEstimate(int sourceIndex, uint64_t cell) const;
     //checks if the stopping criteria for evaluating source visibility is met after source number i in localSources
-    bool isStopCriteriaMet(const std::vector<LocalSource> &localSources, const float sumLuminance, const int i);
+    bool isStopCriteriaMet(SourceRanking &localSources, const float sumLuminance, const int i,
+			   const float tolerance) const;
+    //tolerance of a sample of the current pixel, from the estimates of the pixel
+    //and of its known neighbours
+    float adaptTolerance(const WardThreadState &state) const;
+    //estimate of pixel p if it can be read by the tile of state: the pixels of the
+    //tile already visited and those of the tiles of its generation. Null otherwise
+    const PixelEstimate *knownEstimate(const WardThreadState &state, const Point2i &p) const;
+    //index of pixel p in pixelEstimates
+    int pixelIndex(const Point2i &p) const;
+    //adds the radiance L of a camera sample to the estimate of its pixel
+    void recordPixelSample(const Spectrum &L) const;
+    //relative error the visibility statistics make on the nTested first sources of localSources
+    float predictionError(const LocalSource *localSources, int nTested, float pointVisibility,
+			  uint64_t cell) const;
   
     float certainty, tolerance ;
     const int maxDepth;
     std::vector<LightSource>lightSources;
-    std::mutex mtx;
+    //snapshot of the sources whose point doesn't depend on the shading point, evaluated
+    //all at once at Lambertian points
+    VirtualPointLights virtualLights;
+    std::vector<int> sourceVirtualLight; //index in virtualLights of each source, -1 if not in it
+    //statistics of the last render, merged from all tiles
+    VisibilityStats stats;
+    //the finished tiles are merged in tile order, and every tilesPerGeneration
+    //tiles a copy is published as a generation. A tile reads the generation
+    //ending at least 2 * tilesPerGeneration tiles before it, so the statistics
+    //it sees don't depend on the thread scheduling. With a single generation
+    //of lag the generation is the one the other threads are finishing, and
+    //every thread waits for the slowest tile of it
+    int tilesPerGeneration;
+    mutable std::mutex sharedMutex;
+    mutable std::condition_variable generationPublished;
+    mutable std::map<int, VisibilityStats> finishedTiles; //tiles waiting for the ones before them
+    mutable int nMergedTiles; //tiles 0 to nMergedTiles - 1 are in mergedStats
+    mutable VisibilityStats mergedStats;
+    mutable int nGenerations; //generation g holds the first g * tilesPerGeneration tiles
+    mutable std::shared_ptr<const VisibilityStats> generations[3]; //last three, by index modulo 3
+    //the visibility of a source changes across rooms, so the statistics are also
+    //kept per voxel, the widest dimension of the scene having maxVoxels voxels
+    const int maxVoxels;
+    Bounds3f gridBounds;
+    int nVoxels[3];
+    //lightcuts: the sources are clustered in a tree and each point ranks the
+    //clusters of a cut instead of every source, a cluster being tested
+    //and accounted for in the statistics through its representative
+    const bool useLightTree;
+    const Float maxCutError; //maximum error of a cluster, relative to the total estimate
+    const int maxCutSize;
+    std::unique_ptr<LightTree> lightTree;
+    std::vector<int> treeSources; //index in lightSources of the lights of the tree
+    std::vector<int> otherSources; //sources that can't be clustered, always ranked
+    //adaptive tolerance: instead of tolerance, each sample uses the tolerance
+    //that keeps its relative error, estimated from the neighbouring pixels,
+    //around errorBudget, within [minTolerance, maxTolerance]. The budget is
+    //lowered where the luminance of the samples and pixels varies
+    const bool adaptiveTolerance;
+    const float errorBudget;
+    const float minTolerance, maxTolerance;
+    //estimates of the pixels of the film, each written by the tile rendering it
+    Bounds2i sampleBounds;
+    mutable std::vector<PixelEstimate> pixelEstimates;
 
 };
 
@@ -65,6 +65,29 @@ Spectrum DiffuseAreaLight::Power() const {
     return (twoSided ? 2 : 1) * Lemit * area * Pi;
 }
 
+bool DiffuseAreaLight::EmissionBounds(Bounds3f *bounds,
+                                      Spectrum *maxIntensity) const {
+    // Whichever way the shape is sampled, the estimate is _Lemit_ times
+    // the solid angle sampled, which is at most _area_ / d^2.
+    *bounds = shape->WorldBound();
+    *maxIntensity = Lemit * area;
+    return true;
+}
+
+bool DiffuseAreaLight::SampleFixedPoint(const Point2f &u, Interaction *pLight,
+                                        Spectrum *I, bool *twoSided) const {
+    // _Sample_Li()_ converts the area density of the shape's sample to
+    // solid angle, which gives the cosine and 1 / d^2 factors
+    if (shape->SampleDependsOnReference()) return false;
+    Float pdf;
+    *pLight = shape->Sample(u, &pdf);
+    if (pdf == 0) return false;
+    pLight->mediumInterface = mediumInterface;
+    *I = Lemit / pdf;
+    *twoSided = this->twoSided;
+    return true;
+}
+
 Spectrum DiffuseAreaLight::Sample_Li(const Interaction &ref, const Point2f &u,
                                      Vector3f *wi, Float *pdf,
                                      VisibilityTester *vis) const {
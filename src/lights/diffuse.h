@@ -65,6 +65,9 @@ class DiffuseAreaLight : public AreaLight {
                        Float *pdfDir) const;
     void Pdf_Le(const Ray &, const Normal3f &, Float *pdfPos,
                 Float *pdfDir) const;
+    bool EmissionBounds(Bounds3f *bounds, Spectrum *maxIntensity) const;
+    bool SampleFixedPoint(const Point2f &u, Interaction *pLight, Spectrum *I,
+                          bool *twoSided) const;
 
   protected:
     // DiffuseAreaLight Protected Data
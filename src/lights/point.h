@@ -63,6 +63,18 @@ class PointLight : public Light {
                        Float *pdfDir) const;
     void Pdf_Le(const Ray &, const Normal3f &, Float *pdfPos,
                 Float *pdfDir) const;
+    bool EmissionBounds(Bounds3f *bounds, Spectrum *maxIntensity) const {
+        *bounds = Bounds3f(pLight);
+        *maxIntensity = I;
+        return true;
+    }
+    bool SampleFixedPoint(const Point2f &u, Interaction *pLight, Spectrum *I,
+                          bool *twoSided) const {
+        *pLight = Interaction(this->pLight, 0, mediumInterface);
+        *I = this->I;
+        *twoSided = true;
+        return true;
+    }
 
   private:
     // PointLight Private Data
@@ -61,6 +61,11 @@ class SpotLight : public Light {
                        Float *pdfDir) const;
     void Pdf_Le(const Ray &, const Normal3f &, Float *pdfPos,
                 Float *pdfDir) const;
+    bool EmissionBounds(Bounds3f *bounds, Spectrum *maxIntensity) const {
+        *bounds = Bounds3f(pLight);
+        *maxIntensity = I;
+        return true;
+    }
 
   private:
     // SpotLight Private Data
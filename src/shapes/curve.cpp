@@ -40,6 +40,8 @@ namespace pbrt {
 
 STAT_MEMORY_COUNTER("Memory/Curves", curveBytes);
 STAT_PERCENT("Intersections/Ray-curve intersection tests", nHits, nTests);
+STAT_COUNTER("Intersections/Ray-curve tests culled by oriented bounds",
+             nCulledTests);
 STAT_INT_DISTRIBUTION("Intersections/Curve refinement level", refinementLevel);
 STAT_COUNTER("Scene/Curves", nCurves);
 STAT_COUNTER("Scene/Split curves", nSplitCurves);
@@ -120,6 +122,108 @@ std::vector<std::shared_ptr<Shape>> CreateCurve(
     return segments;
 }
 
+Curve::Curve(const Transform *ObjectToWorld, const Transform *WorldToObject,
+             bool reverseOrientation,
+             const std::shared_ptr<CurveCommon> &common, Float uMin,
+             Float uMax)
+    : Shape(ObjectToWorld, WorldToObject, reverseOrientation),
+      common(common),
+      uMin(uMin),
+      uMax(uMax) {
+    // Compute object-space control points for curve segment, _cpObj_
+    Point3f cpObj[4];
+    cpObj[0] = BlossomBezier(common->cpObj, uMin, uMin, uMin);
+    cpObj[1] = BlossomBezier(common->cpObj, uMin, uMin, uMax);
+    cpObj[2] = BlossomBezier(common->cpObj, uMin, uMax, uMax);
+    cpObj[3] = BlossomBezier(common->cpObj, uMax, uMax, uMax);
+    Float halfWidth =
+        0.5f * std::max(Lerp(uMin, common->width[0], common->width[1]),
+                        Lerp(uMax, common->width[0], common->width[1]));
+    orientedBounds = CurveBounds(*ObjectToWorld, cpObj, halfWidth);
+}
+
+CurveBounds::CurveBounds(const Transform &objectToWorld, const Point3f cp[4],
+                         Float halfWidth) {
+    // Bound the control points, expanded by the curve's width, in an
+    // object-space frame following the chord
+    Vector3f objAxis[3];
+    objAxis[0] = cp[3] - cp[0];
+    if (objAxis[0].LengthSquared() == 0) objAxis[0] = cp[1] - cp[0];
+    if (objAxis[0].LengthSquared() == 0) objAxis[0] = Vector3f(1, 0, 0);
+    objAxis[0] = Normalize(objAxis[0]);
+    CoordinateSystem(objAxis[0], &objAxis[1], &objAxis[2]);
+    Float lo[3], hi[3];
+    for (int i = 0; i < 3; ++i) {
+        lo[i] = hi[i] = Dot(objAxis[i], Vector3f(cp[0]));
+        for (int j = 1; j < 4; ++j) {
+            Float d = Dot(objAxis[i], Vector3f(cp[j]));
+            lo[i] = std::min(lo[i], d);
+            hi[i] = std::max(hi[i], d);
+        }
+        lo[i] -= halfWidth;
+        hi[i] += halfWidth;
+    }
+
+    // Bound the world-space corners of that box in a frame following the
+    // transformed chord
+    axis[0] = Normalize(objectToWorld(objAxis[0]));
+    axis[1] = objectToWorld(objAxis[1]);
+    axis[1] = Normalize(axis[1] - Dot(axis[1], axis[0]) * axis[0]);
+    axis[2] = Cross(axis[0], axis[1]);
+    Float maxCoordinate = 0;
+    for (int i = 0; i < 3; ++i) {
+        pMin[i] = Infinity;
+        pMax[i] = -Infinity;
+    }
+    for (int c = 0; c < 8; ++c) {
+        Point3f corner = Point3f(0, 0, 0) +
+                         ((c & 1) ? hi[0] : lo[0]) * objAxis[0] +
+                         ((c & 2) ? hi[1] : lo[1]) * objAxis[1] +
+                         ((c & 4) ? hi[2] : lo[2]) * objAxis[2];
+        Vector3f pWorld = Vector3f(objectToWorld(corner));
+        maxCoordinate = std::max(maxCoordinate, std::abs(pWorld.x) +
+                                                    std::abs(pWorld.y) +
+                                                    std::abs(pWorld.z));
+        for (int i = 0; i < 3; ++i) {
+            Float d = Dot(axis[i], pWorld);
+            pMin[i] = std::min(pMin[i], d);
+            pMax[i] = std::max(pMax[i], d);
+        }
+    }
+    // Account for the rounding errors of the box's construction
+    Float err = gamma(16) * maxCoordinate;
+    for (int i = 0; i < 3; ++i) {
+        pMin[i] -= err;
+        pMax[i] += err;
+    }
+}
+
+bool CurveBounds::IntersectP(const Ray &ray) const {
+    Float t0 = 0, t1 = ray.tMax;
+    for (int i = 0; i < 3; ++i) {
+        // Project the ray on _axis[i]_, widening the slab by the rounding
+        // error of the projection of its origin
+        Float o = Dot(axis[i], Vector3f(ray.o));
+        Float d = Dot(axis[i], ray.d);
+        Float err = gamma(3) * (std::abs(axis[i].x * ray.o.x) +
+                                std::abs(axis[i].y * ray.o.y) +
+                                std::abs(axis[i].z * ray.o.z));
+        Float lo = pMin[i] - err, hi = pMax[i] + err;
+        if (d == 0) {
+            if (o < lo || o > hi) return false;
+            continue;
+        }
+        Float invD = 1 / d;
+        Float tNear = (lo - o) * invD, tFar = (hi - o) * invD;
+        if (tNear > tFar) std::swap(tNear, tFar);
+        tFar *= 1 + 2 * gamma(3);
+        t0 = tNear > t0 ? tNear : t0;
+        t1 = tFar < t1 ? tFar : t1;
+        if (t0 > t1) return false;
+    }
+    return true;
+}
+
 Bounds3f Curve::ObjectBound() const {
     // Compute object-space control points for curve segment, _cpObj_
     Point3f cpObj[4];
@@ -138,6 +242,13 @@ bool Curve::Intersect(const Ray &r, Float *tHit, SurfaceInteraction *isect,
                       bool testAlphaTexture) const {
     ProfilePhase p(isect ? Prof::CurveIntersect : Prof::CurveIntersectP);
     ++nTests;
+    // Skip the ray's transformation and projection if it misses the
+    // segment's oriented bounds
+    if (!orientedBounds.IntersectP(r)) {
+        ++nCulledTests;
+        return false;
+    }
+
     // Transform _Ray_ to object space
     Vector3f oErr, dErr;
     Ray ray = (*WorldToObject)(r, &oErr, &dErr);
@@ -58,17 +58,28 @@ struct CurveCommon {
     Float normalAngle, invSinNormalAngle;
 };
 
+// CurveBounds Declarations
+// World-space box around a curve segment, with its first axis along the
+// segment's chord; thin diagonal segments fill a small part of their
+// axis-aligned bounds but most of this box.
+struct CurveBounds {
+    CurveBounds() {}
+    // Bounds the cubic Bezier curve with object-space control points _cp_,
+    // expanded by _halfWidth_
+    CurveBounds(const Transform &objectToWorld, const Point3f cp[4],
+                Float halfWidth);
+    bool IntersectP(const Ray &ray) const;
+    Vector3f axis[3];
+    Float pMin[3], pMax[3];
+};
+
 // Curve Declarations
 class Curve : public Shape {
   public:
     // Curve Public Methods
     Curve(const Transform *ObjectToWorld, const Transform *WorldToObject,
           bool reverseOrientation, const std::shared_ptr<CurveCommon> &common,
-          Float uMin, Float uMax)
-        : Shape(ObjectToWorld, WorldToObject, reverseOrientation),
-          common(common),
-          uMin(uMin),
-          uMax(uMax) {}
+          Float uMin, Float uMax);
     Bounds3f ObjectBound() const;
     bool Intersect(const Ray &ray, Float *tHit, SurfaceInteraction *isect,
                    bool testAlphaTexture) const;
@@ -85,6 +96,7 @@ class Curve : public Shape {
     // Curve Private Data
     const std::shared_ptr<CurveCommon> common;
     const Float uMin, uMax;
+    CurveBounds orientedBounds;
 };
 
 std::vector<std::shared_ptr<Shape>> CreateCurveShape(const Transform *o2w,
@@ -286,7 +286,8 @@ std::vector<std::shared_ptr<Shape>> CreatePLYMesh(
                               context.indexCtr / 3, context.indices,
                               vertexCount, context.p, nullptr, context.n,
                               context.uv, alphaTex, shadowAlphaTex,
-                              context.faceIndices);
+                              context.faceIndices,
+                              params.FindOneBool("compact", false));
 }
 
 }  // namespace pbrt
@@ -63,6 +63,7 @@ class Sphere : public Shape {
     bool IntersectP(const Ray &ray, bool testAlphaTexture) const;
     Float Area() const;
     Interaction Sample(const Point2f &u, Float *pdf) const;
+    bool SampleDependsOnReference() const { return true; }
     Interaction Sample(const Interaction &ref, const Point2f &u,
                        Float *pdf) const;
     Float Pdf(const Interaction &ref, const Vector3f &wi) const;
@@ -49,151 +49,12 @@ static void PlyErrorCallback(p_ply, const char *message) {
     Error("PLY writing error: %s", message);
 }
 
-// Triangle Method Definitions
-STAT_RATIO("Scene/Triangles per triangle mesh", nTris, nMeshes);
-TriangleMesh::TriangleMesh(
-    const Transform &ObjectToWorld, int nTriangles, const int *vertexIndices,
-    int nVertices, const Point3f *P, const Vector3f *S, const Normal3f *N,
-    const Point2f *UV, const std::shared_ptr<Texture<Float>> &alphaMask,
-    const std::shared_ptr<Texture<Float>> &shadowAlphaMask,
-    const int *fIndices)
-    : nTriangles(nTriangles),
-      nVertices(nVertices),
-      vertexIndices(vertexIndices, vertexIndices + 3 * nTriangles),
-      alphaMask(alphaMask),
-      shadowAlphaMask(shadowAlphaMask) {
-    ++nMeshes;
-    nTris += nTriangles;
-    triMeshBytes += sizeof(*this) + this->vertexIndices.size() * sizeof(int) +
-                    nVertices * (sizeof(*P) + (N ? sizeof(*N) : 0) +
-                                 (S ? sizeof(*S) : 0) + (UV ? sizeof(*UV) : 0) +
-                                 (fIndices ? sizeof(*fIndices) : 0));
-
-    // Transform mesh vertices to world space
-    p.reset(new Point3f[nVertices]);
-    for (int i = 0; i < nVertices; ++i) p[i] = ObjectToWorld(P[i]);
-
-    // Copy _UV_, _N_, and _S_ vertex data, if present
-    if (UV) {
-        uv.reset(new Point2f[nVertices]);
-        memcpy(uv.get(), UV, nVertices * sizeof(Point2f));
-    }
-    if (N) {
-        n.reset(new Normal3f[nVertices]);
-        for (int i = 0; i < nVertices; ++i) n[i] = ObjectToWorld(N[i]);
-    }
-    if (S) {
-        s.reset(new Vector3f[nVertices]);
-        for (int i = 0; i < nVertices; ++i) s[i] = ObjectToWorld(S[i]);
-    }
-
-    if (fIndices)
-        faceIndices = std::vector<int>(fIndices, fIndices + nTriangles);
-}
-
-std::vector<std::shared_ptr<Shape>> CreateTriangleMesh(
-    const Transform *ObjectToWorld, const Transform *WorldToObject,
-    bool reverseOrientation, int nTriangles, const int *vertexIndices,
-    int nVertices, const Point3f *p, const Vector3f *s, const Normal3f *n,
-    const Point2f *uv, const std::shared_ptr<Texture<Float>> &alphaMask,
-    const std::shared_ptr<Texture<Float>> &shadowAlphaMask,
-    const int *faceIndices) {
-    std::shared_ptr<TriangleMesh> mesh = std::make_shared<TriangleMesh>(
-        *ObjectToWorld, nTriangles, vertexIndices, nVertices, p, s, n, uv,
-        alphaMask, shadowAlphaMask, faceIndices);
-    std::vector<std::shared_ptr<Shape>> tris;
-    tris.reserve(nTriangles);
-    for (int i = 0; i < nTriangles; ++i)
-        tris.push_back(std::make_shared<Triangle>(ObjectToWorld, WorldToObject,
-                                                  reverseOrientation, mesh, i));
-    return tris;
-}
-
-bool WritePlyFile(const std::string &filename, int nTriangles,
-                  const int *vertexIndices, int nVertices, const Point3f *P,
-                  const Vector3f *S, const Normal3f *N, const Point2f *UV,
-                  const int *faceIndices) {
-    p_ply plyFile =
-        ply_create(filename.c_str(), PLY_DEFAULT, PlyErrorCallback, 0, nullptr);
-    if (plyFile == nullptr)
-        return false;
-
-    ply_add_element(plyFile, "vertex", nVertices);
-    ply_add_scalar_property(plyFile, "x", PLY_FLOAT);
-    ply_add_scalar_property(plyFile, "y", PLY_FLOAT);
-    ply_add_scalar_property(plyFile, "z", PLY_FLOAT);
-    if (N) {
-        ply_add_scalar_property(plyFile, "nx", PLY_FLOAT);
-        ply_add_scalar_property(plyFile, "ny", PLY_FLOAT);
-        ply_add_scalar_property(plyFile, "nz", PLY_FLOAT);
-    }
-    if (UV) {
-        ply_add_scalar_property(plyFile, "u", PLY_FLOAT);
-        ply_add_scalar_property(plyFile, "v", PLY_FLOAT);
-    }
-    if (S)
-        Warning("%s: PLY mesh will be missing tangent vectors \"S\".",
-                filename.c_str());
-
-    ply_add_element(plyFile, "face", nTriangles);
-    ply_add_list_property(plyFile, "vertex_indices", PLY_UINT8, PLY_INT);
-    if (faceIndices)
-        ply_add_scalar_property(plyFile, "face_indices", PLY_INT);
-    ply_write_header(plyFile);
-
-    for (int i = 0; i < nVertices; ++i) {
-        ply_write(plyFile, P[i].x);
-        ply_write(plyFile, P[i].y);
-        ply_write(plyFile, P[i].z);
-        if (N) {
-            ply_write(plyFile, N[i].x);
-            ply_write(plyFile, N[i].y);
-            ply_write(plyFile, N[i].z);
-        }
-        if (UV) {
-            ply_write(plyFile, UV[i].x);
-            ply_write(plyFile, UV[i].y);
-        }
-    }
-
-    for (int i = 0; i < nTriangles; ++i) {
-        ply_write(plyFile, 3);
-        ply_write(plyFile, vertexIndices[3 * i]);
-        ply_write(plyFile, vertexIndices[3 * i + 1]);
-        ply_write(plyFile, vertexIndices[3 * i + 2]);
-        if (faceIndices)
-            ply_write(plyFile, faceIndices[i]);
-    }
-    ply_close(plyFile);
-    return true;
-}
-
-Bounds3f Triangle::ObjectBound() const {
-    // Get triangle vertices in _p0_, _p1_, and _p2_
-    const Point3f &p0 = mesh->p[v[0]];
-    const Point3f &p1 = mesh->p[v[1]];
-    const Point3f &p2 = mesh->p[v[2]];
-    return Union(Bounds3f((*WorldToObject)(p0), (*WorldToObject)(p1)),
-                 (*WorldToObject)(p2));
-}
-
-Bounds3f Triangle::WorldBound() const {
-    // Get triangle vertices in _p0_, _p1_, and _p2_
-    const Point3f &p0 = mesh->p[v[0]];
-    const Point3f &p1 = mesh->p[v[1]];
-    const Point3f &p2 = mesh->p[v[2]];
-    return Union(Bounds3f(p0, p1), p2);
-}
-
-bool Triangle::Intersect(const Ray &ray, Float *tHit, SurfaceInteraction *isect,
-                         bool testAlphaTexture) const {
-    ProfilePhase p(Prof::TriIntersect);
-    ++nTests;
-    // Get triangle vertices in _p0_, _p1_, and _p2_
-    const Point3f &p0 = mesh->p[v[0]];
-    const Point3f &p1 = mesh->p[v[1]];
-    const Point3f &p2 = mesh->p[v[2]];
-
+// Performs the watertight ray--triangle test; if the ray hits the triangle
+// before _ray.tMax_, returns the hit's parametric distance and barycentric
+// coordinates
+static bool IntersectTriangle(const Ray &ray, const Point3f &p0,
+                              const Point3f &p1, const Point3f &p2,
+                              Float *tHit, Float *b0, Float *b1, Float *b2) {
     // Perform ray--triangle intersection test
 
     // Transform triangle vertices to ray coordinate space
@@ -262,9 +123,9 @@ bool Triangle::Intersect(const Ray &ray, Float *tHit, SurfaceInteraction *isect,
 
     // Compute barycentric coordinates and $t$ value for triangle intersection
     Float invDet = 1 / det;
-    Float b0 = e0 * invDet;
-    Float b1 = e1 * invDet;
-    Float b2 = e2 * invDet;
+    *b0 = e0 * invDet;
+    *b1 = e1 * invDet;
+    *b2 = e2 * invDet;
     Float t = tScaled * invDet;
 
     // Ensure that computed triangle $t$ is conservatively greater than zero
@@ -289,12 +150,15 @@ bool Triangle::Intersect(const Ray &ray, Float *tHit, SurfaceInteraction *isect,
                    (gamma(3) * maxE * maxZt + deltaE * maxZt + deltaZ * maxE) *
                    std::abs(invDet);
     if (t <= deltaT) return false;
+    *tHit = t;
+    return true;
+}
 
-    // Compute triangle partial derivatives
-    Vector3f dpdu, dpdv;
-    Point2f uv[3];
-    GetUVs(uv);
-
+// Computes the partial derivatives of the triangle with parametric
+// coordinates _uv_; returns false if the triangle is degenerate
+static bool TriangleDerivatives(const Point3f &p0, const Point3f &p1,
+                                const Point3f &p2, const Point2f uv[3],
+                                Vector3f *dpdu, Vector3f *dpdv) {
     // Compute deltas for triangle partial derivatives
     Vector2f duv02 = uv[0] - uv[2], duv12 = uv[1] - uv[2];
     Vector3f dp02 = p0 - p2, dp12 = p1 - p2;
@@ -302,10 +166,10 @@ bool Triangle::Intersect(const Ray &ray, Float *tHit, SurfaceInteraction *isect,
     bool degenerateUV = std::abs(determinant) < 1e-8;
     if (!degenerateUV) {
         Float invdet = 1 / determinant;
-        dpdu = (duv12[1] * dp02 - duv02[1] * dp12) * invdet;
-        dpdv = (-duv12[0] * dp02 + duv02[0] * dp12) * invdet;
+        *dpdu = (duv12[1] * dp02 - duv02[1] * dp12) * invdet;
+        *dpdv = (-duv12[0] * dp02 + duv02[0] * dp12) * invdet;
     }
-    if (degenerateUV || Cross(dpdu, dpdv).LengthSquared() == 0) {
+    if (degenerateUV || Cross(*dpdu, *dpdv).LengthSquared() == 0) {
         // Handle zero determinant for triangle partial derivative matrix
         Vector3f ng = Cross(p2 - p0, p1 - p0);
         if (ng.LengthSquared() == 0)
@@ -313,9 +177,41 @@ bool Triangle::Intersect(const Ray &ray, Float *tHit, SurfaceInteraction *isect,
             // bogus.
             return false;
 
-        CoordinateSystem(Normalize(ng), &dpdu, &dpdv);
+        CoordinateSystem(Normalize(ng), dpdu, dpdv);
     }
+    return true;
+}
+
+// Returns true if one of the alpha masks cuts out the hit point with
+// barycentric coordinates _b0_, _b1_ and _b2_
+static bool AlphaMasked(const Ray &ray, Float b0, Float b1, Float b2,
+                        const Point3f &p0, const Point3f &p1,
+                        const Point3f &p2, const Point2f uv[3],
+                        const Vector3f &dpdu, const Vector3f &dpdv,
+                        const Shape *shape, const Texture<Float> *alphaMask,
+                        const Texture<Float> *shadowAlphaMask) {
+    // Interpolate $(u,v)$ parametric coordinates and hit point
+    Point3f pHit = b0 * p0 + b1 * p1 + b2 * p2;
+    Point2f uvHit = b0 * uv[0] + b1 * uv[1] + b2 * uv[2];
+    SurfaceInteraction isectLocal(pHit, Vector3f(0, 0, 0), uvHit, -ray.d,
+                                  dpdu, dpdv, Normal3f(0, 0, 0),
+                                  Normal3f(0, 0, 0), ray.time, shape);
+    if (alphaMask && alphaMask->Evaluate(isectLocal) == 0) return true;
+    if (shadowAlphaMask && shadowAlphaMask->Evaluate(isectLocal) == 0)
+        return true;
+    return false;
+}
 
+// Fills in _isect_ for the hit with barycentric coordinates _b0_, _b1_ and
+// _b2_, with shading geometry from the vertex normals _n_ and tangents _s_
+// when they're given
+static void TriangleInteraction(const Ray &ray, Float b0, Float b1, Float b2,
+                                const Point3f &p0, const Point3f &p1,
+                                const Point3f &p2, const Point2f uv[3],
+                                const Vector3f &dpdu, const Vector3f &dpdv,
+                                const Normal3f *n, const Vector3f *s,
+                                const Shape *shape, int faceIndex,
+                                SurfaceInteraction *isect) {
     // Compute error bounds for triangle intersection
     Float xAbsSum =
         (std::abs(b0 * p0.x) + std::abs(b1 * p1.x) + std::abs(b2 * p2.x));
@@ -329,31 +225,24 @@ bool Triangle::Intersect(const Ray &ray, Float *tHit, SurfaceInteraction *isect,
     Point3f pHit = b0 * p0 + b1 * p1 + b2 * p2;
     Point2f uvHit = b0 * uv[0] + b1 * uv[1] + b2 * uv[2];
 
-    // Test intersection against alpha texture, if present
-    if (testAlphaTexture && mesh->alphaMask) {
-        SurfaceInteraction isectLocal(pHit, Vector3f(0, 0, 0), uvHit, -ray.d,
-                                      dpdu, dpdv, Normal3f(0, 0, 0),
-                                      Normal3f(0, 0, 0), ray.time, this);
-        if (mesh->alphaMask->Evaluate(isectLocal) == 0) return false;
-    }
-
     // Fill in _SurfaceInteraction_ from triangle hit
     *isect = SurfaceInteraction(pHit, pError, uvHit, -ray.d, dpdu, dpdv,
                                 Normal3f(0, 0, 0), Normal3f(0, 0, 0), ray.time,
-                                this, faceIndex);
+                                shape, faceIndex);
 
     // Override surface normal in _isect_ for triangle
+    Vector3f dp02 = p0 - p2, dp12 = p1 - p2;
     isect->n = isect->shading.n = Normal3f(Normalize(Cross(dp02, dp12)));
-    if (reverseOrientation ^ transformSwapsHandedness)
+    if (shape->reverseOrientation ^ shape->transformSwapsHandedness)
         isect->n = isect->shading.n = -isect->n;
 
-    if (mesh->n || mesh->s) {
+    if (n || s) {
         // Initialize _Triangle_ shading geometry
 
         // Compute shading normal _ns_ for triangle
         Normal3f ns;
-        if (mesh->n) {
-            ns = (b0 * mesh->n[v[0]] + b1 * mesh->n[v[1]] + b2 * mesh->n[v[2]]);
+        if (n) {
+            ns = (b0 * n[0] + b1 * n[1] + b2 * n[2]);
             if (ns.LengthSquared() > 0)
                 ns = Normalize(ns);
             else
@@ -363,8 +252,8 @@ bool Triangle::Intersect(const Ray &ray, Float *tHit, SurfaceInteraction *isect,
 
         // Compute shading tangent _ss_ for triangle
         Vector3f ss;
-        if (mesh->s) {
-            ss = (b0 * mesh->s[v[0]] + b1 * mesh->s[v[1]] + b2 * mesh->s[v[2]]);
+        if (s) {
+            ss = (b0 * s[0] + b1 * s[1] + b2 * s[2]);
             if (ss.LengthSquared() > 0)
                 ss = Normalize(ss);
             else
@@ -382,12 +271,12 @@ bool Triangle::Intersect(const Ray &ray, Float *tHit, SurfaceInteraction *isect,
 
         // Compute $\dndu$ and $\dndv$ for triangle shading geometry
         Normal3f dndu, dndv;
-        if (mesh->n) {
+        if (n) {
             // Compute deltas for triangle partial derivatives of normal
             Vector2f duv02 = uv[0] - uv[2];
             Vector2f duv12 = uv[1] - uv[2];
-            Normal3f dn1 = mesh->n[v[0]] - mesh->n[v[2]];
-            Normal3f dn2 = mesh->n[v[1]] - mesh->n[v[2]];
+            Normal3f dn1 = n[0] - n[2];
+            Normal3f dn2 = n[1] - n[2];
             Float determinant = duv02[0] * duv12[1] - duv02[1] * duv12[0];
             bool degenerateUV = std::abs(determinant) < 1e-8;
             if (degenerateUV) {
@@ -397,8 +286,8 @@ bool Triangle::Intersect(const Ray &ray, Float *tHit, SurfaceInteraction *isect,
                 // (rather than giving up) so that ray differentials for
                 // rays reflected from triangles with degenerate
                 // parameterizations are still reasonable.
-                Vector3f dn = Cross(Vector3f(mesh->n[v[2]] - mesh->n[v[0]]),
-                                    Vector3f(mesh->n[v[1]] - mesh->n[v[0]]));
+                Vector3f dn = Cross(Vector3f(n[2] - n[0]),
+                                    Vector3f(n[1] - n[0]));
                 if (dn.LengthSquared() == 0)
                     dndu = dndv = Normal3f(0, 0, 0);
                 else {
@@ -414,157 +303,255 @@ bool Triangle::Intersect(const Ray &ray, Float *tHit, SurfaceInteraction *isect,
             }
         } else
             dndu = dndv = Normal3f(0, 0, 0);
-        if (reverseOrientation) ts = -ts;
+        if (shape->reverseOrientation) ts = -ts;
         isect->SetShadingGeometry(ss, ts, dndu, dndv, true);
     }
+}
 
-    *tHit = t;
-    ++nHits;
+// Triangle Method Definitions
+STAT_RATIO("Scene/Triangles per triangle mesh", nTris, nMeshes);
+TriangleMesh::TriangleMesh(
+    const Transform &ObjectToWorld, int nTriangles, const int *vertexIndices,
+    int nVertices, const Point3f *P, const Vector3f *S, const Normal3f *N,
+    const Point2f *UV, const std::shared_ptr<Texture<Float>> &alphaMask,
+    const std::shared_ptr<Texture<Float>> &shadowAlphaMask,
+    const int *fIndices)
+    : nTriangles(nTriangles),
+      nVertices(nVertices),
+      vertexIndices(vertexIndices, vertexIndices + 3 * nTriangles),
+      alphaMask(alphaMask),
+      shadowAlphaMask(shadowAlphaMask) {
+    ++nMeshes;
+    nTris += nTriangles;
+    triMeshBytes += sizeof(*this) + this->vertexIndices.size() * sizeof(int) +
+                    nVertices * (sizeof(*P) + (N ? sizeof(*N) : 0) +
+                                 (S ? sizeof(*S) : 0) + (UV ? sizeof(*UV) : 0) +
+                                 (fIndices ? sizeof(*fIndices) : 0));
+
+    // Transform mesh vertices to world space
+    p.reset(new Point3f[nVertices]);
+    for (int i = 0; i < nVertices; ++i) p[i] = ObjectToWorld(P[i]);
+
+    // Copy _UV_, _N_, and _S_ vertex data, if present
+    if (UV) {
+        uv.reset(new Point2f[nVertices]);
+        memcpy(uv.get(), UV, nVertices * sizeof(Point2f));
+    }
+    if (N) {
+        n.reset(new Normal3f[nVertices]);
+        for (int i = 0; i < nVertices; ++i) n[i] = ObjectToWorld(N[i]);
+    }
+    if (S) {
+        s.reset(new Vector3f[nVertices]);
+        for (int i = 0; i < nVertices; ++i) s[i] = ObjectToWorld(S[i]);
+    }
+
+    if (fIndices)
+        faceIndices = std::vector<int>(fIndices, fIndices + nTriangles);
+}
+
+std::vector<std::shared_ptr<Shape>> CreateTriangleMesh(
+    const Transform *ObjectToWorld, const Transform *WorldToObject,
+    bool reverseOrientation, int nTriangles, const int *vertexIndices,
+    int nVertices, const Point3f *p, const Vector3f *s, const Normal3f *n,
+    const Point2f *uv, const std::shared_ptr<Texture<Float>> &alphaMask,
+    const std::shared_ptr<Texture<Float>> &shadowAlphaMask,
+    const int *faceIndices, bool compact) {
+    if (compact) {
+        if (nTriangles == 0) return std::vector<std::shared_ptr<Shape>>();
+        return {std::make_shared<CompactTriangleMesh>(
+            ObjectToWorld, WorldToObject, reverseOrientation, nTriangles,
+            vertexIndices, nVertices, p, s, n, uv, alphaMask, shadowAlphaMask,
+            faceIndices)};
+    }
+    std::shared_ptr<TriangleMesh> mesh = std::make_shared<TriangleMesh>(
+        *ObjectToWorld, nTriangles, vertexIndices, nVertices, p, s, n, uv,
+        alphaMask, shadowAlphaMask, faceIndices);
+    std::vector<std::shared_ptr<Shape>> tris;
+    tris.reserve(nTriangles);
+    for (int i = 0; i < nTriangles; ++i)
+        tris.push_back(std::make_shared<Triangle>(ObjectToWorld, WorldToObject,
+                                                  reverseOrientation, mesh, i));
+    return tris;
+}
+
+bool WritePlyFile(const std::string &filename, int nTriangles,
+                  const int *vertexIndices, int nVertices, const Point3f *P,
+                  const Vector3f *S, const Normal3f *N, const Point2f *UV,
+                  const int *faceIndices) {
+    p_ply plyFile =
+        ply_create(filename.c_str(), PLY_DEFAULT, PlyErrorCallback, 0, nullptr);
+    if (plyFile == nullptr)
+        return false;
+
+    ply_add_element(plyFile, "vertex", nVertices);
+    ply_add_scalar_property(plyFile, "x", PLY_FLOAT);
+    ply_add_scalar_property(plyFile, "y", PLY_FLOAT);
+    ply_add_scalar_property(plyFile, "z", PLY_FLOAT);
+    if (N) {
+        ply_add_scalar_property(plyFile, "nx", PLY_FLOAT);
+        ply_add_scalar_property(plyFile, "ny", PLY_FLOAT);
+        ply_add_scalar_property(plyFile, "nz", PLY_FLOAT);
+    }
+    if (UV) {
+        ply_add_scalar_property(plyFile, "u", PLY_FLOAT);
+        ply_add_scalar_property(plyFile, "v", PLY_FLOAT);
+    }
+    if (S)
+        Warning("%s: PLY mesh will be missing tangent vectors \"S\".",
+                filename.c_str());
+
+    ply_add_element(plyFile, "face", nTriangles);
+    ply_add_list_property(plyFile, "vertex_indices", PLY_UINT8, PLY_INT);
+    if (faceIndices)
+        ply_add_scalar_property(plyFile, "face_indices", PLY_INT);
+    ply_write_header(plyFile);
+
+    for (int i = 0; i < nVertices; ++i) {
+        ply_write(plyFile, P[i].x);
+        ply_write(plyFile, P[i].y);
+        ply_write(plyFile, P[i].z);
+        if (N) {
+            ply_write(plyFile, N[i].x);
+            ply_write(plyFile, N[i].y);
+            ply_write(plyFile, N[i].z);
+        }
+        if (UV) {
+            ply_write(plyFile, UV[i].x);
+            ply_write(plyFile, UV[i].y);
+        }
+    }
+
+    for (int i = 0; i < nTriangles; ++i) {
+        ply_write(plyFile, 3);
+        ply_write(plyFile, vertexIndices[3 * i]);
+        ply_write(plyFile, vertexIndices[3 * i + 1]);
+        ply_write(plyFile, vertexIndices[3 * i + 2]);
+        if (faceIndices)
+            ply_write(plyFile, faceIndices[i]);
+    }
+    ply_close(plyFile);
     return true;
 }
 
-bool Triangle::IntersectP(const Ray &ray, bool testAlphaTexture) const {
-    ProfilePhase p(Prof::TriIntersectP);
-    ++nTests;
+Bounds3f Triangle::ObjectBound() const {
     // Get triangle vertices in _p0_, _p1_, and _p2_
     const Point3f &p0 = mesh->p[v[0]];
     const Point3f &p1 = mesh->p[v[1]];
     const Point3f &p2 = mesh->p[v[2]];
+    return Union(Bounds3f((*WorldToObject)(p0), (*WorldToObject)(p1)),
+                 (*WorldToObject)(p2));
+}
 
-    // Perform ray--triangle intersection test
-
-    // Transform triangle vertices to ray coordinate space
-
-    // Translate vertices based on ray origin
-    Point3f p0t = p0 - Vector3f(ray.o);
-    Point3f p1t = p1 - Vector3f(ray.o);
-    Point3f p2t = p2 - Vector3f(ray.o);
+Bounds3f Triangle::WorldBound() const {
+    // Get triangle vertices in _p0_, _p1_, and _p2_
+    const Point3f &p0 = mesh->p[v[0]];
+    const Point3f &p1 = mesh->p[v[1]];
+    const Point3f &p2 = mesh->p[v[2]];
+    return Union(Bounds3f(p0, p1), p2);
+}
 
-    // Permute components of triangle vertices and ray direction
-    int kz = MaxDimension(Abs(ray.d));
-    int kx = kz + 1;
-    if (kx == 3) kx = 0;
-    int ky = kx + 1;
-    if (ky == 3) ky = 0;
-    Vector3f d = Permute(ray.d, kx, ky, kz);
-    p0t = Permute(p0t, kx, ky, kz);
-    p1t = Permute(p1t, kx, ky, kz);
-    p2t = Permute(p2t, kx, ky, kz);
+Bounds3f Triangle::ClippedWorldBound(const Bounds3f &clip) const {
+    // Clip the triangle's polygon against the six planes of _clip_
+    Point3f poly[10], clipped[10];
+    poly[0] = mesh->p[v[0]];
+    poly[1] = mesh->p[v[1]];
+    poly[2] = mesh->p[v[2]];
+    int nVertices = 3;
+    for (int axis = 0; axis < 3; ++axis)
+        for (int side = 0; side < 2; ++side) {
+            Float plane = clip[side][axis];
+            auto inside = [&](const Point3f &p) {
+                return side == 0 ? p[axis] >= plane : p[axis] <= plane;
+            };
+            bool allInside = true;
+            for (int i = 0; i < nVertices; ++i)
+                allInside &= inside(poly[i]);
+            if (allInside) continue;
+            int nClipped = 0;
+            for (int i = 0; i < nVertices; ++i) {
+                const Point3f &a = poly[i], &b = poly[(i + 1) % nVertices];
+                if (inside(a)) clipped[nClipped++] = a;
+                if (inside(a) != inside(b)) {
+                    // Add the point where edge $ab$ crosses the plane
+                    Float t = (plane - a[axis]) / (b[axis] - a[axis]);
+                    Point3f p = Lerp(t, a, b);
+                    p[axis] = plane;
+                    clipped[nClipped++] = p;
+                }
+            }
+            if (nClipped == 0) return Bounds3f();
+            for (int i = 0; i < nClipped; ++i) poly[i] = clipped[i];
+            nVertices = nClipped;
+        }
 
-    // Apply shear transformation to translated vertex positions
-    Float Sx = -d.x / d.z;
-    Float Sy = -d.y / d.z;
-    Float Sz = 1.f / d.z;
-    p0t.x += Sx * p0t.z;
-    p0t.y += Sy * p0t.z;
-    p1t.x += Sx * p1t.z;
-    p1t.y += Sy * p1t.z;
-    p2t.x += Sx * p2t.z;
-    p2t.y += Sy * p2t.z;
+    // Bound the clipped polygon, allowing for the rounding error of the
+    // crossing points, without going outside of _clip_ or of the triangle
+    Bounds3f bounds;
+    for (int i = 0; i < nVertices; ++i) bounds = Union(bounds, poly[i]);
+    Float error = gamma(3) * MaxComponent(Max(Abs(Vector3f(bounds.pMin)),
+                                              Abs(Vector3f(bounds.pMax))));
+    return pbrt::Intersect(Expand(bounds, error),
+                           pbrt::Intersect(WorldBound(), clip));
+}
 
-    // Compute edge function coefficients _e0_, _e1_, and _e2_
-    Float e0 = p1t.x * p2t.y - p1t.y * p2t.x;
-    Float e1 = p2t.x * p0t.y - p2t.y * p0t.x;
-    Float e2 = p0t.x * p1t.y - p0t.y * p1t.x;
+bool Triangle::Intersect(const Ray &ray, Float *tHit, SurfaceInteraction *isect,
+                         bool testAlphaTexture) const {
+    ProfilePhase p(Prof::TriIntersect);
+    ++nTests;
+    // Get triangle vertices in _p0_, _p1_, and _p2_
+    const Point3f &p0 = mesh->p[v[0]];
+    const Point3f &p1 = mesh->p[v[1]];
+    const Point3f &p2 = mesh->p[v[2]];
 
-    // Fall back to double precision test at triangle edges
-    if (sizeof(Float) == sizeof(float) &&
-        (e0 == 0.0f || e1 == 0.0f || e2 == 0.0f)) {
-        double p2txp1ty = (double)p2t.x * (double)p1t.y;
-        double p2typ1tx = (double)p2t.y * (double)p1t.x;
-        e0 = (float)(p2typ1tx - p2txp1ty);
-        double p0txp2ty = (double)p0t.x * (double)p2t.y;
-        double p0typ2tx = (double)p0t.y * (double)p2t.x;
-        e1 = (float)(p0typ2tx - p0txp2ty);
-        double p1txp0ty = (double)p1t.x * (double)p0t.y;
-        double p1typ0tx = (double)p1t.y * (double)p0t.x;
-        e2 = (float)(p1typ0tx - p1txp0ty);
-    }
+    Float t, b0, b1, b2;
+    if (!IntersectTriangle(ray, p0, p1, p2, &t, &b0, &b1, &b2)) return false;
 
-    // Perform triangle edge and determinant tests
-    if ((e0 < 0 || e1 < 0 || e2 < 0) && (e0 > 0 || e1 > 0 || e2 > 0))
-        return false;
-    Float det = e0 + e1 + e2;
-    if (det == 0) return false;
+    // Compute triangle partial derivatives
+    Vector3f dpdu, dpdv;
+    Point2f uv[3];
+    GetUVs(uv);
+    if (!TriangleDerivatives(p0, p1, p2, uv, &dpdu, &dpdv)) return false;
 
-    // Compute scaled hit distance to triangle and test against ray $t$ range
-    p0t.z *= Sz;
-    p1t.z *= Sz;
-    p2t.z *= Sz;
-    Float tScaled = e0 * p0t.z + e1 * p1t.z + e2 * p2t.z;
-    if (det < 0 && (tScaled >= 0 || tScaled < ray.tMax * det))
-        return false;
-    else if (det > 0 && (tScaled <= 0 || tScaled > ray.tMax * det))
+    // Test intersection against alpha texture, if present
+    if (testAlphaTexture && mesh->alphaMask &&
+        AlphaMasked(ray, b0, b1, b2, p0, p1, p2, uv, dpdu, dpdv, this,
+                    mesh->alphaMask.get(), nullptr))
         return false;
 
-    // Compute barycentric coordinates and $t$ value for triangle intersection
-    Float invDet = 1 / det;
-    Float b0 = e0 * invDet;
-    Float b1 = e1 * invDet;
-    Float b2 = e2 * invDet;
-    Float t = tScaled * invDet;
-
-    // Ensure that computed triangle $t$ is conservatively greater than zero
-
-    // Compute $\delta_z$ term for triangle $t$ error bounds
-    Float maxZt = MaxComponent(Abs(Vector3f(p0t.z, p1t.z, p2t.z)));
-    Float deltaZ = gamma(3) * maxZt;
-
-    // Compute $\delta_x$ and $\delta_y$ terms for triangle $t$ error bounds
-    Float maxXt = MaxComponent(Abs(Vector3f(p0t.x, p1t.x, p2t.x)));
-    Float maxYt = MaxComponent(Abs(Vector3f(p0t.y, p1t.y, p2t.y)));
-    Float deltaX = gamma(5) * (maxXt + maxZt);
-    Float deltaY = gamma(5) * (maxYt + maxZt);
+    Normal3f n[3];
+    Vector3f s[3];
+    for (int i = 0; i < 3; ++i) {
+        if (mesh->n) n[i] = mesh->n[v[i]];
+        if (mesh->s) s[i] = mesh->s[v[i]];
+    }
+    TriangleInteraction(ray, b0, b1, b2, p0, p1, p2, uv, dpdu, dpdv,
+                        mesh->n ? n : nullptr, mesh->s ? s : nullptr, this,
+                        faceIndex, isect);
+    *tHit = t;
+    ++nHits;
+    return true;
+}
 
-    // Compute $\delta_e$ term for triangle $t$ error bounds
-    Float deltaE =
-        2 * (gamma(2) * maxXt * maxYt + deltaY * maxXt + deltaX * maxYt);
+bool Triangle::IntersectP(const Ray &ray, bool testAlphaTexture) const {
+    ProfilePhase p(Prof::TriIntersectP);
+    ++nTests;
+    // Get triangle vertices in _p0_, _p1_, and _p2_
+    const Point3f &p0 = mesh->p[v[0]];
+    const Point3f &p1 = mesh->p[v[1]];
+    const Point3f &p2 = mesh->p[v[2]];
 
-    // Compute $\delta_t$ term for triangle $t$ error bounds and check _t_
-    Float maxE = MaxComponent(Abs(Vector3f(e0, e1, e2)));
-    Float deltaT = 3 *
-                   (gamma(3) * maxE * maxZt + deltaE * maxZt + deltaZ * maxE) *
-                   std::abs(invDet);
-    if (t <= deltaT) return false;
+    Float t, b0, b1, b2;
+    if (!IntersectTriangle(ray, p0, p1, p2, &t, &b0, &b1, &b2)) return false;
 
     // Test shadow ray intersection against alpha texture, if present
     if (testAlphaTexture && (mesh->alphaMask || mesh->shadowAlphaMask)) {
-        // Compute triangle partial derivatives
         Vector3f dpdu, dpdv;
         Point2f uv[3];
         GetUVs(uv);
-
-        // Compute deltas for triangle partial derivatives
-        Vector2f duv02 = uv[0] - uv[2], duv12 = uv[1] - uv[2];
-        Vector3f dp02 = p0 - p2, dp12 = p1 - p2;
-        Float determinant = duv02[0] * duv12[1] - duv02[1] * duv12[0];
-        bool degenerateUV = std::abs(determinant) < 1e-8;
-        if (!degenerateUV) {
-            Float invdet = 1 / determinant;
-            dpdu = (duv12[1] * dp02 - duv02[1] * dp12) * invdet;
-            dpdv = (-duv12[0] * dp02 + duv02[0] * dp12) * invdet;
-        }
-        if (degenerateUV || Cross(dpdu, dpdv).LengthSquared() == 0) {
-            // Handle zero determinant for triangle partial derivative matrix
-            Vector3f ng = Cross(p2 - p0, p1 - p0);
-            if (ng.LengthSquared() == 0)
-                // The triangle is actually degenerate; the intersection is
-                // bogus.
-                return false;
-
-            CoordinateSystem(Normalize(Cross(p2 - p0, p1 - p0)), &dpdu, &dpdv);
-        }
-
-        // Interpolate $(u,v)$ parametric coordinates and hit point
-        Point3f pHit = b0 * p0 + b1 * p1 + b2 * p2;
-        Point2f uvHit = b0 * uv[0] + b1 * uv[1] + b2 * uv[2];
-        SurfaceInteraction isectLocal(pHit, Vector3f(0, 0, 0), uvHit, -ray.d,
-                                      dpdu, dpdv, Normal3f(0, 0, 0),
-                                      Normal3f(0, 0, 0), ray.time, this);
-        if (mesh->alphaMask && mesh->alphaMask->Evaluate(isectLocal) == 0)
-            return false;
-        if (mesh->shadowAlphaMask &&
-            mesh->shadowAlphaMask->Evaluate(isectLocal) == 0)
+        if (!TriangleDerivatives(p0, p1, p2, uv, &dpdu, &dpdv)) return false;
+        if (AlphaMasked(ray, b0, b1, b2, p0, p1, p2, uv, dpdu, dpdv, this,
+                        mesh->alphaMask.get(), mesh->shadowAlphaMask.get()))
             return false;
     }
     ++nHits;
@@ -644,6 +631,283 @@ Float Triangle::SolidAngle(const Point3f &p, int nSamples) const {
         std::acos(Clamp(Dot(cross20, -cross01), -1, 1)) - Pi);
 }
 
+// CompactTriangleMesh Local Declarations
+STAT_MEMORY_COUNTER("Memory/Compact triangle meshes", compactMeshBytes);
+static PBRT_CONSTEXPR int maxTrianglesInLeaf = 4;
+
+// Encodes the direction of _v_ as a point of the octahedron unfolded on
+// $[-1,1]^2$, with 16 bits per coordinate
+static uint32_t EncodeOctahedral(const Vector3f &v) {
+    Float l1 = std::abs(v.x) + std::abs(v.y) + std::abs(v.z);
+    if (l1 == 0) return EncodeOctahedral(Vector3f(0, 0, 1));
+    Float x = v.x / l1, y = v.y / l1;
+    if (v.z < 0) {
+        // Fold the lower hemisphere over the diagonals
+        Float xFolded = (1 - std::abs(y)) * (x >= 0 ? 1 : -1);
+        y = (1 - std::abs(x)) * (y >= 0 ? 1 : -1);
+        x = xFolded;
+    }
+    auto quantize = [](Float f) {
+        return (uint32_t)std::round(Clamp((f + 1) / 2, 0, 1) * 65535);
+    };
+    return quantize(x) | (quantize(y) << 16);
+}
+
+static Vector3f DecodeOctahedral(uint32_t e) {
+    Float x = -1 + 2 * Float(e & 0xffff) / 65535;
+    Float y = -1 + 2 * Float(e >> 16) / 65535;
+    Vector3f v(x, y, 1 - std::abs(x) - std::abs(y));
+    if (v.z < 0) {
+        v.x = (1 - std::abs(y)) * (x >= 0 ? 1 : -1);
+        v.y = (1 - std::abs(x)) * (y >= 0 ? 1 : -1);
+    }
+    return Normalize(v);
+}
+
+// CompactTriangleMesh Method Definitions
+CompactTriangleMesh::CompactTriangleMesh(
+    const Transform *ObjectToWorld, const Transform *WorldToObject,
+    bool reverseOrientation, int nTriangles, const int *vertexIndices,
+    int nVertices, const Point3f *P, const Vector3f *S, const Normal3f *N,
+    const Point2f *UV, const std::shared_ptr<Texture<Float>> &alphaMask,
+    const std::shared_ptr<Texture<Float>> &shadowAlphaMask,
+    const int *fIndices)
+    : Shape(ObjectToWorld, WorldToObject, reverseOrientation),
+      nTriangles(nTriangles),
+      nVertices(nVertices),
+      alphaMask(alphaMask),
+      shadowAlphaMask(shadowAlphaMask) {
+    ++nMeshes;
+    nTris += nTriangles;
+
+    // Quantize the world space vertex positions over their bounds
+    std::vector<Point3f> worldP(nVertices);
+    Bounds3f quantizationBounds;
+    for (int i = 0; i < nVertices; ++i) {
+        worldP[i] = (*ObjectToWorld)(P[i]);
+        quantizationBounds = Union(quantizationBounds, worldP[i]);
+    }
+    origin = quantizationBounds.pMin;
+    quantizationScale = quantizationBounds.Diagonal() / 65535;
+    p.resize(3 * nVertices);
+    for (int i = 0; i < nVertices; ++i)
+        for (int c = 0; c < 3; ++c) {
+            Float q = quantizationScale[c] > 0
+                          ? (worldP[i][c] - origin[c]) / quantizationScale[c]
+                          : 0;
+            p[3 * i + c] = (uint16_t)Clamp(std::round(q), 0, 65535);
+        }
+
+    // Encode _N_ and _S_ and copy _UV_ vertex data, if present
+    if (N) {
+        n.resize(nVertices);
+        for (int i = 0; i < nVertices; ++i)
+            n[i] = EncodeOctahedral(Vector3f((*ObjectToWorld)(N[i])));
+    }
+    if (S) {
+        s.resize(nVertices);
+        for (int i = 0; i < nVertices; ++i)
+            s[i] = EncodeOctahedral((*ObjectToWorld)(S[i]));
+    }
+    if (UV) uv.assign(UV, UV + nVertices);
+
+    // Build the BVH over the triangles with their quantized positions
+    std::vector<Bounds3f> triangleBounds(nTriangles);
+    for (int i = 0; i < nTriangles; ++i) {
+        Point3f p0 = this->P(vertexIndices[3 * i]),
+                p1 = this->P(vertexIndices[3 * i + 1]),
+                p2 = this->P(vertexIndices[3 * i + 2]);
+        triangleBounds[i] = Union(Bounds3f(p0, p1), p2);
+        area += 0.5 * Cross(p1 - p0, p2 - p0).Length();
+    }
+    std::vector<int> triangles =
+        BuildFlatBVH(triangleBounds, nTriangles, 1, maxTrianglesInLeaf,
+                     &nodes, &nodeBounds);
+    if (nTriangles > 0) bounds = nodeBounds[0];
+
+    // Store the vertex and face indices in the order of the leaves
+    if (nVertices <= 65536)
+        indices16.resize(3 * nTriangles);
+    else
+        indices32.resize(3 * nTriangles);
+    for (int i = 0; i < nTriangles; ++i)
+        for (int c = 0; c < 3; ++c) {
+            int vertex = vertexIndices[3 * triangles[i] + c];
+            if (indices16.empty())
+                indices32[3 * i + c] = vertex;
+            else
+                indices16[3 * i + c] = vertex;
+        }
+    if (fIndices) {
+        faceIndices.resize(nTriangles);
+        for (int i = 0; i < nTriangles; ++i)
+            faceIndices[i] = fIndices[triangles[i]];
+    }
+    compactMeshBytes += sizeof(*this) + p.size() * sizeof(p[0]) +
+                        (n.size() + s.size()) * sizeof(uint32_t) +
+                        uv.size() * sizeof(Point2f) +
+                        indices16.size() * sizeof(uint16_t) +
+                        indices32.size() * sizeof(int) +
+                        faceIndices.size() * sizeof(int) +
+                        nodes.size() * sizeof(FlatBVHNode) +
+                        nodeBounds.size() * sizeof(Bounds3f);
+}
+
+Bounds3f CompactTriangleMesh::ObjectBound() const {
+    return (*WorldToObject)(bounds);
+}
+
+void CompactTriangleMesh::GetUVs(int triangle, Point2f uv[3]) const {
+    if (!this->uv.empty()) {
+        for (int i = 0; i < 3; ++i)
+            uv[i] = this->uv[VertexIndex(triangle, i)];
+    } else {
+        uv[0] = Point2f(0, 0);
+        uv[1] = Point2f(1, 0);
+        uv[2] = Point2f(1, 1);
+    }
+}
+
+bool CompactTriangleMesh::Intersect(const Ray &r, Float *tHit,
+                                    SurfaceInteraction *isect,
+                                    bool testAlphaTexture) const {
+    if (nodes.empty()) return false;
+    ProfilePhase prof(Prof::TriIntersect);
+    // Closer hits shorten this copy of the ray
+    Ray ray = r;
+    int hitTriangle = -1;
+    Float b0, b1, b2;
+    Point3f p[3];
+    Point2f uv[3];
+    Vector3f dpdu, dpdv;
+    auto intersectLeaf = [&](const FlatBVHNode &node) {
+        for (int i = 0; i < node.nItems; ++i) {
+            int triangle = node.itemOffset + i;
+            ++nTests;
+            Point3f pt[3];
+            GetVertices(triangle, pt);
+            Float t, bt0, bt1, bt2;
+            if (!IntersectTriangle(ray, pt[0], pt[1], pt[2], &t, &bt0, &bt1,
+                                   &bt2))
+                continue;
+            Point2f uvt[3];
+            GetUVs(triangle, uvt);
+            Vector3f dpdut, dpdvt;
+            if (!TriangleDerivatives(pt[0], pt[1], pt[2], uvt, &dpdut, &dpdvt))
+                continue;
+            if (testAlphaTexture && alphaMask &&
+                AlphaMasked(ray, bt0, bt1, bt2, pt[0], pt[1], pt[2], uvt,
+                            dpdut, dpdvt, this, alphaMask.get(), nullptr))
+                continue;
+            // Record the closest hit so far
+            ray.tMax = t;
+            hitTriangle = triangle;
+            b0 = bt0;
+            b1 = bt1;
+            b2 = bt2;
+            for (int j = 0; j < 3; ++j) {
+                p[j] = pt[j];
+                uv[j] = uvt[j];
+            }
+            dpdu = dpdut;
+            dpdv = dpdvt;
+        }
+        return false;
+    };
+    TraverseFlatBVH(nodes.data(), nodeBounds.data(), 1, ray, intersectLeaf);
+    if (hitTriangle == -1) return false;
+
+    // Decode the shading normals and tangents of the closest hit
+    Normal3f ns[3];
+    Vector3f ss[3];
+    for (int i = 0; i < 3; ++i) {
+        int vertex = VertexIndex(hitTriangle, i);
+        if (!n.empty()) ns[i] = Normal3f(DecodeOctahedral(n[vertex]));
+        if (!s.empty()) ss[i] = DecodeOctahedral(s[vertex]);
+    }
+    TriangleInteraction(ray, b0, b1, b2, p[0], p[1], p[2], uv, dpdu, dpdv,
+                        n.empty() ? nullptr : ns, s.empty() ? nullptr : ss,
+                        this,
+                        faceIndices.empty() ? 0 : faceIndices[hitTriangle],
+                        isect);
+    *tHit = ray.tMax;
+    ++nHits;
+    return true;
+}
+
+bool CompactTriangleMesh::IntersectP(const Ray &ray,
+                                     bool testAlphaTexture) const {
+    if (nodes.empty()) return false;
+    ProfilePhase prof(Prof::TriIntersectP);
+    auto intersectLeaf = [&](const FlatBVHNode &node) {
+        for (int i = 0; i < node.nItems; ++i) {
+            int triangle = node.itemOffset + i;
+            ++nTests;
+            Point3f p[3];
+            GetVertices(triangle, p);
+            Float t, b0, b1, b2;
+            if (!IntersectTriangle(ray, p[0], p[1], p[2], &t, &b0, &b1, &b2))
+                continue;
+            // Test shadow ray intersection against alpha texture, if present
+            if (testAlphaTexture && (alphaMask || shadowAlphaMask)) {
+                Point2f uv[3];
+                GetUVs(triangle, uv);
+                Vector3f dpdu, dpdv;
+                if (!TriangleDerivatives(p[0], p[1], p[2], uv, &dpdu, &dpdv))
+                    continue;
+                if (AlphaMasked(ray, b0, b1, b2, p[0], p[1], p[2], uv, dpdu,
+                                dpdv, this, alphaMask.get(),
+                                shadowAlphaMask.get()))
+                    continue;
+            }
+            ++nHits;
+            return true;
+        }
+        return false;
+    };
+    return TraverseFlatBVH(nodes.data(), nodeBounds.data(), 1, ray,
+                           intersectLeaf);
+}
+
+Interaction CompactTriangleMesh::Sample(const Point2f &u, Float *pdf) const {
+    std::call_once(areaDistributionFlag, [&]() {
+        std::vector<Float> areas(nTriangles);
+        for (int i = 0; i < nTriangles; ++i) {
+            Point3f p[3];
+            GetVertices(i, p);
+            areas[i] = 0.5 * Cross(p[1] - p[0], p[2] - p[0]).Length();
+        }
+        areaDistribution.reset(new Distribution1D(areas.data(), nTriangles));
+    });
+    // Pick a triangle according to its area, then a point on it
+    Float uRemapped;
+    int triangle = areaDistribution->SampleDiscrete(u[0], nullptr, &uRemapped);
+    Point2f b =
+        UniformSampleTriangle(Point2f(std::min(uRemapped, OneMinusEpsilon), u[1]));
+    Point3f p[3];
+    GetVertices(triangle, p);
+    Interaction it;
+    it.p = b[0] * p[0] + b[1] * p[1] + (1 - b[0] - b[1]) * p[2];
+    // Compute surface normal for sampled point on triangle, oriented as in
+    // _Triangle::Sample()_
+    it.n = Normalize(Normal3f(Cross(p[1] - p[0], p[2] - p[0])));
+    if (!n.empty()) {
+        Vector3f ns =
+            b[0] * DecodeOctahedral(n[VertexIndex(triangle, 0)]) +
+            b[1] * DecodeOctahedral(n[VertexIndex(triangle, 1)]) +
+            (1 - b[0] - b[1]) * DecodeOctahedral(n[VertexIndex(triangle, 2)]);
+        it.n = Faceforward(it.n, ns);
+    } else if (reverseOrientation ^ transformSwapsHandedness)
+        it.n *= -1;
+
+    // Compute error bounds for sampled point on triangle
+    Point3f pAbsSum =
+        Abs(b[0] * p[0]) + Abs(b[1] * p[1]) + Abs((1 - b[0] - b[1]) * p[2]);
+    it.pError = gamma(6) * Vector3f(pAbsSum.x, pAbsSum.y, pAbsSum.z);
+    *pdf = 1 / area;
+    return it;
+}
+
 std::vector<std::shared_ptr<Shape>> CreateTriangleMeshShape(
     const Transform *o2w, const Transform *w2o, bool reverseOrientation,
     const ParamSet &params,
@@ -739,7 +1003,8 @@ std::vector<std::shared_ptr<Shape>> CreateTriangleMeshShape(
         shadowAlphaTex.reset(new ConstantTexture<Float>(0.f));
 
     return CreateTriangleMesh(o2w, w2o, reverseOrientation, nvi / 3, vi, npi, P,
-                              S, N, uvs, alphaTex, shadowAlphaTex, faceIndices);
+                              S, N, uvs, alphaTex, shadowAlphaTex, faceIndices,
+                              params.FindOneBool("compact", false));
 }
 
 }  // namespace pbrt
@@ -41,7 +41,9 @@
 // shapes/triangle.h*
 #include "shape.h"
 #include "stats.h"
+#include "accelerators/flatbvh.h"
 #include <map>
+#include <mutex>
 
 namespace pbrt {
 
@@ -81,6 +83,13 @@ class Triangle : public Shape {
     }
     Bounds3f ObjectBound() const;
     Bounds3f WorldBound() const;
+    Bounds3f ClippedWorldBound(const Bounds3f &clip) const;
+    bool GetTriangleVertices(Point3f p[3]) const {
+        // Alpha-masked triangles need the full intersection to be tested
+        if (mesh->alphaMask || mesh->shadowAlphaMask) return false;
+        for (int i = 0; i < 3; ++i) p[i] = mesh->p[v[i]];
+        return true;
+    }
     bool Intersect(const Ray &ray, Float *tHit, SurfaceInteraction *isect,
                    bool testAlphaTexture = true) const;
     bool IntersectP(const Ray &ray, bool testAlphaTexture = true) const;
@@ -113,13 +122,82 @@ class Triangle : public Shape {
     int faceIndex;
 };
 
+// A whole triangle mesh stored as a single shape, with its positions
+// quantized to 16 bits over the mesh's bounds, its normals and tangents
+// octahedral-encoded in 32 bits and 16-bit vertex indices when the mesh has
+// few enough vertices. Its triangles are addressed by index from a BVH of
+// its own rather than being separate _Triangle_ shapes, each one with its
+// _GeometricPrimitive_.
+class CompactTriangleMesh : public Shape {
+  public:
+    // CompactTriangleMesh Public Methods
+    CompactTriangleMesh(const Transform *ObjectToWorld,
+                        const Transform *WorldToObject,
+                        bool reverseOrientation, int nTriangles,
+                        const int *vertexIndices, int nVertices,
+                        const Point3f *P, const Vector3f *S, const Normal3f *N,
+                        const Point2f *UV,
+                        const std::shared_ptr<Texture<Float>> &alphaMask,
+                        const std::shared_ptr<Texture<Float>> &shadowAlphaMask,
+                        const int *faceIndices);
+    Bounds3f ObjectBound() const;
+    Bounds3f WorldBound() const { return bounds; }
+    bool Intersect(const Ray &ray, Float *tHit, SurfaceInteraction *isect,
+                   bool testAlphaTexture = true) const;
+    bool IntersectP(const Ray &ray, bool testAlphaTexture = true) const;
+    Float Area() const { return area; }
+
+    using Shape::Sample;  // Bring in the other Sample() overload.
+    Interaction Sample(const Point2f &u, Float *pdf) const;
+
+  private:
+    // CompactTriangleMesh Private Methods
+    int VertexIndex(int triangle, int corner) const {
+        return indices16.empty() ? indices32[3 * triangle + corner]
+                                 : indices16[3 * triangle + corner];
+    }
+    Point3f P(int vertex) const {
+        const uint16_t *q = &p[3 * vertex];
+        return Point3f(origin.x + q[0] * quantizationScale.x,
+                       origin.y + q[1] * quantizationScale.y,
+                       origin.z + q[2] * quantizationScale.z);
+    }
+    void GetVertices(int triangle, Point3f p[3]) const {
+        for (int i = 0; i < 3; ++i) p[i] = P(VertexIndex(triangle, i));
+    }
+    void GetUVs(int triangle, Point2f uv[3]) const;
+
+    // CompactTriangleMesh Private Data
+    const int nTriangles, nVertices;
+    // Vertex positions are _origin_ plus their 16-bit coordinates scaled by
+    // _quantizationScale_
+    Point3f origin;
+    Vector3f quantizationScale;
+    Bounds3f bounds;
+    std::vector<uint16_t> p;
+    std::vector<uint32_t> n, s;
+    std::vector<Point2f> uv;
+    // Vertex indices, in the order of the BVH's leaves; only one of the two
+    // is used
+    std::vector<uint16_t> indices16;
+    std::vector<int> indices32;
+    std::vector<int> faceIndices;
+    std::shared_ptr<Texture<Float>> alphaMask, shadowAlphaMask;
+    std::vector<FlatBVHNode> nodes;
+    std::vector<Bounds3f> nodeBounds;
+    Float area = 0;
+    // Distribution of the triangles' areas, only created for sampling
+    mutable std::once_flag areaDistributionFlag;
+    mutable std::unique_ptr<Distribution1D> areaDistribution;
+};
+
 std::vector<std::shared_ptr<Shape>> CreateTriangleMesh(
     const Transform *o2w, const Transform *w2o, bool reverseOrientation,
     int nTriangles, const int *vertexIndices, int nVertices, const Point3f *p,
     const Vector3f *s, const Normal3f *n, const Point2f *uv,
     const std::shared_ptr<Texture<Float>> &alphaTexture,
     const std::shared_ptr<Texture<Float>> &shadowAlphaTexture,
-    const int *faceIndices = nullptr);
+    const int *faceIndices = nullptr, bool compact = false);
 std::vector<std::shared_ptr<Shape>> CreateTriangleMeshShape(
     const Transform *o2w, const Transform *w2o, bool reverseOrientation,
     const ParamSet &params,
@@ -0,0 +1,135 @@
+#ifndef PBRT_TESTS_ACCELERATORS_H
+#define PBRT_TESTS_ACCELERATORS_H
+
+// Helpers shared by the tests of the accelerators; tests/gtest/gtest.h must
+// be included first
+#include "pbrt.h"
+#include "rng.h"
+#include "interaction.h"
+#include "primitive.h"
+#include "sampling.h"
+#include "shapes/triangle.h"
+#ifdef PBRT_HAVE_MMAP
+#include <dirent.h>
+#include <unistd.h>
+#endif
+
+namespace pbrt {
+
+// Random triangles of various sizes in a [-10,10]^3 box.
+inline std::vector<std::shared_ptr<Primitive>> RandomTriangles(int nTriangles,
+                                                               RNG &rng) {
+    std::vector<Point3f> p;
+    std::vector<int> indices;
+    for (int i = 0; i < nTriangles; ++i) {
+        Point3f center(Lerp(rng.UniformFloat(), -10, 10),
+                       Lerp(rng.UniformFloat(), -10, 10),
+                       Lerp(rng.UniformFloat(), -10, 10));
+        Float size = std::pow(10, Lerp(rng.UniformFloat(), -2, 0.5));
+        for (int j = 0; j < 3; ++j) {
+            Point2f u(rng.UniformFloat(), rng.UniformFloat());
+            p.push_back(center + size * UniformSampleSphere(u));
+            indices.push_back(3 * i + j);
+        }
+    }
+    static Transform identity;
+    std::vector<std::shared_ptr<Shape>> tris = CreateTriangleMesh(
+        &identity, &identity, false, nTriangles, &indices[0], p.size(), &p[0],
+        nullptr, nullptr, nullptr, nullptr, nullptr);
+    std::vector<std::shared_ptr<Primitive>> prims;
+    for (const auto &tri : tris)
+        prims.push_back(std::make_shared<GeometricPrimitive>(
+            tri, nullptr, nullptr, MediumInterface()));
+    return prims;
+}
+
+// Random rays starting inside and outside the triangles' box, some of them
+// with a limited extent and some axis-aligned, at random times.
+inline Ray RandomRay(RNG &rng) {
+    Point3f o(Lerp(rng.UniformFloat(), -15, 15),
+              Lerp(rng.UniformFloat(), -15, 15),
+              Lerp(rng.UniformFloat(), -15, 15));
+    Vector3f d = UniformSampleSphere(Point2f(rng.UniformFloat(),
+                                             rng.UniformFloat()));
+    if (rng.UniformFloat() < .1f) {
+        int axis = std::min(int(rng.UniformFloat() * 3), 2);
+        d = Vector3f(0, 0, 0);
+        d[axis] = rng.UniformFloat() < .5f ? -1 : 1;
+    }
+    Float tMax = rng.UniformFloat() < .5f ? Infinity : 20 * rng.UniformFloat();
+    return Ray(o, d, tMax, rng.UniformFloat());
+}
+
+// Checks that _bvh_ finds the same intersections as _reference_, one ray at
+// a time and in batches.
+inline void CheckSameIntersections(const Primitive &reference,
+                                   const Primitive &bvh, RNG &rng) {
+    Ray rays[MaxRayBatchSize], refRays[MaxRayBatchSize];
+    SurfaceInteraction refIsects[MaxRayBatchSize];
+    uint64_t refHits = 0;
+    for (int i = 0; i < MaxRayBatchSize; ++i) rays[i] = RandomRay(rng);
+    for (int i = 0; i < MaxRayBatchSize; ++i) {
+        Ray ray = rays[i];
+        refRays[i] = rays[i];
+        SurfaceInteraction isect;
+        bool refHit = reference.Intersect(refRays[i], &refIsects[i]);
+        if (refHit) refHits |= uint64_t(1) << i;
+        EXPECT_EQ(refHit, bvh.Intersect(ray, &isect));
+        if (refHit) {
+            EXPECT_EQ(refRays[i].tMax, ray.tMax);
+            EXPECT_EQ(refIsects[i].primitive, isect.primitive);
+        }
+        EXPECT_EQ(reference.IntersectP(rays[i]), bvh.IntersectP(rays[i]));
+    }
+    EXPECT_EQ(reference.IntersectP(rays, MaxRayBatchSize),
+              bvh.IntersectP(rays, MaxRayBatchSize));
+
+    SurfaceInteraction isects[MaxRayBatchSize];
+    EXPECT_EQ(refHits, bvh.Intersect(rays, MaxRayBatchSize, isects));
+    for (int i = 0; i < MaxRayBatchSize; ++i)
+        if (refHits & (uint64_t(1) << i)) {
+            EXPECT_EQ(refRays[i].tMax, rays[i].tMax);
+            EXPECT_EQ(refIsects[i].primitive, isects[i].primitive);
+        }
+}
+
+#ifdef PBRT_HAVE_MMAP
+// A temporary directory for the tree caches, removed along with the files
+// in it when it goes out of scope.
+class TempCacheDir {
+  public:
+    explicit TempCacheDir(const std::string &prefix)
+        : path("/tmp/" + prefix + "XXXXXX") {
+        CHECK(mkdtemp(&path[0]) != nullptr) << "Unable to create " << path;
+    }
+    ~TempCacheDir() {
+        Clear();
+        EXPECT_EQ(0, rmdir(path.c_str()));
+    }
+    const char *Path() const { return path.c_str(); }
+    // Paths of the files in the directory.
+    std::vector<std::string> Files() const {
+        std::vector<std::string> files;
+        DIR *dir = opendir(path.c_str());
+        EXPECT_TRUE(dir != nullptr);
+        if (!dir) return files;
+        while (struct dirent *entry = readdir(dir))
+            if (entry->d_name[0] != '.')
+                files.push_back(path + "/" + entry->d_name);
+        closedir(dir);
+        return files;
+    }
+    // Removes the files in the directory.
+    void Clear() const {
+        for (const std::string &file : Files())
+            EXPECT_EQ(0, remove(file.c_str())) << file;
+    }
+
+  private:
+    std::string path;
+};
+#endif  // PBRT_HAVE_MMAP
+
+}  // namespace pbrt
+
+#endif  // PBRT_TESTS_ACCELERATORS_H
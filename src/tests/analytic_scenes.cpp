@@ -313,6 +313,26 @@ std::vector<TestIntegrator> GetIntegrators() {
                                    scene});
         }
 
+        for (auto sampler : GetSamplers(Bounds2i(Point2i(0, 0), resolution))) {
+            std::unique_ptr<Filter> filter(new BoxFilter(Vector2f(0.5, 0.5)));
+            Film *film =
+                new Film(resolution, Bounds2f(Point2f(0, 0), Point2f(1, 1)),
+                         std::move(filter), 1., inTestDir("test.exr"), 1.);
+            std::shared_ptr<Camera> camera =
+                std::make_shared<PerspectiveCamera>(
+                    identity, Bounds2f(Point2f(-1, -1), Point2f(1, 1)), 0., 1.,
+                    0., 10., 45, film, nullptr);
+
+            Integrator *integrator = new PathIntegrator(
+                8, camera, sampler.first, film->croppedPixelBounds, 1,
+                "spatial", true);
+            integrators.push_back({integrator, film,
+                                   "Path, depth 8, sorted rays, Perspective, " +
+                                       sampler.second + ", " +
+                                       scene.description,
+                                   scene});
+        }
+
         // Volume path tracing integrators
         for (auto sampler : GetSamplers(Bounds2i(Point2i(0, 0), resolution))) {
             std::unique_ptr<Filter> filter(new BoxFilter(Vector2f(0.5, 0.5)));
@@ -68,3 +68,36 @@ TEST(AnimatedTransform, Randoms) {
         }
     }
 }
+
+TEST(AnimatedTransform, SegmentBounds) {
+    RNG rng(1);
+    auto r = [&rng]() { return -10. + 20. * rng.UniformFloat(); };
+
+    for (int i = 0; i < 100; ++i) {
+        Transform t0 = RandomTransform(rng);
+        Transform t1 = RandomTransform(rng);
+        AnimatedTransform at(&t0, 0., &t1, 1.);
+        Bounds3f bounds(Point3f(r(), r(), r()), Point3f(r(), r(), r()));
+        Bounds3f motionBounds = at.MotionBounds(bounds);
+
+        // The bounds of each part of the interval should hold the box
+        // during that part and be inside the bounds of the whole motion
+        const int nSegments = 5;
+        for (int s = 0; s < nSegments; ++s) {
+            Float time0 = Float(s) / nSegments, time1 = Float(s + 1) / nSegments;
+            Bounds3f segmentBounds = at.MotionBounds(bounds, time0, time1);
+            Vector3f slop = (Float)1e-4 * motionBounds.Diagonal();
+            EXPECT_TRUE(Inside(segmentBounds.pMin + slop, motionBounds));
+            EXPECT_TRUE(Inside(segmentBounds.pMax - slop, motionBounds));
+            for (int j = 0; j <= 100; ++j) {
+                Transform tr;
+                at.Interpolate(Lerp(j / 100.f, time0, time1), &tr);
+                Bounds3f tb = tr(bounds);
+                tb.pMin += (Float)1e-4 * tb.Diagonal();
+                tb.pMax -= (Float)1e-4 * tb.Diagonal();
+                EXPECT_TRUE(Inside(tb.pMin, segmentBounds));
+                EXPECT_TRUE(Inside(tb.pMax, segmentBounds));
+            }
+        }
+    }
+}
@@ -0,0 +1,228 @@
+#include "tests/gtest/gtest.h"
+#include "pbrt.h"
+#include "rng.h"
+#include "interaction.h"
+#include "primitive.h"
+#include "sampling.h"
+#include "parallel.h"
+#include "stats.h"
+#include "accelerators/bvh.h"
+#include "accelerators/instancebvh.h"
+#include "accelerators/motionbvh.h"
+#include "shapes/triangle.h"
+#include "tests/accelerators.h"
+
+using namespace pbrt;
+
+TEST(BVH, WideNodesMatchBinary) {
+    RNG rng(4);
+    std::vector<std::shared_ptr<Primitive>> prims = RandomTriangles(2000, rng);
+    for (int maxPrims : {1, 4}) {
+        BVHAccel binary(prims, maxPrims);
+        for (int width : {4, 8}) {
+            BVHAccel wide(prims, maxPrims, BVHAccel::SplitMethod::SAH, width);
+            EXPECT_EQ(binary.WorldBound(), wide.WorldBound());
+            for (int i = 0; i < 100; ++i)
+                CheckSameIntersections(binary, wide, rng);
+        }
+    }
+}
+
+TEST(BVH, WideNodesSinglePrimitive) {
+    RNG rng(5);
+    std::vector<std::shared_ptr<Primitive>> prims = RandomTriangles(1, rng);
+    BVHAccel binary(prims);
+    BVHAccel wide(prims, 1, BVHAccel::SplitMethod::SAH, 4);
+    for (int i = 0; i < 10; ++i) CheckSameIntersections(binary, wide, rng);
+}
+
+TEST(BVH, ParallelBuildMatchesSerial) {
+    RNG rng(6);
+    // Enough primitives for subtree tasks and parallel binning at the top
+    std::vector<std::shared_ptr<Primitive>> prims =
+        RandomTriangles(100000, rng);
+    int nThreads = PbrtOptions.nThreads;
+    PbrtOptions.nThreads = 1;
+    BVHAccel serial(prims, 4);
+    PbrtOptions.nThreads = 4;
+    ParallelInit();
+    BVHAccel parallel(prims, 4);
+    ParallelCleanup();
+    PbrtOptions.nThreads = nThreads;
+    EXPECT_EQ(serial.WorldBound(), parallel.WorldBound());
+    for (int i = 0; i < 20; ++i) CheckSameIntersections(serial, parallel, rng);
+}
+
+#ifdef PBRT_HAVE_MMAP
+TEST(BVH, CachedTreeMatchesBuild) {
+    TempCacheDir cacheDir("pbrt_bvhcache");
+    RNG rng(7);
+    std::vector<std::shared_ptr<Primitive>> prims = RandomTriangles(2000, rng);
+    for (int width : {2, 4}) {
+        BVHAccel built(prims, 4, BVHAccel::SplitMethod::SAH, width,
+                       cacheDir.Path());
+        ReportThreadStats();
+        int64_t nLoaded = GetStatsCounter("BVH/Trees loaded from cache");
+        BVHAccel cached(prims, 4, BVHAccel::SplitMethod::SAH, width,
+                        cacheDir.Path());
+        ReportThreadStats();
+        EXPECT_EQ(nLoaded + 1, GetStatsCounter("BVH/Trees loaded from cache"));
+        EXPECT_EQ(built.WorldBound(), cached.WorldBound());
+        for (int i = 0; i < 20; ++i) CheckSameIntersections(built, cached, rng);
+    }
+}
+
+TEST(BVH, CorruptedCacheIsRebuilt) {
+    TempCacheDir cacheDir("pbrt_bvhcache");
+    RNG rng(7);
+    std::vector<std::shared_ptr<Primitive>> prims = RandomTriangles(2000, rng);
+    for (int width : {2, 4}) {
+        BVHAccel built(prims, 4, BVHAccel::SplitMethod::SAH, width,
+                       cacheDir.Path());
+
+        // The last node is a leaf; make it point out of the primitives
+        for (const std::string &filename : cacheDir.Files()) {
+            FILE *f = fopen(filename.c_str(), "r+b");
+            ASSERT_TRUE(f != nullptr);
+            ASSERT_EQ(0, fseek(f, -16, SEEK_END));
+            char garbage[16];
+            memset(garbage, 0x7f, sizeof(garbage));
+            EXPECT_EQ(16, fwrite(garbage, 1, 16, f));
+            fclose(f);
+        }
+
+        ReportThreadStats();
+        int64_t nLoaded = GetStatsCounter("BVH/Trees loaded from cache");
+        BVHAccel rebuilt(prims, 4, BVHAccel::SplitMethod::SAH, width,
+                         cacheDir.Path());
+        ReportThreadStats();
+        EXPECT_EQ(nLoaded, GetStatsCounter("BVH/Trees loaded from cache"));
+        for (int i = 0; i < 20; ++i) CheckSameIntersections(built, rebuilt, rng);
+        cacheDir.Clear();
+    }
+}
+#endif  // PBRT_HAVE_MMAP
+
+TEST(BVH, SpatialSplitsMatchSAH) {
+    RNG rng(8);
+    std::vector<std::shared_ptr<Primitive>> prims = RandomTriangles(2000, rng);
+    BVHAccel sah(prims, 4);
+    for (Float maxDuplication : {0.f, .5f, 4.f})
+        for (int width : {2, 4}) {
+            BVHAccel sbvh(prims, 4, BVHAccel::SplitMethod::SBVH, width, "",
+                          maxDuplication);
+            EXPECT_EQ(sah.WorldBound(), sbvh.WorldBound());
+            for (int i = 0; i < 50; ++i) CheckSameIntersections(sah, sbvh, rng);
+        }
+}
+
+TEST(BVH, QuantizedNodesMatchFloat) {
+    RNG rng(9);
+    std::vector<std::shared_ptr<Primitive>> prims = RandomTriangles(2000, rng);
+    BVHAccel binary(prims, 4);
+    for (int width : {4, 8})
+        for (int quantizeBits : {8, 16}) {
+            BVHAccel quantized(prims, 4, BVHAccel::SplitMethod::SAH, width, "",
+                               .5f, quantizeBits);
+            EXPECT_EQ(binary.WorldBound(), quantized.WorldBound());
+            for (int i = 0; i < 50; ++i)
+                CheckSameIntersections(binary, quantized, rng);
+        }
+}
+
+TEST(BVH, TrianglePacketsMatchPrimitives) {
+    RNG rng(10);
+    std::vector<std::shared_ptr<Primitive>> prims = RandomTriangles(2000, rng);
+    for (int maxPrims : {1, 3, 8}) {
+        BVHAccel reference(prims, maxPrims);
+        for (int width : {2, 4}) {
+            BVHAccel packed(prims, maxPrims, BVHAccel::SplitMethod::SAH, width,
+                            "", .5f, 0, true);
+            for (int i = 0; i < 50; ++i)
+                CheckSameIntersections(reference, packed, rng);
+        }
+    }
+}
+
+TEST(BVH, OptimizedTreeletsMatchBuild) {
+    RNG rng(11);
+    std::vector<std::shared_ptr<Primitive>> prims = RandomTriangles(4000, rng);
+    for (auto splitMethod :
+         {BVHAccel::SplitMethod::HLBVH, BVHAccel::SplitMethod::SBVH}) {
+        BVHAccel built(prims, 4, splitMethod);
+        for (int width : {2, 4}) {
+            BVHAccel optimized(prims, 4, splitMethod, width, "", .5f, 0, false,
+                               2);
+            EXPECT_EQ(built.WorldBound(), optimized.WorldBound());
+            EXPECT_LT(optimized.Quality().sahCost, built.Quality().sahCost);
+            for (int i = 0; i < 50; ++i)
+                CheckSameIntersections(built, optimized, rng);
+        }
+    }
+}
+
+TEST(InstanceBVH, MatchesTransformedPrimitives) {
+    RNG rng(11);
+    std::shared_ptr<Primitive> object =
+        std::make_shared<BVHAccel>(RandomTriangles(200, rng), 4);
+    // Small copies of the object, some of them sharing a transformation
+    const int nInstances = 300;
+    std::vector<Transform> transforms;
+    for (int i = 0; i < nInstances / 2; ++i) {
+        Vector3f axis = UniformSampleSphere(
+            Point2f(rng.UniformFloat(), rng.UniformFloat()));
+        Vector3f offset(Lerp(rng.UniformFloat(), -10, 10),
+                        Lerp(rng.UniformFloat(), -10, 10),
+                        Lerp(rng.UniformFloat(), -10, 10));
+        transforms.push_back(Translate(offset) *
+                             Rotate(360 * rng.UniformFloat(), axis) *
+                             Scale(.1f, .1f, .1f));
+    }
+    std::vector<InstanceRecord> records;
+    std::vector<std::shared_ptr<Primitive>> transformed;
+    for (int i = 0; i < nInstances; ++i) {
+        const Transform *instanceToWorld = &transforms[i % transforms.size()];
+        records.push_back({object.get(), instanceToWorld});
+        transformed.push_back(std::make_shared<TransformedPrimitive>(
+            object, AnimatedTransform(instanceToWorld, 0, instanceToWorld, 1)));
+    }
+    BVHAccel reference(transformed);
+    InstanceBVH instances(records, {object});
+    EXPECT_EQ(reference.WorldBound(), instances.WorldBound());
+    for (int i = 0; i < 50; ++i)
+        CheckSameIntersections(reference, instances, rng);
+}
+
+TEST(MotionBVH, MatchesAnimatedPrimitives) {
+    RNG rng(14);
+    std::shared_ptr<Primitive> object =
+        std::make_shared<BVHAccel>(RandomTriangles(100, rng), 4);
+    // Small copies of the object, moving and spinning across the box
+    std::vector<Transform> transforms;
+    std::vector<std::shared_ptr<Primitive>> moving;
+    transforms.reserve(400);
+    for (int i = 0; i < 200; ++i) {
+        for (int j = 0; j < 2; ++j) {
+            Vector3f axis = UniformSampleSphere(
+                Point2f(rng.UniformFloat(), rng.UniformFloat()));
+            Vector3f offset(Lerp(rng.UniformFloat(), -10, 10),
+                            Lerp(rng.UniformFloat(), -10, 10),
+                            Lerp(rng.UniformFloat(), -10, 10));
+            transforms.push_back(Translate(offset) *
+                                 Rotate(360 * rng.UniformFloat(), axis) *
+                                 Scale(.1f, .1f, .1f));
+        }
+        AnimatedTransform objectToWorld(&transforms[2 * i], 0,
+                                        &transforms[2 * i + 1], 1);
+        moving.push_back(
+            std::make_shared<TransformedPrimitive>(object, objectToWorld));
+    }
+    BVHAccel reference(moving);
+    for (int nSegments : {1, 3, 8}) {
+        MotionBVH motionBVH(moving, 0, 1, nSegments);
+        EXPECT_TRUE(Inside(motionBVH.WorldBound().pMin, reference.WorldBound()));
+        EXPECT_TRUE(Inside(motionBVH.WorldBound().pMax, reference.WorldBound()));
+        for (int i = 0; i < 20; ++i)
+            CheckSameIntersections(reference, motionBVH, rng);
+    }
+}
@@ -0,0 +1,47 @@
+#include "tests/gtest/gtest.h"
+#include "pbrt.h"
+#include "rng.h"
+#include "parallel.h"
+#include "stats.h"
+#include "accelerators/bvh.h"
+#include "accelerators/kdtreeaccel.h"
+#include "tests/accelerators.h"
+
+using namespace pbrt;
+
+TEST(KdTree, ParallelBuildMatchesSerial) {
+    RNG rng(12);
+    // Enough primitives for subtree tasks
+    std::vector<std::shared_ptr<Primitive>> prims = RandomTriangles(20000, rng);
+    BVHAccel reference(prims, 4);
+    int nThreads = PbrtOptions.nThreads;
+    PbrtOptions.nThreads = 1;
+    KdTreeAccel serial(prims);
+    PbrtOptions.nThreads = 4;
+    ParallelInit();
+    KdTreeAccel parallel(prims);
+    ParallelCleanup();
+    PbrtOptions.nThreads = nThreads;
+    EXPECT_EQ(reference.WorldBound(), serial.WorldBound());
+    EXPECT_EQ(serial.WorldBound(), parallel.WorldBound());
+    for (int i = 0; i < 20; ++i) {
+        CheckSameIntersections(reference, serial, rng);
+        CheckSameIntersections(serial, parallel, rng);
+    }
+}
+
+#ifdef PBRT_HAVE_MMAP
+TEST(KdTree, CachedTreeMatchesBuild) {
+    TempCacheDir cacheDir("pbrt_kdcache");
+    RNG rng(13);
+    std::vector<std::shared_ptr<Primitive>> prims = RandomTriangles(2000, rng);
+    KdTreeAccel built(prims, 80, 1, .5f, 1, -1, cacheDir.Path());
+    ReportThreadStats();
+    int64_t nLoaded = GetStatsCounter("Kd-tree/Trees loaded from cache");
+    KdTreeAccel cached(prims, 80, 1, .5f, 1, -1, cacheDir.Path());
+    ReportThreadStats();
+    EXPECT_EQ(nLoaded + 1, GetStatsCounter("Kd-tree/Trees loaded from cache"));
+    EXPECT_EQ(built.WorldBound(), cached.WorldBound());
+    for (int i = 0; i < 20; ++i) CheckSameIntersections(built, cached, rng);
+}
+#endif  // PBRT_HAVE_MMAP
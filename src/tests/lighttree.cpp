@@ -0,0 +1,123 @@
+#include "tests/gtest/gtest.h"
+#include "pbrt.h"
+#include "interaction.h"
+#include "lighttree.h"
+#include "memory.h"
+#include "microfacet.h"
+#include "reflection.h"
+#include "rng.h"
+
+using namespace pbrt;
+
+// Point lights scattered around the origin, where a shading point with a
+// Lambertian or a glossy BSDF is lit by them.
+class LightTreeTest : public testing::Test {
+  protected:
+    LightTreeTest() {
+        RNG rng;
+        for (int i = 0; i < 60; ++i) {
+            Point3f p(Lerp(rng.UniformFloat(), -3.f, 3.f),
+                      Lerp(rng.UniformFloat(), -3.f, 3.f),
+                      Lerp(rng.UniformFloat(), -3.f, 3.f));
+            lightPos.push_back(p);
+            lightBounds.push_back(Bounds3f(p));
+            lightIntensity.push_back(Lerp(rng.UniformFloat(), .1f, 2.f));
+        }
+    }
+
+    SurfaceInteraction ShadingPoint(const Vector3f &wo, bool lambertian,
+                                    MemoryArena &arena) {
+        SurfaceInteraction isect(
+            Point3f(0, 0, 0), Vector3f(0, 0, 0), Point2f(0, 0), Normalize(wo),
+            Vector3f(1, 0, 0), Vector3f(0, 1, 0), Normal3f(0, 0, 0),
+            Normal3f(0, 0, 0), 0, nullptr);
+        isect.bsdf = ARENA_ALLOC(arena, BSDF)(isect);
+        if (lambertian)
+            isect.bsdf->Add(
+                ARENA_ALLOC(arena, LambertianReflection)(Spectrum(.7f)));
+        else
+            isect.bsdf->Add(ARENA_ALLOC(arena, MicrofacetReflection)(
+                Spectrum(.7f),
+                ARENA_ALLOC(arena, TrowbridgeReitzDistribution)(.1f, .1f),
+                ARENA_ALLOC(arena, FresnelNoOp)()));
+        return isect;
+    }
+
+    // Unshadowed contribution of light _i_ to _isect_, the BSDF being left
+    // out if _bsdf_ is false
+    Spectrum Contribution(const SurfaceInteraction &isect, int i,
+                          bool bsdf = true) const {
+        Vector3f wi = Normalize(lightPos[i] - isect.p);
+        Spectrum L = Spectrum(lightIntensity[i]) * AbsDot(wi, isect.shading.n) /
+                     DistanceSquared(lightPos[i], isect.p);
+        return bsdf ? isect.bsdf->f(isect.wo, wi, bsdfFlags) * L : L;
+    }
+
+    const BxDFType bsdfFlags = BxDFType(BSDF_ALL & ~BSDF_SPECULAR);
+    std::vector<Point3f> lightPos;
+    std::vector<Bounds3f> lightBounds;
+    std::vector<Float> lightIntensity;
+};
+
+static const Vector3f testWo[] = {Vector3f(0, 0, 1), Vector3f(.3f, -.5f, .8f),
+                                  Vector3f(1, 0, .05f), Vector3f(0, 1, -.3f)};
+
+TEST_F(LightTreeTest, ExactCutIsFullSum) {
+    LightTree tree(lightBounds, lightIntensity);
+    MemoryArena arena;
+    int nLights = lightPos.size();
+    std::vector<LightCutEntry> cut(tree.MaxCutEntries(nLights));
+    for (bool lambertian : {true, false}) {
+        for (const Vector3f &wo : testWo) {
+            SurfaceInteraction isect = ShadingPoint(wo, lambertian, arena);
+            auto evalLight = [&](int i) { return Contribution(isect, i); };
+            Spectrum sum(0.f);
+            for (int i = 0; i < nLights; ++i) sum += Contribution(isect, i);
+
+            int nEntries = tree.Cut(isect, bsdfFlags, evalLight, 0, nLights,
+                                    cut.data());
+            Spectrum cutSum(0.f);
+            for (int i = 0; i < nEntries; ++i) cutSum += cut[i].L;
+            EXPECT_NEAR(sum.y(), cutSum.y(), 1e-4f * sum.y());
+            arena.Reset();
+        }
+    }
+}
+
+TEST_F(LightTreeTest, ErrorBoundsHold) {
+    LightTree tree(lightBounds, lightIntensity);
+    MemoryArena arena;
+    std::vector<LightCutEntry> cut(tree.MaxCutEntries(8));
+    for (bool lambertian : {true, false}) {
+        for (const Vector3f &wo : testWo) {
+            SurfaceInteraction isect = ShadingPoint(wo, lambertian, arena);
+            auto evalLight = [&](int i) { return Contribution(isect, i); };
+            int nEntries =
+                tree.Cut(isect, bsdfFlags, evalLight, .02f, 8, cut.data());
+            for (int e = 0; e < nEntries; ++e) {
+                std::vector<int> lights;
+                tree.ClusterLights(cut[e].nodeIndex, &lights);
+                if (lights.size() == 1) {
+                    // Single lights are evaluated exactly
+                    EXPECT_EQ(0, cut[e].errorBound);
+                    EXPECT_EQ(Contribution(isect, lights[0]), cut[e].L);
+                    continue;
+                }
+                // For Lambertian BSDFs the bound holds as is; for others it
+                // bounds the contribution without the BSDF, so it holds once
+                // scaled by the largest value of the BSDF over the cluster
+                Float sum = 0, fMax = 0;
+                for (int i : lights) {
+                    sum += Contribution(isect, i).y();
+                    Vector3f wi = Normalize(lightPos[i] - isect.p);
+                    fMax = std::max(fMax,
+                                    isect.bsdf->f(isect.wo, wi, bsdfFlags).y());
+                }
+                Float bound = cut[e].errorBound;
+                if (!lambertian) bound *= fMax;
+                EXPECT_GE(bound * 1.0001f, sum) << "entry " << e;
+            }
+            arena.Reset();
+        }
+    }
+}
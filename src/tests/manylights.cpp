@@ -0,0 +1,133 @@
+#include "tests/gtest/gtest.h"
+#include "pbrt.h"
+#include "api.h"
+#include "imageio.h"
+#include "rng.h"
+#include "spectrum.h"
+#include "stats.h"
+
+using namespace pbrt;
+
+static std::string inTestDir(const std::string &path) { return path; }
+
+// World block of a floor with a few walls on it, lit by point lights and
+// small triangle area lights scattered above it, so that many of the shadow
+// rays are blocked.
+static std::string manyLightsWorld(int nLights, int nWalls) {
+    RNG rng;
+    std::string world = "WorldBegin\n";
+    world += "Material \"matte\" \"rgb Kd\" [ .5 .5 .5 ]\n";
+    world +=
+        "Shape \"trianglemesh\" \"point P\" [ -10 0 -10  10 0 -10  10 0 10  "
+        "-10 0 10 ] \"integer indices\" [ 0 2 1  0 3 2 ]\n";
+    for (int i = 0; i < nWalls; ++i) {
+        Float x = Lerp(rng.UniformFloat(), -8.f, 8.f);
+        Float z = Lerp(rng.UniformFloat(), -8.f, 8.f);
+        Float w = Lerp(rng.UniformFloat(), 1.f, 4.f);
+        Float h = Lerp(rng.UniformFloat(), 1.f, 3.f);
+        world += StringPrintf(
+            "Shape \"trianglemesh\" \"point P\" [ %f 0 %f  %f 0 %f  %f %f %f  "
+            "%f %f %f ] \"integer indices\" [ 0 1 2  0 2 3 ]\n",
+            x, z, x + w, z, x + w, h, z, x, h, z);
+    }
+    for (int i = 0; i < nLights; ++i) {
+        Float x = Lerp(rng.UniformFloat(), -10.f, 10.f);
+        Float y = Lerp(rng.UniformFloat(), .5f, 4.f);
+        Float z = Lerp(rng.UniformFloat(), -10.f, 10.f);
+        if (i % 2 == 0)
+            world += StringPrintf(
+                "LightSource \"point\" \"point from\" [ %f %f %f ] "
+                "\"rgb I\" [ 2 2 2 ]\n",
+                x, y, z);
+        else
+            world += StringPrintf(
+                "AttributeBegin\n"
+                "AreaLightSource \"diffuse\" \"rgb L\" [ 200 200 200 ]\n"
+                "Shape \"trianglemesh\" \"point P\" [ %f %f %f  %f %f %f  "
+                "%f %f %f ] \"integer indices\" [ 0 1 2 ]\n"
+                "AttributeEnd\n",
+                x, y, z, x + .2f, y, z, x, y, z + .2f);
+    }
+    world += "WorldEnd\n";
+    return world;
+}
+
+// Renders the world with the integrator and returns the image, which is
+// big enough for the render to have a few dozen tiles.
+static std::unique_ptr<RGBSpectrum[]> renderManyLights(
+    const std::string &world, const std::string &integrator, int nThreads,
+    Point2i *resolution) {
+    Options options;
+    options.quiet = true;
+    options.nThreads = nThreads;
+    pbrtInit(options);
+    pbrtParseString(
+        "LookAt 0 12 -12  0 0 0  0 1 0\n"
+        "Camera \"perspective\" \"float fov\" [ 45 ]\n"
+        "Film \"image\" \"integer xresolution\" [ 96 ] "
+        "\"integer yresolution\" [ 96 ] \"string filename\" [ \"" +
+        inTestDir("manylights.pfm") +
+        "\" ]\n"
+        "Sampler \"halton\" \"integer pixelsamples\" [ 4 ]\n"
+        "Integrator " +
+        integrator + "\n" + world);
+    pbrtCleanup();
+
+    std::unique_ptr<RGBSpectrum[]> image =
+        ReadImage(inTestDir("manylights.pfm"), resolution);
+    EXPECT_EQ(0, remove(inTestDir("manylights.pfm").c_str()));
+    return image;
+}
+
+static void checkSameImages(const RGBSpectrum *a, const RGBSpectrum *b,
+                            const Point2i &resolution) {
+    for (int i = 0; i < resolution.x * resolution.y; ++i) {
+        Float rgbA[3], rgbB[3];
+        a[i].ToRGB(rgbA);
+        b[i].ToRGB(rgbB);
+        for (int c = 0; c < 3; ++c) EXPECT_EQ(rgbA[c], rgbB[c]) << i;
+    }
+}
+
+TEST(Ward, SameThreadCountSameImage) {
+    // The visibility statistics a tile reads don't depend on the thread
+    // scheduling, so two renders with the same number of threads match
+    std::string world = manyLightsWorld(40, 6);
+    for (const std::string integrator :
+         {"\"ward\" \"float certainty\" [ .9 ] \"float tolerance\" [ .1 ]",
+          "\"ward\" \"float certainty\" [ .9 ] "
+          "\"bool adaptivetolerance\" [ \"true\" ]"}) {
+        Point2i resolution, resolution2;
+        std::unique_ptr<RGBSpectrum[]> image =
+            renderManyLights(world, integrator, 4, &resolution);
+        std::unique_ptr<RGBSpectrum[]> image2 =
+            renderManyLights(world, integrator, 4, &resolution2);
+        ASSERT_TRUE(image && image2);
+        ASSERT_EQ(resolution, resolution2);
+        checkSameImages(image.get(), image2.get(), resolution);
+    }
+}
+
+TEST(DeterministDirect, OccluderCacheSameImage) {
+    // Testing the cached occluder first only skips shadow rays that would
+    // be blocked anyway
+    std::string world = manyLightsWorld(40, 6);
+    for (const std::string params : {"", " \"bool lighttree\" [ \"true\" ]"}) {
+        Point2i resolution, cachedResolution;
+        std::unique_ptr<RGBSpectrum[]> image = renderManyLights(
+            world, "\"deterministdirect\"" + params, 4, &resolution);
+        ClearStats();
+        std::unique_ptr<RGBSpectrum[]> cachedImage = renderManyLights(
+            world,
+            "\"deterministdirect\" \"bool occludercache\" [ \"true\" ]" +
+                params,
+            4, &cachedResolution);
+        int64_t hits, tests;
+        GetStatsRatio("Integrator/Shadow occluder cache hits", &hits, &tests);
+        ClearStats();
+        EXPECT_GT(hits, 0);
+        ASSERT_TRUE(image && cachedImage);
+        ASSERT_EQ(resolution, cachedResolution);
+        checkSameImages(image.get(), cachedImage.get(), resolution);
+    }
+}
@@ -8,11 +8,13 @@
 #include "lowdiscrepancy.h"
 #include "sampling.h"
 #include "shapes/cone.h"
+#include "shapes/curve.h"
 #include "shapes/cylinder.h"
 #include "shapes/disk.h"
 #include "shapes/paraboloid.h"
 #include "shapes/sphere.h"
 #include "shapes/triangle.h"
+#include "texture.h"
 
 using namespace pbrt;
 
@@ -268,6 +270,198 @@ TEST(Triangle, Sampling) {
     }
 }
 
+TEST(Triangle, ClippedWorldBound) {
+    for (int i = 0; i < 100; ++i) {
+        RNG rng(i);
+        std::shared_ptr<Triangle> tri =
+            GetRandomTriangle([&]() { return pUnif(rng); });
+        if (!tri) continue;
+        Bounds3f clip(Point3f(pUnif(rng), pUnif(rng), pUnif(rng)),
+                      Point3f(pUnif(rng), pUnif(rng), pUnif(rng)));
+        Bounds3f clipped = tri->ClippedWorldBound(clip);
+
+        // The clipped bounds must hold all the points of the triangle
+        // inside _clip_, without going outside of the triangle's bounds
+        Bounds3f bounds = Intersect(tri->WorldBound(), clip);
+        if (clipped.pMin.x <= clipped.pMax.x) {
+            EXPECT_TRUE(Inside(clipped.pMin, bounds));
+            EXPECT_TRUE(Inside(clipped.pMax, bounds));
+        }
+        for (int j = 0; j < 1000; ++j) {
+            Float pdf;
+            Interaction it =
+                tri->Sample(Point2f(rng.UniformFloat(), rng.UniformFloat()),
+                            &pdf);
+            if (Inside(it.p, clip)) {
+                EXPECT_TRUE(Inside(it.p, clipped))
+                    << "tri index " << i << ", point " << it.p
+                    << ", clipped bounds " << clipped;
+            }
+        }
+    }
+}
+
+// Random triangles with vertices on the integer grid spanning
+// [0,65535]^3, so that a compact mesh's quantized positions are exact.
+static void RandomGridTriangles(int nTriangles, RNG &rng,
+                                std::vector<Point3f> *p,
+                                std::vector<Normal3f> *n,
+                                std::vector<int> *indices) {
+    auto randomCoordinate = [&](Float center) {
+        return Clamp(std::round(center + Lerp(rng.UniformFloat(), -3000, 3000)),
+                     0, 65535);
+    };
+    for (int i = 0; i < nTriangles; ++i) {
+        Point3f center(Lerp(rng.UniformFloat(), 0, 65535),
+                       Lerp(rng.UniformFloat(), 0, 65535),
+                       Lerp(rng.UniformFloat(), 0, 65535));
+        for (int j = 0; j < 3; ++j) {
+            p->push_back(Point3f(randomCoordinate(center.x),
+                                 randomCoordinate(center.y),
+                                 randomCoordinate(center.z)));
+            n->push_back(Normal3f(UniformSampleSphere(
+                Point2f(rng.UniformFloat(), rng.UniformFloat()))));
+            indices->push_back(3 * i + j);
+        }
+    }
+    (*p)[0] = Point3f(0, 0, 0);
+    (*p)[1] = Point3f(65535, 65535, 65535);
+}
+
+// Checks that a compact mesh of random grid triangles finds the same
+// intersections as the corresponding individual triangles.
+static void TestCompactMatchesTriangles(
+    int nTriangles, int nRays,
+    const std::shared_ptr<Texture<Float>> &alphaMask) {
+    RNG rng;
+    std::vector<Point3f> p;
+    std::vector<Normal3f> n;
+    std::vector<int> indices;
+    RandomGridTriangles(nTriangles, rng, &p, &n, &indices);
+
+    Transform identity;
+    std::vector<std::shared_ptr<Shape>> tris = CreateTriangleMesh(
+        &identity, &identity, false, nTriangles, &indices[0], p.size(), &p[0],
+        nullptr, &n[0], nullptr, alphaMask, nullptr);
+    std::vector<std::shared_ptr<Shape>> compact = CreateTriangleMesh(
+        &identity, &identity, false, nTriangles, &indices[0], p.size(), &p[0],
+        nullptr, &n[0], nullptr, alphaMask, nullptr, nullptr, true);
+    ASSERT_EQ(1, compact.size());
+    Float area = 0;
+    for (const auto &tri : tris) area += tri->Area();
+    EXPECT_LT(std::abs(area - compact[0]->Area()), 1e-4 * area);
+
+    int nHits = 0;
+    for (int i = 0; i < nRays; ++i) {
+        Point3f o(Lerp(rng.UniformFloat(), -20000, 85000),
+                  Lerp(rng.UniformFloat(), -20000, 85000),
+                  Lerp(rng.UniformFloat(), -20000, 85000));
+        Point3f target(Lerp(rng.UniformFloat(), 0, 65535),
+                       Lerp(rng.UniformFloat(), 0, 65535),
+                       Lerp(rng.UniformFloat(), 0, 65535));
+        Ray ray(o, target - o);
+
+        // Find the closest hit over all triangles
+        Float tRef = Infinity;
+        SurfaceInteraction refIsect;
+        for (const auto &tri : tris) {
+            Float tHit;
+            SurfaceInteraction isect;
+            if (tri->Intersect(ray, &tHit, &isect) && tHit < tRef) {
+                tRef = tHit;
+                refIsect = isect;
+                ray.tMax = tHit;
+            }
+        }
+        ray.tMax = Infinity;
+
+        Float tHit;
+        SurfaceInteraction isect;
+        bool hit = compact[0]->Intersect(ray, &tHit, &isect);
+        EXPECT_EQ(tRef < Infinity, hit) << "ray " << ray;
+        EXPECT_EQ(hit, compact[0]->IntersectP(ray)) << "ray " << ray;
+        if (!hit || tRef == Infinity) continue;
+        ++nHits;
+        EXPECT_EQ(tRef, tHit) << "ray " << ray;
+        EXPECT_EQ(refIsect.n, isect.n) << "ray " << ray;
+        EXPECT_LT((refIsect.shading.n - isect.shading.n).Length(), 1e-3)
+            << "ray " << ray << ", " << refIsect.shading.n << " vs "
+            << isect.shading.n;
+    }
+    EXPECT_GT(nHits, nRays / 10);
+}
+
+TEST(CompactTriangleMesh, MatchesTriangles) {
+    TestCompactMatchesTriangles(500, 10000, nullptr);
+}
+
+// Meshes with more than 65536 vertices store 32-bit vertex indices.
+TEST(CompactTriangleMesh, ManyVertices) {
+    TestCompactMatchesTriangles(22000, 300, nullptr);
+}
+
+// Cuts away the part of the surface with x < 32768.
+class HalfSpaceAlphaTexture : public Texture<Float> {
+  public:
+    Float Evaluate(const SurfaceInteraction &si) const {
+        return si.p.x < 32768 ? 0 : 1;
+    }
+};
+
+TEST(CompactTriangleMesh, AlphaMask) {
+    TestCompactMatchesTriangles(500, 10000,
+                                std::make_shared<HalfSpaceAlphaTexture>());
+}
+
+// The points sampled on a compact mesh lie on its triangles, with
+// frequencies proportional to the triangles' areas.
+TEST(CompactTriangleMesh, SampleMatchesArea) {
+    RNG rng;
+    int nTriangles = 50;
+    std::vector<Point3f> p;
+    std::vector<Normal3f> n;
+    std::vector<int> indices;
+    RandomGridTriangles(nTriangles, rng, &p, &n, &indices);
+    Transform identity;
+    std::vector<std::shared_ptr<Shape>> tris = CreateTriangleMesh(
+        &identity, &identity, false, nTriangles, &indices[0], p.size(), &p[0],
+        nullptr, nullptr, nullptr, nullptr, nullptr);
+    std::vector<std::shared_ptr<Shape>> compact = CreateTriangleMesh(
+        &identity, &identity, false, nTriangles, &indices[0], p.size(), &p[0],
+        nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, true);
+    ASSERT_EQ(1, compact.size());
+    Float area = compact[0]->Area();
+
+    // Find the triangle of each sampled point with a short ray through it
+    // along the sampled normal
+    const int nSamples = 20000;
+    std::vector<int> counts(nTriangles, 0);
+    for (int i = 0; i < nSamples; ++i) {
+        Float pdf;
+        Interaction it = compact[0]->Sample(
+            Point2f(RadicalInverse(0, i), RadicalInverse(1, i)), &pdf);
+        EXPECT_FLOAT_EQ(1 / area, pdf);
+        Ray ray(it.p + 10 * Vector3f(it.n), -Vector3f(it.n), 20);
+        for (int t = 0; t < nTriangles; ++t) {
+            Float tHit;
+            SurfaceInteraction isect;
+            if (tris[t]->Intersect(ray, &tHit, &isect)) {
+                EXPECT_LT(std::abs(tHit - 10), .1) << "point " << it.p;
+                ++counts[t];
+                break;
+            }
+        }
+    }
+    int nFound = 0;
+    Float error = 0;
+    for (int t = 0; t < nTriangles; ++t) {
+        nFound += counts[t];
+        error += std::abs(Float(counts[t]) / nSamples - tris[t]->Area() / area);
+    }
+    EXPECT_GT(nFound, .99 * nSamples);
+    EXPECT_LT(error, .03);
+}
+
 // Checks the closed-form solid angle computation for triangles against a
 // Monte Carlo estimate of it.
 TEST(Triangle, SolidAngle) {
@@ -557,3 +751,46 @@ TEST(Triangle, BadCases) {
     SurfaceInteraction isect;
     EXPECT_FALSE(mesh[0]->Intersect(ray, &thit, &isect));
 }
+
+// Rays aimed at points within half the width of random curves, in various
+// transformations, must not miss the curves' oriented bounds.
+TEST(Curve, OrientedBoundsHits) {
+    RNG rng(5);
+    for (int i = 0; i < 200; ++i) {
+        Vector3f axis = UniformSampleSphere(
+            Point2f(rng.UniformFloat(), rng.UniformFloat()));
+        Transform objectToWorld =
+            Translate(Vector3f(pUnif(rng), pUnif(rng), pUnif(rng))) *
+            Rotate(360 * rng.UniformFloat(), axis) *
+            Scale(pExp(rng, 1), pExp(rng, 1), pExp(rng, 1));
+        Point3f cp[4];
+        for (int j = 0; j < 4; ++j)
+            cp[j] = Point3f(pUnif(rng, 1), pUnif(rng, 1), pUnif(rng, 1));
+        // Straight segments are the ones whose bounds are the tightest
+        if (i & 1)
+            for (int j = 1; j < 3; ++j) cp[j] = Lerp(j / 3.f, cp[0], cp[3]);
+        Float halfWidth = .01f * pExp(rng, 1);
+        CurveBounds bounds(objectToWorld, cp, halfWidth);
+
+        for (int j = 0; j < 50; ++j) {
+            // Evaluate the curve at a random _u_ with de Casteljau's
+            // algorithm and offset the point by up to _halfWidth_
+            Float u = rng.UniformFloat();
+            Point3f a[3] = {Lerp(u, cp[0], cp[1]), Lerp(u, cp[1], cp[2]),
+                            Lerp(u, cp[2], cp[3])};
+            Point3f b[2] = {Lerp(u, a[0], a[1]), Lerp(u, a[1], a[2])};
+            Vector3f offset = halfWidth * UniformSampleSphere(Point2f(
+                                              rng.UniformFloat(),
+                                              rng.UniformFloat()));
+            Point3f p = objectToWorld(Lerp(u, b[0], b[1]) + offset);
+
+            // Rays ending at the point and going through it
+            Point3f o(pUnif(rng, 30), pUnif(rng, 30), pUnif(rng, 30));
+            EXPECT_TRUE(bounds.IntersectP(Ray(o, p - o, 1)));
+            EXPECT_TRUE(bounds.IntersectP(Ray(o, p - o)));
+        }
+        // A ray going away from the curve misses them
+        Point3f o = objectToWorld(Point3f(0, 0, 0)) + Vector3f(1000, 0, 0);
+        EXPECT_FALSE(bounds.IntersectP(Ray(o, Vector3f(1, 0, 0))));
+    }
+}
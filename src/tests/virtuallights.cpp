@@ -0,0 +1,115 @@
+#include "tests/gtest/gtest.h"
+#include "pbrt.h"
+#include "integrator.h"
+#include "interaction.h"
+#include "memory.h"
+#include "reflection.h"
+#include "rng.h"
+#include "virtuallights.h"
+#include "lights/diffuse.h"
+#include "lights/point.h"
+#include "shapes/disk.h"
+
+using namespace pbrt;
+
+// Point lights and one-sided and two-sided disk area lights scattered on
+// both sides of the origin, facing random directions.
+class VirtualLightsTest : public testing::Test {
+  protected:
+    void AddLights(int nLights, RNG &rng) {
+        for (int i = 0; i < nLights; ++i) {
+            Vector3f p(Lerp(rng.UniformFloat(), -2.f, 2.f),
+                       Lerp(rng.UniformFloat(), -2.f, 2.f),
+                       Lerp(rng.UniformFloat(), -2.f, 2.f));
+            Spectrum I = Spectrum(rng.UniformFloat() + .1f);
+            if (i % 3 == 0)
+                lights.push_back(std::make_shared<PointLight>(
+                    Translate(p), MediumInterface(), I));
+            else {
+                Vector3f axis(rng.UniformFloat() - .5f,
+                              rng.UniformFloat() - .5f,
+                              rng.UniformFloat() - .5f);
+                transforms.emplace_back(new Transform(
+                    Translate(p) * Rotate(360 * rng.UniformFloat(), axis)));
+                transforms.emplace_back(
+                    new Transform(Inverse(*transforms.back())));
+                std::shared_ptr<Shape> disk = std::make_shared<Disk>(
+                    transforms[transforms.size() - 2].get(),
+                    transforms.back().get(), false, 0, .3f, 0, 360);
+                lights.push_back(std::make_shared<DiffuseAreaLight>(
+                    Transform(), MediumInterface(), I, 1, disk, i % 3 == 2));
+            }
+            u.push_back(Point2f(rng.UniformFloat(), rng.UniformFloat()));
+        }
+    }
+
+    std::vector<std::unique_ptr<Transform>> transforms;
+    std::vector<std::shared_ptr<Light>> lights;
+    std::vector<Point2f> u;
+};
+
+static void checkClose(const Spectrum &expected, const Spectrum &s) {
+    for (int c = 0; c < Spectrum::nSamples; ++c)
+        EXPECT_NEAR(expected[c], s[c], 1e-4f * std::max(expected[c], 1.f))
+            << expected << " vs " << s;
+}
+
+TEST_F(VirtualLightsTest, MatchesUnshadowedContribution) {
+    RNG rng;
+    MemoryArena arena;
+    const Float scale = .5f;
+    BxDFType bsdfFlags = BxDFType(BSDF_ALL & ~BSDF_SPECULAR);
+    // Light counts that aren't all multiples of the SIMD width
+    for (int nLights : {1, 7, 8, 13, 30}) {
+        lights.clear();
+        u.clear();
+        AddLights(nLights, rng);
+        VirtualPointLights virtualLights;
+        for (int i = 0; i < nLights; ++i)
+            ASSERT_EQ(i, virtualLights.Add(*lights[i], u[i], scale));
+
+        // Directions toward the viewer, grazing ones included, and
+        // shading normals that are or aren't the geometric one
+        for (Vector3f wo : {Vector3f(0, 0, 1), Vector3f(.3f, -.5f, .8f),
+                            Vector3f(1, 0, 1e-3f), Vector3f(0, 1, -1e-3f),
+                            Vector3f(1, 0, 0)}) {
+            for (Normal3f ns : {Normal3f(0, 0, 1), Normal3f(.2f, .1f, 1)}) {
+                SurfaceInteraction isect(
+                    Point3f(0, 0, 0), Vector3f(0, 0, 0), Point2f(0, 0),
+                    Normalize(wo), Vector3f(1, 0, 0), Vector3f(0, 1, 0),
+                    Normal3f(0, 0, 0), Normal3f(0, 0, 0), 0, nullptr);
+                Vector3f n = Normalize(Vector3f(ns));
+                Vector3f dpdv = Normalize(Cross(n, Vector3f(1, 0, 0)));
+                Vector3f dpdu = Cross(dpdv, n);
+                isect.SetShadingGeometry(dpdu, dpdv, Normal3f(0, 0, 0),
+                                         Normal3f(0, 0, 0), true);
+                isect.bsdf = ARENA_ALLOC(arena, BSDF)(isect);
+                isect.bsdf->Add(ARENA_ALLOC(arena, LambertianReflection)(
+                    Spectrum(.7f)));
+
+                Spectrum *ld = arena.Alloc<Spectrum>(nLights);
+                Spectrum *scalarLd = arena.Alloc<Spectrum>(nLights);
+                Float *luminance = arena.Alloc<Float>(nLights);
+                Float *scalarLuminance = arena.Alloc<Float>(nLights);
+                ASSERT_TRUE(
+                    virtualLights.EvaluateLambertian(isect, ld, luminance));
+                ASSERT_TRUE(virtualLights.EvaluateLambertian(
+                    isect, scalarLd, scalarLuminance, false));
+                for (int i = 0; i < nLights; ++i) {
+                    VisibilityTester vis;
+                    Spectrum expected =
+                        UnshadowedContribution(isect, *lights[i], u[i],
+                                               bsdfFlags, &vis) *
+                        scale;
+                    checkClose(expected, scalarLd[i]);
+                    checkClose(scalarLd[i], ld[i]);
+                    EXPECT_NEAR(scalarLd[i].y(), scalarLuminance[i],
+                                1e-4f * std::max(scalarLuminance[i], 1.f));
+                    EXPECT_NEAR(scalarLuminance[i], luminance[i],
+                                1e-4f * std::max(scalarLuminance[i], 1.f));
+                }
+                arena.Reset();
+            }
+        }
+    }
+}
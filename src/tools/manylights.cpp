@@ -0,0 +1,353 @@
+//
+// manylights.cpp
+//
+// Many-lights benchmark: renders procedurally generated scenes lit by many
+// point and area lights with the "ward" integrator at several
+// certainty/tolerance settings and with "deterministdirect", which is
+// used as the reference.
+//
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <cmath>
+#include <string>
+#include <vector>
+#include "api.h"
+#include "imageio.h"
+#include "pbrt.h"
+#include "rng.h"
+#include "spectrum.h"
+#include "stats.h"
+#include <glog/logging.h>
+
+using namespace pbrt;
+
+static void usage(const char *msg = nullptr, ...) {
+    if (msg) {
+        va_list args;
+        va_start(args, msg);
+        fprintf(stderr, "manylights: ");
+        vfprintf(stderr, msg, args);
+        fprintf(stderr, "\n");
+    }
+    fprintf(stderr, R"(usage: manylights [options]
+
+Generates scenes lit by many point and area lights, renders each of them with
+"deterministdirect" and with "ward" for every certainty/tolerance pair, and
+reports the wall time, the light source shadow rays traced per pixel and the
+RMSE against the "deterministdirect" image. Lists are comma-separated.
+
+options:
+    --areafraction <f> Fraction of the lights that are triangle area lights,
+                       the others being point lights. Default: 0.5
+    --certainty <list> Values of the ward "certainty" parameter.
+                       Default: 0.5,0.9
+    --errorbudget <list>
+                       Values of the ward "errorbudget" parameter, each
+                       rendered with "adaptivetolerance" for every
+                       certainty. Default: none
+    --keepimages       Keep the rendered images in the current directory.
+    --lights <list>    Numbers of lights of the scenes.
+                       Default: 10,100,1000,10000,100000
+    --nthreads <n>     Number of threads used for rendering. Default: the
+                       number of cores
+    --occluders <list> Numbers of boxes scattered over the floor between the
+                       lights. Default: 0,64,512
+    --resolution <r>   Width and height of the images. Default: 64
+    --seed <s>         Seed of the scene generation. Default: 0
+    --spp <n>          Pixel samples. Default: 1
+    --tolerance <list> Values of the ward "tolerance" parameter.
+                       Default: 0.05,0.1,0.3
+
+)");
+    exit(1);
+}
+
+static std::vector<Float> parseList(const char *str) {
+    std::vector<Float> values;
+    const char *ptr = str;
+    while (*ptr) {
+        char *end;
+        values.push_back(strtod(ptr, &end));
+        if (end == ptr || (*end && *end != ',')) usage("invalid list \"%s\"", str);
+        ptr = *end ? end + 1 : end;
+    }
+    if (values.empty()) usage("empty list");
+    return values;
+}
+
+// Scene Generation Declarations
+struct SceneDesc {
+    int nLights;
+    int nOccluders;
+    Float areaFraction;
+    uint64_t seed;
+};
+
+static const Float FloorSize = 10;
+
+static std::string boxMesh(Float x0, Float z0, Float x1, Float z1, Float h) {
+    return StringPrintf(
+        "Shape \"trianglemesh\"\n"
+        "  \"point P\" [ %f 0 %f  %f 0 %f  %f 0 %f  %f 0 %f "
+        "%f %f %f  %f %f %f  %f %f %f  %f %f %f ]\n"
+        "  \"integer indices\" [ 0 1 5  0 5 4  1 2 6  1 6 5  2 3 7  2 7 6 "
+        "3 0 4  3 4 7  4 5 6  4 6 7 ]\n",
+        x0, z0, x1, z0, x1, z1, x0, z1, x0, h, z0, x1, h, z0, x1, h, z1, x0,
+        h, z1);
+}
+
+// Returns the world block of a scene: a floor with the occluders on it and
+// the lights above, the total power of the lights not depending on their
+// number so that the images stay comparable.
+static std::string generateScene(const SceneDesc &desc) {
+    RNG rng(desc.seed);
+    std::string scene = "WorldBegin\n";
+    scene += "Material \"matte\" \"rgb Kd\" [ .5 .5 .5 ]\n";
+    scene += StringPrintf(
+        "Shape \"trianglemesh\" \"point P\" [ %f 0 %f  %f 0 %f  %f 0 %f  "
+        "%f 0 %f ]\n  \"integer indices\" [ 0 2 1  0 3 2 ]\n",
+        -FloorSize, -FloorSize, FloorSize, -FloorSize, FloorSize, FloorSize,
+        -FloorSize, FloorSize);
+    for (int i = 0; i < desc.nOccluders; ++i) {
+        // Thin walls and blocks of various heights
+        Float x = Lerp(rng.UniformFloat(), -FloorSize, FloorSize);
+        Float z = Lerp(rng.UniformFloat(), -FloorSize, FloorSize);
+        Float w = Lerp(rng.UniformFloat(), .1f, 2.f);
+        Float d = Lerp(rng.UniformFloat(), .1f, 2.f);
+        Float h = Lerp(rng.UniformFloat(), .5f, 4.f);
+        scene += boxMesh(x, z, x + w, z + d, h);
+    }
+
+    // Lights, the area lights being small triangles facing the floor that
+    // all share a single mesh
+    const Float power = 200;
+    const Float triangleSize = .1f;
+    const Float triangleArea = .5f * triangleSize * triangleSize;
+    std::string areaP, areaIndices;
+    int nAreaLights = 0;
+    for (int i = 0; i < desc.nLights; ++i) {
+        Float x = Lerp(rng.UniformFloat(), -FloorSize, FloorSize);
+        Float y = Lerp(rng.UniformFloat(), .5f, 5.f);
+        Float z = Lerp(rng.UniformFloat(), -FloorSize, FloorSize);
+        Float r = Lerp(rng.UniformFloat(), .5f, 1.f);
+        Float g = Lerp(rng.UniformFloat(), .5f, 1.f);
+        Float b = Lerp(rng.UniformFloat(), .5f, 1.f);
+        if (rng.UniformFloat() < desc.areaFraction) {
+            areaP += StringPrintf("%f %f %f  %f %f %f  %f %f %f\n", x, y, z,
+                                  x + triangleSize, y, z, x, y,
+                                  z + triangleSize);
+            areaIndices += StringPrintf("%d %d %d ", 3 * nAreaLights,
+                                        3 * nAreaLights + 1,
+                                        3 * nAreaLights + 2);
+            ++nAreaLights;
+        } else {
+            Float I = power / (4 * Pi * desc.nLights);
+            scene += StringPrintf(
+                "LightSource \"point\" \"point from\" [ %f %f %f ] "
+                "\"rgb I\" [ %f %f %f ]\n",
+                x, y, z, r * I, g * I, b * I);
+        }
+    }
+    if (nAreaLights > 0) {
+        Float L = power / (Pi * triangleArea * desc.nLights);
+        scene += "AttributeBegin\n";
+        scene += StringPrintf(
+            "AreaLightSource \"diffuse\" \"rgb L\" [ %f %f %f ]\n", L, L, L);
+        scene += "Shape \"trianglemesh\" \"point P\" [\n" + areaP +
+                 "]\n  \"integer indices\" [ " + areaIndices + "]\n";
+        scene += "AttributeEnd\n";
+    }
+    scene += "WorldEnd\n";
+    return scene;
+}
+
+// Benchmark Declarations
+struct RunResult {
+    double seconds;
+    int64_t shadowRays;
+    std::unique_ptr<RGBSpectrum[]> image;
+    Point2i resolution;
+};
+
+static RunResult render(const std::string &world, const std::string &integrator,
+                        const std::string &filename, int resolution, int spp,
+                        bool keepImage) {
+    std::string scene = StringPrintf(
+        "LookAt 0 16 -14  0 0 0  0 1 0\n"
+        "Camera \"perspective\" \"float fov\" [ 45 ]\n"
+        "Film \"image\" \"integer xresolution\" [ %d ] "
+        "\"integer yresolution\" [ %d ] \"string filename\" [ \"%s\" ]\n"
+        "Sampler \"stratified\" \"integer xsamples\" [ %d ] "
+        "\"integer ysamples\" [ 1 ] \"bool jitter\" [ \"false\" ]\n"
+        "Integrator %s\n",
+        resolution, resolution, filename.c_str(), spp, integrator.c_str());
+    scene += world;
+
+    RunResult result;
+    ClearStats();
+    auto start = std::chrono::steady_clock::now();
+    pbrtParseString(scene);
+    auto end = std::chrono::steady_clock::now();
+    result.seconds = std::chrono::duration<double>(end - start).count();
+    result.shadowRays = GetStatsCounter("Integrator/Light source shadow rays");
+    ClearStats();
+    result.image = ReadImage(filename, &result.resolution);
+    if (!result.image) {
+        fprintf(stderr, "manylights: unable to read rendered image \"%s\"\n",
+                filename.c_str());
+        exit(1);
+    }
+    if (!keepImage) remove(filename.c_str());
+    return result;
+}
+
+static double rmse(const RunResult &run, const RunResult &reference) {
+    CHECK(run.resolution == reference.resolution);
+    int nPixels = run.resolution.x * run.resolution.y;
+    double sumSquared = 0;
+    for (int i = 0; i < nPixels; ++i) {
+        Float rgb[3], refRGB[3];
+        run.image[i].ToRGB(rgb);
+        reference.image[i].ToRGB(refRGB);
+        for (int c = 0; c < 3; ++c)
+            sumSquared += (rgb[c] - refRGB[c]) * (rgb[c] - refRGB[c]);
+    }
+    return std::sqrt(sumSquared / (3 * nPixels));
+}
+
+static double meanLuminance(const RunResult &run) {
+    int nPixels = run.resolution.x * run.resolution.y;
+    double sum = 0;
+    for (int i = 0; i < nPixels; ++i) sum += run.image[i].y();
+    return sum / nPixels;
+}
+
+static void report(const SceneDesc &desc, const char *settings,
+                   const RunResult &run, const RunResult &reference,
+                   int resolution) {
+    double error = rmse(run, reference);
+    double mean = meanLuminance(reference);
+    printf("%8d %9d  %-18s %10.3f %12.1f %12.6f %9.4f\n", desc.nLights,
+           desc.nOccluders, settings, run.seconds,
+           (double)run.shadowRays / (resolution * resolution), error,
+           mean > 0 ? error / mean : 0.);
+    fflush(stdout);
+}
+
+int main(int argc, char *argv[]) {
+    google::InitGoogleLogging(argv[0]);
+    FLAGS_stderrthreshold = 1;  // Warning and above.
+
+    std::vector<Float> lights = {10, 100, 1000, 10000, 100000};
+    std::vector<Float> occluders = {0, 64, 512};
+    std::vector<Float> certainties = {0.5, 0.9};
+    std::vector<Float> tolerances = {0.05, 0.1, 0.3};
+    std::vector<Float> errorBudgets;
+    Float areaFraction = 0.5;
+    int resolution = 64, spp = 1, seed = 0;
+    bool keepImages = false;
+    Options opt;
+    opt.quiet = true;
+
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--keepimages")) {
+            keepImages = true;
+            continue;
+        }
+        if (i + 1 == argc) usage("missing value after %s flag", argv[i]);
+        const char *value = argv[++i];
+        if (!strcmp(argv[i - 1], "--areafraction")) {
+            areaFraction = atof(value);
+            if (areaFraction < 0 || areaFraction > 1)
+                usage("--areafraction must be between 0 and 1");
+        } else if (!strcmp(argv[i - 1], "--certainty"))
+            certainties = parseList(value);
+        else if (!strcmp(argv[i - 1], "--errorbudget"))
+            errorBudgets = parseList(value);
+        else if (!strcmp(argv[i - 1], "--lights"))
+            lights = parseList(value);
+        else if (!strcmp(argv[i - 1], "--nthreads"))
+            opt.nThreads = atoi(value);
+        else if (!strcmp(argv[i - 1], "--occluders"))
+            occluders = parseList(value);
+        else if (!strcmp(argv[i - 1], "--resolution")) {
+            resolution = atoi(value);
+            if (resolution < 1) usage("--resolution must be >= 1");
+        } else if (!strcmp(argv[i - 1], "--seed"))
+            seed = atoi(value);
+        else if (!strcmp(argv[i - 1], "--spp")) {
+            spp = atoi(value);
+            if (spp < 1) usage("--spp must be >= 1");
+        } else if (!strcmp(argv[i - 1], "--tolerance"))
+            tolerances = parseList(value);
+        else
+            usage("unknown option %s", argv[i - 1]);
+    }
+    for (Float c : certainties)
+        if (c < 0 || c > 1) usage("certainty values must be between 0 and 1");
+    for (Float t : tolerances)
+        if (t < 0 || t > 1) usage("tolerance values must be between 0 and 1");
+    for (Float b : errorBudgets)
+        if (b <= 0) usage("error budgets must be positive");
+
+    pbrtInit(opt);
+    printf("%8s %9s  %-18s %10s %12s %12s %9s\n", "lights", "occluders",
+           "integrator", "time (s)", "rays/pixel", "RMSE", "rel. RMSE");
+    for (Float nOccluders : occluders) {
+        for (Float nLights : lights) {
+            SceneDesc desc;
+            desc.nLights = int(nLights);
+            desc.nOccluders = int(nOccluders);
+            desc.areaFraction = areaFraction;
+            desc.seed = seed;
+            std::string world = generateScene(desc);
+            std::string prefix = StringPrintf("manylights-l%d-o%d",
+                                              desc.nLights, desc.nOccluders);
+
+            RunResult reference =
+                render(world, "\"deterministdirect\"", prefix + "-dd.pfm",
+                       resolution, spp, keepImages);
+            report(desc, "deterministdirect", reference, reference,
+                   resolution);
+            for (Float certainty : certainties) {
+                for (Float tolerance : tolerances) {
+                    std::string integrator = StringPrintf(
+                        "\"ward\" \"float certainty\" [ %f ] "
+                        "\"float tolerance\" [ %f ]",
+                        certainty, tolerance);
+                    std::string filename = StringPrintf(
+                        "%s-ward-c%g-t%g.pfm", prefix.c_str(), certainty,
+                        tolerance);
+                    RunResult run = render(world, integrator, filename,
+                                           resolution, spp, keepImages);
+                    std::string settings =
+                        StringPrintf("ward %g/%g", certainty, tolerance);
+                    report(desc, settings.c_str(), run, reference,
+                           resolution);
+                }
+                for (Float errorBudget : errorBudgets) {
+                    std::string integrator = StringPrintf(
+                        "\"ward\" \"float certainty\" [ %f ] "
+                        "\"bool adaptivetolerance\" [ \"true\" ] "
+                        "\"float errorbudget\" [ %f ]",
+                        certainty, errorBudget);
+                    std::string filename = StringPrintf(
+                        "%s-ward-c%g-b%g.pfm", prefix.c_str(), certainty,
+                        errorBudget);
+                    RunResult run = render(world, integrator, filename,
+                                           resolution, spp, keepImages);
+                    std::string settings = StringPrintf(
+                        "ward %g/budget %g", certainty, errorBudget);
+                    report(desc, settings.c_str(), run, reference,
+                           resolution);
+                }
+            }
+        }
+    }
+    pbrtCleanup();
+    return 0;
+}
@@ -0,0 +1,352 @@
+//
+// raybench.cpp
+//
+// Ray-tracing throughput benchmark: loads a scene, builds it with several
+// accelerators and times their closest-hit and occlusion queries on the
+// same camera, diffuse bounce and shadow rays, independently of shading.
+//
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "api.h"
+#include "camera.h"
+#include "film.h"
+#include "interaction.h"
+#include "light.h"
+#include "paramset.h"
+#include "pbrt.h"
+#include "primitive.h"
+#include "rng.h"
+#include "sampling.h"
+#include "scene.h"
+#include "stats.h"
+#include "accelerators/bvh.h"
+#include "accelerators/kdtreeaccel.h"
+#include <glog/logging.h>
+
+using namespace pbrt;
+
+static void usage(const char *msg = nullptr, ...) {
+    if (msg) {
+        va_list args;
+        va_start(args, msg);
+        fprintf(stderr, "raybench: ");
+        vfprintf(stderr, msg, args);
+        fprintf(stderr, "\n");
+    }
+    fprintf(stderr, R"(usage: raybench [options] <filename.pbrt>
+
+Loads the scene, builds its primitives with each accelerator and traces the
+same rays with each of them: camera rays, diffuse bounce rays leaving their
+hits and shadow rays from these hits to points sampled on the lights. For
+every ray set, reports the build time and, for closest-hit (Intersect) and
+occlusion (IntersectP) queries, the Mrays/s of a single thread, the nodes
+visited and the ray-primitive tests per ray. Triangles tested in packets of
+four count as four tests. Node visits are only counted when pbrt is built
+with PBRT_TRAVERSAL_STATS and are shown as "-" otherwise. The SAH cost,
+sibling overlap and leaf sizes of the BVHs follow. The scene's Accelerator
+directive is ignored.
+
+options:
+    --accel <list>     Comma-separated accelerators among "sah", "hlbvh",
+                       "middle", "equal", "sbvh" (BVH split methods) and
+                       "kdtree". Default: all of them
+    --batch            Trace the rays in batches of 64 with the batched
+                       queries instead of one at a time.
+    --maxnodeprims <n> Maximum number of primitives in BVH leaves.
+                       Default: 4
+    --nthreads <n>     Number of threads used to build the accelerators.
+                       Default: the number of cores
+    --optimizepasses <n>
+                       Passes of treelet restructuring of the BVHs.
+                       Default: 0
+    --repeat <n>       Number of timed runs of each query, the fastest one
+                       being reported. Default: 3
+    --seed <s>         Seed of the ray sets. Default: 0
+    --spp <n>          Camera rays per pixel. Default: 1
+
+)");
+    exit(1);
+}
+
+static std::vector<std::string> parseNames(const char *str) {
+    std::vector<std::string> names;
+    const char *ptr = str;
+    while (true) {
+        const char *end = strchr(ptr, ',');
+        if (!end) end = ptr + strlen(ptr);
+        if (end == ptr) usage("invalid list \"%s\"", str);
+        names.push_back(std::string(ptr, end));
+        if (!*end) break;
+        ptr = end + 1;
+    }
+    return names;
+}
+
+// Ray Set Generation
+struct RaySets {
+    std::vector<Ray> camera, bounce, shadow;
+};
+
+// Rays are generated with a SAH BVH over the scene so that every
+// accelerator traces the same ones
+static RaySets generateRays(const WorldDescription &world, int spp,
+                            uint64_t seed) {
+    Scene scene(CreateBVHAccelerator(world.primitives, ParamSet()),
+                world.lights);
+    const Camera &camera = *world.camera;
+    Point2i resolution = camera.film->fullResolution;
+    RNG rng(seed);
+    RaySets rays;
+    for (int y = 0; y < resolution.y; ++y)
+        for (int x = 0; x < resolution.x; ++x)
+            for (int i = 0; i < spp; ++i) {
+                CameraSample cs;
+                cs.pFilm = Point2f(x + rng.UniformFloat(),
+                                   y + rng.UniformFloat());
+                cs.pLens = Point2f(rng.UniformFloat(), rng.UniformFloat());
+                cs.time = rng.UniformFloat();
+                Ray ray;
+                if (camera.GenerateRay(cs, &ray) == 0) continue;
+                rays.camera.push_back(ray);
+
+                SurfaceInteraction isect;
+                if (!scene.Intersect(ray, &isect)) continue;
+                // Cosine-distributed direction about the normal on the side
+                // of the incoming ray
+                Normal3f n = Faceforward(isect.n, -ray.d);
+                Vector3f s, t;
+                CoordinateSystem(Vector3f(n), &s, &t);
+                Vector3f w = CosineSampleHemisphere(
+                    Point2f(rng.UniformFloat(), rng.UniformFloat()));
+                rays.bounce.push_back(
+                    isect.SpawnRay(w.x * s + w.y * t + w.z * Vector3f(n)));
+
+                if (scene.lights.empty()) continue;
+                int lightNum = std::min(
+                    int(rng.UniformFloat() * scene.lights.size()),
+                    int(scene.lights.size()) - 1);
+                Vector3f wi;
+                Float pdf;
+                VisibilityTester vis;
+                scene.lights[lightNum]->Sample_Li(
+                    isect, Point2f(rng.UniformFloat(), rng.UniformFloat()),
+                    &wi, &pdf, &vis);
+                if (pdf > 0)
+                    rays.shadow.push_back(vis.P0().SpawnRayTo(vis.P1()));
+            }
+    return rays;
+}
+
+// Benchmark Definitions
+struct QueryResult {
+    double seconds;
+    double nodeVisits, primitiveTests;
+};
+
+static double primitiveTests() {
+    int64_t hits, triangleTests, curveTests;
+    GetStatsRatio("Intersections/Ray-triangle intersection tests", &hits,
+                  &triangleTests);
+    GetStatsRatio("Intersections/Ray-curve intersection tests", &hits,
+                  &curveTests);
+    return triangleTests + curveTests +
+           4 * GetStatsCounter("BVH/Triangle packet tests");
+}
+
+// Traces _rays_ _repeat_ times with closest-hit or occlusion queries and
+// returns the fastest time with the per-ray statistics of all the runs
+static QueryResult trace(const Primitive &accel, const std::vector<Ray> &rays,
+                         bool occlusion, bool batch, int repeat,
+                         const std::string &statsPrefix) {
+    ReportThreadStats();
+    ClearStats();
+    QueryResult result;
+    result.seconds = Infinity;
+    std::vector<Ray> batchRays(MaxRayBatchSize);
+    std::vector<SurfaceInteraction> isects(MaxRayBatchSize);
+    for (int run = 0; run < repeat; ++run) {
+        auto start = std::chrono::steady_clock::now();
+        // The hits are counted so that the queries can't be optimized out
+        uint64_t nHits = 0;
+        if (batch) {
+            for (size_t i = 0; i < rays.size(); i += MaxRayBatchSize) {
+                int n = std::min<size_t>(MaxRayBatchSize, rays.size() - i);
+                std::copy(rays.begin() + i, rays.begin() + i + n,
+                          batchRays.begin());
+                uint64_t mask =
+                    occlusion ? accel.IntersectP(&batchRays[0], n)
+                              : accel.Intersect(&batchRays[0], n, &isects[0]);
+                for (; mask != 0; mask &= mask - 1) ++nHits;
+            }
+        } else {
+            for (const Ray &r : rays) {
+                if (occlusion)
+                    nHits += accel.IntersectP(r);
+                else {
+                    Ray ray = r;
+                    nHits += accel.Intersect(ray, &isects[0]);
+                }
+            }
+        }
+        auto end = std::chrono::steady_clock::now();
+        result.seconds = std::min(
+            result.seconds, std::chrono::duration<double>(end - start).count());
+        CHECK_LE(nHits, rays.size());
+    }
+    ReportThreadStats();
+#ifdef PBRT_TRAVERSAL_STATS
+    int64_t nodeVisits, nRays;
+    GetStatsRatio(statsPrefix + (occlusion ? "/Node visits per shadow ray"
+                                           : "/Node visits per closest-hit ray"),
+                  &nodeVisits, &nRays);
+    result.nodeVisits = nRays > 0 ? double(nodeVisits) / nRays : 0;
+#else
+    result.nodeVisits = -1;
+#endif  // PBRT_TRAVERSAL_STATS
+    result.primitiveTests =
+        rays.empty() ? 0 : primitiveTests() / (double(rays.size()) * repeat);
+    ClearStats();
+    return result;
+}
+
+int main(int argc, char *argv[]) {
+    google::InitGoogleLogging(argv[0]);
+    FLAGS_stderrthreshold = 1;  // Warning and above.
+
+    std::vector<std::string> accelerators = {"sah",   "hlbvh", "middle",
+                                             "equal", "sbvh",  "kdtree"};
+    int maxNodePrims = 4, optimizePasses = 0, repeat = 3, seed = 0, spp = 1;
+    bool batch = false;
+    std::string filename;
+    Options opt;
+    opt.quiet = true;
+
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--batch")) {
+            batch = true;
+            continue;
+        }
+        if (argv[i][0] != '-') {
+            if (!filename.empty()) usage("only one scene file may be given");
+            filename = argv[i];
+            continue;
+        }
+        if (i + 1 == argc) usage("missing value after %s flag", argv[i]);
+        const char *value = argv[++i];
+        if (!strcmp(argv[i - 1], "--accel"))
+            accelerators = parseNames(value);
+        else if (!strcmp(argv[i - 1], "--maxnodeprims")) {
+            maxNodePrims = atoi(value);
+            if (maxNodePrims < 1) usage("--maxnodeprims must be >= 1");
+        } else if (!strcmp(argv[i - 1], "--nthreads"))
+            opt.nThreads = atoi(value);
+        else if (!strcmp(argv[i - 1], "--optimizepasses")) {
+            optimizePasses = atoi(value);
+            if (optimizePasses < 0) usage("--optimizepasses must be >= 0");
+        }
+        else if (!strcmp(argv[i - 1], "--repeat")) {
+            repeat = atoi(value);
+            if (repeat < 1) usage("--repeat must be >= 1");
+        } else if (!strcmp(argv[i - 1], "--seed"))
+            seed = atoi(value);
+        else if (!strcmp(argv[i - 1], "--spp")) {
+            spp = atoi(value);
+            if (spp < 1) usage("--spp must be >= 1");
+        } else
+            usage("unknown option %s", argv[i - 1]);
+    }
+    if (filename.empty()) usage("no scene file given");
+    for (const std::string &name : accelerators)
+        if (name != "sah" && name != "hlbvh" && name != "middle" &&
+            name != "equal" && name != "sbvh" && name != "kdtree")
+            usage("unknown accelerator \"%s\"", name.c_str());
+
+    pbrtInit(opt);
+    WorldDescription world;
+    if (!pbrtLoadWorld(filename, &world)) return 1;
+    RaySets rays = generateRays(world, spp, seed);
+    printf("%zu primitives, %zu camera rays, %zu bounce rays, %zu shadow "
+           "rays%s\n\n",
+           world.primitives.size(), rays.camera.size(), rays.bounce.size(),
+           rays.shadow.size(), batch ? ", batches of 64" : "");
+
+    printf("%-8s %9s  %-7s %-10s %9s %10s %10s\n", "accel", "build (s)",
+           "rays", "query", "Mrays/s", "nodes/ray", "prims/ray");
+    const struct {
+        const char *name;
+        const std::vector<Ray> &rays;
+    } raySets[] = {{"camera", rays.camera},
+                   {"bounce", rays.bounce},
+                   {"shadow", rays.shadow}};
+    std::vector<std::string> qualities;
+    for (const std::string &name : accelerators) {
+        ParamSet params;
+        std::string statsPrefix;
+        std::shared_ptr<Primitive> accel;
+        auto start = std::chrono::steady_clock::now();
+        if (name == "kdtree") {
+            accel = CreateKdTreeAccelerator(world.primitives, params);
+            statsPrefix = "Kd-tree";
+        } else {
+            std::unique_ptr<std::string[]> splitMethod(new std::string[1]);
+            splitMethod[0] = name;
+            params.AddString("splitmethod", std::move(splitMethod), 1);
+            std::unique_ptr<int[]> maxPrims(new int[1]);
+            maxPrims[0] = maxNodePrims;
+            params.AddInt("maxnodeprims", std::move(maxPrims), 1);
+            std::unique_ptr<int[]> passes(new int[1]);
+            passes[0] = optimizePasses;
+            params.AddInt("optimizepasses", std::move(passes), 1);
+            std::shared_ptr<BVHAccel> bvh =
+                CreateBVHAccelerator(world.primitives, params);
+            accel = bvh;
+            statsPrefix = "BVH";
+
+            const BVHQuality &quality = bvh->Quality();
+            std::string leafSizes;
+            for (size_t n = 1; n < quality.leafSizes.size(); ++n)
+                leafSizes += StringPrintf(" %zu:%d", n, quality.leafSizes[n]);
+            qualities.push_back(StringPrintf(
+                "%-8s %10.2f %10.3f %s", name.c_str(), quality.sahCost,
+                quality.siblingOverlap, leafSizes.c_str()));
+        }
+        auto end = std::chrono::steady_clock::now();
+        double buildSeconds = std::chrono::duration<double>(end - start).count();
+
+        for (const auto &set : raySets) {
+            for (bool occlusion : {false, true}) {
+                QueryResult result = trace(*accel, set.rays, occlusion, batch,
+                                           repeat, statsPrefix);
+                std::string nodeVisits =
+                    result.nodeVisits < 0
+                        ? "-"
+                        : StringPrintf("%.1f", result.nodeVisits);
+                printf("%-8s %9.3f  %-7s %-10s %9.3f %10s %10.1f\n",
+                       name.c_str(), buildSeconds, set.name,
+                       occlusion ? "IntersectP" : "Intersect",
+                       result.seconds > 0
+                           ? set.rays.size() / result.seconds * 1e-6
+                           : 0.,
+                       nodeVisits.c_str(), result.primitiveTests);
+                fflush(stdout);
+            }
+        }
+    }
+    if (!qualities.empty()) {
+        printf("\n%-8s %10s %10s  %s\n", "accel", "SAH cost", "overlap",
+               "leaves by number of primitives");
+        for (const std::string &quality : qualities)
+            printf("%s\n", quality.c_str());
+    }
+    // The world references the API's cached transforms and textures
+    world = WorldDescription();
+    pbrtCleanup();
+    return 0;
+}